@@ -0,0 +1,243 @@
+//
+// Pooled fixed-size receive buffers.
+//
+
+#ifndef SERVER_NETWORK_BUFFER_POOL_H_
+#define SERVER_NETWORK_BUFFER_POOL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "server/protocol/config.h"
+
+namespace network {
+
+// Fixed-size blocks carved from large slabs and shared by every thread. Blocks
+// are handed out and taken back in batches by BufferCache, so the mutex is only
+// touched once per batch. Slabs are kept until the pool is destroyed; pages of
+// blocks that were never used are never touched and cost no memory.
+class BufferPool {
+ public:
+  enum {
+    kBlockSize = 16 * 1024,
+    kBlocksPerSlab = 64,
+  };
+
+  BufferPool() = default;
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  // Shared by every event loop of the process.
+  static BufferPool& Default() {
+    static BufferPool pool;
+    return pool;
+  }
+
+  // Moves `n` free blocks to the back of `out`.
+  void Take(std::vector<char*>& out, size_t n) {
+    std::lock_guard<std::mutex> lck(m_);
+    while (free_.size() < n) {
+      slabs_.emplace_back(new char[kBlockSize * kBlocksPerSlab]);
+      for (size_t i = 0; i < kBlocksPerSlab; ++i)
+        free_.emplace_back(slabs_.back().get() + i * kBlockSize);
+    }
+    out.insert(out.end(), free_.end() - n, free_.end());
+    free_.resize(free_.size() - n);
+  }
+
+  // Moves the last `n` blocks of `blocks` back to the pool.
+  void Give(std::vector<char*>& blocks, size_t n) {
+    std::lock_guard<std::mutex> lck(m_);
+    free_.insert(free_.end(), blocks.end() - n, blocks.end());
+    blocks.resize(blocks.size() - n);
+  }
+
+  NETWORK_NODISCARD size_t block_count() const {
+    std::lock_guard<std::mutex> lck(m_);
+    return slabs_.size() * kBlocksPerSlab;
+  }
+
+  NETWORK_NODISCARD size_t free_blocks() const {
+    std::lock_guard<std::mutex> lck(m_);
+    return free_.size();
+  }
+
+ private:
+  mutable std::mutex m_;
+  std::vector<char*> free_;
+  std::vector<std::unique_ptr<char[]>> slabs_;
+};
+
+// Per-thread front end of a BufferPool. Not thread-safe; each event loop keeps
+// its own and every block it hands out must be released on the same thread.
+class BufferCache {
+ public:
+  enum {
+    // Blocks moved from and to the shared pool at once
+    kBatch = 16,
+    kMaxCached = 64,
+  };
+
+  explicit BufferCache(BufferPool& pool = BufferPool::Default()) : pool_(pool) {
+    blocks_.reserve(kMaxCached + kBatch);
+  }
+
+  BufferCache(const BufferCache&) = delete;
+  BufferCache& operator=(const BufferCache&) = delete;
+
+  ~BufferCache() {
+    if (!blocks_.empty())
+      pool_.Give(blocks_, blocks_.size());
+  }
+
+  NETWORK_NODISCARD char* Acquire() {
+    if (blocks_.empty())
+      pool_.Take(blocks_, kBatch);
+    const auto block = blocks_.back();
+    blocks_.pop_back();
+    ++in_use_;
+    return block;
+  }
+
+  void Release(char* block) {
+    blocks_.emplace_back(block);
+    --in_use_;
+    if (blocks_.size() > kMaxCached)
+      pool_.Give(blocks_, blocks_.size() - kMaxCached + kBatch);
+  }
+
+  // Blocks currently held by receive buffers of this thread
+  NETWORK_NODISCARD size_t in_use() const { return in_use_; }
+  NETWORK_NODISCARD size_t cached() const { return blocks_.size(); }
+
+ private:
+  BufferPool& pool_;
+  std::vector<char*> blocks_;
+  size_t in_use_ = 0;
+};
+
+// Bytes received on a connection and not consumed yet. A buffer holds no
+// memory while it is empty, which is most of the time for a keep-alive
+// connection, and borrows one pooled block as soon as data arrives. Requests
+// larger than a block overflow to a heap buffer that grows geometrically and
+// is freed as soon as it has been consumed, up to `max_size` bytes: past
+// that, prepare() has no space left to give.
+//
+// The bytes are always contiguous so they can be handed to a parser as one
+// view; data() may move whenever prepare() is called.
+class ReceiveBuffer {
+ public:
+  enum {
+    // Free space guaranteed by prepare()
+    kMinReadSize = 2048,
+  };
+
+  explicit ReceiveBuffer(BufferCache& cache, size_t max_size = SIZE_MAX)
+    : cache_(cache), max_size_(max_size) {}
+
+  ReceiveBuffer(const ReceiveBuffer&) = delete;
+  ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+
+  ~ReceiveBuffer() { Reset(); }
+
+  NETWORK_NODISCARD std::string_view view() const { return {data_ + begin_, end_ - begin_}; }
+  NETWORK_NODISCARD const char* data() const { return data_ + begin_; }
+  // Handlers may rewrite received bytes in place, e.g. to unmask them
+  NETWORK_NODISCARD char* data() { return data_ + begin_; }
+  NETWORK_NODISCARD size_t size() const { return end_ - begin_; }
+  NETWORK_NODISCARD bool empty() const { return begin_ == end_; }
+  NETWORK_NODISCARD bool overflowed() const { return data_ != nullptr && data_ != block_; }
+  NETWORK_NODISCARD bool full() const { return size() >= max_size_; }
+  NETWORK_NODISCARD size_t max_size() const { return max_size_; }
+
+  // Drops the first `n` bytes.
+  void consume(size_t n) {
+    NETWORK_ASSERT(n <= size(), "consumed more than was received");
+    begin_ += n;
+    if (begin_ == end_)
+      Reset();
+  }
+
+  void clear() { Reset(); }
+
+  // Space for the next read: at least kMinReadSize bytes, less as the buffer
+  // nears max_size(), and none once it is full.
+  NETWORK_NODISCARD std::pair<char*, size_t> prepare() {
+    if (data_ == nullptr) {
+      block_ = data_ = cache_.Acquire();
+      capacity_ = BufferPool::kBlockSize;
+    }
+    if (capacity_ - end_ < kMinReadSize) {
+      if (capacity_ - size() >= kMinReadSize || capacity_ >= max_size_) {
+        if (begin_ != 0)
+          std::memmove(data_, data_ + begin_, size());
+      } else {
+        const auto capacity = std::min(capacity_ * 2, max_size_);
+        std::unique_ptr<char[]> overflow(new char[capacity]);
+        std::memcpy(overflow.get(), data_ + begin_, size());
+        if (block_ != nullptr) {
+          cache_.Release(block_);
+          block_ = nullptr;
+        }
+        overflow_ = std::move(overflow);
+        data_ = overflow_.get();
+        capacity_ = capacity;
+      }
+      end_ -= begin_;
+      begin_ = 0;
+    }
+    const auto room = max_size_ > size() ? max_size_ - size() : 0;
+    return {data_ + end_, std::min(capacity_ - end_, room)};
+  }
+
+  // Marks `n` bytes written after prepare() as received.
+  void commit(size_t n) {
+    end_ += n;
+    if (begin_ == end_)
+      Reset();
+  }
+
+  // Copies `data` in; for handlers and tests that do not read from a socket.
+  // Returns false if the buffer filled up before all of it was copied.
+  bool append(std::string_view data) {
+    while (!data.empty()) {
+      const auto [p, n] = prepare();
+      if (n == 0)
+        return false;
+      const auto count = std::min(n, data.size());
+      std::memcpy(p, data.data(), count);
+      commit(count);
+      data.remove_prefix(count);
+    }
+    return true;
+  }
+
+ private:
+  void Reset() {
+    if (block_ != nullptr)
+      cache_.Release(block_);
+    overflow_.reset();
+    block_ = data_ = nullptr;
+    begin_ = end_ = capacity_ = 0;
+  }
+
+  BufferCache& cache_;
+  size_t max_size_;
+  char* block_ = nullptr;
+  std::unique_ptr<char[]> overflow_;
+  char* data_ = nullptr;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+  size_t capacity_ = 0;
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_BUFFER_POOL_H_
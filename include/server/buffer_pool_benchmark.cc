@@ -0,0 +1,156 @@
+//
+// Receive buffer benchmark: a zero-filled 100KB string per connection, a
+// per-connection string grown as data arrives, and pooled ReceiveBuffers.
+// Every connection sends a few small keep-alive requests; resident memory and
+// heap allocations are reported per strategy, each run in its own process.
+//
+// usage: buffer_pool_benchmark [connections] [requests_per_connection]
+//
+
+#include "server/buffer_pool.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+long ResidentKiB() {
+  std::ifstream statm("/proc/self/statm");
+  long size = 0;
+  long resident = 0;
+  statm >> size >> resident;
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+const std::string request =
+    "POST / HTTP/1.1\r\n"
+    "Host: localhost:3000\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 62\r\n"
+    "\r\n"
+    "{\"name\": \"이범석\", \"chat\": \"안녕하세요, 오늘 저녁에 뭐 먹을까요?\"}";
+
+// Each strategy reads one request from `fd` into the buffer of connection `i`,
+// consumes it, and keeps whatever a real connection would keep until its next request.
+struct FixedString {
+  explicit FixedString(size_t connections) : buffers(connections) {}
+
+  void Receive(size_t i, int fd) {
+    auto& buf = buffers[i];
+    if (buf.empty())
+      buf.assign(100'000, '\0');
+    const auto n = read(fd, buf.data(), buf.size());
+    if (n != static_cast<ssize_t>(request.size()))
+      std::abort();
+  }
+
+  std::vector<std::string> buffers;
+};
+
+struct GrowingString {
+  enum { kReadChunk = 4096 };
+
+  explicit GrowingString(size_t connections) : buffers(connections) {}
+
+  void Receive(size_t i, int fd) {
+    auto& buf = buffers[i];
+    buf.resize(kReadChunk);
+    const auto n = read(fd, buf.data(), kReadChunk);
+    if (n != static_cast<ssize_t>(request.size()))
+      std::abort();
+    buf.resize(n);
+    buf.erase(0, n);
+  }
+
+  std::vector<std::string> buffers;
+};
+
+struct Pooled {
+  explicit Pooled(size_t connections) {
+    buffers.reserve(connections);
+    for (size_t i = 0; i < connections; ++i)
+      buffers.emplace_back(std::make_unique<network::ReceiveBuffer>(cache));
+  }
+
+  void Receive(size_t i, int fd) {
+    auto& buf = *buffers[i];
+    const auto [p, size] = buf.prepare();
+    const auto n = read(fd, p, size);
+    if (n != static_cast<ssize_t>(request.size()))
+      std::abort();
+    buf.commit(n);
+    buf.consume(buf.size());
+  }
+
+  network::BufferCache cache;
+  std::vector<std::unique_ptr<network::ReceiveBuffer>> buffers;
+};
+
+template<typename Strategy>
+void Run(const char* name, size_t connections, int requests) {
+  std::cout.flush();
+  if (fork() != 0) {
+    wait(nullptr);
+    return;
+  }
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    std::abort();
+
+  const auto rss_before = ResidentKiB();
+  Strategy strategy(connections);
+  const auto allocations_before = allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < requests; ++r) {
+    for (size_t i = 0; i < connections; ++i) {
+      if (write(fds[1], request.data(), request.size()) != static_cast<ssize_t>(request.size()))
+        std::abort();
+      strategy.Receive(i, fds[0]);
+    }
+  }
+  const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+  const auto total = static_cast<double>(connections) * requests;
+
+  std::cout << name << "\t" << (ResidentKiB() - rss_before) / 1024.0 << "\t\t"
+            << (allocations.load() - allocations_before) / total << "\t\t"
+            << elapsed.count() / total << '\n';
+  std::exit(EXIT_SUCCESS);
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+int main(int argc, char* argv[]) {
+  const size_t connections = argc > 1 ? atol(argv[1]) : 10'000;
+  const int requests = argc > 2 ? atoi(argv[2]) : 10;
+
+  std::cout << connections << " connections, " << requests << " requests each\n";
+  std::cout << "strategy\tRSS MiB\t\tallocs/request\tus/request\n";
+  Run<FixedString>("100KB string", connections, requests);
+  Run<GrowingString>("grown string", connections, requests);
+  Run<Pooled>("pooled\t", connections, requests);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+//
+// Tests for network::BufferPool, network::BufferCache and network::ReceiveBuffer.
+//
+
+#include "server/buffer_pool.h"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int main() {
+  { // Blocks are reused through the thread cache
+    network::BufferPool pool;
+    network::BufferCache cache(pool);
+    const auto a = cache.Acquire();
+    if (cache.in_use() != 1) TEST_FAIL;
+    cache.Release(a);
+    if (cache.Acquire() != a) TEST_FAIL;
+    cache.Release(a);
+    if (pool.block_count() != network::BufferPool::kBlocksPerSlab) TEST_FAIL;
+    if (pool.free_blocks() != network::BufferPool::kBlocksPerSlab - network::BufferCache::kBatch) TEST_FAIL;
+  }
+
+  { // A cache over its limit hands blocks back to the pool
+    network::BufferPool pool;
+    std::vector<char*> blocks;
+    {
+      network::BufferCache cache(pool);
+      for (int i = 0; i < 200; ++i)
+        blocks.emplace_back(cache.Acquire());
+      for (const auto block : blocks)
+        cache.Release(block);
+      if (cache.in_use() != 0 || cache.cached() > network::BufferCache::kMaxCached) TEST_FAIL;
+    }
+    if (pool.free_blocks() != pool.block_count()) TEST_FAIL;
+  }
+
+  { // Small requests stay in one block, which is returned once consumed
+    network::BufferPool pool;
+    network::BufferCache cache(pool);
+    network::ReceiveBuffer buf(cache);
+    if (!buf.empty() || cache.in_use() != 0) TEST_FAIL;
+
+    buf.append("GET / HTTP/1.1\r\n\r\n");
+    if (buf.view() != "GET / HTTP/1.1\r\n\r\n" || cache.in_use() != 1 || buf.overflowed()) TEST_FAIL;
+    buf.consume(4);
+    if (buf.view() != "/ HTTP/1.1\r\n\r\n") TEST_FAIL;
+    buf.consume(buf.size());
+    if (!buf.empty() || cache.in_use() != 0) TEST_FAIL;
+
+    // Nothing read keeps nothing
+    const auto space = buf.prepare();
+    if (space.second < network::ReceiveBuffer::kMinReadSize || cache.in_use() != 1) TEST_FAIL;
+    buf.commit(0);
+    if (cache.in_use() != 0) TEST_FAIL;
+  }
+
+  { // Consumed bytes are compacted away before the buffer grows
+    network::BufferPool pool;
+    network::BufferCache cache(pool);
+    network::ReceiveBuffer buf(cache);
+    const std::string chunk(network::BufferPool::kBlockSize / 4, 'c');
+    for (int i = 0; i < 100; ++i) {
+      buf.append(chunk);
+      buf.consume(chunk.size() - 1);
+    }
+    if (buf.overflowed() || buf.size() != 100) TEST_FAIL;
+  }
+
+  { // Large bodies overflow to the heap and keep their bytes contiguous
+    network::BufferPool pool;
+    network::BufferCache cache(pool);
+    network::ReceiveBuffer buf(cache);
+    std::string expected;
+    for (int i = 0; expected.size() < 1024 * 1024; ++i) {
+      const auto piece = std::to_string(i) + ',';
+      buf.append(piece);
+      expected += piece;
+    }
+    if (!buf.overflowed() || cache.in_use() != 0) TEST_FAIL;
+    if (buf.view() != expected) TEST_FAIL;
+    buf.consume(10);
+    if (buf.view() != std::string_view(expected).substr(10)) TEST_FAIL;
+    buf.clear();
+    if (!buf.empty() || buf.overflowed()) TEST_FAIL;
+  }
+
+  { // A buffer stops growing at its limit
+    network::BufferPool pool;
+    network::BufferCache cache(pool);
+    constexpr size_t kMaxSize = 3 * network::BufferPool::kBlockSize;
+    network::ReceiveBuffer buf(cache, kMaxSize);
+    if (buf.append(std::string(kMaxSize + 1, 'x'))) TEST_FAIL;
+    if (buf.size() != kMaxSize || !buf.full() || buf.prepare().second != 0) TEST_FAIL;
+    // Consuming makes room again
+    buf.consume(10);
+    if (buf.full() || !buf.append(std::string(10, 'y')) || !buf.full()) TEST_FAIL;
+    if (buf.view().substr(kMaxSize - 11) != "xyyyyyyyyyy") TEST_FAIL;
+  }
+
+  { // Threads share the pool through their own caches
+    network::BufferPool pool;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&pool, t] {
+        network::BufferCache cache(pool);
+        for (int i = 0; i < 10000; ++i) {
+          network::ReceiveBuffer buf(cache);
+          buf.append(std::string(100 + i % 1000, static_cast<char>('a' + t)));
+          if (buf.view().front() != 'a' + t || buf.view().back() != 'a' + t) TEST_FAIL;
+        }
+      });
+    }
+    for (auto& t : threads)
+      t.join();
+    if (pool.free_blocks() != pool.block_count()) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,771 @@
+//
+// Edge-triggered epoll reactor used by the chat server.
+//
+
+#ifndef SERVER_NETWORK_EVENT_LOOP_H_
+#define SERVER_NETWORK_EVENT_LOOP_H_
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "server/buffer_pool.h"
+#include "server/protocol/protocol.h"
+
+namespace network {
+
+inline bool SetNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1)
+    return false;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// Pins the calling thread to a single CPU. Returns false if the CPU is not
+// available to this process.
+inline bool PinCurrentThread(unsigned cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % CPU_SETSIZE, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+class EventLoop;
+class Connection;
+
+namespace detail {
+
+// A listening socket and the handlers of the connections accepted from it
+struct Listener {
+  int fd;
+  std::function<void(Connection&)> on_read;
+  std::function<void(Connection&, bool)> on_resume;
+};
+
+} // namespace detail
+
+// Bytes waiting to be written to a socket, as a queue of slices that are
+// written together in one gathering sendmsg. Slices are either owned, or shared with other
+// connections (a cached response body, for instance) and never copied.
+class OutputQueue {
+ public:
+  enum {
+    // Small copied writes are merged into the last slice up to this size
+    kCoalesceSize = 16 * 1024,
+    kMaxIovecs = 64,
+  };
+
+  void append(std::string_view data) {
+    if (data.empty())
+      return;
+    bytes_ += data.size();
+    if (!slices_.empty() && !slices_.back().shared && slices_.back().owned.size() + data.size() <= kCoalesceSize) {
+      slices_.back().owned.append(data.data(), data.size());
+      return;
+    }
+    auto owned = std::move(spare_);
+    owned.assign(data.data(), data.size());
+    slices_.push_back({std::move(owned), nullptr});
+  }
+
+  void append(const char* data) { append(std::string_view(data)); }
+
+  void append(std::string&& data) {
+    if (data.size() <= kCoalesceSize / 4) {
+      append(std::string_view(data));
+      return;
+    }
+    bytes_ += data.size();
+    slices_.push_back({std::move(data), nullptr});
+  }
+
+  void append(std::shared_ptr<const std::string> data) {
+    if (!data || data->empty())
+      return;
+    bytes_ += data->size();
+    slices_.push_back({std::string(), std::move(data)});
+  }
+
+  NETWORK_NODISCARD bool empty() const { return bytes_ == 0; }
+  // Bytes still to be written
+  NETWORK_NODISCARD size_t size() const { return bytes_; }
+
+  // Writes until the queue is empty or the socket would block. Returns false
+  // if the socket failed.
+  bool WriteTo(int fd) {
+    iovec iov[kMaxIovecs];
+    while (bytes_ != 0) {
+      int count = 0;
+      for (auto it = slices_.begin(); it != slices_.end() && count < kMaxIovecs; ++it, ++count) {
+        const auto data = it->data();
+        const auto skip = count == 0 ? offset_ : 0;
+        iov[count].iov_base = const_cast<char*>(data.data() + skip);
+        iov[count].iov_len = data.size() - skip;
+      }
+
+      // writev with MSG_NOSIGNAL, so a vanished peer is an error, not SIGPIPE
+      msghdr msg{};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = count;
+      const auto n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+      Consume(n);
+    }
+    return true;
+  }
+
+ private:
+  struct Slice {
+    std::string owned;
+    std::shared_ptr<const std::string> shared;
+
+    NETWORK_NODISCARD std::string_view data() const { return shared ? *shared : owned; }
+  };
+
+  void Consume(size_t n) {
+    bytes_ -= n;
+    while (n != 0) {
+      const auto remaining = slices_.front().data().size() - offset_;
+      if (n < remaining) {
+        offset_ += n;
+        return;
+      }
+      n -= remaining;
+      offset_ = 0;
+      // Keep one small buffer around for the next response
+      auto& front = slices_.front();
+      if (!front.shared && front.owned.capacity() <= kCoalesceSize) {
+        spare_ = std::move(front.owned);
+        spare_.clear();
+      }
+      slices_.pop_front();
+    }
+  }
+
+  std::deque<Slice> slices_;
+  // Bytes of the first slice already written
+  size_t offset_ = 0;
+  size_t bytes_ = 0;
+  std::string spare_;
+};
+
+// A client socket owned by exactly one EventLoop. All member functions must be
+// called from the thread running the owning loop.
+class Connection {
+ public:
+  Connection(int fd, BufferCache& buffers, size_t max_input = SIZE_MAX)
+    : fd_(fd), input_(buffers, max_input) {}
+
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  NETWORK_NODISCARD int fd() const { return fd_; }
+
+  // Bytes received so far that the handler has not consumed yet.
+  NETWORK_NODISCARD ReceiveBuffer& input() { return input_; }
+  NETWORK_NODISCARD const ReceiveBuffer& input() const { return input_; }
+
+  // Queue data for writing. As much as possible is written immediately, the
+  // rest is flushed by the loop when the socket becomes writable again.
+  void send(std::string_view data) {
+    output_.append(data);
+    Flush();
+  }
+
+  void send(std::string&& data) {
+    output_.append(std::move(data));
+    Flush();
+  }
+
+  void send(const char* data) { send(std::string_view(data)); }
+
+  // The buffer is shared, not copied, until it is written.
+  void send(std::shared_ptr<const std::string> data) {
+    output_.append(std::move(data));
+    Flush();
+  }
+
+  // Queue several pieces and write them with as few syscalls as possible.
+  template<typename... Args>
+  void send_all(Args&&... pieces) {
+    (output_.append(std::forward<Args>(pieces)), ...);
+    Flush();
+  }
+
+  // Close the connection once every queued byte has been written.
+  void close();
+
+  NETWORK_NODISCARD bool closing() const { return close_after_write_; }
+  // Bytes queued and not written yet, e.g. because the peer stopped reading
+  NETWORK_NODISCARD size_t queued() const { return output_.size(); }
+
+  // Sends a reply too large to be queued at once, piece by piece: `next` is
+  // called whenever every queued byte has been written, queues the next
+  // piece, and returns false once it queued the last one. Until then, input
+  // is left unread in the socket, so replies never interleave, and close()
+  // waits for the end of the stream. Must be called
+  // from a read or resume handler; the first piece is asked for when it
+  // returns.
+  void stream(std::function<bool(Connection&)> next);
+
+  NETWORK_NODISCARD bool streaming() const { return static_cast<bool>(stream_); }
+  NETWORK_NODISCARD bool peer_closed() const { return peer_closed_; }
+
+  // Holds the connection until the loop is woken (see EventLoop::Wake) or
+  // `deadline` passes, then hands it to the listener's resume handler. While
+  // parked, input is left unread in the socket, only the peer closing it is
+  // noticed, and the connection is exempt from the idle timeout. The resume
+  // handler may park it again.
+  void park(std::chrono::steady_clock::time_point deadline);
+
+  NETWORK_NODISCARD bool parked() const { return parked_; }
+  // Deadline of the current or last park
+  NETWORK_NODISCARD std::chrono::steady_clock::time_point park_deadline() const { return park_deadline_; }
+
+  // Exempts the connection from the idle timeout until close() is called,
+  // for protocols whose connections stay open without traffic (WebSocket).
+  // A peer that stops reading then cannot hold it open.
+  void keep_open();
+
+  NETWORK_NODISCARD bool kept_open() const { return keep_open_; }
+
+  // Per-connection state of the protocol handler, created on first use. A
+  // connection only ever holds one type of state.
+  template<typename T>
+  NETWORK_NODISCARD T& context() {
+    if (!context_)
+      context_ = std::make_shared<T>();
+    return *static_cast<T*>(context_.get());
+  }
+
+ private:
+  friend class EventLoop;
+
+  // Returns false if the socket failed and must be dropped.
+  bool Flush() {
+    if (error_)
+      return false;
+    if (!output_.WriteTo(fd_))
+      error_ = true;
+    return !error_;
+  }
+
+  NETWORK_NODISCARD bool drained() const { return output_.empty(); }
+
+  int fd_;
+  EventLoop* loop_ = nullptr;
+  std::chrono::steady_clock::time_point last_active_;
+  std::list<Connection*>::iterator idle_it_;
+  std::chrono::steady_clock::time_point park_deadline_;
+  std::multimap<std::chrono::steady_clock::time_point, Connection*>::iterator parked_it_;
+  // The listener that accepted the connection, owned by the loop
+  const detail::Listener* listener_ = nullptr;
+  std::shared_ptr<void> context_;
+  std::function<bool(Connection&)> stream_;
+  ReceiveBuffer input_;
+  OutputQueue output_;
+  bool close_after_write_ = false;
+  bool peer_closed_ = false;
+  bool error_ = false;
+  bool closed_ = false;
+  bool parked_ = false;
+  bool keep_open_ = false;
+};
+
+// One epoll instance driven by one thread. Several loops may share the same
+// non-blocking listening socket: it is registered with EPOLLEXCLUSIVE so a new
+// connection wakes a single loop, which then owns the accepted socket for its
+// whole lifetime. Alternatively every loop gets its own SO_REUSEPORT listener
+// (see sock_init_reuseport) and the kernel shards connections between them.
+// A loop may serve several listeners, each with its own protocol handler.
+// Client sockets are edge-triggered.
+class EventLoop {
+ public:
+  using read_handler = std::function<void(Connection&)>;
+  // Called when a parked connection is resumed, with whether its deadline passed
+  using resume_handler = std::function<void(Connection&, bool timed_out)>;
+  using clock = std::chrono::steady_clock;
+
+  enum {
+    kMaxEvents = 256,
+    kMaxAcceptPerWakeup = 64,
+  };
+
+  // Input a connection may have received and not consumed yet, by default
+  static constexpr size_t kDefaultMaxInputSize = 16 * 1024 * 1024;
+
+  // A loop without listeners; see AddListener
+  explicit EventLoop(BufferPool& buffers = BufferPool::Default())
+    : buffers_(buffers)
+  {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wakeup_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+  }
+
+  EventLoop(int listen_fd, read_handler on_read, BufferPool& buffers = BufferPool::Default())
+    : EventLoop(buffers)
+  {
+    if (listen_fd != -1)
+      AddListener(listen_fd, std::move(on_read));
+  }
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  ~EventLoop() {
+    for (auto& [fd, conn] : connections_)
+      ::close(fd);
+    ::close(wakeup_fd_);
+    ::close(epoll_fd_);
+  }
+
+  // Connections accepted from `listen_fd` are handled by `on_read`, and by
+  // `on_resume` once parked. Must be called before Run().
+  bool AddListener(int listen_fd, read_handler on_read, resume_handler on_resume = {}) {
+    auto& listener = listeners_.emplace_back(Listener{listen_fd, std::move(on_read), std::move(on_resume)});
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listener;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+      perror("epoll_ctl");
+      listeners_.pop_back();
+      return false;
+    }
+    return true;
+  }
+
+  // Connections without any I/O for `timeout` are closed. Zero disables it.
+  void set_idle_timeout(std::chrono::milliseconds timeout) { idle_timeout_ = timeout; }
+
+  // Connections that are sent more than `size` bytes their handler has not
+  // consumed are dropped. Applies to connections accepted afterwards.
+  void set_max_input_size(size_t size) { max_input_size_ = size; }
+
+  // Runs until Stop() is called.
+  void Run() {
+    std::vector<epoll_event> events(kMaxEvents);
+
+    while (!stop_.load(std::memory_order_acquire)) {
+      const int n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), NextTimeout());
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        perror("epoll_wait");
+        break;
+      }
+      now_ = clock::now();
+
+      for (int i = 0; i < n; ++i) {
+        const auto& ev = events[i];
+        if (ev.data.ptr == &wakeup_fd_) {
+          uint64_t value;
+          while (read(wakeup_fd_, &value, sizeof(value)) > 0) {}
+        } else if (auto* listener = FindListener(ev.data.ptr)) {
+          Accept(*listener);
+        } else {
+          HandleEvent(*static_cast<Connection*>(ev.data.ptr), ev.events);
+        }
+      }
+      ResumeWoken();
+      ResumeExpired();
+      CloseIdle();
+
+      // Connections are released only after the whole batch was processed, so
+      // no pending event can refer to a destroyed Connection.
+      for (const int fd : closed_) {
+        ::close(fd);
+        connections_.erase(fd);
+      }
+      closed_.clear();
+
+      RunTasks();
+    }
+  }
+
+  // Resumes every parked connection, e.g. after new data was published.
+  // Thread-safe. A loop without parked connections is not woken up: a
+  // connection parked concurrently is resumed at the end of the loop
+  // iteration that parked it.
+  void Wake() {
+    if (!wake_pending_.exchange(true) && parked_count_.load() != 0) {
+      const uint64_t one = 1;
+      (void)!write(wakeup_fd_, &one, sizeof(one));
+    }
+  }
+
+  // Runs `task` on the loop's thread, once the events of the current iteration
+  // are handled. Thread-safe. Tasks run in the order they were posted, and
+  // never see a connection that was closed before they run.
+  void Post(std::function<void()> task) {
+    bool first;
+    {
+      std::lock_guard<std::mutex> lock(tasks_mutex_);
+      first = tasks_.empty();
+      tasks_.emplace_back(std::move(task));
+    }
+    // Later tasks ride on the same wakeup
+    if (first) {
+      const uint64_t one = 1;
+      (void)!write(wakeup_fd_, &one, sizeof(one));
+    }
+  }
+
+  // Thread-safe and async-signal-safe.
+  void Stop() {
+    stop_.store(true, std::memory_order_release);
+    const uint64_t one = 1;
+    (void)!write(wakeup_fd_, &one, sizeof(one));
+  }
+
+  NETWORK_NODISCARD size_t connection_count() const { return connections_.size(); }
+  NETWORK_NODISCARD size_t parked_count() const { return parked_count_.load(std::memory_order_relaxed); }
+
+ private:
+  friend class Connection;
+
+  using Listener = detail::Listener;
+
+  // A loop has one or two listeners, a scan is cheaper than tagging pointers
+  Listener* FindListener(void* ptr) {
+    for (auto& listener : listeners_) {
+      if (&listener == ptr)
+        return &listener;
+    }
+    return nullptr;
+  }
+
+  void Accept(const Listener& listener) {
+    for (int i = 0; i < kMaxAcceptPerWakeup; ++i) {
+      sockaddr_in client_addr{};
+      socklen_t client_addr_size = sizeof(client_addr);
+      const int fd = accept4(listener.fd, reinterpret_cast<sockaddr*>(&client_addr), &client_addr_size,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd == -1) {
+        if (errno == EINTR)
+          continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          perror("accept4");
+        return;
+      }
+
+      // Replies are already coalesced by the output queue; Nagle would hold
+      // back the replies to pipelined requests until the peer's delayed ACK
+      const int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+      auto conn = std::make_unique<Connection>(fd, buffers_, max_input_size_);
+      conn->loop_ = this;
+      conn->listener_ = &listener;
+      conn->last_active_ = now_;
+      conn->idle_it_ = idle_list_.emplace(idle_list_.end(), conn.get());
+      epoll_event ev{};
+      ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      ev.data.ptr = conn.get();
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl");
+        idle_list_.erase(conn->idle_it_);
+        ::close(fd);
+        continue;
+      }
+      connections_.emplace(fd, std::move(conn));
+    }
+  }
+
+  void HandleEvent(Connection& conn, uint32_t events) {
+    if (conn.closed_)
+      return;
+    if (!conn.parked_)
+      Touch(conn);
+
+    if (conn.parked_ || conn.stream_) {
+      // Read once it resumes or the stream ends
+      if (events & (EPOLLRDHUP | EPOLLHUP))
+        conn.peer_closed_ = true;
+    } else if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+      Receive(conn);
+    }
+    if (events & EPOLLOUT)
+      conn.Flush();
+    Pump(conn);
+
+    if (events & EPOLLERR)
+      conn.error_ = true;
+    CloseIfDone(conn);
+  }
+
+  void CloseIfDone(Connection& conn) {
+    if (conn.error_ || ((conn.close_after_write_ || conn.peer_closed_) && conn.drained() && !conn.stream_))
+      Close(conn);
+  }
+
+  // Feeds a streaming connection for as long as its socket takes the pieces
+  // without blocking; EPOLLOUT brings it back here otherwise. Requests that
+  // arrived during the stream are handled once it ends, and may start
+  // another one.
+  void Pump(Connection& conn) {
+    while (conn.stream_ && conn.drained() && !conn.error_ && !conn.closed_) {
+      if (conn.stream_(conn))
+        continue;
+      conn.stream_ = nullptr;
+      if (!conn.parked_ && !conn.close_after_write_)
+        Receive(conn);
+    }
+  }
+
+  void Park(Connection& conn, clock::time_point deadline) {
+    NETWORK_ASSERT(!conn.parked_ && !conn.closed_, "Connection cannot be parked");
+    if (!conn.keep_open_)
+      idle_list_.erase(conn.idle_it_);
+    conn.parked_ = true;
+    conn.park_deadline_ = deadline;
+    conn.parked_it_ = parked_.emplace(deadline, &conn);
+    parked_count_.fetch_add(1);
+  }
+
+  void Unpark(Connection& conn) {
+    parked_.erase(conn.parked_it_);
+    parked_count_.fetch_sub(1);
+    conn.parked_ = false;
+    conn.last_active_ = now_;
+    if (!conn.keep_open_)
+      conn.idle_it_ = idle_list_.emplace(idle_list_.end(), &conn);
+  }
+
+  void KeepOpen(Connection& conn) {
+    if (conn.keep_open_)
+      return;
+    if (!conn.parked_)
+      idle_list_.erase(conn.idle_it_);
+    conn.keep_open_ = true;
+  }
+
+  void CloseAfterWrite(Connection& conn) {
+    conn.close_after_write_ = true;
+    if (!conn.keep_open_ || conn.closed_)
+      return;
+    conn.keep_open_ = false;
+    if (!conn.parked_) {
+      conn.last_active_ = now_;
+      conn.idle_it_ = idle_list_.emplace(idle_list_.end(), &conn);
+    }
+  }
+
+  // Requests that arrived while the connection was parked are handled right
+  // after it resumes, in order.
+  void Resume(Connection& conn, bool timed_out) {
+    Unpark(conn);
+    const auto& listener = *conn.listener_;
+    if (listener.on_resume)
+      listener.on_resume(conn, timed_out);
+    if (!conn.parked_ && !conn.close_after_write_ && !conn.stream_)
+      Receive(conn);
+    Pump(conn);
+    CloseIfDone(conn);
+  }
+
+  // A handler may wake the loop while it resumes, when nothing is parked and
+  // the eventfd is not written: the connections parked since are resumed
+  // again before the loop sleeps, or the wake would be lost.
+  void ResumeWoken() {
+    while (!parked_.empty() && wake_pending_.exchange(false)) {
+      // Connections parking again during the resume must not be visited twice
+      std::vector<Connection*> woken;
+      woken.reserve(parked_.size());
+      for (const auto& [deadline, conn] : parked_)
+        woken.emplace_back(conn);
+      for (auto* conn : woken)
+        Resume(*conn, false);
+    }
+  }
+
+  void ResumeExpired() {
+    while (!parked_.empty() && parked_.begin()->first <= now_)
+      Resume(*parked_.begin()->second, true);
+  }
+
+  // Drains the socket as required by edge-triggered mode, or reads until the
+  // input buffer is full. Returns whether new bytes were appended to it.
+  bool ReadAll(Connection& conn) {
+    bool received = false;
+    auto& buf = conn.input_;
+    while (true) {
+      // An empty buffer gives its block back on commit(0)
+      const auto [p, size] = buf.prepare();
+      if (size == 0)
+        break;
+      const auto n = read(conn.fd_, p, size);
+      buf.commit(n > 0 ? n : 0);
+
+      if (n > 0) {
+        received = true;
+        continue;
+      }
+      if (n == 0) {
+        conn.peer_closed_ = true;
+        break;
+      }
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        conn.error_ = true;
+      break;
+    }
+    return received;
+  }
+
+  // Reads the socket and hands the input to the read handler, also the input
+  // left unread while the connection was parked or streaming. A full buffer
+  // is handed over as it is, and reading goes on once the handler consumed
+  // some of it; a handler that cannot was sent more than any request may
+  // take, and the connection is dropped.
+  void Receive(Connection& conn) {
+    while (true) {
+      ReadAll(conn);
+      if (conn.error_ || conn.input_.empty())
+        return;
+      const bool full = conn.input_.full();
+      conn.listener_->on_read(conn);
+      if (!full || conn.parked_ || conn.stream_ || conn.close_after_write_)
+        return;
+      if (conn.input_.full()) {
+        conn.error_ = true;
+        return;
+      }
+    }
+  }
+
+  void Close(Connection& conn) {
+    if (conn.closed_)
+      return;
+    conn.closed_ = true;
+    // Releases whatever the stream holds on to
+    conn.stream_ = nullptr;
+    if (conn.parked_) {
+      parked_.erase(conn.parked_it_);
+      parked_count_.fetch_sub(1);
+      conn.parked_ = false;
+    } else if (!conn.keep_open_) {
+      idle_list_.erase(conn.idle_it_);
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd_, nullptr);
+    closed_.emplace_back(conn.fd_);
+  }
+
+  // Keeps connections ordered by last activity, least recent first
+  void Touch(Connection& conn) {
+    conn.last_active_ = now_;
+    if (!conn.keep_open_)
+      idle_list_.splice(idle_list_.end(), idle_list_, conn.idle_it_);
+  }
+
+  void CloseIdle() {
+    if (idle_timeout_.count() == 0)
+      return;
+    while (!idle_list_.empty() && now_ - idle_list_.front()->last_active_ >= idle_timeout_)
+      Close(*idle_list_.front());
+  }
+
+  void RunTasks() {
+    {
+      std::lock_guard<std::mutex> lock(tasks_mutex_);
+      if (tasks_.empty())
+        return;
+      running_tasks_.swap(tasks_);
+    }
+    for (auto& task : running_tasks_)
+      task();
+    running_tasks_.clear();
+  }
+
+  // Milliseconds until the least recently active connection or the first
+  // parked one expires
+  int NextTimeout() const {
+    const bool idle = idle_timeout_.count() != 0 && !idle_list_.empty();
+    if (!idle && parked_.empty())
+      return -1;
+    auto deadline = clock::time_point::max();
+    if (idle)
+      deadline = idle_list_.front()->last_active_ + idle_timeout_;
+    if (!parked_.empty())
+      deadline = std::min(deadline, parked_.begin()->first);
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now());
+    return static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count() + 1, 0));
+  }
+
+  int epoll_fd_ = -1;
+  int wakeup_fd_ = -1;
+  // Stable addresses, registered as epoll data
+  std::deque<Listener> listeners_;
+  std::atomic<bool> stop_{false};
+  std::chrono::milliseconds idle_timeout_{0};
+  size_t max_input_size_ = kDefaultMaxInputSize;
+  clock::time_point now_ = clock::now();
+  std::list<Connection*> idle_list_;
+  // Parked connections by deadline
+  std::multimap<clock::time_point, Connection*> parked_;
+  std::atomic<size_t> parked_count_{0};
+  std::atomic<bool> wake_pending_{false};
+  std::mutex tasks_mutex_;
+  std::vector<std::function<void()>> tasks_;
+  // Swapped with tasks_, so both keep their capacity
+  std::vector<std::function<void()>> running_tasks_;
+  // Declared before the connections, which return their blocks to it
+  BufferCache buffers_;
+  std::unordered_map<int, std::unique_ptr<Connection>> connections_;
+  std::vector<int> closed_;
+};
+
+inline void Connection::park(std::chrono::steady_clock::time_point deadline) {
+  loop_->Park(*this, deadline);
+}
+
+inline void Connection::stream(std::function<bool(Connection&)> next) {
+  NETWORK_ASSERT(!stream_ && !parked_, "Connection cannot stream");
+  stream_ = std::move(next);
+}
+
+inline void Connection::keep_open() {
+  loop_->KeepOpen(*this);
+}
+
+inline void Connection::close() {
+  loop_->CloseAfterWrite(*this);
+}
+
+} // namespace network
+
+#endif // SERVER_NETWORK_EVENT_LOOP_H_
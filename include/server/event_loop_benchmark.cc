@@ -0,0 +1,135 @@
+//
+// Connection rate benchmark: one shared listener vs. SO_REUSEPORT shards.
+//
+// usage: event_loop_benchmark [seconds_per_run] [client_threads] [max_shards]
+//
+
+#include "server/socket.h"
+#include "server/event_loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int LocalPort(int fd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+int Connect(int port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Returns accepted connections per second.
+double Run(unsigned shards, bool reuseport, unsigned client_threads, double seconds) {
+  std::vector<int> listen_socks;
+  if (reuseport) {
+    listen_socks.emplace_back(sock_init_reuseport(0));
+    const int port = LocalPort(listen_socks.front());
+    for (unsigned i = 1; i < shards; ++i)
+      listen_socks.emplace_back(sock_init_reuseport(port));
+  } else {
+    const int shared = sock_listen(0);
+    network::SetNonBlocking(shared);
+    listen_socks.assign(shards, shared);
+  }
+  const int port = LocalPort(listen_socks.front());
+
+  const auto handler = [](network::Connection& conn) {
+    conn.send("ok");
+    conn.close();
+  };
+
+  std::vector<std::unique_ptr<network::EventLoop>> loops;
+  std::vector<std::thread> servers;
+  for (unsigned i = 0; i < shards; ++i)
+    loops.emplace_back(std::make_unique<network::EventLoop>(listen_socks[i], handler));
+  for (unsigned i = 0; i < shards; ++i) {
+    servers.emplace_back([&loop = loops[i], i, reuseport] {
+      if (reuseport)
+        network::PinCurrentThread(i);
+      loop->Run();
+    });
+  }
+
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> completed{0};
+  std::vector<std::thread> clients;
+  for (unsigned i = 0; i < client_threads; ++i) {
+    clients.emplace_back([&] {
+      char buf[16];
+      uint64_t n = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        const int fd = Connect(port);
+        if (fd == -1)
+          continue;
+        // Reset instead of FIN so the client side does not pile up TIME_WAIT
+        const linger l{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        if (write(fd, "x", 1) == 1 && read(fd, buf, sizeof(buf)) > 0)
+          ++n;
+        close(fd);
+      }
+      completed += n;
+    });
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  done = true;
+  for (auto& t : clients)
+    t.join();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  for (auto& loop : loops)
+    loop->Stop();
+  for (auto& t : servers)
+    t.join();
+  loops.clear();
+
+  if (reuseport) {
+    for (const int fd : listen_socks)
+      close(fd);
+  } else {
+    close(listen_socks.front());
+  }
+
+  return completed / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  const unsigned client_threads = argc > 2 ? atoi(argv[2]) : cores;
+  const unsigned max_shards = argc > 3 ? atoi(argv[3]) : cores;
+
+  std::cout << cores << " hardware threads, " << client_threads << " client threads\n";
+  std::cout << "shards\tshared accepts/s\treuseport accepts/s\n";
+  for (unsigned shards = 1; shards <= max_shards; shards *= 2) {
+    const auto shared = Run(shards, false, client_threads, seconds);
+    const auto sharded = Run(shards, true, client_threads, seconds);
+    std::cout << shards << '\t' << static_cast<uint64_t>(shared)
+              << "\t\t\t" << static_cast<uint64_t>(sharded) << '\n';
+  }
+
+  return EXIT_SUCCESS;
+}
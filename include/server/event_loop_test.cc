@@ -0,0 +1,590 @@
+//
+// Echo server test for network::EventLoop.
+//
+
+#include "server/event_loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int ListenLoopback(int* port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) return -1;
+  if (listen(fd, SOMAXCONN) == -1) return -1;
+
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  *port = ntohs(addr.sin_port);
+  network::SetNonBlocking(fd);
+  return fd;
+}
+
+int Connect(int port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) return -1;
+  return fd;
+}
+
+std::string ReadUntilClosed(int fd) {
+  std::string result;
+  char buf[1024];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    result.append(buf, n);
+  return result;
+}
+
+int main() {
+  int port = 0;
+  const int listen_fd = ListenLoopback(&port);
+  if (listen_fd == -1) TEST_FAIL;
+
+  // Echo the first line back and close, like a one-shot request handler
+  const auto handler = [](network::Connection& conn) {
+    const auto input = conn.input().view();
+    const auto p = input.find('\n');
+    if (p == std::string_view::npos)
+      return;
+    conn.send(input.substr(0, p + 1));
+    conn.close();
+  };
+
+  std::vector<std::unique_ptr<network::EventLoop>> loops;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i)
+    loops.emplace_back(std::make_unique<network::EventLoop>(listen_fd, handler));
+  for (auto& loop : loops)
+    threads.emplace_back([&loop] { loop->Run(); });
+
+  { // Single client
+    const int fd = Connect(port);
+    if (fd == -1) TEST_FAIL;
+    const std::string msg = "Hello, loop!\n";
+    if (write(fd, msg.data(), msg.size()) != static_cast<ssize_t>(msg.size())) TEST_FAIL;
+    if (ReadUntilClosed(fd) != msg) TEST_FAIL;
+    close(fd);
+  }
+
+  { // Request split across several writes
+    const int fd = Connect(port);
+    if (fd == -1) TEST_FAIL;
+    if (write(fd, "Hel", 3) != 3) TEST_FAIL;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    if (write(fd, "lo\nignored", 10) != 10) TEST_FAIL;
+    if (ReadUntilClosed(fd) != "Hello\n") TEST_FAIL;
+    close(fd);
+  }
+
+  { // Many concurrent clients
+    std::vector<int> fds;
+    for (int i = 0; i < 200; ++i) {
+      fds.emplace_back(Connect(port));
+      if (fds.back() == -1) TEST_FAIL;
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+      const auto msg = std::to_string(i) + '\n';
+      if (write(fds[i], msg.data(), msg.size()) != static_cast<ssize_t>(msg.size())) TEST_FAIL;
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+      if (ReadUntilClosed(fds[i]) != std::to_string(i) + '\n') TEST_FAIL;
+      close(fds[i]);
+    }
+  }
+
+  { // Large response is flushed across several EPOLLOUT events
+    const auto big_handler = [](network::Connection& conn) {
+      conn.send(std::string(4 * 1024 * 1024, 'x'));
+      conn.close();
+    };
+    int big_port = 0;
+    const int big_listen_fd = ListenLoopback(&big_port);
+    network::EventLoop loop(big_listen_fd, big_handler);
+    std::thread t([&loop] { loop.Run(); });
+
+    const int fd = Connect(big_port);
+    if (write(fd, "x", 1) != 1) TEST_FAIL;
+    if (ReadUntilClosed(fd).size() != 4 * 1024 * 1024) TEST_FAIL;
+    close(fd);
+
+    loop.Stop();
+    t.join();
+    close(big_listen_fd);
+  }
+
+  { // A request larger than a pooled block arrives in one contiguous buffer
+    const std::string request(300 * 1000, 'r');
+    const auto large_handler = [&request](network::Connection& conn) {
+      if (conn.input().size() < request.size())
+        return;
+      conn.send(conn.input().view() == request ? "ok" : "corrupt");
+      conn.input().clear();
+      conn.close();
+    };
+    int large_port = 0;
+    const int large_listen_fd = ListenLoopback(&large_port);
+    network::EventLoop loop(large_listen_fd, large_handler);
+    std::thread t([&loop] { loop.Run(); });
+
+    const int fd = Connect(large_port);
+    for (size_t sent = 0; sent < request.size(); sent += 1000) {
+      if (write(fd, request.data() + sent, 1000) != 1000) TEST_FAIL;
+    }
+    if (ReadUntilClosed(fd) != "ok") TEST_FAIL;
+    close(fd);
+
+    loop.Stop();
+    t.join();
+    close(large_listen_fd);
+  }
+
+  { // Idle connections are closed, active ones are kept
+    const auto keep_alive_handler = [](network::Connection& conn) {
+      conn.send(conn.input().view());
+      conn.input().clear();
+    };
+    int idle_port = 0;
+    const int idle_listen_fd = ListenLoopback(&idle_port);
+    network::EventLoop loop(idle_listen_fd, keep_alive_handler);
+    loop.set_idle_timeout(std::chrono::milliseconds(100));
+    std::thread t([&loop] { loop.Run(); });
+
+    const int idle_fd = Connect(idle_port);
+    const int active_fd = Connect(idle_port);
+    char buf[16];
+    for (int i = 0; i < 5; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(40));
+      if (write(active_fd, "x", 1) != 1) TEST_FAIL;
+      if (read(active_fd, buf, sizeof(buf)) != 1) TEST_FAIL;
+    }
+    if (!ReadUntilClosed(idle_fd).empty()) TEST_FAIL;
+    if (write(active_fd, "y", 1) != 1) TEST_FAIL;
+    if (read(active_fd, buf, sizeof(buf)) != 1 || buf[0] != 'y') TEST_FAIL;
+    if (!ReadUntilClosed(active_fd).empty()) TEST_FAIL;
+    close(idle_fd);
+    close(active_fd);
+
+    loop.Stop();
+    t.join();
+    close(idle_listen_fd);
+  }
+
+  { // Output queue: slices are written in order across short writes
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) TEST_FAIL;
+    network::SetNonBlocking(fds[0]);
+
+    network::OutputQueue queue;
+    std::string expected;
+    const auto shared = std::make_shared<const std::string>(1024 * 1024, 's');
+    for (int i = 0; i < 100; ++i) {
+      const auto small = "header " + std::to_string(i) + "\r\n";
+      queue.append(std::string_view(small));
+      queue.append(std::string(i * 1000, 'o'));
+      queue.append(shared);
+      expected += small + std::string(i * 1000, 'o') + *shared;
+    }
+    if (queue.size() != expected.size()) TEST_FAIL;
+
+    std::string received;
+    char buf[64 * 1024];
+    while (!queue.empty()) {
+      if (!queue.WriteTo(fds[0])) TEST_FAIL;
+      ssize_t n;
+      while ((n = read(fds[1], buf, sizeof(buf))) > 0) {
+        received.append(buf, n);
+        if (n < static_cast<ssize_t>(sizeof(buf)))
+          break;
+      }
+    }
+    if (received != expected) TEST_FAIL;
+    if (shared.use_count() != 1) TEST_FAIL;
+
+    // Writing to a closed peer fails
+    close(fds[1]);
+    queue.append("lost");
+    if (queue.WriteTo(fds[0])) TEST_FAIL;
+    close(fds[0]);
+  }
+
+  { // A shared body sent along with a header reaches every client intact
+    const auto body = std::make_shared<const std::string>(2 * 1024 * 1024, 'b');
+    const auto shared_handler = [&body](network::Connection& conn) {
+      conn.send_all(std::string("HEAD\n"), body);
+      conn.close();
+    };
+    int shared_port = 0;
+    const int shared_listen_fd = ListenLoopback(&shared_port);
+    network::EventLoop loop(shared_listen_fd, shared_handler);
+    std::thread t([&loop] { loop.Run(); });
+
+    std::vector<int> fds;
+    for (int i = 0; i < 4; ++i) {
+      fds.emplace_back(Connect(shared_port));
+      if (write(fds.back(), "x", 1) != 1) TEST_FAIL;
+    }
+    for (const int fd : fds) {
+      if (ReadUntilClosed(fd) != "HEAD\n" + *body) TEST_FAIL;
+      close(fd);
+    }
+
+    loop.Stop();
+    t.join();
+    close(shared_listen_fd);
+  }
+
+  { // Each listener's connections are served by that listener's handler
+    int first_port = 0, second_port = 0;
+    const int first_fd = ListenLoopback(&first_port);
+    const int second_fd = ListenLoopback(&second_port);
+    network::EventLoop loop(first_fd, [](network::Connection& conn) {
+      conn.send("first\n");
+      conn.close();
+    });
+    if (!loop.AddListener(second_fd, [](network::Connection& conn) {
+      conn.send("second\n");
+      conn.close();
+    })) TEST_FAIL;
+    std::thread t([&loop] { loop.Run(); });
+
+    for (int i = 0; i < 3; ++i) {
+      const int a = Connect(first_port);
+      const int b = Connect(second_port);
+      if (write(a, "x", 1) != 1 || write(b, "x", 1) != 1) TEST_FAIL;
+      if (ReadUntilClosed(b) != "second\n") TEST_FAIL;
+      if (ReadUntilClosed(a) != "first\n") TEST_FAIL;
+      close(a);
+      close(b);
+    }
+
+    loop.Stop();
+    t.join();
+    close(first_fd);
+    close(second_fd);
+  }
+
+  { // Parked connections resume on Wake() or at their deadline
+    int park_port = 0;
+    const int park_fd = ListenLoopback(&park_port);
+    std::atomic<bool> ready{false};
+    network::EventLoop loop;
+    // "w" waits until woken, "t" until its deadline; any other line is echoed
+    loop.AddListener(park_fd, [](network::Connection& conn) {
+      auto input = conn.input().view();
+      while (!input.empty() && !conn.parked()) {
+        if (input.front() == 'w') {
+          conn.park(network::EventLoop::clock::now() + std::chrono::seconds(10));
+        } else if (input.front() == 't') {
+          conn.park(network::EventLoop::clock::now() + std::chrono::milliseconds(50));
+        } else {
+          conn.send(input.substr(0, 1));
+          if (input.front() == 'q')
+            conn.close();
+        }
+        input.remove_prefix(1);
+      }
+      conn.input().consume(conn.input().size() - input.size());
+    }, [&ready](network::Connection& conn, bool timed_out) {
+      // Spurious wakes park again with the same deadline
+      if (!timed_out && !ready) {
+        conn.park(conn.park_deadline());
+        return;
+      }
+      conn.send(timed_out ? "T" : "W");
+    });
+    std::thread t([&loop] { loop.Run(); });
+
+    const auto wait_parked = [&loop](size_t count) {
+      for (int i = 0; i < 1000 && loop.parked_count() != count; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      return loop.parked_count() == count;
+    };
+
+    // Woken from another thread. Bytes sent while parked are held back
+    // until the connection resumes, then handled in order.
+    const int fd = Connect(park_port);
+    if (write(fd, "w", 1) != 1) TEST_FAIL;
+    if (!wait_parked(1)) TEST_FAIL;
+    if (write(fd, "ab", 2) != 2) TEST_FAIL;
+    loop.Wake();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    if (loop.parked_count() != 1) TEST_FAIL;
+    ready = true;
+    loop.Wake();
+    if (write(fd, "tq", 2) != 2) TEST_FAIL;
+    if (ReadUntilClosed(fd) != "WabTq") TEST_FAIL;
+    close(fd);
+    if (!wait_parked(0)) TEST_FAIL;
+
+    // A peer that goes away while parked is closed and unparked
+    const int gone = Connect(park_port);
+    if (write(gone, "w", 1) != 1) TEST_FAIL;
+    if (!wait_parked(1)) TEST_FAIL;
+    close(gone);
+    if (!wait_parked(0)) TEST_FAIL;
+
+    loop.Stop();
+    t.join();
+    close(park_fd);
+  }
+
+  { // A wake from a read handler during a resume is not lost
+    int park_port = 0;
+    const int park_fd = ListenLoopback(&park_port);
+    network::EventLoop loop;
+    // "w" waits until woken, "p" wakes the loop, as a post does
+    loop.AddListener(park_fd, [&loop](network::Connection& conn) {
+      auto& input = conn.input();
+      while (!input.empty() && !conn.parked()) {
+        const auto c = input.view().front();
+        input.consume(1);
+        if (c == 'w')
+          conn.park(network::EventLoop::clock::now() + std::chrono::seconds(10));
+        else if (c == 'p')
+          loop.Wake();
+      }
+    }, [](network::Connection& conn, bool) { conn.send("W"); });
+    std::thread t([&loop] { loop.Run(); });
+
+    const int fd = Connect(park_port);
+    timeval timeout{2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (write(fd, "w", 1) != 1) TEST_FAIL;
+    for (int i = 0; i < 1000 && loop.parked_count() != 1; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // Read when it resumes: the wake comes while nothing is parked, then it parks
+    if (write(fd, "pw", 2) != 2) TEST_FAIL;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    loop.Wake();
+    char buf[2];
+    if (read(fd, buf, 1) != 1 || buf[0] != 'W') TEST_FAIL;
+    loop.Wake();
+    if (read(fd, buf, 1) != 1 || buf[0] != 'W') TEST_FAIL;
+    close(fd);
+
+    loop.Stop();
+    t.join();
+    close(park_fd);
+  }
+
+  { // Input past the limit that the handler cannot consume drops the connection;
+    // parked ones hold it back until they resume
+    constexpr size_t kMaxInput = 64 * 1024;
+    int cap_port = 0;
+    const int cap_fd = ListenLoopback(&cap_port);
+    network::EventLoop loop;
+    loop.set_max_input_size(kMaxInput);
+    // Parks on "w", consumes "c"s, and never consumes anything else
+    size_t consumed = 0;
+    loop.AddListener(cap_fd, [&consumed](network::Connection& conn) {
+      auto& input = conn.input();
+      if (input.view().front() == 'w') {
+        input.consume(1);
+        conn.park(network::EventLoop::clock::now() + std::chrono::seconds(10));
+      } else if (input.view().front() == 'c') {
+        consumed += input.size();
+        input.consume(input.size());
+      }
+    }, [](network::Connection&, bool) {});
+    std::thread t([&loop] { loop.Run(); });
+
+    // Blocks until the loop reads or drops the connection
+    const auto flood = [](int fd, char c = 'x') {
+      return std::thread([fd, c] {
+        const std::string data(4 * kMaxInput, c);
+        size_t sent = 0;
+        while (sent < data.size()) {
+          const auto n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+          if (n <= 0)
+            break;
+          sent += n;
+        }
+      });
+    };
+
+    const int fd = Connect(cap_port);
+    auto writer = flood(fd);
+    if (!ReadUntilClosed(fd).empty()) TEST_FAIL;
+    writer.join();
+    close(fd);
+
+    // As much as the handler keeps up with
+    const int consuming = Connect(cap_port);
+    writer = flood(consuming, 'c');
+    writer.join();
+    shutdown(consuming, SHUT_WR);
+    if (!ReadUntilClosed(consuming).empty()) TEST_FAIL;
+    close(consuming);
+
+    const int parked = Connect(cap_port);
+    if (write(parked, "w", 1) != 1) TEST_FAIL;
+    for (int i = 0; i < 1000 && loop.parked_count() != 1; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (loop.parked_count() != 1) TEST_FAIL;
+    writer = flood(parked);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if (loop.parked_count() != 1) TEST_FAIL;
+    loop.Wake();
+    if (!ReadUntilClosed(parked).empty()) TEST_FAIL;
+    writer.join();
+    if (loop.parked_count() != 0) TEST_FAIL;
+    close(parked);
+
+    loop.Stop();
+    t.join();
+    if (consumed != 4 * kMaxInput) TEST_FAIL;
+    close(cap_fd);
+  }
+
+  { // Posted tasks run in order on the loop thread; kept-open connections outlive the idle timeout
+    int open_port = 0;
+    const int open_fd = ListenLoopback(&open_port);
+    network::EventLoop loop;
+    loop.set_idle_timeout(std::chrono::milliseconds(50));
+    // Only touched on the loop thread
+    std::vector<network::Connection*> subscribers;
+    loop.AddListener(open_fd, [&subscribers](network::Connection& conn) {
+      conn.input().clear();
+      conn.keep_open();
+      subscribers.emplace_back(&conn);
+      conn.send("k");
+    });
+    std::thread t([&loop] { loop.Run(); });
+
+    const int subscriber = Connect(open_port);
+    const int idle = Connect(open_port);
+    char buf[16];
+    if (write(subscriber, "s", 1) != 1) TEST_FAIL;
+    if (read(subscriber, buf, 1) != 1 || buf[0] != 'k') TEST_FAIL;
+    if (!ReadUntilClosed(idle).empty()) TEST_FAIL;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::atomic<bool> on_loop_thread{true};
+    for (const char* data : {"1", "2", "3"}) {
+      loop.Post([&, data] {
+        on_loop_thread = on_loop_thread && std::this_thread::get_id() == t.get_id();
+        for (auto* conn : subscribers)
+          conn->send(data);
+      });
+    }
+    std::string received;
+    while (received.size() < 3) {
+      const auto n = read(subscriber, buf, sizeof(buf));
+      if (n <= 0) TEST_FAIL;
+      received.append(buf, n);
+    }
+    if (received != "123" || !on_loop_thread) TEST_FAIL;
+    close(subscriber);
+    close(idle);
+
+    loop.Stop();
+    t.join();
+    close(open_fd);
+  }
+
+  { // A kept-open connection whose peer stopped reading times out once it is closed
+    constexpr size_t kFlood = 32 * 1024 * 1024;
+    int open_port = 0;
+    const int open_fd = ListenLoopback(&open_port);
+    network::EventLoop loop;
+    loop.set_idle_timeout(std::chrono::milliseconds(50));
+    network::Connection* subscriber = nullptr;
+    loop.AddListener(open_fd, [&subscriber](network::Connection& conn) {
+      conn.input().clear();
+      conn.keep_open();
+      subscriber = &conn;
+    });
+    std::thread t([&loop] { loop.Run(); });
+
+    const int fd = Connect(open_port);
+    if (write(fd, "s", 1) != 1) TEST_FAIL;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::atomic<size_t> queued{0};
+    loop.Post([&] {
+      const auto piece = std::make_shared<const std::string>(1024 * 1024, 'x');
+      for (size_t sent = 0; sent < kFlood; sent += piece->size())
+        subscriber->send(piece);
+      queued = subscriber->queued();
+      subscriber->close();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    if (queued == 0) TEST_FAIL;
+    // What the socket took before the peer stalled, but not the rest
+    if (ReadUntilClosed(fd).size() + queued > kFlood) TEST_FAIL;
+    close(fd);
+
+    loop.Stop();
+    t.join();
+    close(open_fd);
+  }
+
+  { // Streamed replies are produced as the socket drains, and hold back later requests
+    constexpr size_t kPieces = 256;
+    constexpr size_t kPieceSize = 16 * 1024;
+    int stream_port = 0;
+    const int stream_fd = ListenLoopback(&stream_port);
+    // "s" streams kPieces pieces, "q" replies and closes
+    network::EventLoop loop(stream_fd, [](network::Connection& conn) {
+      auto& input = conn.input();
+      while (!input.empty() && !conn.streaming()) {
+        const auto c = input.view().front();
+        input.consume(1);
+        if (c == 's') {
+          auto piece = std::make_shared<size_t>(0);
+          conn.stream([piece](network::Connection& conn) {
+            conn.send(std::string(kPieceSize, static_cast<char>('a' + *piece % 26)));
+            return ++*piece < kPieces;
+          });
+        } else if (c == 'q') {
+          conn.send("Q");
+          conn.close();
+        }
+      }
+    });
+    std::thread t([&loop] { loop.Run(); });
+
+    // The close asked for by "q" waits for the second stream too
+    const int fd = Connect(stream_port);
+    if (write(fd, "ssq", 3) != 3) TEST_FAIL;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const auto received = ReadUntilClosed(fd);
+    if (received.size() != 2 * kPieces * kPieceSize + 1 || received.back() != 'Q') TEST_FAIL;
+    for (size_t i = 0; i < 2 * kPieces; ++i) {
+      const auto expected = static_cast<char>('a' + i % kPieces % 26);
+      if (received[i * kPieceSize] != expected || received[(i + 1) * kPieceSize - 1] != expected) TEST_FAIL;
+    }
+    close(fd);
+
+    loop.Stop();
+    t.join();
+    close(stream_fd);
+  }
+
+  for (auto& loop : loops)
+    loop->Stop();
+  for (auto& t : threads)
+    t.join();
+  close(listen_fd);
+
+  return EXIT_SUCCESS;
+}
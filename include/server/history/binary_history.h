@@ -0,0 +1,68 @@
+//
+// Binary history replies made from a MessageLog snapshot.
+//
+
+#ifndef SERVER_HISTORY_BINARY_HISTORY_H_
+#define SERVER_HISTORY_BINARY_HISTORY_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "server/history/message_log.h"
+#include "server/protocol/binary_protocol.h"
+
+namespace network {
+
+// The kHistoryReply payload of the messages from `next` on, or of as many of
+// them as fit in kMaxHistoryPayload bytes, and moves `next` past them. While
+// `next` is short of snapshot.end(), the payload goes in a kHistoryPart frame
+// and the next page follows. A message too large for a frame of its own is
+// left out.
+//
+// Sized in a first pass, so the payload is written into one exact buffer. A
+// message evicted between the passes is left out.
+inline std::string MakeHistoryPage(const MessageLog::Snapshot& snapshot, uint64_t& next) {
+  constexpr size_t kMaxEntrySize = kMaxHistoryPayload - sizeof(uint32_t);
+  const auto fits = [](const MessageView& message) {
+    return HistoryEntrySize(message.name.size(), message.chat.size()) <= kMaxEntrySize;
+  };
+
+  // Messages [next, end) fill the page
+  size_t size = sizeof(uint32_t);
+  auto end = std::max(next, snapshot.begin());
+  bool full = false;
+  while (!full && end < snapshot.end()) {
+    const auto chunk_end = std::min(snapshot.end(), (end / MessageLog::kChunkSize + 1) * MessageLog::kChunkSize);
+    snapshot.for_each(end, chunk_end, [&](const MessageView& message) {
+      if (full || !fits(message))
+        return;
+      const auto entry = HistoryEntrySize(message.name.size(), message.chat.size());
+      if (size + entry > kMaxHistoryPayload) {
+        full = true;
+        end = message.sequence;
+        return;
+      }
+      size += entry;
+    });
+    if (!full)
+      end = chunk_end;
+  }
+
+  BinaryPacket payload(size);
+  uint32_t count = 0;
+  payload << count;
+  snapshot.for_each(next, end, [&](const MessageView& message) {
+    if (!fits(message))
+      return;
+    WriteHistoryEntry(payload, message.time, message.name, message.chat);
+    ++count;
+  });
+  payload.put(0, count);
+  next = std::max(next, end);
+  return payload.release();
+}
+
+} // namespace network
+
+#endif // SERVER_HISTORY_BINARY_HISTORY_H_
@@ -0,0 +1,121 @@
+//
+// Tests for binary history replies cut into frames.
+//
+
+#include "server/history/binary_history.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+struct Entry {
+  uint64_t time;
+  std::string name;
+  std::string chat;
+};
+
+// Sends every page as a client would receive it, and reads the frames back
+// with a default FrameDecoder. Returns the entries, and the frame types.
+std::vector<Entry> ReadReply(const network::MessageLog::Snapshot& snapshot, uint64_t begin,
+                             std::vector<network::FrameType>& types) {
+  std::string wire;
+  auto next = begin;
+  do {
+    const auto page = network::MakeHistoryPage(snapshot, next);
+    if (page.size() > network::kMaxHistoryPayload) TEST_FAIL;
+    const auto type = next < snapshot.end() ? network::FrameType::kHistoryPart : network::FrameType::kHistoryReply;
+    wire += network::MakeFrame(type, 7, page).release();
+  } while (next < snapshot.end());
+
+  std::vector<Entry> entries;
+  network::FrameDecoder decoder;
+  std::string_view data = wire;
+  while (!data.empty()) {
+    if (decoder.parse(data) != network::FrameDecoder::kComplete) TEST_FAIL;
+    if (decoder.sequence() != 7) TEST_FAIL;
+    types.push_back(decoder.type());
+    data.remove_prefix(decoder.size());
+
+    network::FrameReader reader(decoder.payload());
+    uint32_t count = 0;
+    if (!reader.read(count)) TEST_FAIL;
+    for (uint32_t i = 0; i < count; ++i) {
+      Entry entry;
+      uint32_t name_size = 0, chat_size = 0;
+      std::string_view name, chat;
+      if (!reader.read(entry.time) || !reader.read(name_size) || !reader.read(chat_size)) TEST_FAIL;
+      if (!reader.read(name_size, name) || !reader.read(chat_size, chat)) TEST_FAIL;
+      entry.name = name;
+      entry.chat = chat;
+      entries.push_back(std::move(entry));
+    }
+    if (!reader.empty()) TEST_FAIL;
+  }
+  return entries;
+}
+
+int main() {
+  { // A short history is one kHistoryReply
+    network::MessageLog log;
+    log.append(10, "James", "Hi");
+    log.append(20, "이범석", "안녕하세요");
+    std::vector<network::FrameType> types;
+    const auto entries = ReadReply(log.snapshot(), 0, types);
+    if (types != std::vector<network::FrameType>{network::FrameType::kHistoryReply}) TEST_FAIL;
+    if (entries.size() != 2 || entries[1].time != 20 || entries[1].chat != "안녕하세요") TEST_FAIL;
+
+    // Nothing from the end on
+    types.clear();
+    if (!ReadReply(log.snapshot(), 2, types).empty() || types.size() != 1) TEST_FAIL;
+  }
+
+  { // A history larger than a frame comes in pages, every one of them decodable
+    network::MessageLog log;
+    constexpr int kMessages = 3000;
+    for (int i = 0; i < kMessages; ++i)
+      log.append(i, "user" + std::to_string(i % 7), std::string(1000, static_cast<char>('a' + i % 26)));
+    const auto snapshot = log.snapshot();
+
+    std::vector<network::FrameType> types;
+    const auto entries = ReadReply(snapshot, 0, types);
+    if (types.size() < 3) TEST_FAIL;
+    for (size_t i = 0; i + 1 < types.size(); ++i) {
+      if (types[i] != network::FrameType::kHistoryPart) TEST_FAIL;
+    }
+    if (types.back() != network::FrameType::kHistoryReply) TEST_FAIL;
+
+    // Every message once, in order
+    if (entries.size() != kMessages) TEST_FAIL;
+    for (int i = 0; i < kMessages; ++i) {
+      if (entries[i].time != static_cast<uint64_t>(i)) TEST_FAIL;
+      if (entries[i].name != "user" + std::to_string(i % 7)) TEST_FAIL;
+      if (entries[i].chat.size() != 1000 || entries[i].chat[0] != 'a' + i % 26) TEST_FAIL;
+    }
+
+    // From the middle
+    types.clear();
+    const auto tail = ReadReply(snapshot, 2500, types);
+    if (tail.size() != 500 || tail.front().time != 2500) TEST_FAIL;
+  }
+
+  { // A message larger than a frame is left out
+    network::MessageLog log;
+    log.append(1, "James", "before");
+    log.append(2, "James", std::string(network::kMaxHistoryPayload, 'x'));
+    log.append(3, "James", "after");
+    std::vector<network::FrameType> types;
+    const auto entries = ReadReply(log.snapshot(), 0, types);
+    if (entries.size() != 2 || entries[0].chat != "before" || entries[1].chat != "after") TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
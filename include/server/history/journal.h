@@ -0,0 +1,458 @@
+//
+// Append-only on-disk journal of chat messages, with group commit and mmap
+// based recovery.
+//
+
+#ifndef SERVER_HISTORY_JOURNAL_H_
+#define SERVER_HISTORY_JOURNAL_H_
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "server/protocol/config.h"
+
+#if defined(NETWORK_X86)
+#include <immintrin.h>
+#endif
+
+namespace network {
+namespace detail {
+
+constexpr std::array<uint32_t, 256> MakeCrc32cTable() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    table[i] = crc;
+  }
+  return table;
+}
+
+inline uint32_t Crc32cScalar(uint32_t crc, const char* p, size_t n) {
+  static constexpr auto table = MakeCrc32cTable();
+  for (size_t i = 0; i < n; ++i)
+    crc = table[(crc ^ static_cast<uint8_t>(p[i])) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t Crc32cSSE42(uint32_t crc, const char* p, size_t n) {
+  uint64_t crc64 = crc;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; n > 0; ++p, --n)
+    crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*p));
+  return crc;
+}
+#endif
+
+} // namespace detail
+
+// CRC-32C (Castagnoli) of `data`, continuing from `crc`. Uses the SSE4.2
+// instruction when the CPU has it.
+inline uint32_t Crc32c(std::string_view data, uint32_t crc = 0) {
+#if defined(__x86_64__)
+  static const bool sse42 = __builtin_cpu_supports("sse4.2");
+  if (sse42)
+    return ~detail::Crc32cSSE42(~crc, data.data(), data.size());
+#endif
+  return ~detail::Crc32cScalar(~crc, data.data(), data.size());
+}
+
+struct JournalOptions {
+  // A new segment is started once the current one exceeds this size
+  size_t segment_size = 64 << 20;
+  // Oldest segments are deleted beyond this count. Zero keeps every segment.
+  size_t max_segments = 0;
+  // How long the commit thread waits for more records before writing a batch.
+  // Zero commits as soon as the previous fsync is done.
+  std::chrono::microseconds commit_delay{0};
+  // Called on the commit thread after every batch written and synced, once
+  // durable() reached the ticket it is given
+  std::function<void(uint64_t)> on_commit;
+  // Called on the commit thread after a batch failed to reach the disk, with
+  // its last ticket. status() reports its records as failed.
+  std::function<void(uint64_t)> on_failure;
+};
+
+// Messages are appended to an in-memory batch and written by a single commit
+// thread, which issues one fdatasync per batch however many threads appended
+// to it. Records that arrive during an fsync form the next batch.
+//
+// The journal is a directory of segments named after their index. Each
+// segment starts with a magic string followed by records:
+//
+//   uint32 crc32c | uint32 name size | uint32 chat size | uint64 time | name | chat
+//
+// where the CRC covers everything after itself. Recovery maps every segment
+// and stops reading a segment at its first incomplete or corrupted record, so
+// a write torn by a crash only loses that record. A batch that fails to be
+// written or synced is cut off its segment before the next one is written.
+class Journal {
+ public:
+  // Outcome of the record of a ticket
+  enum class Commit {
+    kPending,
+    kDurable,
+    kFailed,
+  };
+
+  static constexpr char kMagic[8] = {'C', 'H', 'A', 'T', 'J', 'N', 'L', '1'};
+  static constexpr size_t kRecordHeaderSize = 20;
+  static constexpr size_t kMaxBatchSize = 4 << 20;
+
+  explicit Journal(std::string directory, JournalOptions options = {})
+    : directory_(std::move(directory)), options_(options) {}
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  ~Journal() { close(); }
+
+  // Calls f(time, name, chat) for every record on disk, oldest first, and
+  // returns the number of records. Views are only valid during the call.
+  template<typename F>
+  size_t recover(F&& f) const {
+    size_t count = 0;
+    for (const auto index : ListSegments()) {
+      const auto path = SegmentPath(index);
+      const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd == -1) {
+        perror(path.c_str());
+        continue;
+      }
+
+      struct stat st{};
+      if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(kMagic)) {
+        ::close(fd);
+        continue;
+      }
+      const auto size = static_cast<size_t>(st.st_size);
+      void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED) {
+        perror("mmap");
+        continue;
+      }
+      madvise(map, size, MADV_SEQUENTIAL);
+
+      const std::string_view segment(static_cast<const char*>(map), size);
+      if (segment.substr(0, sizeof(kMagic)) == std::string_view(kMagic, sizeof(kMagic))) {
+        auto offset = sizeof(kMagic);
+        while (segment.size() - offset >= kRecordHeaderSize) {
+          uint32_t crc, name_size, chat_size;
+          uint64_t time;
+          const char* p = segment.data() + offset;
+          std::memcpy(&crc, p, 4);
+          std::memcpy(&name_size, p + 4, 4);
+          std::memcpy(&chat_size, p + 8, 4);
+          std::memcpy(&time, p + 12, 8);
+
+          const auto record_size = kRecordHeaderSize + name_size + chat_size;
+          if (segment.size() - offset < record_size ||
+              Crc32c(segment.substr(offset + 4, record_size - 4)) != crc)
+            break;
+
+          f(time, segment.substr(offset + kRecordHeaderSize, name_size),
+            segment.substr(offset + kRecordHeaderSize + name_size, chat_size));
+          offset += record_size;
+          ++count;
+        }
+      }
+      munmap(map, size);
+    }
+    return count;
+  }
+
+  // Starts a new segment after the existing ones and the commit thread.
+  bool open() {
+    if (mkdir(directory_.c_str(), 0755) == -1 && errno != EEXIST) {
+      perror(directory_.c_str());
+      return false;
+    }
+    const auto segments = ListSegments();
+    segments_.assign(segments.begin(), segments.end());
+    if (!OpenSegment(segments_.empty() ? 0 : segments_.back() + 1))
+      return false;
+
+    stop_ = false;
+    committer_ = std::thread([this] { CommitLoop(); });
+    return true;
+  }
+
+  // Queues a record and returns its ticket, for status() and wait().
+  uint64_t append(uint64_t time, std::string_view name, std::string_view chat) {
+    char header[kRecordHeaderSize];
+    const auto name_size = static_cast<uint32_t>(name.size());
+    const auto chat_size = static_cast<uint32_t>(chat.size());
+    std::memcpy(header + 4, &name_size, 4);
+    std::memcpy(header + 8, &chat_size, 4);
+    std::memcpy(header + 12, &time, 8);
+    const auto crc = Crc32c(chat, Crc32c(name, Crc32c(std::string_view(header + 4, kRecordHeaderSize - 4))));
+    std::memcpy(header, &crc, 4);
+
+    std::unique_lock lck(m_);
+    pending_.append(header, kRecordHeaderSize);
+    pending_.append(name);
+    pending_.append(chat);
+    const auto ticket = ++appended_;
+    lck.unlock();
+    pending_cv_.notify_one();
+    return ticket;
+  }
+
+  // Blocks until the batch of `ticket` was committed or failed. Returns
+  // whether the record is on disk.
+  bool wait(uint64_t ticket) {
+    std::unique_lock lck(m_);
+    durable_cv_.wait(lck, [&] { return settled_ >= ticket || committer_done_; });
+    return StatusLocked(ticket) == Commit::kDurable;
+  }
+
+  // Blocks until every record appended so far was committed or failed.
+  // Returns whether the last one is on disk.
+  bool flush() {
+    std::unique_lock lck(m_);
+    const auto ticket = appended_;
+    lck.unlock();
+    return wait(ticket);
+  }
+
+  // Writes the remaining records and stops the commit thread.
+  void close() {
+    if (!committer_.joinable())
+      return;
+    {
+      std::lock_guard lck(m_);
+      stop_ = true;
+    }
+    pending_cv_.notify_one();
+    committer_.join();
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+  NETWORK_NODISCARD Commit status(uint64_t ticket) const {
+    std::lock_guard lck(m_);
+    return StatusLocked(ticket);
+  }
+
+  // Last ticket of the last batch written and synced. Records of earlier
+  // failed batches are not on disk; status() tells them apart.
+  NETWORK_NODISCARD uint64_t durable() const {
+    std::lock_guard lck(m_);
+    return durable_;
+  }
+  NETWORK_NODISCARD uint64_t commits() const { return commits_.load(std::memory_order_relaxed); }
+  NETWORK_NODISCARD bool failed() const { return failed_.load(std::memory_order_relaxed); }
+  NETWORK_NODISCARD size_t segment_count() const {
+    std::lock_guard lck(m_);
+    return segments_.size();
+  }
+
+ private:
+  Commit StatusLocked(uint64_t ticket) const {
+    if (ticket > settled_)
+      return Commit::kPending;
+    for (const auto& [first, last] : lost_) {
+      if (ticket >= first && ticket <= last)
+        return Commit::kFailed;
+    }
+    return Commit::kDurable;
+  }
+
+  std::string SegmentPath(uint64_t index) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%020llu.journal", static_cast<unsigned long long>(index));
+    return directory_ + name;
+  }
+
+  std::vector<uint64_t> ListSegments() const {
+    std::vector<uint64_t> segments;
+    DIR* dir = opendir(directory_.c_str());
+    if (dir == nullptr)
+      return segments;
+    while (const auto* entry = readdir(dir)) {
+      unsigned long long index;
+      char suffix[16];
+      if (sscanf(entry->d_name, "%20llu.%15s", &index, suffix) == 2 && std::strcmp(suffix, "journal") == 0)
+        segments.emplace_back(index);
+    }
+    closedir(dir);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+  }
+
+  bool OpenSegment(uint64_t index) {
+    const auto path = SegmentPath(index);
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+      perror(path.c_str());
+      return false;
+    }
+    segment_bytes_ = 0;
+    synced_bytes_ = 0;
+    segments_.emplace_back(index);
+    if (!WriteAll(std::string_view(kMagic, sizeof(kMagic))))
+      return false;
+    synced_bytes_ = segment_bytes_;
+    return true;
+  }
+
+  // Called on the commit thread only
+  bool WriteAll(std::string_view data) {
+    while (!data.empty()) {
+      const auto n = write(fd_, data.data(), data.size());
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        perror("journal write");
+        return false;
+      }
+      data.remove_prefix(n);
+      segment_bytes_ += n;
+    }
+    return true;
+  }
+
+  // Cuts a failed batch off the segment, so that the next batches are not
+  // written behind a torn record, and recovery does not bring back records
+  // reported as failed. Starts a new segment if the cut fails.
+  void Discard() {
+    if (ftruncate(fd_, static_cast<off_t>(synced_bytes_)) == 0) {
+      segment_bytes_ = synced_bytes_;
+      return;
+    }
+    perror("journal truncate");
+    Rotate();
+  }
+
+  void Rotate() {
+    std::vector<uint64_t> removed;
+    {
+      std::lock_guard lck(m_);
+      ::close(fd_);
+      if (!OpenSegment(segments_.back() + 1)) {
+        failed_ = true;
+        return;
+      }
+      while (options_.max_segments != 0 && segments_.size() > options_.max_segments) {
+        removed.emplace_back(segments_.front());
+        segments_.pop_front();
+      }
+    }
+    for (const auto index : removed)
+      unlink(SegmentPath(index).c_str());
+  }
+
+  void CommitLoop() {
+    std::string batch;
+    while (true) {
+      std::unique_lock lck(m_);
+      pending_cv_.wait(lck, [this] { return stop_ || !pending_.empty(); });
+      if (!stop_ && options_.commit_delay.count() != 0) {
+        pending_cv_.wait_for(lck, options_.commit_delay,
+                             [this] { return stop_ || pending_.size() >= kMaxBatchSize; });
+      }
+      if (pending_.empty() && stop_)
+        break;
+
+      batch.swap(pending_);
+      pending_.clear();
+      const auto ticket = appended_;
+      lck.unlock();
+
+      // The batch is written even if the previous one failed, so that a
+      // transient error only loses the records it hit
+      bool ok = WriteAll(batch);
+      if (ok && fdatasync(fd_) == -1) {
+        perror("journal sync");
+        ok = false;
+      }
+      if (ok) {
+        synced_bytes_ = segment_bytes_;
+      } else {
+        failed_ = true;
+        Discard();
+      }
+      commits_.fetch_add(1, std::memory_order_relaxed);
+      if (segment_bytes_ >= options_.segment_size)
+        Rotate();
+
+      lck.lock();
+      if (ok) {
+        durable_ = ticket;
+      } else if (!lost_.empty() && lost_.back().second == settled_) {
+        lost_.back().second = ticket;
+      } else {
+        lost_.emplace_back(settled_ + 1, ticket);
+      }
+      settled_ = ticket;
+      lck.unlock();
+      durable_cv_.notify_all();
+      const auto& notify = ok ? options_.on_commit : options_.on_failure;
+      if (notify)
+        notify(ticket);
+    }
+
+    std::lock_guard lck(m_);
+    committer_done_ = true;
+    durable_cv_.notify_all();
+  }
+
+  const std::string directory_;
+  const JournalOptions options_;
+
+  mutable std::mutex m_;
+  std::condition_variable pending_cv_;
+  std::condition_variable durable_cv_;
+  std::string pending_;
+  uint64_t appended_ = 0;
+  uint64_t durable_ = 0;
+  // Last ticket committed or failed
+  uint64_t settled_ = 0;
+  // Tickets of failed batches, first and last; adjacent ones are merged
+  std::vector<std::pair<uint64_t, uint64_t>> lost_;
+  bool stop_ = false;
+  bool committer_done_ = false;
+  std::deque<uint64_t> segments_;
+
+  std::thread committer_;
+  int fd_ = -1;
+  size_t segment_bytes_ = 0;
+  // Size of the segment up to its last synced batch
+  size_t synced_bytes_ = 0;
+  std::atomic<uint64_t> commits_{0};
+  std::atomic<bool> failed_{false};
+};
+
+} // namespace network
+
+#endif // SERVER_HISTORY_JOURNAL_H_
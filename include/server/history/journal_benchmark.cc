@@ -0,0 +1,111 @@
+//
+// Journal benchmark: sustained append throughput with group commit, and
+// cold-start recovery time.
+//
+// usage: journal_benchmark [messages] [writer_threads] [directory]
+//
+
+#include "server/history/journal.h"
+#include "server/history/message_log.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Drops the segments from the page cache so that recovery reads from disk.
+void EvictPageCache(const std::string& directory) {
+  DIR* dir = opendir(directory.c_str());
+  while (const auto* entry = dir ? readdir(dir) : nullptr) {
+    const int fd = open((directory + '/' + entry->d_name).c_str(), O_RDONLY);
+    if (fd == -1)
+      continue;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+  if (dir)
+    closedir(dir);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const long messages = argc > 1 ? atol(argv[1]) : 2'000'000;
+  const int writer_num = argc > 2 ? atoi(argv[2]) : 4;
+  std::string directory = argc > 3 ? argv[3] : "";
+  if (directory.empty()) {
+    char path[] = "/tmp/journal_benchmark.XXXXXX";
+    directory = mkdtemp(path);
+  }
+
+  const std::string name = "이범석";
+  const std::string chat = "안녕하세요, 오늘 저녁에 뭐 먹을까요?";
+  const auto record_size = network::Journal::kRecordHeaderSize + name.size() + chat.size();
+
+  {
+    network::Journal journal(directory);
+    if (!journal.open())
+      return EXIT_FAILURE;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writer_num; ++w) {
+      writers.emplace_back([&] {
+        for (long i = 0; i < messages / writer_num; ++i)
+          journal.append(i, name, chat);
+      });
+    }
+    for (auto& t : writers)
+      t.join();
+    journal.flush();
+    const auto seconds = SecondsSince(start);
+
+    const auto appended = messages / writer_num * writer_num;
+    std::cout << "append:   " << appended << " records in " << seconds << " s, "
+              << appended / seconds / 1e6 << " M records/s, "
+              << appended * record_size / seconds / (1 << 20) << " MiB/s, "
+              << journal.commits() << " fsyncs, "
+              << journal.segment_count() << " segments\n";
+  }
+
+  EvictPageCache(directory);
+  {
+    const network::Journal journal(directory);
+    size_t bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    const auto count = journal.recover([&bytes](uint64_t, std::string_view name, std::string_view chat) {
+      bytes += name.size() + chat.size();
+    });
+    const auto seconds = SecondsSince(start);
+    std::cout << "scan:     " << count << " records in " << seconds << " s, "
+              << count * record_size / seconds / (1 << 20) << " MiB/s (cold)\n";
+  }
+
+  {
+    const network::Journal journal(directory);
+    network::MessageLog log;
+    const auto start = std::chrono::steady_clock::now();
+    const auto count = journal.recover([&log](uint64_t time, std::string_view name, std::string_view chat) {
+      log.append(time, name, chat);
+    });
+    const auto seconds = SecondsSince(start);
+    std::cout << "rebuild:  " << count << " records in " << seconds << " s, "
+              << count * record_size / seconds / (1 << 20) << " MiB/s into MessageLog\n";
+  }
+
+  if (argc <= 3) {
+    const auto command = "rm -rf '" + directory + "'";
+    if (system(command.c_str()) != 0)
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
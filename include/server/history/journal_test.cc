@@ -0,0 +1,227 @@
+//
+// Tests for network::Journal.
+//
+
+#include "server/history/journal.h"
+
+#include <signal.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+struct Record {
+  uint64_t time;
+  std::string name;
+  std::string chat;
+};
+
+std::vector<Record> Recover(const network::Journal& journal) {
+  std::vector<Record> records;
+  journal.recover([&records](uint64_t time, std::string_view name, std::string_view chat) {
+    records.push_back({time, std::string(name), std::string(chat)});
+  });
+  return records;
+}
+
+std::string MakeTempDirectory() {
+  char path[] = "/tmp/journal_test.XXXXXX";
+  if (mkdtemp(path) == nullptr) TEST_FAIL;
+  return path;
+}
+
+void RemoveDirectory(const std::string& directory) {
+  const auto command = "rm -rf '" + directory + "'";
+  if (system(command.c_str()) != 0) TEST_FAIL;
+}
+
+int main() {
+  { // CRC-32C check value, scalar and hardware
+    if (network::Crc32c("123456789") != 0xE3069283) TEST_FAIL;
+    if (network::Crc32c("56789", network::Crc32c("1234")) != 0xE3069283) TEST_FAIL;
+    if (~network::detail::Crc32cScalar(~0u, "123456789", 9) != 0xE3069283) TEST_FAIL;
+    if (network::Crc32c("") != 0) TEST_FAIL;
+  }
+
+  { // Records survive a restart, and each restart starts a new segment
+    const auto directory = MakeTempDirectory();
+    {
+      network::Journal journal(directory);
+      if (!journal.open()) TEST_FAIL;
+      journal.append(10, "James", "Hi");
+      journal.append(20, "이범석", "안녕하세요");
+      journal.flush();
+      if (journal.durable() != 2) TEST_FAIL;
+    }
+    {
+      network::Journal journal(directory);
+      if (!journal.open()) TEST_FAIL;
+      journal.append(30, "Nana", "");
+    }
+
+    network::Journal journal(directory);
+    const auto records = Recover(journal);
+    if (records.size() != 3) TEST_FAIL;
+    if (records[1].time != 20) TEST_FAIL;
+    if (records[1].name != "이범석") TEST_FAIL;
+    if (records[1].chat != "안녕하세요") TEST_FAIL;
+    if (records[2].name != "Nana" || !records[2].chat.empty()) TEST_FAIL;
+    RemoveDirectory(directory);
+  }
+
+  { // Torn and corrupted records end their segment
+    const auto directory = MakeTempDirectory();
+    {
+      network::Journal journal(directory);
+      if (!journal.open()) TEST_FAIL;
+      for (int i = 0; i < 10; ++i)
+        journal.append(i, "name", std::to_string(i));
+    }
+    const auto path = directory + "/00000000000000000000.journal";
+
+    struct stat st{};
+    if (stat(path.c_str(), &st) == -1) TEST_FAIL;
+    if (truncate(path.c_str(), st.st_size - 3) == -1) TEST_FAIL;
+    if (Recover(network::Journal(directory)).size() != 9) TEST_FAIL;
+
+    // Flip a byte in the chat of the fifth record
+    const int fd = ::open(path.c_str(), O_RDWR);
+    const auto record_size = network::Journal::kRecordHeaderSize + 5;
+    const auto offset = sizeof(network::Journal::kMagic) + 4 * record_size + record_size - 1;
+    if (pwrite(fd, "x", 1, offset) != 1) TEST_FAIL;
+    ::close(fd);
+    const auto records = Recover(network::Journal(directory));
+    if (records.size() != 4) TEST_FAIL;
+    if (records.back().chat != "3") TEST_FAIL;
+    RemoveDirectory(directory);
+  }
+
+  { // Segment rotation and deletion of old segments
+    const auto directory = MakeTempDirectory();
+    network::JournalOptions options;
+    options.segment_size = 4096;
+    options.max_segments = 3;
+    network::Journal journal(directory, options);
+    if (!journal.open()) TEST_FAIL;
+    for (int i = 0; i < 1000; ++i) {
+      journal.append(i, "name", std::string(100, 'x'));
+      if (i % 10 == 0)
+        journal.flush();
+    }
+    journal.close();
+    if (journal.segment_count() != 3) TEST_FAIL;
+
+    // Only the newest records are left, in order
+    const auto records = Recover(journal);
+    if (records.empty() || records.size() >= 1000) TEST_FAIL;
+    for (size_t i = 0; i < records.size(); ++i) {
+      if (records[i].time != 1000 - records.size() + i) TEST_FAIL;
+    }
+    RemoveDirectory(directory);
+  }
+
+  { // The commit hook sees every batch once it is durable
+    const auto directory = MakeTempDirectory();
+    std::atomic<uint64_t> committed{0};
+    std::atomic<bool> in_order{true};
+    network::Journal* journal_ptr = nullptr;
+    network::JournalOptions options;
+    options.on_commit = [&](uint64_t ticket) {
+      in_order = in_order && ticket > committed && journal_ptr->durable() >= ticket;
+      committed = ticket;
+    };
+    network::Journal journal(directory, options);
+    journal_ptr = &journal;
+    if (!journal.open()) TEST_FAIL;
+    for (int i = 0; i < 100; ++i)
+      journal.append(i, "James", std::to_string(i));
+    journal.close();
+    if (committed != 100 || !in_order) TEST_FAIL;
+    RemoveDirectory(directory);
+  }
+
+  { // A failed batch is reported, and cut off its segment before the next one
+    const auto directory = MakeTempDirectory();
+    std::atomic<uint64_t> failed{0};
+    network::JournalOptions options;
+    options.on_failure = [&](uint64_t ticket) { failed = ticket; };
+    network::Journal journal(directory, options);
+    if (!journal.open()) TEST_FAIL;
+    journal.append(1, "name", "before");
+    if (!journal.flush()) TEST_FAIL;
+
+    // Writes past the file size limit fail with EFBIG, this one half-way
+    struct stat st{};
+    if (stat((directory + "/00000000000000000000.journal").c_str(), &st) == -1) TEST_FAIL;
+    signal(SIGXFSZ, SIG_IGN);
+    rlimit saved{};
+    if (getrlimit(RLIMIT_FSIZE, &saved) == -1) TEST_FAIL;
+    rlimit limit = saved;
+    limit.rlim_cur = st.st_size + 10;
+    if (setrlimit(RLIMIT_FSIZE, &limit) == -1) TEST_FAIL;
+    const auto lost = journal.append(2, "name", "lost");
+    if (journal.flush()) TEST_FAIL;
+    if (setrlimit(RLIMIT_FSIZE, &saved) == -1) TEST_FAIL;
+    if (journal.status(lost) != network::Journal::Commit::kFailed) TEST_FAIL;
+    if (!journal.failed() || journal.durable() != 1) TEST_FAIL;
+
+    const auto after = journal.append(3, "name", "after");
+    if (!journal.flush()) TEST_FAIL;
+    if (journal.status(after) != network::Journal::Commit::kDurable) TEST_FAIL;
+    if (journal.status(lost) != network::Journal::Commit::kFailed) TEST_FAIL;
+    if (journal.status(after + 1) != network::Journal::Commit::kPending) TEST_FAIL;
+    journal.close();
+    if (failed != lost) TEST_FAIL;
+
+    // Nothing torn is left in the way of the record after it
+    const auto records = Recover(journal);
+    if (records.size() != 2) TEST_FAIL;
+    if (records[0].chat != "before" || records[1].chat != "after") TEST_FAIL;
+    RemoveDirectory(directory);
+  }
+
+  { // Concurrent appends are committed in batches
+    const auto directory = MakeTempDirectory();
+    network::Journal journal(directory);
+    if (!journal.open()) TEST_FAIL;
+    constexpr int kWriters = 4;
+    constexpr int kPerWriter = 5000;
+    std::vector<std::thread> writers;
+    for (int w = 0; w < kWriters; ++w) {
+      writers.emplace_back([&journal, w] {
+        for (int i = 0; i < kPerWriter; ++i)
+          journal.append(i, "writer" + std::to_string(w), std::to_string(i));
+      });
+    }
+    for (auto& t : writers)
+      t.join();
+    journal.close();
+    if (journal.durable() != kWriters * kPerWriter) TEST_FAIL;
+    if (journal.commits() >= kWriters * kPerWriter) TEST_FAIL;
+
+    std::vector<int> next(kWriters);
+    for (const auto& record : Recover(journal)) {
+      const auto w = record.name.back() - '0';
+      if (record.chat != std::to_string(next[w]++)) TEST_FAIL;
+    }
+    for (const auto count : next) {
+      if (count != kPerWriter) TEST_FAIL;
+    }
+    RemoveDirectory(directory);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,505 @@
+//
+// Append-only, time ordered chat message log with bounded retention.
+//
+
+#ifndef SERVER_HISTORY_MESSAGE_LOG_H_
+#define SERVER_HISTORY_MESSAGE_LOG_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "server/protocol/config.h"
+
+namespace network {
+
+struct MessageView {
+  uint64_t sequence;
+  uint64_t time;
+  std::string_view name;
+  std::string_view chat;
+  std::string_view payload;
+};
+
+// Limits of a MessageLog. The oldest messages are evicted as soon as any limit
+// is exceeded. `max_messages` also fixes the capacity of the underlying ring.
+struct RetentionPolicy {
+  uint64_t max_messages = 1 << 20;
+  uint64_t max_bytes = 0;                 // 0: unlimited
+  std::chrono::milliseconds max_age{0};   // 0: unlimited
+};
+
+// Messages are stored in fixed-size chunks held by a ring sized from the
+// retention policy. Timestamps of a chunk are kept in their own array so that
+// a range query binary-searches a few dense cache lines instead of the message
+// payloads.
+//
+// Each message may carry a payload, its serialized form built once by the
+// caller. When a chunk is fully published its payloads are also joined into
+// one contiguous buffer, so reading a long range touches one slice per chunk.
+//
+// Writers never take a lock nor wait for each other. A slot is reserved with a
+// single fetch_add and filled concurrently with other writers. Filled slots are
+// published in reservation order by whichever writer finds them ready, so
+// readers always see a gap-free prefix of the log whose timestamps never
+// decrease. Messages with identical timestamps are all kept.
+//
+// Eviction only moves the head of the log forward; a chunk leaves the ring
+// when a writer needs its place. Readers pin the chunk they are looking at and
+// a pinned chunk is only reused once its last reader is done with it, so
+// eviction never waits for readers and readers never see a reused chunk.
+// Chunk objects are recycled rather than freed, which keeps memory flat once
+// the ring is full.
+class MessageLog {
+ public:
+  enum : uint64_t {
+    kChunkSize = 1024,
+  };
+
+ private:
+  static constexpr uint64_t kNoBase = ~uint64_t{0};
+  static constexpr uint64_t kRetired = uint64_t{1} << 63;
+  static constexpr uint64_t kClaimed = uint64_t{1} << 62;
+  static constexpr uint64_t kPinMask = kClaimed - 1;
+
+  struct Chunk {
+    MessageLog* owner = nullptr;
+    Chunk* next_allocated = nullptr;
+    // Sequence number of the first slot, kNoBase once evicted
+    std::atomic<uint64_t> base{kNoBase};
+    // Number of pins, plus the kRetired and kClaimed flags
+    std::atomic<uint64_t> state{0};
+
+    std::atomic<uint64_t> time[kChunkSize];
+    std::atomic<bool> ready[kChunkSize];
+    std::string name[kChunkSize];
+    std::string chat[kChunkSize];
+    std::string payload[kChunkSize];
+
+    // Every payload of the chunk, once all of its messages are published
+    std::atomic<bool> sealed{false};
+    std::string joined;
+  };
+
+  static uint64_t SlotBytes(const Chunk& chunk, uint64_t i) {
+    return chunk.name[i].size() + chunk.chat[i].size() + chunk.payload[i].size();
+  }
+
+  // Keeps a chunk from being reused while it is alive. Empty if the chunk of
+  // `sequence` is not in the ring.
+  class Pin {
+   public:
+    Pin() = default;
+    Pin(const MessageLog* log, uint64_t sequence) : chunk_(log->TryPin(sequence)) {}
+    Pin(Pin&& other) noexcept : chunk_(std::exchange(other.chunk_, nullptr)) {}
+    Pin& operator=(Pin&& other) noexcept {
+      std::swap(chunk_, other.chunk_);
+      return *this;
+    }
+    ~Pin() { if (chunk_) Unpin(chunk_); }
+
+    explicit operator bool() const { return chunk_ != nullptr; }
+    Chunk* operator->() const { return chunk_; }
+    Chunk& operator*() const { return *chunk_; }
+
+   private:
+    Chunk* chunk_ = nullptr;
+  };
+
+ public:
+  // The messages that were live when the snapshot was taken. Messages evicted
+  // while it is in use are skipped.
+  class Snapshot {
+   public:
+    NETWORK_NODISCARD uint64_t begin() const { return begin_; }
+    NETWORK_NODISCARD uint64_t end() const { return end_; }
+    NETWORK_NODISCARD uint64_t size() const { return end_ - begin_; }
+    NETWORK_NODISCARD bool empty() const { return begin_ == end_; }
+
+    // First sequence whose time is not less than `time`, or end().
+    NETWORK_NODISCARD uint64_t lower_bound(uint64_t time) const {
+      if (empty())
+        return end_;
+
+      // Last chunk whose first message is older than `time`. Evicted chunks
+      // count as older.
+      const auto first_chunk = begin_ / kChunkSize;
+      auto lo = first_chunk;
+      auto hi = (end_ - 1) / kChunkSize + 1;
+      while (lo < hi) {
+        const auto mid = lo + (hi - lo) / 2;
+        const auto first = std::max(begin_, mid * kChunkSize);
+        const Pin chunk(log_, first);
+        if (!chunk || chunk->time[first % kChunkSize].load(std::memory_order_relaxed) < time)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      if (lo == first_chunk)
+        return begin_;
+
+      const auto index = lo - 1;
+      const auto first = std::max(begin_, index * kChunkSize);
+      const auto last = std::min(end_, (index + 1) * kChunkSize);
+      const Pin chunk(log_, first);
+      if (!chunk)
+        return last;
+      const auto* times = chunk->time;
+      const auto it = std::lower_bound(times + first % kChunkSize, times + (last - 1) % kChunkSize + 1, time,
+                                       [](const auto& a, uint64_t b) { return a.load(std::memory_order_relaxed) < b; });
+      return index * kChunkSize + (it - times);
+    }
+
+    // Calls f(MessageView) for every live message in [from, to). Views are
+    // only valid during the call.
+    template<typename F>
+    void for_each(uint64_t from, uint64_t to, F&& f) const {
+      auto sequence = std::max(from, begin_);
+      to = std::min(to, end_);
+      while (sequence < to) {
+        const auto chunk_end = std::min(to, (sequence / kChunkSize + 1) * kChunkSize);
+        if (const Pin chunk(log_, sequence); chunk) {
+          for (; sequence < chunk_end; ++sequence) {
+            const auto i = sequence % kChunkSize;
+            f(MessageView{sequence, chunk->time[i].load(std::memory_order_relaxed),
+                          chunk->name[i], chunk->chat[i], chunk->payload[i]});
+          }
+        }
+        sequence = chunk_end;
+      }
+    }
+
+    // Calls f(std::string_view) with the payloads of every live message in
+    // [from, to), in order. Whole chunks are passed as one slice. Slices are
+    // only valid during the call.
+    template<typename F>
+    void for_each_payload(uint64_t from, uint64_t to, F&& f) const {
+      auto sequence = std::max(from, begin_);
+      to = std::min(to, end_);
+      while (sequence < to) {
+        const auto chunk_end = std::min(to, (sequence / kChunkSize + 1) * kChunkSize);
+        if (const Pin chunk(log_, sequence); chunk) {
+          if (sequence % kChunkSize == 0 && chunk_end - sequence == kChunkSize &&
+              chunk->sealed.load(std::memory_order_acquire)) {
+            f(std::string_view(chunk->joined));
+          } else {
+            for (auto s = sequence; s < chunk_end; ++s)
+              f(std::string_view(chunk->payload[s % kChunkSize]));
+          }
+        }
+        sequence = chunk_end;
+      }
+    }
+
+    template<typename F>
+    void for_each(uint64_t from, F&& f) const {
+      for_each(from, end_, std::forward<F>(f));
+    }
+
+   private:
+    friend class MessageLog;
+    Snapshot(const MessageLog* log, uint64_t begin, uint64_t end)
+      : log_(log), begin_(std::min(begin, end)), end_(end) {}
+
+    const MessageLog* log_;
+    uint64_t begin_;
+    uint64_t end_;
+  };
+
+  explicit MessageLog(RetentionPolicy policy = {})
+    : policy_(policy),
+      ring_size_((std::max<uint64_t>(policy.max_messages, 1) - 1) / kChunkSize + 2),
+      ring_(new std::atomic<Chunk*>[ring_size_]()) {}
+
+  MessageLog(const MessageLog&) = delete;
+  MessageLog& operator=(const MessageLog&) = delete;
+
+  ~MessageLog() {
+    auto* chunk = allocated_.load(std::memory_order_acquire);
+    while (chunk != nullptr)
+      delete std::exchange(chunk, chunk->next_allocated);
+  }
+
+  // Appends a message stamped with `time`, or with the latest timestamp in the
+  // log if that is larger, then applies the retention policy as of `time`.
+  // Returns the sequence number of the message.
+  uint64_t append(uint64_t time, std::string_view name, std::string_view chat, std::string_view payload = {}) {
+    const auto sequence = reserved_.fetch_add(1, std::memory_order_relaxed);
+
+    // The chunk is gone if this writer was stalled for a whole ring
+    if (const auto chunk = GetOrCreateChunk(sequence); chunk) {
+      const auto i = sequence % kChunkSize;
+      chunk->name[i].assign(name);
+      chunk->chat[i].assign(chat);
+      chunk->payload[i].assign(payload);
+      chunk->time[i].store(time, std::memory_order_relaxed);
+      appended_bytes_.fetch_add(name.size() + chat.size() + payload.size(), std::memory_order_relaxed);
+      chunk->ready[i].store(true);
+    }
+
+    Publish();
+    trim(time);
+    return sequence;
+  }
+
+  // Evicts the oldest messages until the retention policy holds at `now`.
+  // Runs on one thread at a time; concurrent callers return immediately.
+  void trim(uint64_t now) {
+    if (trimming_.test_and_set(std::memory_order_acquire))
+      return;
+
+    const auto end = published_.load(std::memory_order_acquire);
+    if (end > policy_.max_messages)
+      AdvanceHead(end - policy_.max_messages);
+
+    const auto max_age = static_cast<uint64_t>(policy_.max_age.count());
+    if (policy_.max_bytes != 0 || max_age != 0) {
+      const auto min_time = max_age == 0 || now < max_age ? 0 : now - max_age;
+      uint64_t head;
+      while ((head = head_.load(std::memory_order_acquire)) < end) {
+        const Pin chunk(this, head);
+        if (!chunk)
+          break;
+
+        auto live = live_bytes();
+        auto target = head;
+        const auto chunk_end = std::min(end, (head / kChunkSize + 1) * kChunkSize);
+        for (; target < chunk_end; ++target) {
+          const auto i = target % kChunkSize;
+          const bool over_budget = policy_.max_bytes != 0 && live > policy_.max_bytes;
+          if (!over_budget && chunk->time[i].load(std::memory_order_relaxed) >= min_time)
+            break;
+          live -= SlotBytes(*chunk, i);
+        }
+        if (target == head)
+          break;
+        AdvanceHead(target);
+      }
+    }
+
+    trimming_.clear(std::memory_order_release);
+  }
+
+  NETWORK_NODISCARD Snapshot snapshot() const {
+    const auto head = head_.load(std::memory_order_acquire);
+    return Snapshot(this, head, published_.load(std::memory_order_acquire));
+  }
+
+  // Number of live messages
+  NETWORK_NODISCARD uint64_t size() const { return snapshot().size(); }
+
+  NETWORK_NODISCARD uint64_t evicted_messages() const { return evicted_messages_.load(std::memory_order_relaxed); }
+  NETWORK_NODISCARD uint64_t evicted_bytes() const { return evicted_bytes_.load(std::memory_order_relaxed); }
+  // Payload bytes of live messages. Only approximate while a writer is stalled
+  // for a whole ring.
+  NETWORK_NODISCARD uint64_t live_bytes() const {
+    return appended_bytes_.load(std::memory_order_relaxed) - evicted_bytes_.load(std::memory_order_relaxed);
+  }
+  NETWORK_NODISCARD uint64_t allocated_chunks() const { return allocated_chunks_.load(std::memory_order_relaxed); }
+  NETWORK_NODISCARD uint64_t capacity() const { return ring_size_ * kChunkSize; }
+  NETWORK_NODISCARD const RetentionPolicy& policy() const { return policy_; }
+
+ private:
+  Chunk* TryPin(uint64_t sequence) const {
+    auto* chunk = ring_[sequence / kChunkSize % ring_size_].load(std::memory_order_acquire);
+    if (chunk == nullptr)
+      return nullptr;
+
+    // Either the writer retiring the chunk sees the pin, or the pin sees the
+    // chunk's new base. A stale pointer is still a valid object, since chunks
+    // are only freed with the log.
+    chunk->state.fetch_add(1);
+    if (chunk->base.load() != sequence / kChunkSize * kChunkSize) {
+      Unpin(chunk);
+      return nullptr;
+    }
+    return chunk;
+  }
+
+  static void Unpin(Chunk* chunk) {
+    if (chunk->state.fetch_sub(1) == (kRetired | 1))
+      Claim(chunk);
+  }
+
+  // Hands an evicted chunk back for reuse once nothing pins it. Exactly one of
+  // the retiring writer and the last reader succeeds.
+  static void Claim(Chunk* chunk) {
+    auto expected = kRetired;
+    if (chunk->state.compare_exchange_strong(expected, kRetired | kClaimed))
+      chunk->owner->Recycle(chunk);
+  }
+
+  static void Retire(Chunk* chunk) {
+    chunk->base.store(kNoBase);
+    if ((chunk->state.fetch_or(kRetired) & kPinMask) == 0)
+      Claim(chunk);
+  }
+
+  void Recycle(Chunk* chunk) {
+    std::lock_guard lck(spare_m_);
+    spare_.emplace_back(chunk);
+  }
+
+  // Reuses a spare chunk if one is available without waiting, or allocates one.
+  Chunk* AcquireChunk() {
+    Chunk* chunk = nullptr;
+    if (std::unique_lock lck(spare_m_, std::try_to_lock); lck.owns_lock() && !spare_.empty()) {
+      chunk = spare_.back();
+      spare_.pop_back();
+    }
+
+    if (chunk == nullptr) {
+      chunk = new Chunk();
+      chunk->owner = this;
+      chunk->next_allocated = allocated_.load(std::memory_order_relaxed);
+      while (!allocated_.compare_exchange_weak(chunk->next_allocated, chunk, std::memory_order_release)) {}
+      allocated_chunks_.fetch_add(1, std::memory_order_relaxed);
+      return chunk;
+    }
+
+    // Stale pins may still come and go, so only the flags are cleared
+    chunk->state.fetch_and(kPinMask);
+    for (auto& ready : chunk->ready)
+      ready.store(false, std::memory_order_relaxed);
+    chunk->sealed.store(false, std::memory_order_relaxed);
+    chunk->joined.clear();
+    return chunk;
+  }
+
+  Pin GetOrCreateChunk(uint64_t sequence) {
+    const auto index = sequence / kChunkSize;
+    auto& slot = ring_[index % ring_size_];
+
+    while (true) {
+      auto* current = slot.load(std::memory_order_acquire);
+      const auto current_base = current != nullptr ? current->base.load() : 0;
+      if (current != nullptr && current_base >= index * kChunkSize)
+        return Pin(this, sequence);
+
+      // Everything in the older chunk is evicted before its place is reused
+      if (index >= ring_size_)
+        AdvanceHead((index - ring_size_ + 1) * kChunkSize);
+
+      auto* created = AcquireChunk();
+      created->base.store(index * kChunkSize);
+      if (slot.compare_exchange_strong(current, created, std::memory_order_acq_rel)) {
+        if (current != nullptr)
+          Retire(current);
+        return Pin(this, sequence);
+      }
+
+      // Another writer of this chunk won
+      created->base.store(kNoBase);
+      created->state.fetch_or(kRetired | kClaimed);
+      Recycle(created);
+    }
+  }
+
+  // Moves the head forward to `target` and counts the evicted messages.
+  void AdvanceHead(uint64_t target) {
+    auto head = head_.load(std::memory_order_acquire);
+    while (head < target) {
+      uint64_t bytes = 0;
+      for (auto sequence = head; sequence < target;) {
+        const auto chunk_end = std::min(target, (sequence / kChunkSize + 1) * kChunkSize);
+        if (const Pin chunk(this, sequence); chunk) {
+          for (; sequence < chunk_end; ++sequence) {
+            const auto i = sequence % kChunkSize;
+            if (chunk->ready[i].load())
+              bytes += SlotBytes(*chunk, i);
+          }
+        }
+        sequence = chunk_end;
+      }
+
+      if (head_.compare_exchange_weak(head, target, std::memory_order_acq_rel)) {
+        evicted_messages_.fetch_add(target - head, std::memory_order_relaxed);
+        evicted_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  // Advances the published length over every consecutive ready slot. Any
+  // writer may publish the slots of others; a slot whose writer is still busy
+  // is published by that writer once it is done.
+  void Publish() {
+    auto sequence = published_.load(std::memory_order_acquire);
+    Pin slot;
+    uint64_t pinned = kNoBase;
+    uint64_t prev_time = 0;
+    while (sequence < reserved_.load(std::memory_order_acquire)) {
+      // Slots evicted before being published are skipped
+      const auto head = head_.load(std::memory_order_acquire);
+      if (sequence < head) {
+        published_.compare_exchange_weak(sequence, head, std::memory_order_acq_rel);
+        continue;
+      }
+
+      if (sequence / kChunkSize != pinned) {
+        slot = Pin(this, sequence);
+        pinned = sequence / kChunkSize;
+        if (sequence > 0) {
+          const Pin prev(this, sequence - 1);
+          prev_time = prev ? prev->time[(sequence - 1) % kChunkSize].load(std::memory_order_relaxed) : 0;
+        }
+      }
+      const auto i = sequence % kChunkSize;
+      if (!slot || !slot->ready[i].load())
+        return;
+
+      // Clamp to the previous timestamp. Concurrent writers publishing the
+      // same slot compute and store the same value.
+      if (i != 0)
+        prev_time = slot->time[i - 1].load(std::memory_order_relaxed);
+      if (slot->time[i].load(std::memory_order_relaxed) < prev_time)
+        slot->time[i].store(prev_time, std::memory_order_relaxed);
+
+      if (published_.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acq_rel)) {
+        // Only the writer that published the last slot seals the chunk
+        if (i == kChunkSize - 1)
+          Seal(*slot);
+        ++sequence;
+      }
+    }
+  }
+
+  static void Seal(Chunk& chunk) {
+    size_t size = 0;
+    for (const auto& payload : chunk.payload)
+      size += payload.size();
+    chunk.joined.reserve(size);
+    for (const auto& payload : chunk.payload)
+      chunk.joined += payload;
+    chunk.sealed.store(true, std::memory_order_release);
+  }
+
+  const RetentionPolicy policy_;
+  const uint64_t ring_size_;
+  std::unique_ptr<std::atomic<Chunk*>[]> ring_;
+
+  std::atomic<uint64_t> reserved_{0};
+  std::atomic<uint64_t> published_{0};
+  std::atomic<uint64_t> head_{0};
+  std::atomic_flag trimming_ = ATOMIC_FLAG_INIT;
+
+  std::atomic<uint64_t> appended_bytes_{0};
+  std::atomic<uint64_t> evicted_messages_{0};
+  std::atomic<uint64_t> evicted_bytes_{0};
+
+  std::atomic<Chunk*> allocated_{nullptr};
+  std::atomic<uint64_t> allocated_chunks_{0};
+  std::mutex spare_m_;
+  std::vector<Chunk*> spare_;
+};
+
+} // namespace network
+
+#endif // SERVER_HISTORY_MESSAGE_LOG_H_
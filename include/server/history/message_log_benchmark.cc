@@ -0,0 +1,68 @@
+//
+// Soak benchmark for network::MessageLog: append throughput and resident
+// memory while the retention policy keeps evicting.
+//
+// usage: message_log_benchmark [messages] [writer_threads] [max_messages]
+//
+
+#include "server/history/message_log.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+long ResidentKiB() {
+  std::ifstream statm("/proc/self/statm");
+  long size = 0;
+  long resident = 0;
+  statm >> size >> resident;
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const long messages = argc > 1 ? atol(argv[1]) : 20'000'000;
+  const int writer_num = argc > 2 ? atoi(argv[2]) : 4;
+
+  network::RetentionPolicy policy;
+  policy.max_messages = argc > 3 ? atol(argv[3]) : 1'000'000;
+  network::MessageLog log(policy);
+
+  const std::string name = "이범석";
+  const std::string chat = "안녕하세요, 오늘 저녁에 뭐 먹을까요?";
+  const long per_writer = messages / writer_num;
+  constexpr int kRounds = 10;
+
+  std::cout << "messages\tM appends/s\tRSS MiB\tlive\tevicted\tchunks\n";
+  for (int round = 1; round <= kRounds; ++round) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writer_num; ++w) {
+      writers.emplace_back([&] {
+        for (long i = 0; i < per_writer / kRounds; ++i)
+          log.append(i, name, chat);
+      });
+    }
+    for (auto& t : writers)
+      t.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto appended = round * (per_writer / kRounds) * writer_num;
+    std::cout << appended << '\t'
+              << (per_writer / kRounds) * writer_num / elapsed.count() / 1e6 << "\t\t"
+              << ResidentKiB() / 1024 << '\t'
+              << log.size() << '\t'
+              << log.evicted_messages() << '\t'
+              << log.allocated_chunks() << '\n';
+  }
+
+  return EXIT_SUCCESS;
+}
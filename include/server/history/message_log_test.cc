@@ -0,0 +1,241 @@
+//
+// Tests for network::MessageLog.
+//
+
+#include "server/history/message_log.h"
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+struct Message {
+  uint64_t sequence;
+  uint64_t time;
+  std::string name;
+  std::string chat;
+};
+
+std::vector<Message> Collect(const network::MessageLog::Snapshot& snapshot) {
+  std::vector<Message> messages;
+  snapshot.for_each(0, [&messages](const network::MessageView& m) {
+    messages.push_back({m.sequence, m.time, std::string(m.name), std::string(m.chat)});
+  });
+  return messages;
+}
+
+int main() {
+  { // Range queries with duplicate timestamps
+    network::MessageLog log;
+    if (!log.snapshot().empty()) TEST_FAIL;
+    if (log.snapshot().lower_bound(0) != 0) TEST_FAIL;
+
+    log.append(10, "James", "Hi");
+    log.append(20, "Nana", "Hi to you too");
+    log.append(20, "Nana", "Same millisecond");
+    log.append(15, "Late", "Clock went backwards");
+    log.append(30, "James", "Bye");
+
+    const auto snapshot = log.snapshot();
+    if (snapshot.size() != 5) TEST_FAIL;
+    if (snapshot.lower_bound(0) != 0) TEST_FAIL;
+    if (snapshot.lower_bound(11) != 1) TEST_FAIL;
+    if (snapshot.lower_bound(20) != 1) TEST_FAIL;
+    if (snapshot.lower_bound(21) != 4) TEST_FAIL;
+    if (snapshot.lower_bound(31) != 5) TEST_FAIL;
+
+    const auto messages = Collect(snapshot);
+    if (messages[2].chat != "Same millisecond") TEST_FAIL;
+    if (messages[3].time != 20) TEST_FAIL;
+    if (messages[3].name != "Late") TEST_FAIL;
+
+    // Later appends are not visible to an older snapshot
+    log.append(40, "Nana", "Hello again");
+    if (snapshot.size() != 5) TEST_FAIL;
+    if (log.snapshot().size() != 6) TEST_FAIL;
+  }
+
+  { // Lookups across chunk boundaries
+    network::MessageLog log;
+    const uint64_t n = network::MessageLog::kChunkSize * 3 + 7;
+    for (uint64_t i = 0; i < n; ++i)
+      log.append(i / 2, "name", std::to_string(i));
+
+    const auto snapshot = log.snapshot();
+    for (uint64_t t = 0; t <= n / 2 + 1; ++t) {
+      if (snapshot.lower_bound(t) != std::min(t * 2, n)) TEST_FAIL;
+    }
+
+    uint64_t count = 0;
+    snapshot.for_each(snapshot.lower_bound(1000), [&](const network::MessageView& m) {
+      if (m.time < 1000) TEST_FAIL;
+      if (m.chat != std::to_string(m.sequence)) TEST_FAIL;
+      ++count;
+    });
+    if (count != n - 2000) TEST_FAIL;
+  }
+
+  { // Concurrent writers and readers
+    network::MessageLog log;
+    constexpr int kWriters = 4;
+    constexpr int kPerWriter = 20000;
+
+    std::atomic<bool> done{false};
+    std::thread reader([&] {
+      while (!done) {
+        const auto snapshot = log.snapshot();
+        uint64_t prev = 0;
+        snapshot.for_each(snapshot.size() > 100 ? snapshot.size() - 100 : 0, [&](const network::MessageView& m) {
+          if (m.time < prev) TEST_FAIL;
+          if (m.name.empty()) TEST_FAIL;
+          prev = m.time;
+        });
+      }
+    });
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < kWriters; ++w) {
+      writers.emplace_back([&log, w] {
+        for (int i = 0; i < kPerWriter; ++i)
+          log.append(i, "writer" + std::to_string(w), std::to_string(i));
+      });
+    }
+    for (auto& t : writers)
+      t.join();
+    done = true;
+    reader.join();
+
+    const auto snapshot = log.snapshot();
+    if (snapshot.size() != kWriters * kPerWriter) TEST_FAIL;
+
+    std::vector<int> counts(kWriters);
+    uint64_t prev = 0;
+    snapshot.for_each(0, [&](const network::MessageView& m) {
+      if (m.time < prev) TEST_FAIL;
+      prev = m.time;
+      ++counts[m.name.back() - '0'];
+    });
+    for (const auto count : counts) {
+      if (count != kPerWriter) TEST_FAIL;
+    }
+  }
+
+  { // Retention by message count
+    network::RetentionPolicy policy;
+    policy.max_messages = 3000;
+    network::MessageLog log(policy);
+    const uint64_t n = 10000;
+    for (uint64_t i = 0; i < n; ++i)
+      log.append(i, "name", std::to_string(i));
+
+    const auto snapshot = log.snapshot();
+    if (snapshot.size() != 3000) TEST_FAIL;
+    if (snapshot.begin() != n - 3000) TEST_FAIL;
+    if (log.evicted_messages() != n - 3000) TEST_FAIL;
+    if (snapshot.lower_bound(0) != n - 3000) TEST_FAIL;
+    if (snapshot.lower_bound(9000) != 9000) TEST_FAIL;
+
+    const auto messages = Collect(snapshot);
+    if (messages.size() != 3000) TEST_FAIL;
+    for (const auto& m : messages) {
+      if (m.chat != std::to_string(m.sequence)) TEST_FAIL;
+    }
+
+    // Chunks of a snapshot stay readable after they are evicted, and are
+    // skipped once reused
+    const auto old_snapshot = log.snapshot();
+    uint64_t seen = 0;
+    old_snapshot.for_each(old_snapshot.begin(), old_snapshot.begin() + 1, [&](const network::MessageView& m) {
+      for (uint64_t i = 0; i < 5000; ++i)
+        log.append(n + i, "name", "evicting");
+      if (m.chat != std::to_string(m.sequence)) TEST_FAIL;
+      ++seen;
+    });
+    if (seen != 1) TEST_FAIL;
+    if (!Collect(old_snapshot).empty()) TEST_FAIL;
+  }
+
+  { // Retention by byte budget
+    network::RetentionPolicy policy;
+    policy.max_bytes = 1000;
+    network::MessageLog log(policy);
+    for (int i = 0; i < 500; ++i)
+      log.append(i, "name", "0123456789");  // 14 bytes
+
+    if (log.live_bytes() > 1000) TEST_FAIL;
+    if (log.size() != 1000 / 14) TEST_FAIL;
+    if (log.evicted_messages() != 500 - 1000 / 14) TEST_FAIL;
+    if (log.evicted_bytes() != log.evicted_messages() * 14) TEST_FAIL;
+  }
+
+  { // Retention by age
+    network::RetentionPolicy policy;
+    policy.max_age = std::chrono::milliseconds(100);
+    network::MessageLog log(policy);
+    for (uint64_t t = 1000; t < 2000; t += 10)
+      log.append(t, "name", "chat");
+
+    // Messages at or after 1990 - 100 are kept
+    const auto snapshot = log.snapshot();
+    if (snapshot.size() != 11) TEST_FAIL;
+    if (Collect(snapshot).front().time != 1890) TEST_FAIL;
+
+    log.trim(2050);
+    if (log.size() != 5) TEST_FAIL;
+    log.trim(10000);
+    if (!log.snapshot().empty()) TEST_FAIL;
+    if (log.live_bytes() != 0) TEST_FAIL;
+  }
+
+  { // Memory stays flat under a sustained load with concurrent readers
+    network::RetentionPolicy policy;
+    policy.max_messages = 4 * network::MessageLog::kChunkSize;
+    network::MessageLog log(policy);
+    constexpr int kWriters = 4;
+    constexpr int kPerWriter = 100000;
+
+    std::atomic<bool> done{false};
+    std::thread reader([&] {
+      while (!done) {
+        const auto snapshot = log.snapshot();
+        uint64_t prev = 0;
+        snapshot.for_each(snapshot.lower_bound(0), [&](const network::MessageView& m) {
+          if (m.time < prev) TEST_FAIL;
+          if (m.name.empty()) TEST_FAIL;
+          prev = m.time;
+        });
+      }
+    });
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < kWriters; ++w) {
+      writers.emplace_back([&log, w] {
+        for (int i = 0; i < kPerWriter; ++i)
+          log.append(i, "writer" + std::to_string(w), std::to_string(i));
+      });
+    }
+    for (auto& t : writers)
+      t.join();
+    done = true;
+    reader.join();
+
+    if (log.size() > policy.max_messages) TEST_FAIL;
+    if (log.size() + log.evicted_messages() != kWriters * kPerWriter) TEST_FAIL;
+    // The ring, plus the chunks that were pinned by a writer or the reader
+    // when they were evicted
+    const auto ring_chunks = log.capacity() / network::MessageLog::kChunkSize;
+    if (log.allocated_chunks() > ring_chunks + 2 * kWriters + 2) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+//
+// Cache of serialized history range responses.
+//
+
+#ifndef SERVER_HISTORY_RESPONSE_CACHE_H_
+#define SERVER_HISTORY_RESPONSE_CACHE_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "server/protocol/config.h"
+
+namespace network {
+
+// Responses covering the messages [begin, end) of a MessageLog, keyed by
+// `begin`. Every from_time that resolves to the same first message shares an
+// entry. Appending a message moves the end of every later snapshot, so the
+// whole cache is dropped as soon as a newer end is seen.
+//
+// An entry holds up to kMaxVariants forms of the same response, compressed
+// ones for instance, each made once per end and found under its own variant.
+//
+// Not thread-safe; each event loop keeps its own.
+class ResponseCache {
+ public:
+  using value_type = std::shared_ptr<const std::string>;
+
+  enum : unsigned {
+    kMaxVariants = 4,
+  };
+
+  explicit ResponseCache(size_t max_bytes = 64 << 20) : max_bytes_(max_bytes) {}
+
+  // The cached response for [begin, end), or null.
+  NETWORK_NODISCARD value_type find(uint64_t begin, uint64_t end, unsigned variant = 0) {
+    NETWORK_ASSERT(variant < kMaxVariants, "Invalid variant");
+    if (end != end_) {
+      ++misses_;
+      return nullptr;
+    }
+    const auto it = entries_.find(begin);
+    if (it == entries_.end() || !it->second[variant]) {
+      ++misses_;
+      return nullptr;
+    }
+    ++hits_;
+    return it->second[variant];
+  }
+
+  // Responses that do not fit in the byte budget are not kept.
+  void insert(uint64_t begin, uint64_t end, value_type value, unsigned variant = 0) {
+    NETWORK_ASSERT(variant < kMaxVariants, "Invalid variant");
+    if (end < end_)
+      return;
+    if (end > end_) {
+      entries_.clear();
+      bytes_ = 0;
+      end_ = end;
+    }
+    const auto it = entries_.find(begin);
+    size_t replaced = 0;
+    if (it != entries_.end() && it->second[variant])
+      replaced = it->second[variant]->size();
+    if (bytes_ - replaced + value->size() > max_bytes_)
+      return;
+    bytes_ += value->size() - replaced;
+    entries_[begin][variant] = std::move(value);
+  }
+
+  NETWORK_NODISCARD uint64_t hits() const { return hits_; }
+  NETWORK_NODISCARD uint64_t misses() const { return misses_; }
+  NETWORK_NODISCARD size_t size() const { return entries_.size(); }
+
+ private:
+  const size_t max_bytes_;
+  uint64_t end_ = 0;
+  size_t bytes_ = 0;
+  std::unordered_map<uint64_t, std::array<value_type, kMaxVariants>> entries_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+} // namespace network
+
+#endif // SERVER_HISTORY_RESPONSE_CACHE_H_
@@ -0,0 +1,89 @@
+//
+// History response benchmark: per-request JSON concatenation vs. payload
+// slices serialized at insert time vs. a ResponseCache hit.
+//
+// usage: response_cache_benchmark [history_size] [iterations]
+//
+
+#include "server/history/message_log.h"
+#include "server/history/response_cache.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+template<typename F>
+double MicrosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile size_t sink;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const uint64_t history_size = argc > 1 ? atol(argv[1]) : 100'000;
+  const int iterations = argc > 2 ? atoi(argv[2]) : 100;
+
+  network::MessageLog log;
+  const std::string name = "이범석";
+  const std::string chat = "안녕하세요, 오늘 저녁에 뭐 먹을까요?";
+  const auto fragment = ",{\"name\":\"" + name + "\",\"chatKey\":\"" + chat + "\"}";
+  for (uint64_t i = 0; i < history_size; ++i)
+    log.append(i, name, chat, fragment);
+
+  std::cout << "window\t\tconcat us\tslices us\tcache hit us\n";
+  for (const auto window : {uint64_t{10}, uint64_t{1000}, history_size}) {
+    const auto snapshot = log.snapshot();
+    const auto begin = snapshot.lower_bound(history_size - window);
+
+    // Every message re-encoded on every request
+    const auto concat_us = MicrosecondsPerCall(iterations, [&] {
+      std::string res = "[";
+      snapshot.for_each(begin, [&res](const network::MessageView& message) {
+        if (res.size() > 1)
+          res += ',';
+        res += "{\"name\":\"";
+        res += message.name;
+        res += "\",\"chatKey\":\"";
+        res += message.chat;
+        res += "\"}";
+      });
+      res += "]";
+      sink = res.size();
+    });
+
+    const auto make_body = [&] {
+      std::string res = "[";
+      bool first = true;
+      snapshot.for_each_payload(begin, snapshot.end(), [&](std::string_view slice) {
+        if (first && !slice.empty()) {
+          slice.remove_prefix(1);
+          first = false;
+        }
+        res += slice;
+      });
+      res += "]";
+      return res;
+    };
+    const auto slices_us = MicrosecondsPerCall(iterations, [&] { sink = make_body().size(); });
+
+    network::ResponseCache cache(1 << 30);
+    cache.insert(begin, snapshot.end(), std::make_shared<const std::string>(make_body()));
+    const auto hit_us = MicrosecondsPerCall(iterations * 100, [&] {
+      const auto current = log.snapshot();
+      sink = cache.find(current.lower_bound(history_size - window), current.end())->size();
+    });
+
+    std::cout << window << "\t\t" << concat_us << "\t\t" << slices_us << "\t\t" << hit_us << '\n';
+  }
+
+  return EXIT_SUCCESS;
+}
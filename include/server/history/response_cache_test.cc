@@ -0,0 +1,91 @@
+//
+// Tests for network::ResponseCache and the payload slices of network::MessageLog.
+//
+
+#include "server/history/message_log.h"
+#include "server/history/response_cache.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int main() {
+  { // Entries are shared until a newer end is seen
+    network::ResponseCache cache(100);
+    if (cache.find(0, 10)) TEST_FAIL;
+
+    const auto value = std::make_shared<const std::string>("[1,2,3]");
+    cache.insert(0, 10, value);
+    if (cache.find(0, 10) != value) TEST_FAIL;
+    if (cache.find(1, 10)) TEST_FAIL;
+    if (cache.find(0, 11)) TEST_FAIL;
+    if (cache.hits() != 1 || cache.misses() != 3) TEST_FAIL;
+
+    // An older response does not replace newer ones
+    cache.insert(1, 9, value);
+    if (cache.find(1, 9) || cache.size() != 1) TEST_FAIL;
+
+    cache.insert(1, 11, value);
+    if (cache.find(0, 10) || cache.size() != 1) TEST_FAIL;
+    if (cache.find(1, 11) != value) TEST_FAIL;
+
+    // Over the byte budget
+    cache.insert(2, 11, std::make_shared<const std::string>(100, 'x'));
+    if (cache.find(2, 11)) TEST_FAIL;
+    cache.insert(1, 11, std::make_shared<const std::string>(90, 'x'));
+    if (cache.find(1, 11)->size() != 90) TEST_FAIL;
+  }
+
+  { // Variants of an entry are found apart, share its budget and go with it
+    network::ResponseCache cache(100);
+    const auto plain = std::make_shared<const std::string>(60, 'p');
+    const auto compressed = std::make_shared<const std::string>(30, 'c');
+    cache.insert(0, 10, plain);
+    if (cache.find(0, 10, 1)) TEST_FAIL;
+    cache.insert(0, 10, compressed, 1);
+    if (cache.find(0, 10) != plain || cache.find(0, 10, 1) != compressed) TEST_FAIL;
+    if (cache.size() != 1) TEST_FAIL;
+    cache.insert(0, 10, std::make_shared<const std::string>(20, 'd'), 2);
+    if (cache.find(0, 10, 2)) TEST_FAIL;
+    cache.insert(0, 11, compressed, 1);
+    if (cache.find(0, 11) || cache.find(0, 11, 1) != compressed) TEST_FAIL;
+  }
+
+  { // Payload slices cover every message once, whole chunks in one slice
+    network::MessageLog log;
+    const uint64_t n = network::MessageLog::kChunkSize * 2 + 10;
+    std::string expected;
+    for (uint64_t i = 0; i < n; ++i) {
+      const auto payload = ',' + std::to_string(i);
+      log.append(i, "name", "chat", payload);
+      if (i >= 5)
+        expected += payload;
+    }
+
+    const auto snapshot = log.snapshot();
+    std::string joined;
+    int slices = 0;
+    snapshot.for_each_payload(5, snapshot.end(), [&](std::string_view slice) {
+      joined += slice;
+      ++slices;
+    });
+    if (joined != expected) TEST_FAIL;
+    // A partial first chunk, one sealed chunk, and a partial last chunk
+    if (slices != (network::MessageLog::kChunkSize - 5) + 1 + 10) TEST_FAIL;
+
+    joined.clear();
+    snapshot.for_each_payload(0, 3, [&](std::string_view slice) { joined += slice; });
+    if (joined != ",0,1,2") TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
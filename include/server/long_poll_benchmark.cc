@@ -0,0 +1,170 @@
+//
+// Long-poll fan-out: N connections parked across the loops, one publish, and
+// the time until every waiter has its reply. The same shared payload goes to
+// every connection. For comparison, the request rate short polling needs to
+// match the mean delivery latency (polling every 2x the mean latency).
+//
+// usage: long_poll_benchmark [loops] [rounds]
+//
+
+#include "server/socket.h"
+#include "server/event_loop.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+int LocalPort(int fd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+int Connect(int port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Published by the benchmark, read by the loops after a wake
+std::shared_ptr<const std::string> payload;
+std::atomic<uint64_t> version{0};
+
+struct Waiter {
+  uint64_t version = 0;
+};
+
+struct Stats {
+  double mean_ms;
+  double last_ms;
+};
+
+Stats Round(std::vector<std::unique_ptr<network::EventLoop>>& loops, const std::vector<int>& clients) {
+  for (const int fd : clients) {
+    if (write(fd, "w", 1) != 1)
+      return {};
+  }
+  const auto parked = [&loops] {
+    size_t count = 0;
+    for (auto& loop : loops)
+      count += loop->parked_count();
+    return count;
+  };
+  while (parked() != clients.size())
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  std::atomic_store(&payload, std::make_shared<const std::string>(256, 'p'));
+  const auto start = clock_type::now();
+  version.fetch_add(1);
+  for (auto& loop : loops)
+    loop->Wake();
+
+  // Replies are collected with one epoll set over every client
+  const int epoll_fd = epoll_create1(0);
+  for (const int fd : clients) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+  double total_ms = 0, last_ms = 0;
+  size_t received = 0;
+  std::vector<epoll_event> events(256);
+  char buf[512];
+  while (received < clients.size()) {
+    const int n = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 1000);
+    if (n <= 0)
+      break;
+    const std::chrono::duration<double, std::milli> elapsed = clock_type::now() - start;
+    for (int i = 0; i < n; ++i) {
+      size_t got = 0;
+      ssize_t r;
+      while (got < 256 && (r = read(events[i].data.fd, buf, sizeof(buf))) > 0)
+        got += r;
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, events[i].data.fd, nullptr);
+      total_ms += elapsed.count();
+      last_ms = elapsed.count();
+      ++received;
+    }
+  }
+  close(epoll_fd);
+  return {total_ms / clients.size(), last_ms};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const unsigned loop_count = argc > 1 ? atoi(argv[1]) : 2;
+  const int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+  const int listen_fd = sock_init_reuseport(0);
+  std::vector<std::unique_ptr<network::EventLoop>> loops;
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < loop_count; ++i) {
+    loops.emplace_back(std::make_unique<network::EventLoop>());
+    loops.back()->AddListener(listen_fd, [](network::Connection& conn) {
+      conn.context<Waiter>().version = version.load();
+      conn.input().clear();
+      conn.park(clock_type::now() + std::chrono::seconds(30));
+    }, [](network::Connection& conn, bool timed_out) {
+      if (!timed_out && conn.context<Waiter>().version == version.load()) {
+        conn.park(conn.park_deadline());
+        return;
+      }
+      conn.send(std::atomic_load(&payload));
+    });
+  }
+  for (auto& loop : loops)
+    threads.emplace_back([&loop] { loop->Run(); });
+
+  std::cout << loop_count << " loops, mean of " << rounds << " rounds\n";
+  std::cout << "waiters\tmean delivery ms\tlast delivery ms\tshort-poll req/s for the same mean\n";
+  for (const size_t waiters : {size_t{10}, size_t{100}, size_t{1000}, size_t{5000}}) {
+    std::vector<int> clients;
+    for (size_t i = 0; i < waiters; ++i)
+      clients.emplace_back(Connect(LocalPort(listen_fd)));
+
+    Stats sum{0, 0};
+    for (int r = 0; r < rounds; ++r) {
+      const auto stats = Round(loops, clients);
+      sum.mean_ms += stats.mean_ms / rounds;
+      sum.last_ms += stats.last_ms / rounds;
+    }
+    // Polling every 2 * mean gives the same mean latency
+    const auto poll_rate = waiters / (2 * sum.mean_ms / 1000);
+    std::cout << waiters << '\t' << sum.mean_ms << "\t\t\t" << sum.last_ms << "\t\t\t"
+              << static_cast<uint64_t>(poll_rate) << '\n';
+
+    for (const int fd : clients)
+      close(fd);
+    for (auto& loop : loops) {
+      while (loop->parked_count() != 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  for (auto& loop : loops)
+    loop->Stop();
+  for (auto& t : threads)
+    t.join();
+  close(listen_fd);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+//
+// Monotonic arena for short-lived, per-request objects.
+//
+
+#ifndef SERVER_NETWORK_ARENA_H_
+#define SERVER_NETWORK_ARENA_H_
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "server/protocol/config.h"
+
+namespace network {
+
+// Memory resource over an inline buffer of `Size` bytes. Allocation is a
+// pointer bump, deallocation is a no-op, and reset() releases everything at
+// once. Once the inline buffer is exhausted, further blocks come from the
+// upstream resource and are freed by reset().
+//
+// Objects allocated from the arena must be destroyed before reset() is called.
+template<size_t Size>
+class BasicArena {
+ public:
+  explicit BasicArena(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+    : resource_(buffer_, Size, upstream) {}
+
+  BasicArena(const BasicArena&) = delete;
+  BasicArena& operator=(const BasicArena&) = delete;
+
+  NETWORK_NODISCARD std::pmr::memory_resource* resource() { return &resource_; }
+
+  void reset() { resource_.release(); }
+
+ private:
+  alignas(std::max_align_t) std::byte buffer_[Size];
+  std::pmr::monotonic_buffer_resource resource_;
+};
+
+using Arena = BasicArena<4096>;
+
+} // namespace network
+
+#endif // SERVER_NETWORK_ARENA_H_
@@ -0,0 +1,145 @@
+//
+// Per-request protocol object benchmark: heap-backed vs. arena-backed
+// HTTPProtocol, counting heap allocations through a replaced operator new.
+//
+// usage: arena_benchmark [iterations]
+//
+
+#include "server/protocol/arena.h"
+#include "server/protocol/http_protocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory_resource>
+#include <new>
+#include <string>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+const std::string request =
+    "GET /chat/history HTTP/1.1\r\n"
+    "Host: 3.37.112.35:8085\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 Chrome/118.0\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Accept-Language: ko-KR,ko;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+    "from_time: 1667768091000\r\n"
+    "\r\n";
+
+// Fills the protocol object like the server does for a response header
+void FillResponse(network::HTTPProtocol& protocol) {
+  protocol.response(200, "OK");
+  protocol.add_header("Server", "Apache");
+  protocol.add_header("Content-Length", 1234);
+  protocol.add_header("Connection", "keep-alive");
+  protocol.add_header("Keep-Alive", "timeout=30");
+}
+
+// new_delete_resource() allocates inside libstdc++ without going through the
+// replaced operator new, so default-resource allocations are counted here
+class CountingResource : public std::pmr::memory_resource {
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+struct Result {
+  double ns;
+  double allocations;
+};
+
+template<typename F>
+Result Measure(int iterations, F&& f) {
+  const auto allocations_before = allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return {elapsed.count() / iterations, static_cast<double>(allocations.load() - allocations_before) / iterations};
+}
+
+volatile size_t sink;
+
+} // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 500'000;
+
+  CountingResource counting;
+  std::pmr::set_default_resource(&counting);
+
+  const auto print = [](const char* name, Result heap, Result arena) {
+    std::cout << name << "\t" << heap.ns << "\t\t" << heap.allocations << "\t\t"
+              << arena.ns << "\t\t" << arena.allocations << '\n';
+  };
+
+  std::cout << "work\t\theap ns\t\theap allocs\tarena ns\tarena allocs\n";
+
+  print("response",
+        Measure(iterations, [] {
+          network::HTTPProtocol protocol;
+          FillResponse(protocol);
+          sink = protocol.header().size();
+        }),
+        Measure(iterations, [] {
+          network::Arena arena;
+          network::HTTPProtocol protocol(arena.resource());
+          FillResponse(protocol);
+          sink = protocol.header().size();
+        }));
+
+  // A whole small reply serialized into a reused buffer, as the server does
+  std::string out;
+  print("reply\t",
+        Measure(iterations, [&out] {
+          network::HTTPProtocol protocol;
+          FillResponse(protocol);
+          out.clear();
+          protocol.build_to(out);
+          sink = out.size();
+        }),
+        Measure(iterations, [&out] {
+          network::Arena arena;
+          network::HTTPProtocol protocol(arena.resource());
+          FillResponse(protocol);
+          out.clear();
+          protocol.build_to(out);
+          sink = out.size();
+        }));
+
+  print("parse\t",
+        Measure(iterations, [] {
+          network::HTTPProtocol protocol;
+          protocol.parse(request);
+          sink = protocol.header().size();
+        }),
+        Measure(iterations, [] {
+          network::Arena arena;
+          network::HTTPProtocol protocol(arena.resource());
+          protocol.parse(request);
+          sink = protocol.header().size();
+        }));
+
+  return EXIT_SUCCESS;
+}
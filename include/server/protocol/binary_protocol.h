@@ -0,0 +1,245 @@
+//
+// Length-prefixed binary framing for native clients.
+//
+// Every frame starts with a 12-byte header:
+//
+//   u32 size      whole frame, header included
+//   u32 sequence  chosen by the client, echoed in the reply
+//   u8  type      FrameType
+//   u8  reserved[3], zero
+//
+// followed by size - 12 bytes of payload. Integers are little-endian.
+//
+//   kPost          u32 name size, name, chat (the rest of the payload)
+//   kHistory       u64 from_time, optionally u32 wait_ms: with nothing newer
+//                  than from_time, the reply is held until a message is
+//                  posted or wait_ms passes
+//   kPostOk        empty
+//   kHistoryReply  u32 count, then per message:
+//                  u64 time, u32 name size, u32 chat size, name, chat
+//   kHistoryPart   as kHistoryReply. A history too large for one frame comes
+//                  as kHistoryPart frames and a last kHistoryReply, each with
+//                  at most kMaxHistoryPayload bytes of payload
+//   kError         message text
+//
+
+#ifndef SERVER_NETWORK_BINARY_PROTOCOL_H_
+#define SERVER_NETWORK_BINARY_PROTOCOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include "server/protocol/byte_order.h"
+#include "server/protocol/config.h"
+#include "server/protocol/protocol.h"
+
+namespace network {
+
+enum class FrameType : uint8_t {
+  kPost = 0x01,
+  kHistory = 0x02,
+  kPostOk = 0x81,
+  kHistoryReply = 0x82,
+  kHistoryPart = 0x83,
+  kError = 0xFF,
+};
+
+class FramePacket : public BinaryPacket {
+ public:
+  using base = BinaryPacket;
+  using base::operator<<;
+
+  enum {
+    kSizeOffset = 0,
+    kSequenceOffset = kSizeOffset + sizeof(uint32_t),
+    kTypeOffset = kSequenceOffset + sizeof(uint32_t),
+    kHeaderSize = kTypeOffset + 4,
+  };
+
+  // Writes the header of a frame carrying `payload_size` bytes. The buffer
+  // holds the header and the first `buffered_size` bytes of the payload, which
+  // the caller writes next; the rest may be sent from elsewhere.
+  FramePacket(FrameType type, uint32_t sequence, size_t payload_size, size_t buffered_size)
+    : base(kHeaderSize + buffered_size)
+  {
+    NETWORK_ASSERT(buffered_size <= payload_size, "Buffered payload is larger than the frame");
+    NETWORK_ASSERT(payload_size <= UINT32_MAX - kHeaderSize, "Frame size does not fit its header");
+    (*this) << static_cast<uint32_t>(kHeaderSize + payload_size) << sequence << static_cast<uint8_t>(type)
+            << uint8_t{0} << uint8_t{0} << uint8_t{0};
+  }
+
+  FramePacket(FrameType type, uint32_t sequence, size_t payload_size)
+    : FramePacket(type, sequence, payload_size, payload_size) {}
+
+  NETWORK_NODISCARD uint32_t frame_size() const { return get<uint32_t>(kSizeOffset); }
+  NETWORK_NODISCARD uint32_t sequence() const { return get<uint32_t>(kSequenceOffset); }
+  NETWORK_NODISCARD FrameType type() const { return static_cast<FrameType>(get<uint8_t>(kTypeOffset)); }
+};
+
+// Size of one message in a kHistoryReply payload
+constexpr size_t HistoryEntrySize(size_t name_size, size_t chat_size) {
+  return sizeof(uint64_t) + 2 * sizeof(uint32_t) + name_size + chat_size;
+}
+
+inline void WriteHistoryEntry(BinaryPacket& packet, uint64_t time, std::string_view name, std::string_view chat) {
+  packet << time << static_cast<uint32_t>(name.size()) << static_cast<uint32_t>(chat.size()) << name << chat;
+}
+
+inline FramePacket MakePostFrame(uint32_t sequence, std::string_view name, std::string_view chat) {
+  FramePacket frame(FrameType::kPost, sequence, sizeof(uint32_t) + name.size() + chat.size());
+  frame << static_cast<uint32_t>(name.size()) << name << chat;
+  return frame;
+}
+
+inline FramePacket MakeHistoryFrame(uint32_t sequence, uint64_t from_time, uint32_t wait_ms = 0) {
+  FramePacket frame(FrameType::kHistory, sequence, sizeof(uint64_t) + (wait_ms != 0 ? sizeof(uint32_t) : 0));
+  frame << from_time;
+  if (wait_ms != 0)
+    frame << wait_ms;
+  return frame;
+}
+
+inline FramePacket MakeFrame(FrameType type, uint32_t sequence, std::string_view payload = {}) {
+  FramePacket frame(type, sequence, payload.size());
+  frame << payload;
+  return frame;
+}
+
+// Reads the fields of a payload in order. A read past the end fails and
+// leaves the output untouched.
+class FrameReader {
+ public:
+  explicit FrameReader(std::string_view data) : data_(data) {}
+
+  template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+  bool read(T& value) {
+    if (data_.size() < sizeof(T))
+      return false;
+    value = LoadLittleEndian<T>(data_.data());
+    data_.remove_prefix(sizeof(T));
+    return true;
+  }
+
+  template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+  bool read(T* values, size_t count) {
+    if (data_.size() / sizeof(T) < count)
+      return false;
+    LoadLittleEndian(data_.data(), values, count);
+    data_.remove_prefix(count * sizeof(T));
+    return true;
+  }
+
+  bool read_varint(uint64_t& value) {
+    const auto end = DecodeVarint(data_.data(), data_.data() + data_.size(), value);
+    if (!end)
+      return false;
+    data_.remove_prefix(end - data_.data());
+    return true;
+  }
+
+  bool read_signed_varint(int64_t& value) {
+    uint64_t zigzag;
+    if (!read_varint(zigzag))
+      return false;
+    value = ZigZagDecode(zigzag);
+    return true;
+  }
+
+  bool read(size_t size, std::string_view& bytes) {
+    if (data_.size() < size)
+      return false;
+    bytes = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return true;
+  }
+
+  // Everything not read yet
+  NETWORK_NODISCARD std::string_view rest() const { return data_; }
+  NETWORK_NODISCARD bool empty() const { return data_.empty(); }
+
+ private:
+  std::string_view data_;
+};
+
+// Incremental frame decoder. Feed it everything received so far: parse()
+// returns kNeedMore until a whole frame is available, so a frame may arrive
+// in any number of reads. The payload points into the given buffer.
+//
+//   while (decoder.parse(buf) == FrameDecoder::kComplete) {
+//     handle(decoder.type(), decoder.payload());
+//     buf.remove_prefix(decoder.size());
+//   }
+class FrameDecoder {
+ public:
+  enum Result {
+    kNeedMore,
+    kComplete,
+    kError,
+  };
+
+  enum {
+    kHeaderSize = FramePacket::kHeaderSize,
+    // Larger frames are refused rather than buffered
+    kDefaultMaxFrameSize = 1 << 20,
+  };
+
+  explicit FrameDecoder(size_t max_frame_size = kDefaultMaxFrameSize) : max_frame_size_(max_frame_size) {}
+
+  Result parse(std::string_view data) {
+    if (data.size() < kHeaderSize)
+      return kNeedMore;
+
+    FrameReader header(data);
+    uint8_t type, reserved[3];
+    header.read(size_);
+    header.read(sequence_);
+    header.read(type);
+    header.read(reserved[0]);
+    header.read(reserved[1]);
+    header.read(reserved[2]);
+    type_ = static_cast<FrameType>(type);
+
+    if (size_ < kHeaderSize)
+      return Fail("Frame shorter than its header");
+    if (size_ > max_frame_size_)
+      return Fail("Frame too large");
+    if (reserved[0] != 0 || reserved[1] != 0 || reserved[2] != 0)
+      return Fail("Reserved header bytes are not zero");
+    if (data.size() < size_)
+      return kNeedMore;
+
+    payload_ = data.substr(kHeaderSize, size_ - kHeaderSize);
+    return kComplete;
+  }
+
+  // Bytes of the last complete frame, header included
+  NETWORK_NODISCARD size_t size() const { return size_; }
+  NETWORK_NODISCARD uint32_t sequence() const { return sequence_; }
+  NETWORK_NODISCARD FrameType type() const { return type_; }
+  NETWORK_NODISCARD std::string_view payload() const { return payload_; }
+  NETWORK_NODISCARD std::string_view error() const { return error_; }
+
+ private:
+  Result Fail(const char* message) {
+    error_ = message;
+    return kError;
+  }
+
+  size_t max_frame_size_;
+  uint32_t size_ = 0;
+  uint32_t sequence_ = 0;
+  FrameType type_ = FrameType::kError;
+  std::string_view payload_;
+  const char* error_ = "";
+};
+
+// Largest payload of a history reply frame, so that every frame of a reply
+// passes a FrameDecoder with the default limit
+constexpr size_t kMaxHistoryPayload = FrameDecoder::kDefaultMaxFrameSize - FrameDecoder::kHeaderSize;
+
+} // namespace network
+
+#endif // SERVER_NETWORK_BINARY_PROTOCOL_H_
@@ -0,0 +1,253 @@
+//
+// Request throughput over loopback: the HTTP/JSON path vs. binary frames, for
+// posts and for history requests. Both listeners run on one event loop with
+// handlers that do what the server's do, minus logging and the response
+// cache, so every history reply is encoded. Clients pipeline requests on one
+// connection.
+//
+// usage: binary_protocol_benchmark [seconds_per_run] [pipeline_depth] [history_messages]
+//
+
+#include "server/socket.h"
+#include "server/event_loop.h"
+#include "server/history/message_log.h"
+#include "server/protocol/arena.h"
+#include "server/protocol/binary_protocol.h"
+#include "server/protocol/http_parser.h"
+#include "server/protocol/http_protocol.h"
+
+#include "json/json.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+network::MessageLog history;
+std::atomic<uint64_t> clock_ms{1};
+
+void Append(std::string_view name, std::string_view chat) {
+  std::string fragment = ",{\"name\":\"";
+  fragment.append(name).append("\",\"chatKey\":\"").append(chat).append("\"}");
+  history.append(clock_ms++, name, chat, fragment);
+}
+
+void AppendHttpResponse(std::string& out, size_t content_length) {
+  network::Arena arena;
+  network::HTTPProtocol protocol(arena.resource());
+  protocol.response(200, "OK");
+  protocol.add_header("Server", "Apache");
+  protocol.add_header("Content-Length", content_length);
+  protocol.add_header("Connection", "keep-alive");
+  protocol.add_header("Keep-Alive", "timeout=30");
+  protocol.build_to(out);
+}
+
+void HandleHttp(network::Connection& conn) {
+  auto& parser = conn.context<network::HTTPRequestParser>();
+  auto& buf = conn.input();
+  thread_local std::string response;
+
+  size_t consumed = 0;
+  while (parser.parse(buf.view().substr(consumed)) == network::HTTPRequestParser::kComplete) {
+    response.clear();
+    if (parser.method() == "POST") {
+      const auto content = parser.content();
+      Json::Value root;
+      thread_local const std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+      reader->parse(content.data(), content.data() + content.size(), &root, nullptr);
+      Append(root["name"].asString(), root["chat"].asString());
+      AppendHttpResponse(response, 0);
+    } else {
+      const auto from_time = parser.find(network::KnownHeader::kFromTime);
+      const auto snapshot = history.snapshot();
+      std::string body = "[";
+      bool first = true;
+      snapshot.for_each_payload(snapshot.lower_bound(std::stoull(std::string(*from_time))), snapshot.end(),
+                                [&](std::string_view slice) {
+        if (first && !slice.empty()) {
+          slice.remove_prefix(1);
+          first = false;
+        }
+        body += slice;
+      });
+      body += "]";
+      AppendHttpResponse(response, body.size());
+      response += body;
+    }
+    conn.send(std::string_view(response));
+    consumed += parser.size();
+    parser.reset();
+  }
+  buf.consume(consumed);
+}
+
+void HandleBinary(network::Connection& conn) {
+  auto& decoder = conn.context<network::FrameDecoder>();
+  auto& buf = conn.input();
+
+  size_t consumed = 0;
+  while (decoder.parse(buf.view().substr(consumed)) == network::FrameDecoder::kComplete) {
+    network::FrameReader payload(decoder.payload());
+    if (decoder.type() == network::FrameType::kPost) {
+      uint32_t name_size = 0;
+      std::string_view name;
+      payload.read(name_size);
+      payload.read(name_size, name);
+      Append(name, payload.rest());
+      conn.send(network::FramePacket(network::FrameType::kPostOk, decoder.sequence(), 0).string_view());
+    } else {
+      uint64_t from_time = 0;
+      payload.read(from_time);
+      const auto snapshot = history.snapshot();
+      const auto begin = snapshot.lower_bound(from_time);
+      size_t size = sizeof(uint32_t);
+      uint32_t count = 0;
+      snapshot.for_each(begin, [&](const network::MessageView& message) {
+        size += network::HistoryEntrySize(message.name.size(), message.chat.size());
+        ++count;
+      });
+      network::FramePacket reply(network::FrameType::kHistoryReply, decoder.sequence(), size);
+      reply << count;
+      snapshot.for_each(begin, [&reply](const network::MessageView& message) {
+        network::WriteHistoryEntry(reply, message.time, message.name, message.chat);
+      });
+      conn.send(reply.release());
+    }
+    consumed += decoder.size();
+  }
+  buf.consume(consumed);
+}
+
+int LocalPort(int fd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+int Connect(int port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool ReadExactly(int fd, std::string& buf, size_t size) {
+  buf.resize(size);
+  for (size_t offset = 0; offset < size;) {
+    const auto n = read(fd, buf.data() + offset, size - offset);
+    if (n <= 0)
+      return false;
+    offset += n;
+  }
+  return true;
+}
+
+struct Result {
+  double requests_per_second;
+  double request_bytes;
+  double reply_bytes;
+};
+
+// Sends `request` `depth` times back to back and waits for every reply, until
+// `seconds` have passed. Replies to the same request have the same size.
+Result Run(int port, const std::string& request, unsigned depth, double seconds) {
+  const int fd = Connect(port);
+  std::string reply;
+  if (write(fd, request.data(), request.size()) != static_cast<ssize_t>(request.size()))
+    return {};
+  // The size of one reply, read without knowing the protocol: wait for the
+  // server and take what arrived
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  reply.resize(1 << 22);
+  const auto reply_size = read(fd, reply.data(), reply.size());
+  if (reply_size <= 0)
+    return {};
+
+  std::string batch;
+  for (unsigned i = 0; i < depth; ++i)
+    batch += request;
+
+  uint64_t requests = 0;
+  const auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed{};
+  while (elapsed.count() < seconds) {
+    if (write(fd, batch.data(), batch.size()) != static_cast<ssize_t>(batch.size()))
+      return {};
+    if (!ReadExactly(fd, reply, reply_size * depth))
+      return {};
+    requests += depth;
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+  close(fd);
+  return {requests / elapsed.count(), static_cast<double>(request.size()), static_cast<double>(reply_size)};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  const unsigned depth = argc > 2 ? atoi(argv[2]) : 32;
+  const unsigned history_messages = argc > 3 ? atoi(argv[3]) : 20;
+
+  const int http_fd = sock_init_reuseport(0);
+  const int binary_fd = sock_init_reuseport(0);
+  network::EventLoop loop(http_fd, HandleHttp);
+  loop.AddListener(binary_fd, HandleBinary);
+  std::thread server([&loop] { loop.Run(); });
+
+  for (unsigned i = 0; i < history_messages; ++i)
+    Append("이민호", "안녕하세요, 반갑습니다");
+
+  const std::string json = "{\"name\": \"이민호\", \"chat\": \"안녕하세요\"}";
+  const std::string http_post =
+      "POST /chat HTTP/1.1\r\n"
+      "Host: 3.37.112.35:8085\r\n"
+      "Content-Type: application/json\r\n"
+      "Content-Length: " + std::to_string(json.size()) + "\r\n"
+      "\r\n" + json;
+  const std::string http_history =
+      "GET /chat HTTP/1.1\r\n"
+      "Host: 3.37.112.35:8085\r\n"
+      "from_time: 1\r\n"
+      "\r\n";
+  const std::string binary_post(network::MakePostFrame(1, "이민호", "안녕하세요").string_view());
+  const std::string binary_history(network::MakeHistoryFrame(1, 1).string_view());
+
+  const auto print = [](const char* name, Result http, Result binary) {
+    std::cout << name << '\t' << static_cast<uint64_t>(http.requests_per_second) << "\t\t"
+              << static_cast<uint64_t>(binary.requests_per_second) << "\t\t"
+              << binary.requests_per_second / http.requests_per_second << "x\t"
+              << http.request_bytes << '/' << http.reply_bytes << "\t\t"
+              << binary.request_bytes << '/' << binary.reply_bytes << '\n';
+  };
+
+  std::cout << "pipeline depth " << depth << ", " << history_messages << " messages per history reply\n";
+  std::cout << "request\tHTTP req/s\tbinary req/s\tspeedup\tHTTP bytes in/out\tbinary bytes in/out\n";
+  // History first, so its window does not grow with the posts
+  const auto http_history_result = Run(LocalPort(http_fd), http_history, depth, seconds);
+  const auto binary_history_result = Run(LocalPort(binary_fd), binary_history, depth, seconds);
+  print("history", http_history_result, binary_history_result);
+  const auto http_post_result = Run(LocalPort(http_fd), http_post, depth, seconds);
+  const auto binary_post_result = Run(LocalPort(binary_fd), binary_post, depth, seconds);
+  print("post", http_post_result, binary_post_result);
+
+  loop.Stop();
+  server.join();
+  close(http_fd);
+  close(binary_fd);
+
+  return EXIT_SUCCESS;
+}
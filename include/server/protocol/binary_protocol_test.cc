@@ -0,0 +1,150 @@
+//
+// Tests for the binary frame encoder and network::FrameDecoder.
+//
+
+#include "server/protocol/binary_protocol.h"
+
+#include <iostream>
+#include <string>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int main() {
+  { // Fields are written one after another, not over each other
+    network::BinaryPacket packet(1 + 4 + 8 + 3);
+    packet << uint8_t{7} << uint32_t{0x01020304} << uint64_t{1667768091000} << std::string_view("abc");
+    if (packet.used_size() != packet.size()) TEST_FAIL;
+    if (packet.get<uint8_t>(0) != 7) TEST_FAIL;
+    // Unaligned offsets
+    if (packet.get<uint32_t>(1) != 0x01020304) TEST_FAIL;
+    if (packet.get<uint64_t>(5) != 1667768091000) TEST_FAIL;
+    if (packet.string_view().substr(13) != "abc") TEST_FAIL;
+
+    packet.put<uint32_t>(1, 42);
+    if (packet.get<uint32_t>(1) != 42 || packet.get<uint64_t>(5) != 1667768091000) TEST_FAIL;
+
+    const auto released = packet.release();
+    if (released.size() != 16 || packet.used_size() != 0) TEST_FAIL;
+  }
+
+  { // Header layout
+    const auto frame = network::MakePostFrame(9, "James", "Hi");
+    if (frame.frame_size() != network::FramePacket::kHeaderSize + 4 + 5 + 2) TEST_FAIL;
+    if (frame.used_size() != frame.frame_size()) TEST_FAIL;
+    if (frame.sequence() != 9 || frame.type() != network::FrameType::kPost) TEST_FAIL;
+    if (frame.string_view().substr(9, 3) != std::string_view("\0\0\0", 3)) TEST_FAIL;
+
+    // A header for a payload that is sent separately
+    const network::FramePacket header(network::FrameType::kHistoryReply, 3, 1000, 0);
+    if (header.used_size() != network::FramePacket::kHeaderSize || header.frame_size() != 1012) TEST_FAIL;
+  }
+
+  { // Round trip of a post
+    const auto frame = network::MakePostFrame(1, "이민호", "안녕하세요");
+    network::FrameDecoder decoder;
+    if (decoder.parse(frame.string_view()) != network::FrameDecoder::kComplete) TEST_FAIL;
+    if (decoder.size() != frame.used_size()) TEST_FAIL;
+    if (decoder.sequence() != 1 || decoder.type() != network::FrameType::kPost) TEST_FAIL;
+
+    network::FrameReader reader(decoder.payload());
+    uint32_t name_size = 0;
+    std::string_view name;
+    if (!reader.read(name_size) || !reader.read(name_size, name)) TEST_FAIL;
+    if (name != "이민호" || reader.rest() != "안녕하세요") TEST_FAIL;
+
+    // Reads past the end fail
+    uint64_t value = 0;
+    network::FrameReader empty(std::string_view("abc"));
+    if (empty.read(value) || value != 0) TEST_FAIL;
+    if (empty.read(4, name) || !empty.read(3, name) || name != "abc" || !empty.empty()) TEST_FAIL;
+  }
+
+  { // Frames arriving byte by byte, several in one buffer
+    std::string stream;
+    for (uint32_t i = 0; i < 3; ++i)
+      stream += network::MakeHistoryFrame(i, 100 + i).string_view();
+    stream += network::MakeFrame(network::FrameType::kPostOk, 3).string_view();
+
+    network::FrameDecoder decoder;
+    std::string received;
+    uint32_t frames = 0;
+    for (const char c : stream) {
+      received += c;
+      auto buf = std::string_view(received);
+      network::FrameDecoder::Result result;
+      while ((result = decoder.parse(buf)) == network::FrameDecoder::kComplete) {
+        if (decoder.sequence() != frames) TEST_FAIL;
+        if (frames < 3) {
+          uint64_t from_time = 0;
+          network::FrameReader reader(decoder.payload());
+          if (decoder.type() != network::FrameType::kHistory || !reader.read(from_time)) TEST_FAIL;
+          if (from_time != 100 + frames) TEST_FAIL;
+        } else if (decoder.type() != network::FrameType::kPostOk || !decoder.payload().empty()) {
+          TEST_FAIL;
+        }
+        ++frames;
+        buf.remove_prefix(decoder.size());
+      }
+      if (result != network::FrameDecoder::kNeedMore) TEST_FAIL;
+      received = std::string(buf);
+    }
+    if (frames != 4 || !received.empty()) TEST_FAIL;
+  }
+
+  { // History reply payload
+    const std::string_view names[] = {"James", "Nana"};
+    const std::string_view chats[] = {"Hi", "Hi to you too"};
+    size_t size = sizeof(uint32_t);
+    for (int i = 0; i < 2; ++i)
+      size += network::HistoryEntrySize(names[i].size(), chats[i].size());
+
+    network::BinaryPacket payload(size);
+    payload << uint32_t{2};
+    for (int i = 0; i < 2; ++i)
+      network::WriteHistoryEntry(payload, 10 * (i + 1), names[i], chats[i]);
+    if (payload.used_size() != size) TEST_FAIL;
+
+    network::FrameReader reader(payload.string_view());
+    uint32_t count = 0;
+    if (!reader.read(count) || count != 2) TEST_FAIL;
+    for (uint32_t i = 0; i < count; ++i) {
+      uint64_t time;
+      uint32_t name_size, chat_size;
+      std::string_view name, chat;
+      if (!reader.read(time) || !reader.read(name_size) || !reader.read(chat_size) ||
+          !reader.read(name_size, name) || !reader.read(chat_size, chat)) TEST_FAIL;
+      if (time != 10 * (i + 1) || name != names[i] || chat != chats[i]) TEST_FAIL;
+    }
+    if (!reader.empty()) TEST_FAIL;
+  }
+
+  { // Malformed headers are rejected
+    auto frame = network::MakeHistoryFrame(1, 0).release();
+    network::FrameDecoder decoder(64);
+
+    auto bad = frame;
+    bad[10] = 1;
+    if (decoder.parse(bad) != network::FrameDecoder::kError) TEST_FAIL;
+
+    network::BinaryPacket short_frame(network::FramePacket::kHeaderSize);
+    short_frame << uint32_t{4} << uint32_t{0} << uint32_t{0};
+    if (decoder.parse(short_frame.string_view()) != network::FrameDecoder::kError) TEST_FAIL;
+
+    // Refused as soon as the header is in, before the payload is buffered
+    const network::FramePacket large(network::FrameType::kPost, 1, 1000, 0);
+    if (decoder.parse(large.string_view()) != network::FrameDecoder::kError) TEST_FAIL;
+    if (decoder.error().empty()) TEST_FAIL;
+
+    if (decoder.parse(std::string_view(frame).substr(0, 11)) != network::FrameDecoder::kNeedMore) TEST_FAIL;
+    if (decoder.parse(frame) != network::FrameDecoder::kComplete) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
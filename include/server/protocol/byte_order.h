@@ -0,0 +1,203 @@
+//
+// Little- and big-endian loads and stores at any alignment, and LEB128 varints.
+//
+
+#ifndef SERVER_NETWORK_BYTE_ORDER_H_
+#define SERVER_NETWORK_BYTE_ORDER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace network {
+
+namespace detail {
+
+template<size_t Size> struct UnsignedOfSize;
+template<> struct UnsignedOfSize<1> { using type = uint8_t; };
+template<> struct UnsignedOfSize<2> { using type = uint16_t; };
+template<> struct UnsignedOfSize<4> { using type = uint32_t; };
+template<> struct UnsignedOfSize<8> { using type = uint64_t; };
+
+inline uint8_t ByteSwap(uint8_t value) { return value; }
+inline uint16_t ByteSwap(uint16_t value) { return __builtin_bswap16(value); }
+inline uint32_t ByteSwap(uint32_t value) { return __builtin_bswap32(value); }
+inline uint64_t ByteSwap(uint64_t value) { return __builtin_bswap64(value); }
+
+} // namespace detail
+
+constexpr bool kLittleEndianHost = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+// Stores `value` at `p` in little-endian order. `p` need not be aligned.
+template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+inline void StoreLittleEndian(char* p, T value) {
+  if constexpr (kLittleEndianHost) {
+    std::memcpy(p, &value, sizeof(T));
+  } else {
+    typename detail::UnsignedOfSize<sizeof(T)>::type bits;
+    std::memcpy(&bits, &value, sizeof(T));
+    bits = detail::ByteSwap(bits);
+    std::memcpy(p, &bits, sizeof(T));
+  }
+}
+
+template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+inline T LoadLittleEndian(const char* p) {
+  T value;
+  if constexpr (kLittleEndianHost) {
+    std::memcpy(&value, p, sizeof(T));
+  } else {
+    typename detail::UnsignedOfSize<sizeof(T)>::type bits;
+    std::memcpy(&bits, p, sizeof(T));
+    bits = detail::ByteSwap(bits);
+    std::memcpy(&value, &bits, sizeof(T));
+  }
+  return value;
+}
+
+// Network byte order, for protocols defined that way (WebSocket lengths)
+template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+inline void StoreBigEndian(char* p, T value) {
+  typename detail::UnsignedOfSize<sizeof(T)>::type bits;
+  std::memcpy(&bits, &value, sizeof(T));
+  if constexpr (kLittleEndianHost)
+    bits = detail::ByteSwap(bits);
+  std::memcpy(p, &bits, sizeof(T));
+}
+
+template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+inline T LoadBigEndian(const char* p) {
+  typename detail::UnsignedOfSize<sizeof(T)>::type bits;
+  std::memcpy(&bits, p, sizeof(T));
+  if constexpr (kLittleEndianHost)
+    bits = detail::ByteSwap(bits);
+  T value;
+  std::memcpy(&value, &bits, sizeof(T));
+  return value;
+}
+
+// Bulk variants: one memcpy on little-endian hosts, a loop the compiler turns
+// into vector shuffles elsewhere.
+template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+inline void StoreLittleEndian(char* p, const T* values, size_t count) {
+  if constexpr (kLittleEndianHost) {
+    std::memcpy(p, values, count * sizeof(T));
+  } else {
+    for (size_t i = 0; i < count; ++i)
+      StoreLittleEndian(p + i * sizeof(T), values[i]);
+  }
+}
+
+template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+inline void LoadLittleEndian(const char* p, T* values, size_t count) {
+  if constexpr (kLittleEndianHost) {
+    std::memcpy(values, p, count * sizeof(T));
+  } else {
+    for (size_t i = 0; i < count; ++i)
+      values[i] = LoadLittleEndian<T>(p + i * sizeof(T));
+  }
+}
+
+// Unsigned LEB128: seven bits per byte, least significant group first, the
+// high bit set on every byte but the last. Small values take one byte.
+enum {
+  kMaxVarintSize = 10,
+};
+
+constexpr size_t VarintSize(uint64_t value) {
+  // 1 + floor(log2(value)) / 7, without a loop
+  const int bits = 64 - __builtin_clzll(value | 1);
+  return static_cast<size_t>((bits + 6) / 7);
+}
+
+// Signed values are zigzag-mapped first, so small negative numbers stay short
+constexpr uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+constexpr int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Writes VarintSize(value) bytes at `p` and returns the end of them.
+inline char* EncodeVarint(char* p, uint64_t value) {
+  while (value >= 0x80) {
+    *p++ = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = static_cast<char>(value);
+  return p;
+}
+
+namespace detail {
+
+constexpr uint64_t kContinuationBits = 0x8080808080808080;
+
+// Moves the 7-bit groups of `value` into the low 7 bits of consecutive bytes
+constexpr uint64_t SpreadVarintGroups(uint64_t value) {
+  uint64_t spread = 0;
+  for (int i = 0; i < 8; ++i)
+    spread |= (value & (uint64_t{0x7F} << (7 * i))) << i;
+  return spread;
+}
+
+// The inverse: the low 7 bits of every byte, packed together
+constexpr uint64_t GatherVarintGroups(uint64_t bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i)
+    value |= (bytes >> i) & (uint64_t{0x7F} << (7 * i));
+  return value;
+}
+
+} // namespace detail
+
+// EncodeVarint for buffers with at least kMaxVarintSize writable bytes at
+// `p`. Values up to 56 bits are written as one 8-byte store without a loop,
+// which avoids a mispredicted branch per byte when lengths vary.
+inline char* EncodeVarintUnchecked(char* p, uint64_t value) {
+  if (value >= (uint64_t{1} << 56))
+    return EncodeVarint(p, value);
+  const auto size = VarintSize(value);
+  const auto continuation = detail::kContinuationBits & ((uint64_t{1} << (8 * (size - 1))) - 1);
+  StoreLittleEndian(p, detail::SpreadVarintGroups(value) | continuation);
+  return p + size;
+}
+
+// Reads a varint from [p, end). Returns the end of it, or nullptr if the
+// varint is truncated or longer than kMaxVarintSize.
+inline const char* DecodeVarint(const char* p, const char* end, uint64_t& value) {
+  // One byte is by far the most common case
+  if (p != end && static_cast<uint8_t>(*p) < 0x80) {
+    value = static_cast<uint8_t>(*p);
+    return p + 1;
+  }
+
+  // Up to eight bytes from one load, the size found from the first byte
+  // without a continuation bit
+  if (end - p >= 8) {
+    const auto bytes = LoadLittleEndian<uint64_t>(p);
+    const auto last = ~bytes & detail::kContinuationBits;
+    if (last != 0) {
+      const auto size = (__builtin_ctzll(last) + 1) / 8;
+      const auto mask = size == 8 ? ~uint64_t{0} : (uint64_t{1} << (8 * size)) - 1;
+      value = detail::GatherVarintGroups(bytes & mask);
+      return p + size;
+    }
+  }
+
+  uint64_t result = 0;
+  for (int shift = 0; shift < 7 * kMaxVarintSize && p != end; shift += 7) {
+    const auto byte = static_cast<uint8_t>(*p++);
+    result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      value = result;
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace network
+
+#endif // SERVER_NETWORK_BYTE_ORDER_H_
@@ -0,0 +1,144 @@
+//
+// Encoding large arrays of integers into a BinaryPacket: a portable
+// shift-per-byte loop, one operator<< per value, and the bulk write(); then
+// varints one at a time vs. write_varints, and decoding the same ways.
+//
+// usage: byte_order_benchmark [values] [iterations]
+//
+
+#include "server/protocol/byte_order.h"
+#include "server/protocol/binary_protocol.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename F>
+double NanosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+// What a byte-order independent encoder looks like without memcpy, into a
+// plain buffer of the same size
+template<typename T>
+void ShiftEncode(char* p, const T* values, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    typename network::detail::UnsignedOfSize<sizeof(T)>::type value;
+    std::memcpy(&value, &values[i], sizeof(T));
+    for (size_t b = 0; b < sizeof(T); ++b, value >>= 8)
+      *p++ = static_cast<char>(value & 0xFF);
+  }
+}
+
+volatile uint64_t sink;
+
+template<typename T>
+void RunFixed(const char* name, size_t count, int iterations) {
+  std::mt19937_64 rng(42);
+  std::vector<T> values(count);
+  for (auto& value : values)
+    value = static_cast<T>(rng());
+  const auto bytes = count * sizeof(T);
+
+  network::BinaryPacket packet(bytes);
+  const auto shift_ns = NanosecondsPerCall(iterations, [&] {
+    std::string buffer(bytes, '\0');
+    ShiftEncode(buffer.data(), values.data(), count);
+    sink = buffer.size();
+  });
+  const auto scalar_ns = NanosecondsPerCall(iterations, [&] {
+    network::BinaryPacket p(bytes);
+    for (const auto value : values)
+      p << value;
+    sink = p.used_size();
+  });
+  const auto bulk_ns = NanosecondsPerCall(iterations, [&] {
+    network::BinaryPacket p(bytes);
+    p.write(values.data(), count);
+    sink = p.used_size();
+  });
+
+  packet.write(values.data(), count);
+  std::vector<T> decoded(count);
+  const auto get_ns = NanosecondsPerCall(iterations, [&] {
+    for (size_t i = 0; i < count; ++i)
+      decoded[i] = packet.get<T>(i * sizeof(T));
+    sink = decoded.back();
+  });
+  const auto bulk_get_ns = NanosecondsPerCall(iterations, [&] {
+    packet.get(0, decoded.data(), count);
+    sink = decoded.back();
+  });
+  if (decoded != values)
+    std::cerr << "decode mismatch\n";
+
+  const auto gbps = [bytes](double ns) { return bytes / ns; };
+  std::cout << name << "\tshift " << gbps(shift_ns) << "\t<< " << gbps(scalar_ns) << "\twrite " << gbps(bulk_ns)
+            << "\t\tget " << gbps(get_ns) << "\tbulk get " << gbps(bulk_get_ns) << '\n';
+}
+
+void RunVarint(size_t count, int iterations) {
+  // Mostly small values, like lengths and time deltas
+  std::mt19937_64 rng(42);
+  std::vector<uint64_t> values(count);
+  size_t bytes = 0;
+  for (auto& value : values) {
+    value = rng() >> (rng() % 64);
+    bytes += network::VarintSize(value);
+  }
+
+  const auto scalar_ns = NanosecondsPerCall(iterations, [&] {
+    network::BinaryPacket p(bytes);
+    for (const auto value : values)
+      p.write_varint(value);
+    sink = p.used_size();
+  });
+  const auto bulk_ns = NanosecondsPerCall(iterations, [&] {
+    network::BinaryPacket p(bytes);
+    p.write_varints(values.data(), count);
+    sink = p.used_size();
+  });
+
+  network::BinaryPacket packet(bytes);
+  packet.write_varints(values.data(), count);
+  std::vector<uint64_t> decoded(count);
+  const auto decode_ns = NanosecondsPerCall(iterations, [&] {
+    network::FrameReader reader(packet.string_view());
+    for (auto& value : decoded)
+      reader.read_varint(value);
+    sink = decoded.back();
+  });
+  if (decoded != values)
+    std::cerr << "decode mismatch\n";
+
+  std::cout << "varint\t" << static_cast<double>(bytes) / count << " bytes/value"
+            << "\twrite_varint " << scalar_ns / count << " ns/value"
+            << "\twrite_varints " << bulk_ns / count << " ns/value"
+            << "\tread_varint " << decode_ns / count << " ns/value\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t count = argc > 1 ? atoi(argv[1]) : 1 << 20;
+  const int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+  std::cout << count << " values, GB/s\n";
+  RunFixed<uint16_t>("u16", count, iterations);
+  RunFixed<uint32_t>("u32", count, iterations);
+  RunFixed<uint64_t>("u64", count, iterations);
+  RunFixed<double>("f64", count, iterations);
+  RunVarint(count, iterations);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+//
+// Tests for the little-endian and varint encoding of network::BinaryPacket.
+//
+
+#include "server/protocol/byte_order.h"
+#include "server/protocol/binary_protocol.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int main() {
+  { // Wire bytes do not depend on the host byte order
+    network::BinaryPacket packet(1 + 2 + 4 + 8 + 8);
+    packet << uint8_t{0x01} << uint16_t{0x0203} << uint32_t{0x04050607} << uint64_t{0x08090A0B0C0D0E0F} << 1.0;
+    const std::string expected("\x01"
+                               "\x03\x02"
+                               "\x07\x06\x05\x04"
+                               "\x0F\x0E\x0D\x0C\x0B\x0A\x09\x08"
+                               "\x00\x00\x00\x00\x00\x00\xF0\x3F", 23);
+    if (packet.string_view() != expected) TEST_FAIL;
+
+    // Read back at odd offsets
+    if (packet.get<uint16_t>(1) != 0x0203) TEST_FAIL;
+    if (packet.get<uint32_t>(3) != 0x04050607) TEST_FAIL;
+    if (packet.get<uint64_t>(7) != 0x08090A0B0C0D0E0F) TEST_FAIL;
+    if (packet.get<double>(15) != 1.0) TEST_FAIL;
+    if (packet.get<int16_t>(1) != 0x0203) TEST_FAIL;
+  }
+
+  { // Arrays of scalars round trip through one call
+    std::vector<int32_t> values(1001);
+    for (size_t i = 0; i < values.size(); ++i)
+      values[i] = static_cast<int32_t>(i * 2654435761u);
+
+    network::BinaryPacket packet(1 + values.size() * sizeof(int32_t));
+    packet << uint8_t{0};
+    packet.write(values.data(), values.size());
+    if (packet.used_size() != packet.size()) TEST_FAIL;
+    if (packet.get<int32_t>(1 + 7 * sizeof(int32_t)) != values[7]) TEST_FAIL;
+
+    std::vector<int32_t> decoded(values.size());
+    packet.get(1, decoded.data(), decoded.size());
+    if (decoded != values) TEST_FAIL;
+
+    network::FrameReader reader(packet.string_view().substr(1));
+    std::vector<int32_t> read(values.size());
+    if (!reader.read(read.data(), read.size()) || read != values || !reader.empty()) TEST_FAIL;
+    if (reader.read(read.data(), 1)) TEST_FAIL;
+  }
+
+  { // Varint sizes at every 7-bit boundary
+    if (network::VarintSize(0) != 1 || network::VarintSize(127) != 1 || network::VarintSize(128) != 2) TEST_FAIL;
+    if (network::VarintSize(16383) != 2 || network::VarintSize(16384) != 3) TEST_FAIL;
+    if (network::VarintSize(std::numeric_limits<uint64_t>::max()) != network::kMaxVarintSize) TEST_FAIL;
+
+    char buf[network::kMaxVarintSize];
+    if (network::EncodeVarint(buf, 300) - buf != 2 || std::string(buf, 2) != "\xAC\x02") TEST_FAIL;
+
+    for (int shift = 0; shift < 64; ++shift) {
+      for (const uint64_t value : {(uint64_t{1} << shift) - 1, uint64_t{1} << shift, (uint64_t{1} << shift) + 1}) {
+        const auto end = network::EncodeVarint(buf, value);
+        if (static_cast<size_t>(end - buf) != network::VarintSize(value)) TEST_FAIL;
+        uint64_t decoded = 0;
+        if (network::DecodeVarint(buf, end, decoded) != end || decoded != value) TEST_FAIL;
+        // Truncated
+        if (network::DecodeVarint(buf, end - 1, decoded) != nullptr) TEST_FAIL;
+
+        // The word-at-a-time paths, with trailing bytes after the varint
+        char padded[2 * network::kMaxVarintSize];
+        std::memset(padded, 0xFF, sizeof(padded));
+        const auto padded_end = network::EncodeVarintUnchecked(padded, value);
+        if (padded_end - padded != end - buf || std::memcmp(padded, buf, end - buf) != 0) TEST_FAIL;
+        if (network::DecodeVarint(padded, padded + sizeof(padded), decoded) != padded_end) TEST_FAIL;
+        if (decoded != value) TEST_FAIL;
+      }
+    }
+
+    // More than ten bytes is malformed
+    const std::string overlong(11, '\x80');
+    uint64_t decoded = 0;
+    if (network::DecodeVarint(overlong.data(), overlong.data() + overlong.size(), decoded) != nullptr) TEST_FAIL;
+  }
+
+  { // Signed varints keep small magnitudes short
+    for (const int64_t value : {int64_t{0}, int64_t{-1}, int64_t{1}, int64_t{-64}, int64_t{63},
+                                std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()}) {
+      if (network::ZigZagDecode(network::ZigZagEncode(value)) != value) TEST_FAIL;
+    }
+    if (network::ZigZagEncode(-1) != 1 || network::ZigZagEncode(1) != 2) TEST_FAIL;
+    if (network::VarintSize(network::ZigZagEncode(-64)) != 1) TEST_FAIL;
+
+    network::BinaryPacket packet(16);
+    packet.write_signed_varint(-3).write_varint(300);
+    network::FrameReader reader(packet.string_view());
+    int64_t signed_value = 0;
+    uint64_t value = 0;
+    if (!reader.read_signed_varint(signed_value) || signed_value != -3) TEST_FAIL;
+    if (!reader.read_varint(value) || value != 300 || !reader.empty()) TEST_FAIL;
+    if (reader.read_varint(value)) TEST_FAIL;
+
+    if (packet.get_varint(1, value) != 2 || value != 300) TEST_FAIL;
+  }
+
+  { // Bulk varints fill a buffer exactly, down to the last byte
+    std::vector<uint64_t> values;
+    size_t size = 0;
+    for (uint64_t i = 0; i < 500; ++i) {
+      values.emplace_back(i * i * i * 977);
+      size += network::VarintSize(values.back());
+    }
+
+    network::BinaryPacket packet(size);
+    packet.write_varints(values.data(), values.size());
+    if (packet.used_size() != size) TEST_FAIL;
+
+    network::FrameReader reader(packet.string_view());
+    for (const auto expected : values) {
+      uint64_t value = 0;
+      if (!reader.read_varint(value) || value != expected) TEST_FAIL;
+    }
+    if (!reader.empty()) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+//
+// Transfer-Encoding: chunked (RFC 9112 section 7.1), both ways.
+//
+
+#ifndef SERVER_NETWORK_CHUNKED_ENCODING_H_
+#define SERVER_NETWORK_CHUNKED_ENCODING_H_
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "server/protocol/config.h"
+
+namespace network {
+
+// Hex digits of a size_t, and CRLF
+constexpr size_t kMaxChunkHeaderSize = 2 * sizeof(size_t) + 2;
+
+// Ends a chunked body, with no trailer fields
+constexpr std::string_view kLastChunk = "0\r\n\r\n";
+
+// Writes the size line of a chunk of `size` bytes and returns its end
+inline char* WriteChunkHeader(char* out, size_t size) {
+  out = std::to_chars(out, out + 2 * sizeof(size_t), size, 16).ptr;
+  *out++ = '\r';
+  *out++ = '\n';
+  return out;
+}
+
+// Bytes AppendChunk() adds for `size` bytes of data, framing included
+constexpr size_t ChunkedSize(size_t size) {
+  if (size == 0)
+    return 0;
+  size_t digits = 0;
+  for (auto s = size; s != 0; s >>= 4)
+    ++digits;
+  return digits + 2 + size + 2;
+}
+
+// Appends `data` as one chunk. Nothing is appended for empty data, since an
+// empty chunk would end the body.
+inline void AppendChunk(std::string& out, std::string_view data) {
+  if (data.empty())
+    return;
+  char header[kMaxChunkHeaderSize];
+  const auto end = WriteChunkHeader(header, data.size());
+  out.reserve(out.size() + (end - header) + data.size() + 2);
+  out.append(header, end - header).append(data).append("\r\n");
+}
+
+// Decodes a chunked body as it arrives:
+//
+//   ChunkedDecoder decoder;
+//   while (decoder.decode(body) == ChunkedDecoder::kNeedMore)
+//     body += read_more();
+//   use(decoder.content());
+//
+// `body` starts at the first chunk and holds everything received so far;
+// only bytes that were not examined by an earlier call are looked at again.
+// Chunk extensions and trailer fields are skipped. Bytes behind the body are
+// left alone; size() tells where it ended.
+class ChunkedDecoder {
+ public:
+  enum Result {
+    kNeedMore,
+    kComplete,
+    kError,
+  };
+
+  static constexpr size_t kMaxLineSize = 4096;
+
+  explicit ChunkedDecoder(size_t max_size = 8 * 1024 * 1024) : max_size_(max_size) {}
+
+  Result decode(std::string_view body) {
+    while (true) {
+      switch (state_) {
+        case kSizeState: {
+          const auto line = NextLine(body);
+          if (!line.data())
+            return state_ == kErrorState ? kError : kNeedMore;
+          if (!ParseSize(line))
+            return kError;
+          state_ = remaining_ == 0 ? kTrailerState : kDataState;
+          break;
+        }
+
+        case kDataState: {
+          const auto n = std::min<size_t>(remaining_, body.size() - pos_);
+          content_.append(body.data() + pos_, n);
+          pos_ += n;
+          remaining_ -= n;
+          if (remaining_ != 0)
+            return kNeedMore;
+          state_ = kDataEndState;
+          break;
+        }
+
+        case kDataEndState: {
+          const auto line = NextLine(body);
+          if (!line.data())
+            return state_ == kErrorState ? kError : kNeedMore;
+          if (!line.empty()) {
+            Fail("Chunk longer than its size");
+            return kError;
+          }
+          state_ = kSizeState;
+          break;
+        }
+
+        case kTrailerState: {
+          const auto line = NextLine(body);
+          if (!line.data())
+            return state_ == kErrorState ? kError : kNeedMore;
+          if (line.empty()) {
+            state_ = kCompleteState;
+            return kComplete;
+          }
+          break;
+        }
+
+        case kCompleteState:
+          return kComplete;
+
+        case kErrorState:
+          return kError;
+      }
+    }
+  }
+
+  // Prepares for the next body. Keeps the capacity of the content.
+  void reset() {
+    state_ = kSizeState;
+    pos_ = 0;
+    remaining_ = 0;
+    content_.clear();
+    error_ = nullptr;
+  }
+
+  // The chunks joined, so far
+  NETWORK_NODISCARD std::string_view content() const { return content_; }
+  // Bytes of the body taken, trailer included. Valid once complete.
+  NETWORK_NODISCARD size_t size() const { return pos_; }
+  NETWORK_NODISCARD bool complete() const { return state_ == kCompleteState; }
+  NETWORK_NODISCARD const char* error() const { return error_; }
+
+ private:
+  enum State {
+    kSizeState,
+    kDataState,
+    kDataEndState,
+    kTrailerState,
+    kCompleteState,
+    kErrorState,
+  };
+
+  // The next line without its "\r\n" or "\n", or a null view if it is not
+  // all there yet
+  std::string_view NextLine(std::string_view body) {
+    const auto eol = body.find('\n', pos_);
+    if (eol == std::string_view::npos) {
+      if (body.size() - pos_ > kMaxLineSize)
+        Fail("Chunk line too long");
+      return {};
+    }
+    auto line = body.substr(pos_, eol - pos_);
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    pos_ = eol + 1;
+    // Not null even when empty
+    return line.empty() ? std::string_view(body.data() + eol, 0) : line;
+  }
+
+  // chunk-size [ BWS ";" chunk-ext ]
+  bool ParseSize(std::string_view line) {
+    const auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), remaining_, 16);
+    if (ec == std::errc::result_out_of_range)
+      return Fail("Chunk too large");
+    if (ec != std::errc())
+      return Fail("Invalid chunk size");
+    for (auto p = end; p != line.data() + line.size() && *p != ';'; ++p) {
+      if (*p != ' ' && *p != '\t')
+        return Fail("Invalid chunk size");
+    }
+    if (remaining_ > max_size_ - content_.size())
+      return Fail("Content too large");
+    return true;
+  }
+
+  bool Fail(const char* reason) {
+    error_ = reason;
+    state_ = kErrorState;
+    return false;
+  }
+
+  const size_t max_size_;
+  State state_ = kSizeState;
+  size_t pos_ = 0;
+  uint64_t remaining_ = 0;
+  std::string content_;
+  const char* error_ = nullptr;
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_CHUNKED_ENCODING_H_
@@ -0,0 +1,108 @@
+//
+// Tests for chunked transfer coding.
+//
+
+#include "server/protocol/chunked_encoding.h"
+
+#include <iostream>
+#include <string>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int main() {
+  using network::ChunkedDecoder;
+
+  { // Encoding
+    std::string out;
+    network::AppendChunk(out, "");
+    if (!out.empty()) TEST_FAIL;
+    network::AppendChunk(out, "Hello");
+    network::AppendChunk(out, std::string(300, 'x'));
+    out += network::kLastChunk;
+    if (out != "5\r\nHello\r\n12c\r\n" + std::string(300, 'x') + "\r\n0\r\n\r\n") TEST_FAIL;
+
+    for (const size_t size : {size_t{0}, size_t{1}, size_t{15}, size_t{16}, size_t{4095}, size_t{65536}}) {
+      std::string chunk;
+      network::AppendChunk(chunk, std::string(size, 'y'));
+      if (chunk.size() != network::ChunkedSize(size)) TEST_FAIL;
+    }
+
+    char header[network::kMaxChunkHeaderSize];
+    const auto end = network::WriteChunkHeader(header, SIZE_MAX);
+    if (static_cast<size_t>(end - header) != network::kMaxChunkHeaderSize) TEST_FAIL;
+  }
+
+  { // Whole body, with extensions and trailer fields, and bytes behind it
+    const std::string body = "4;name=value\r\nWiki\r\n"
+                             "5 ; x\r\npedia\r\n"
+                             "E\r\n in\r\n\r\nchunks.\r\n"
+                             "0\r\n"
+                             "Expires: never\r\n"
+                             "\r\n"
+                             "GET / HTTP/1.1";
+    ChunkedDecoder decoder;
+    if (decoder.decode(body) != ChunkedDecoder::kComplete) TEST_FAIL;
+    if (decoder.content() != "Wikipedia in\r\n\r\nchunks.") TEST_FAIL;
+    if (body.substr(decoder.size()) != "GET / HTTP/1.1") TEST_FAIL;
+    if (!decoder.complete()) TEST_FAIL;
+
+    // One byte at a time gives the same
+    ChunkedDecoder split;
+    std::string buffer;
+    const auto end = decoder.size();
+    for (size_t i = 0; i < end; ++i) {
+      buffer.push_back(body[i]);
+      const auto result = split.decode(buffer);
+      if (i + 1 < end && result != ChunkedDecoder::kNeedMore) TEST_FAIL;
+      if (i + 1 == end && result != ChunkedDecoder::kComplete) TEST_FAIL;
+    }
+    if (split.content() != decoder.content() || split.size() != end) TEST_FAIL;
+
+    // Bare LF line ends are taken too
+    split.reset();
+    if (split.decode("3\nabc\n0\n\n") != ChunkedDecoder::kComplete || split.content() != "abc") TEST_FAIL;
+  }
+
+  { // Round trip
+    std::string body;
+    std::string expected;
+    for (size_t size = 1; size < 2000; size += 97) {
+      const std::string data(size, static_cast<char>('a' + size % 26));
+      network::AppendChunk(body, data);
+      expected += data;
+    }
+    body += network::kLastChunk;
+    ChunkedDecoder decoder;
+    if (decoder.decode(body) != ChunkedDecoder::kComplete) TEST_FAIL;
+    if (decoder.content() != expected || decoder.size() != body.size()) TEST_FAIL;
+  }
+
+  { // Malformed bodies
+    const auto fails = [](std::string_view body, size_t max = 1024) {
+      ChunkedDecoder decoder(max);
+      return decoder.decode(body) == ChunkedDecoder::kError && decoder.error() != nullptr;
+    };
+    if (!fails("x\r\n")) TEST_FAIL;
+    if (!fails("\r\n")) TEST_FAIL;
+    if (!fails("-1\r\n")) TEST_FAIL;
+    if (!fails("3 x\r\nabc\r\n")) TEST_FAIL;
+    if (!fails("3\r\nabcd\r\n")) TEST_FAIL;
+    if (!fails("10000000000000000\r\n")) TEST_FAIL;
+    // Over the limit, refused from the size line alone
+    if (!fails("401\r\n")) TEST_FAIL;
+    if (!fails("200\r\n" + std::string(0x200, 'x') + "\r\n201\r\n")) TEST_FAIL;
+    if (!fails(std::string(ChunkedDecoder::kMaxLineSize + 1, '1'))) TEST_FAIL;
+
+    ChunkedDecoder decoder(1024);
+    if (decoder.decode("400\r\n") != ChunkedDecoder::kNeedMore) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
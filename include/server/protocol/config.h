@@ -0,0 +1,23 @@
+//
+// Macros shared by the network headers.
+//
+
+#ifndef SERVER_NETWORK_CONFIG_H_
+#define SERVER_NETWORK_CONFIG_H_
+
+#include <cassert>
+
+#if __cplusplus >= 201703L
+#define NETWORK_NODISCARD [[nodiscard]]
+#else
+#define NETWORK_NODISCARD
+#endif
+
+#define NETWORK_ASSERT(expr, msg) \
+  assert(((void)msg, (expr)))
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NETWORK_X86 1
+#endif
+
+#endif // SERVER_NETWORK_CONFIG_H_
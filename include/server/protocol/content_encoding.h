@@ -0,0 +1,224 @@
+//
+// Content-Encoding negotiation and gzip/deflate compression (zlib).
+//
+
+#ifndef SERVER_NETWORK_CONTENT_ENCODING_H_
+#define SERVER_NETWORK_CONTENT_ENCODING_H_
+
+#include <algorithm>
+#include <climits>
+#include <string>
+#include <string_view>
+
+#include "server/protocol/config.h"
+#include "server/protocol/header_map.h"
+
+// Defined by the build when zlib was found; without it every response is
+// sent as it is
+#if defined(NETWORK_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace network {
+
+enum class ContentEncoding {
+  kIdentity,
+  kGzip,
+  // The zlib format (RFC 1950), as HTTP means it
+  kDeflate,
+};
+
+constexpr std::string_view ContentEncodingName(ContentEncoding encoding) {
+  switch (encoding) {
+    case ContentEncoding::kGzip: return "gzip";
+    case ContentEncoding::kDeflate: return "deflate";
+    default: return "identity";
+  }
+}
+
+constexpr bool CompressionSupported() {
+#if defined(NETWORK_HAVE_ZLIB)
+  return true;
+#else
+  return false;
+#endif
+}
+
+namespace detail {
+
+// qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] ), in
+// thousandths. -1 if malformed.
+constexpr int ParseQValue(std::string_view value) {
+  if (value.empty() || (value[0] != '0' && value[0] != '1'))
+    return -1;
+  int q = (value[0] - '0') * 1000;
+  if (value.size() == 1)
+    return q;
+  if (value[1] != '.' || value.size() > 5)
+    return -1;
+  int scale = 100;
+  for (size_t i = 2; i < value.size(); ++i, scale /= 10) {
+    if (value[i] < '0' || value[i] > '9')
+      return -1;
+    q += (value[i] - '0') * scale;
+  }
+  return q > 1000 ? -1 : q;
+}
+
+constexpr std::string_view TrimSpace(std::string_view str) {
+  while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+    str.remove_prefix(1);
+  while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+    str.remove_suffix(1);
+  return str;
+}
+
+} // namespace detail
+
+// The coding to answer with, given the Accept-Encoding of a request (RFC 9110
+// section 12.5.3): the compressed one with the highest weight, gzip on a tie,
+// or identity if the client takes neither, the header is missing, or
+// compression was not built in. "*" stands for any coding not listed, and
+// "x-gzip" for gzip.
+constexpr ContentEncoding NegotiateEncoding(std::string_view accept_encoding) {
+  if (!CompressionSupported())
+    return ContentEncoding::kIdentity;
+
+  int gzip = -1, deflate = -1, any = -1;
+  while (!accept_encoding.empty()) {
+    const auto comma = accept_encoding.find(',');
+    auto item = accept_encoding.substr(0, comma);
+    accept_encoding.remove_prefix(comma == std::string_view::npos ? accept_encoding.size() : comma + 1);
+
+    int q = 1000;
+    if (const auto semicolon = item.find(';'); semicolon != std::string_view::npos) {
+      const auto parameter = detail::TrimSpace(item.substr(semicolon + 1));
+      item = item.substr(0, semicolon);
+      if (parameter.size() < 2 || (parameter[0] != 'q' && parameter[0] != 'Q') || parameter[1] != '=')
+        continue;
+      q = detail::ParseQValue(parameter.substr(2));
+      if (q < 0)
+        continue;
+    }
+    const auto coding = detail::TrimSpace(item);
+    if (EqualsIgnoreCase(coding, "gzip") || EqualsIgnoreCase(coding, "x-gzip"))
+      gzip = std::max(gzip, q);
+    else if (EqualsIgnoreCase(coding, "deflate"))
+      deflate = std::max(deflate, q);
+    else if (coding == "*")
+      any = q;
+  }
+
+  if (gzip < 0)
+    gzip = any;
+  if (deflate < 0)
+    deflate = any;
+  if (gzip <= 0 && deflate <= 0)
+    return ContentEncoding::kIdentity;
+  return gzip >= deflate ? ContentEncoding::kGzip : ContentEncoding::kDeflate;
+}
+
+// Compresses a body in one or several pieces:
+//
+//   Compressor compressor(ContentEncoding::kGzip);
+//   compressor.append(out, first);
+//   compressor.append(out, last, true);
+//
+// Every piece is flushed, so the output so far can be sent right away and
+// decompressed as it arrives, as the chunks of a streamed response are. All
+// calls fail if compression is not built in, or for identity.
+class Compressor {
+ public:
+  enum {
+    kFastest = 1,
+    kDefaultLevel = 6,
+    kBest = 9,
+  };
+
+  explicit Compressor(ContentEncoding encoding, int level = kDefaultLevel) {
+#if defined(NETWORK_HAVE_ZLIB)
+    if (encoding == ContentEncoding::kIdentity)
+      return;
+    // 15 bits of window; +16 asks for a gzip wrapper instead of a zlib one
+    const int window_bits = encoding == ContentEncoding::kGzip ? 15 + 16 : 15;
+    ok_ = deflateInit2(&stream_, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+#else
+    (void)encoding;
+    (void)level;
+#endif
+  }
+
+  Compressor(const Compressor&) = delete;
+  Compressor& operator=(const Compressor&) = delete;
+
+  ~Compressor() {
+#if defined(NETWORK_HAVE_ZLIB)
+    if (ok_)
+      deflateEnd(&stream_);
+#endif
+  }
+
+  // Appends `data` compressed to `out`; `finish` ends the body. Returns false
+  // if compression failed or the body was already finished.
+  bool append(std::string& out, std::string_view data, bool finish = false) {
+#if defined(NETWORK_HAVE_ZLIB)
+    if (!ok_ || finished_)
+      return false;
+    NETWORK_ASSERT(data.size() <= UINT_MAX, "Piece too large");
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream_.avail_in = static_cast<uInt>(data.size());
+    const int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+    auto size = out.size();
+    while (true) {
+      // Enough for the whole piece in one call, flush and wrapper included
+      const size_t room = deflateBound(&stream_, stream_.avail_in) + 64;
+      out.resize(size + room);
+      stream_.next_out = reinterpret_cast<Bytef*>(out.data() + size);
+      stream_.avail_out = static_cast<uInt>(room);
+      const auto result = deflate(&stream_, flush);
+      size += room - stream_.avail_out;
+      if (result == Z_STREAM_ERROR) {
+        out.resize(size);
+        ok_ = false;
+        return false;
+      }
+      if (finish ? result == Z_STREAM_END : stream_.avail_out != 0)
+        break;
+    }
+    out.resize(size);
+    finished_ = finish;
+    return true;
+#else
+    (void)out;
+    (void)data;
+    (void)finish;
+    return false;
+#endif
+  }
+
+  // Whether the compressor was set up; false for identity
+  NETWORK_NODISCARD bool ok() const { return ok_; }
+  NETWORK_NODISCARD bool finished() const { return finished_; }
+
+ private:
+#if defined(NETWORK_HAVE_ZLIB)
+  z_stream stream_{};
+#endif
+  bool ok_ = false;
+  bool finished_ = false;
+};
+
+// `data` as one compressed body, or an empty string if it cannot be
+// compressed with `encoding`
+NETWORK_NODISCARD inline std::string Compress(std::string_view data, ContentEncoding encoding,
+                                              int level = Compressor::kDefaultLevel) {
+  std::string out;
+  Compressor compressor(encoding, level);
+  if (!compressor.append(out, data, true))
+    out.clear();
+  return out;
+}
+
+} // namespace network
+
+#endif // SERVER_NETWORK_CONTENT_ENCODING_H_
@@ -0,0 +1,70 @@
+//
+// Compressing history responses: size and time per body for gzip and deflate
+// at several levels, against handing out a compressed body kept in a
+// ResponseCache, as every poll of the same content version does.
+//
+// usage: content_encoding_benchmark [messages] [iterations]
+//
+
+#include "server/history/response_cache.h"
+#include "server/protocol/content_encoding.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+template<typename F>
+double MicrosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile size_t sink;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const int messages = argc > 1 ? atoi(argv[1]) : 2000;
+  const int iterations = argc > 2 ? atoi(argv[2]) : 50;
+
+  if (!network::CompressionSupported()) {
+    std::cout << "Built without zlib\n";
+    return EXIT_SUCCESS;
+  }
+
+  const std::string names[] = {"이범석", "James", "민지", "Olivia"};
+  const std::string chats[] = {"안녕하세요, 오늘 저녁에 뭐 먹을까요?", "See you at 7", "ㅋㅋㅋㅋ", "On my way!"};
+  std::string history = "[";
+  for (int i = 0; i < messages; ++i)
+    history += "{\"name\":\"" + names[i % 4] + "\",\"chatKey\":\"" + chats[(i / 3) % 4] + " #" + std::to_string(i * 7919 % 10007) + "\"},";
+  history.back() = ']';
+  std::cout << "history of " << messages << " messages, " << history.size() << " B\n";
+
+  using network::ContentEncoding;
+  for (const auto encoding : {ContentEncoding::kGzip, ContentEncoding::kDeflate}) {
+    for (const int level : {1, 6, 9}) {
+      std::string out;
+      const auto us = MicrosecondsPerCall(iterations, [&] {
+        out = network::Compress(history, encoding, level);
+        sink = out.size();
+      });
+      std::cout << "  " << network::ContentEncodingName(encoding) << " level " << level << "\t" << out.size()
+                << " B (" << 100.0 * out.size() / history.size() << "%)\t" << us << " us\n";
+    }
+  }
+
+  network::ResponseCache cache;
+  cache.insert(0, messages, std::make_shared<const std::string>(network::Compress(history, ContentEncoding::kGzip)), 1);
+  const auto hit_us = MicrosecondsPerCall(iterations * 1000, [&] {
+    sink = cache.find(0, messages, 1)->size();
+  });
+  std::cout << "  cached gzip body\t" << hit_us << " us\n";
+
+  return EXIT_SUCCESS;
+}
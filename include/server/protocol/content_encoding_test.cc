@@ -0,0 +1,135 @@
+//
+// Tests for Accept-Encoding negotiation and response compression.
+//
+
+#include "server/protocol/content_encoding.h"
+#include "server/protocol/http_protocol.h"
+
+#include <iostream>
+#include <string>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+#if defined(NETWORK_HAVE_ZLIB)
+// Undoes gzip and zlib wrappers alike
+std::string Inflate(std::string_view data) {
+  z_stream stream{};
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) TEST_FAIL;
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  std::string out;
+  int result = Z_OK;
+  while (result == Z_OK) {
+    char buffer[4096];
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    result = inflate(&stream, Z_NO_FLUSH);
+    out.append(buffer, sizeof(buffer) - stream.avail_out);
+    if (result == Z_BUF_ERROR && stream.avail_in == 0)
+      break;
+  }
+  inflateEnd(&stream);
+  return out;
+}
+#endif
+
+int main() {
+  using network::ContentEncoding;
+  using network::NegotiateEncoding;
+
+  { // Negotiation
+    if (!network::CompressionSupported()) {
+      if (NegotiateEncoding("gzip, deflate") != ContentEncoding::kIdentity) TEST_FAIL;
+      return EXIT_SUCCESS;
+    }
+    if (NegotiateEncoding("") != ContentEncoding::kIdentity) TEST_FAIL;
+    if (NegotiateEncoding("gzip, deflate, br") != ContentEncoding::kGzip) TEST_FAIL;
+    if (NegotiateEncoding("deflate") != ContentEncoding::kDeflate) TEST_FAIL;
+    if (NegotiateEncoding(" X-GZIP ") != ContentEncoding::kGzip) TEST_FAIL;
+    if (NegotiateEncoding("br, identity") != ContentEncoding::kIdentity) TEST_FAIL;
+    // Weights
+    if (NegotiateEncoding("gzip;q=0.5, deflate") != ContentEncoding::kDeflate) TEST_FAIL;
+    if (NegotiateEncoding("gzip ; Q=1.000, deflate;q=0.999") != ContentEncoding::kGzip) TEST_FAIL;
+    if (NegotiateEncoding("gzip;q=0, deflate;q=0") != ContentEncoding::kIdentity) TEST_FAIL;
+    if (NegotiateEncoding("deflate;q=0.1, gzip;q=0") != ContentEncoding::kDeflate) TEST_FAIL;
+    // Malformed weights drop their coding
+    if (NegotiateEncoding("gzip;q=2, deflate;q=0.5") != ContentEncoding::kDeflate) TEST_FAIL;
+    if (NegotiateEncoding("gzip;level=1") != ContentEncoding::kIdentity) TEST_FAIL;
+    // "*" covers the codings not listed
+    if (NegotiateEncoding("*") != ContentEncoding::kGzip) TEST_FAIL;
+    if (NegotiateEncoding("*;q=0.5, gzip;q=0") != ContentEncoding::kDeflate) TEST_FAIL;
+    if (NegotiateEncoding("*;q=0") != ContentEncoding::kIdentity) TEST_FAIL;
+
+    static_assert(network::detail::ParseQValue("0.25") == 250);
+    static_assert(network::detail::ParseQValue("1.001") == -1);
+  }
+
+#if defined(NETWORK_HAVE_ZLIB)
+  std::string history = "[";
+  for (int i = 0; i < 2000; ++i)
+    history += "{\"name\":\"user" + std::to_string(i % 7) + "\",\"chatKey\":\"hello " + std::to_string(i) + "\"},";
+  history.back() = ']';
+
+  { // One-shot compression round trips in both formats
+    for (const auto encoding : {ContentEncoding::kGzip, ContentEncoding::kDeflate}) {
+      const auto compressed = network::Compress(history, encoding);
+      if (compressed.empty() || compressed.size() * 5 > history.size()) TEST_FAIL;
+      if (Inflate(compressed) != history) TEST_FAIL;
+    }
+    // gzip magic, zlib header
+    if (network::Compress("x", ContentEncoding::kGzip).substr(0, 2) != "\x1f\x8b") TEST_FAIL;
+    if (network::Compress("x", ContentEncoding::kDeflate)[0] != 0x78) TEST_FAIL;
+    if (!network::Compress(history, ContentEncoding::kIdentity).empty()) TEST_FAIL;
+    if (Inflate(network::Compress("", ContentEncoding::kGzip)) != "") TEST_FAIL;
+  }
+
+  { // Streamed pieces are each flushed, and decode as one body
+    network::Compressor compressor(ContentEncoding::kGzip, network::Compressor::kFastest);
+    std::string out;
+    std::string sent;
+    for (size_t offset = 0; offset < history.size(); offset += 10000) {
+      const auto piece = std::string_view(history).substr(offset, 10000);
+      const auto before = out.size();
+      if (!compressor.append(out, piece, offset + 10000 >= history.size())) TEST_FAIL;
+      if (out.size() == before) TEST_FAIL;
+      sent += piece;
+      // Everything appended so far decodes to everything given so far
+      if (Inflate(out) != sent) TEST_FAIL;
+    }
+    if (!compressor.finished() || compressor.append(out, "more")) TEST_FAIL;
+    if (Inflate(out) != history) TEST_FAIL;
+  }
+
+  { // HTTP messages
+    network::HTTPProtocol request;
+    if (!request.parse("GET / HTTP/1.1\r\naccept-encoding: deflate, gzip;q=0.8\r\n\r\n")) TEST_FAIL;
+    if (request.accepted_encoding() != ContentEncoding::kDeflate) TEST_FAIL;
+    if (!request.parse("GET / HTTP/1.1\r\n\r\n")) TEST_FAIL;
+    if (request.accepted_encoding() != ContentEncoding::kIdentity) TEST_FAIL;
+
+    network::HTTPProtocol response;
+    response.response(200, "OK");
+    response.add_header("Content-Length", history.size());
+    response.set_content(history);
+    // Under the threshold, or identity
+    if (response.encode_content(ContentEncoding::kGzip, history.size() + 1)) TEST_FAIL;
+    if (response.encode_content(ContentEncoding::kIdentity)) TEST_FAIL;
+    if (std::string_view(response.content()) != history) TEST_FAIL;
+
+    if (!response.encode_content(ContentEncoding::kGzip, 1024)) TEST_FAIL;
+    if (response.header().find("Content-Encoding")->second != "gzip") TEST_FAIL;
+    if (response.header().find("Vary")->second != "Accept-Encoding") TEST_FAIL;
+    if (response.header().find("Content-Length")->second != std::to_string(response.content().size()).c_str()) TEST_FAIL;
+    if (Inflate(response.content()) != history) TEST_FAIL;
+  }
+#endif
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+//
+// Runtime choice between the scalar and vector kernels of a routine.
+//
+
+#ifndef SERVER_NETWORK_CPU_FEATURES_H_
+#define SERVER_NETWORK_CPU_FEATURES_H_
+
+#include "server/protocol/config.h"
+
+// Names a vector kernel where it is compiled in, and nullptr elsewhere, so
+// that KernelDispatch::Select() can be given every kernel on every target
+#if defined(NETWORK_X86) && defined(__SSE2__)
+#define NETWORK_SSE2_KERNEL(f) (f)
+#else
+#define NETWORK_SSE2_KERNEL(f) nullptr
+#endif
+
+#if defined(NETWORK_X86)
+#define NETWORK_AVX2_KERNEL(f) (f)
+#else
+#define NETWORK_AVX2_KERNEL(f) nullptr
+#endif
+
+namespace network {
+
+// Base of the classes whose work is done by a scalar, an SSE2 or an AVX2
+// kernel. The kernel is picked at runtime from what the CPU supports; tests
+// and benchmarks may ask for a given one.
+class KernelDispatch {
+ public:
+  enum Kernel {
+    kScalar,
+    kSSE2,
+    kAVX2,
+  };
+
+  NETWORK_NODISCARD static bool supported(Kernel kernel) {
+    switch (kernel) {
+      case kScalar:
+        return true;
+#if defined(NETWORK_X86) && defined(__SSE2__)
+      case kSSE2:
+        return true;
+#endif
+#if defined(NETWORK_X86)
+      case kAVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+      default:
+        return false;
+    }
+  }
+
+  NETWORK_NODISCARD static Kernel best_kernel() {
+    static const Kernel kernel = supported(kAVX2) ? kAVX2 : supported(kSSE2) ? kSSE2 : kScalar;
+    return kernel;
+  }
+
+ protected:
+  template<typename T>
+  struct NonDeduced {
+    using type = T;
+  };
+
+  // The function for `kernel`, or for the best supported kernel below it.
+  // `sse2` and `avx2` are null where they are not compiled in.
+  template<typename F>
+  static F* Select(Kernel kernel, F* scalar, typename NonDeduced<F*>::type sse2,
+                   typename NonDeduced<F*>::type avx2) {
+    if (kernel == kAVX2 && avx2 != nullptr && supported(kAVX2))
+      return avx2;
+    if (kernel != kScalar && sse2 != nullptr && supported(kSSE2))
+      return sse2;
+    return scalar;
+  }
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_CPU_FEATURES_H_
@@ -0,0 +1,132 @@
+//
+// Single pass search for two delimiter bytes, vectorized with SSE2/AVX2.
+//
+
+#ifndef SERVER_NETWORK_DELIMITER_SCANNER_H_
+#define SERVER_NETWORK_DELIMITER_SCANNER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "server/protocol/config.h"
+#include "server/protocol/cpu_features.h"
+
+#if defined(NETWORK_X86)
+#include <immintrin.h>
+#endif
+
+namespace network {
+namespace detail {
+
+// Each kernel returns a bitmask of the bytes of p[0..64) equal to `a` or `b`.
+using match_kernel = uint64_t (*)(const char* p, char a, char b);
+
+inline uint64_t MatchMaskScalar(const char* p, char a, char b) {
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; ++i) {
+    mask |= static_cast<uint64_t>(p[i] == a || p[i] == b) << i;
+  }
+  return mask;
+}
+
+#if defined(NETWORK_X86) && defined(__SSE2__)
+inline uint64_t MatchMaskSSE2(const char* p, char a, char b) {
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+    const __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb));
+    mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(eq))) << (16 * i);
+  }
+  return mask;
+}
+#endif
+
+#if defined(NETWORK_X86)
+__attribute__((target("avx2")))
+inline uint64_t MatchMaskAVX2(const char* p, char a, char b) {
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+  const __m256i eq_lo = _mm256_or_si256(_mm256_cmpeq_epi8(lo, va), _mm256_cmpeq_epi8(lo, vb));
+  const __m256i eq_hi = _mm256_or_si256(_mm256_cmpeq_epi8(hi, va), _mm256_cmpeq_epi8(hi, vb));
+  return static_cast<uint32_t>(_mm256_movemask_epi8(eq_lo)) |
+         (static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq_hi))) << 32);
+}
+#endif
+
+} // namespace detail
+
+// Iterates over every position of `a` or `b` in a buffer, 64 bytes at a time:
+//
+//   DelimiterScanner scanner(str, '\r', ':');
+//   for (auto p = scanner.next(); p != DelimiterScanner::npos; p = scanner.next())
+//     ...
+//
+// Each byte is loaded once, however many delimiters it is followed by. The
+// vector kernel is chosen at runtime from what the CPU supports.
+class DelimiterScanner : public KernelDispatch {
+ public:
+  using size_type = std::string_view::size_type;
+  static constexpr size_type npos = std::string_view::npos;
+
+  DelimiterScanner(std::string_view data, char a, char b, Kernel kernel = best_kernel())
+    : data_(data), a_(a), b_(b), match_(SelectKernel(kernel)) {}
+
+  // Returns the offset of the next delimiter, or npos.
+  size_type next() {
+    while (mask_ == 0) {
+      if (next_block_ >= data_.size())
+        return npos;
+      LoadBlock();
+    }
+    const auto bit = __builtin_ctzll(mask_);
+    mask_ &= mask_ - 1;
+    return block_ + bit;
+  }
+
+  // Continues scanning at `pos`, skipping everything before it.
+  void seek(size_type pos) {
+    next_block_ = pos;
+    mask_ = 0;
+  }
+
+  NETWORK_NODISCARD std::string_view data() const { return data_; }
+
+ private:
+  static detail::match_kernel SelectKernel(Kernel kernel) {
+    return Select(kernel, detail::MatchMaskScalar, NETWORK_SSE2_KERNEL(detail::MatchMaskSSE2),
+                  NETWORK_AVX2_KERNEL(detail::MatchMaskAVX2));
+  }
+
+  void LoadBlock() {
+    block_ = next_block_;
+    const auto remaining = data_.size() - block_;
+    if (remaining >= 64) {
+      mask_ = match_(data_.data() + block_, a_, b_);
+      next_block_ = block_ + 64;
+    } else {
+      // Never read past the end of the buffer: scan a padded copy of the tail
+      // and drop matches in the padding.
+      char tail[64] = {};
+      std::memcpy(tail, data_.data() + block_, remaining);
+      mask_ = match_(tail, a_, b_) & ((uint64_t{1} << remaining) - 1);
+      next_block_ = data_.size();
+    }
+  }
+
+  std::string_view data_;
+  char a_;
+  char b_;
+  detail::match_kernel match_;
+  size_type block_ = 0;
+  size_type next_block_ = 0;
+  uint64_t mask_ = 0;
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_DELIMITER_SCANNER_H_
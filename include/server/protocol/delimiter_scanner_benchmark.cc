@@ -0,0 +1,179 @@
+//
+// Header parsing benchmark: std::string::find based parser vs. DelimiterScanner.
+//
+// usage: delimiter_scanner_benchmark [iterations]
+//
+
+#include "server/protocol/delimiter_scanner.h"
+#include "server/protocol/http_parser.h"
+#include "server/protocol/http_protocol.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// The header parser as it was before DelimiterScanner, kept as a baseline.
+struct LegacyParser {
+  std::unordered_map<std::string, std::string> header;
+  std::vector<std::string> tokens;
+  std::string content;
+
+  bool parse(const std::string& request) {
+    const std::string key_separator = "\r\n";
+    const std::string key_value_separator = ": ";
+
+    const auto line_end = request.find(key_separator, 0);
+    const std::string start_line = request.substr(0, line_end);
+    tokens.clear();
+    std::string::size_type p = 0;
+    while (true) {
+      const auto p2 = start_line.find(' ', p);
+      tokens.emplace_back(start_line.substr(p, p2 - p));
+      if (p2 == std::string::npos)
+        break;
+      p = p2 + 1;
+    }
+
+    const std::string str = request.substr(line_end + key_separator.size());
+    header.clear();
+    std::string::size_type pos_begin = 0;
+    std::string::size_type pos_end = 0;
+    while (pos_begin < str.size()) {
+      pos_end = str.find(key_separator, pos_begin);
+      if (pos_begin == pos_end)
+        break;
+      const auto sep_pos = str.find(key_value_separator, pos_begin);
+      if (sep_pos == std::string::npos)
+        return false;
+      std::string key(str.begin() + pos_begin, str.begin() + sep_pos);
+      std::string value(str.begin() + sep_pos + key_value_separator.size(), str.begin() + pos_end);
+      header.emplace(std::move(key), std::move(value));
+      pos_begin = pos_end + key_separator.size();
+    }
+    content = str.substr(std::min(pos_end + key_separator.size(), str.size()));
+    return true;
+  }
+};
+
+std::string MakeRequest(int header_num, int value_size) {
+  std::string request = "GET /chat/history?room=lobby HTTP/1.1\r\n";
+  request += "Host: 3.37.112.35:8085\r\n";
+  request += "from_time: 1667768091000\r\n";
+  for (int i = 0; i < header_num; ++i) {
+    request += "X-Custom-Header-" + std::to_string(i) + ": ";
+    request += std::string(value_size, 'v');
+    request += "\r\n";
+  }
+  request += "\r\n";
+  return request;
+}
+
+template<typename F>
+double NanosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile size_t sink;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  using Scanner = network::DelimiterScanner;
+  const int iterations = argc > 1 ? atoi(argv[1]) : 200'000;
+
+  std::cout << "Best kernel: "
+            << (Scanner::best_kernel() == Scanner::kAVX2 ? "AVX2" :
+                Scanner::best_kernel() == Scanner::kSSE2 ? "SSE2" : "scalar") << "\n\n";
+
+  std::cout << "request bytes\tlegacy ns\tHTTPProtocol ns\tHTTPRequestParser ns\n";
+  const std::pair<int, int> shapes[] = {{2, 10}, {8, 30}, {16, 60}, {32, 120}};
+  for (const auto& [header_num, value_size] : shapes) {
+    const auto request = MakeRequest(header_num, value_size);
+
+    const auto legacy_ns = NanosecondsPerCall(iterations, [&] {
+      LegacyParser legacy;
+      legacy.parse(request);
+      sink = legacy.header.size();
+    });
+
+    const auto protocol_ns = NanosecondsPerCall(iterations, [&] {
+      network::HTTPProtocol protocol;
+      protocol.parse(request);
+      sink = protocol.header().size();
+    });
+
+    network::HTTPRequestParser parser;
+    const auto parser_ns = NanosecondsPerCall(iterations, [&] {
+      parser.reset();
+      parser.parse(request);
+      sink = parser.header_count();
+    });
+
+    std::cout << request.size() << "\t\t" << legacy_ns << "\t\t" << protocol_ns << "\t\t" << parser_ns << '\n';
+  }
+
+  // Host, Content-Length and from_time are looked up on every request
+  std::cout << "\nrequest bytes\tscan by name ns\tknown header ns\n";
+  for (const auto& [header_num, value_size] : shapes) {
+    const auto request = MakeRequest(header_num, value_size);
+    network::HTTPRequestParser parser;
+    parser.parse(request);
+    const std::string_view names[] = {"Host", "Content-Length", "from_time"};
+
+    const auto by_name_ns = NanosecondsPerCall(iterations * 10, [&] {
+      size_t found = 0;
+      for (const auto name : names) {
+        for (size_t i = 0; i < parser.header_count(); ++i) {
+          if (network::EqualsIgnoreCase(parser.header(i).first, name)) {
+            found += parser.header(i).second.size();
+            break;
+          }
+        }
+      }
+      sink = found;
+    });
+
+    const auto known_ns = NanosecondsPerCall(iterations * 10, [&] {
+      size_t found = 0;
+      for (const auto header : {network::KnownHeader::kHost, network::KnownHeader::kContentLength,
+                                network::KnownHeader::kFromTime}) {
+        if (const auto value = parser.find(header))
+          found += value->size();
+      }
+      sink = found;
+    });
+
+    std::cout << request.size() << "\t\t" << by_name_ns << "\t\t" << known_ns << '\n';
+  }
+
+  std::cout << "\nkernel\tGB/s (64 KiB buffer, ~1 delimiter per 32 bytes)\n";
+  std::string buffer;
+  while (buffer.size() < 64 * 1024)
+    buffer += "X-Custom-Header: some value\r\n";
+
+  const std::pair<Scanner::Kernel, const char*> kernels[] = {
+    {Scanner::kScalar, "scalar"}, {Scanner::kSSE2, "SSE2"}, {Scanner::kAVX2, "AVX2"}};
+  for (const auto& [kernel, name] : kernels) {
+    if (!Scanner::supported(kernel))
+      continue;
+    const int scan_iterations = std::max(1, iterations / 100);
+    const auto ns = NanosecondsPerCall(scan_iterations, [&] {
+      Scanner scanner(buffer, '\r', ':', kernel);
+      size_t count = 0;
+      while (scanner.next() != Scanner::npos)
+        ++count;
+      sink = count;
+    });
+    std::cout << name << '\t' << buffer.size() / ns << '\n';
+  }
+
+  return EXIT_SUCCESS;
+}
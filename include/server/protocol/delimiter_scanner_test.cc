@@ -0,0 +1,81 @@
+//
+// Tests for network::DelimiterScanner.
+//
+
+#include "server/protocol/delimiter_scanner.h"
+#include "server/protocol/protocol.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+std::vector<size_t> Scan(std::string_view str, char a, char b, network::DelimiterScanner::Kernel kernel) {
+  std::vector<size_t> result;
+  network::DelimiterScanner scanner(str, a, b, kernel);
+  for (auto p = scanner.next(); p != network::DelimiterScanner::npos; p = scanner.next())
+    result.emplace_back(p);
+  return result;
+}
+
+std::vector<size_t> Naive(std::string_view str, char a, char b) {
+  std::vector<size_t> result;
+  for (size_t i = 0; i < str.size(); ++i) {
+    if (str[i] == a || str[i] == b)
+      result.emplace_back(i);
+  }
+  return result;
+}
+
+int main() {
+  using Scanner = network::DelimiterScanner;
+  const Scanner::Kernel kernels[] = {Scanner::kScalar, Scanner::kSSE2, Scanner::kAVX2};
+
+  { // Every kernel agrees with a naive search, for every length around block edges
+    std::mt19937 rng(42);
+    const char alphabet[] = "ab:\r\n\0\xff";
+    for (size_t size = 0; size < 300; ++size) {
+      std::string str(size, '\0');
+      for (auto& c : str)
+        c = alphabet[rng() % (sizeof(alphabet) - 1)];
+
+      for (const auto kernel : kernels) {
+        if (!Scanner::supported(kernel))
+          continue;
+        if (Scan(str, '\r', ':', kernel) != Naive(str, '\r', ':')) TEST_FAIL;
+        if (Scan(str, '\0', '\xff', kernel) != Naive(str, '\0', '\xff')) TEST_FAIL;
+      }
+    }
+  }
+
+  { // Seek skips earlier matches
+    const std::string str = "a:b:c:d" + std::string(100, ' ') + ":";
+    Scanner scanner(str, ':', ':');
+    if (scanner.next() != 1) TEST_FAIL;
+    scanner.seek(4);
+    if (scanner.next() != 5) TEST_FAIL;
+    if (scanner.next() != str.size() - 1) TEST_FAIL;
+    if (scanner.next() != Scanner::npos) TEST_FAIL;
+  }
+
+  { // Separators sharing bytes with values
+    network::BasicProtocol<1024, network::BasicPacketGenerator<network::StringPacket>> protocol(": ", "\r\n");
+    if (!protocol.parse("Host: localhost:8000\r\nA: b: c\r\n\r\nx: y\r\n")) TEST_FAIL;
+    if (protocol.header().at("Host") != "localhost:8000") TEST_FAIL;
+    if (protocol.header().at("A") != "b: c") TEST_FAIL;
+    if (protocol.content() != "x: y\r\n") TEST_FAIL;
+
+    if (protocol.parse("NoSeparator\r\n\r\n")) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
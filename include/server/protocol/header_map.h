@@ -0,0 +1,258 @@
+//
+// Flat, insertion-ordered header fields with case-insensitive lookup.
+//
+
+#ifndef SERVER_NETWORK_HEADER_MAP_H_
+#define SERVER_NETWORK_HEADER_MAP_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+#include "server/protocol/config.h"
+
+namespace network {
+
+constexpr char ToLowerAscii(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+constexpr bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (std::string_view::size_type i = 0; i < a.size(); ++i) {
+    if (ToLowerAscii(a[i]) != ToLowerAscii(b[i]))
+      return false;
+  }
+  return true;
+}
+
+// Whether a comma-separated header value such as "keep-alive, Upgrade" lists
+// `token`, ignoring case and the whitespace around each element.
+constexpr bool HasToken(std::string_view list, std::string_view token) {
+  while (!list.empty()) {
+    const auto comma = list.find(',');
+    auto element = list.substr(0, comma);
+    while (!element.empty() && (element.front() == ' ' || element.front() == '\t'))
+      element.remove_prefix(1);
+    while (!element.empty() && (element.back() == ' ' || element.back() == '\t'))
+      element.remove_suffix(1);
+    if (EqualsIgnoreCase(element, token))
+      return true;
+    if (comma == std::string_view::npos)
+      break;
+    list.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// Header fields kept in one contiguous array, in the order they were added.
+// A message rarely has more than a dozen fields, so a linear scan that
+// compares lengths first beats hashing every name and allocating a node per
+// field. Names are matched case-insensitively, and a name may appear several
+// times (Set-Cookie, for instance); find() returns the first occurrence.
+//
+// The first kInlineCapacity fields live in the object itself, so a typical
+// message allocates nothing for its field array whatever the memory resource.
+// Only more fields, and names or values too long for the small string
+// buffer, take memory from the resource.
+class HeaderMap {
+ public:
+  using string_type = std::pmr::string;
+  using key_type = string_type;
+  using mapped_type = string_type;
+  using value_type = std::pair<key_type, mapped_type>;
+  using iterator = value_type*;
+  using const_iterator = const value_type*;
+  using size_type = size_t;
+  using allocator_type = std::pmr::polymorphic_allocator<value_type>;
+
+  enum {
+    kInlineCapacity = 16,
+  };
+
+  explicit HeaderMap(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : allocator_(resource) {}
+
+  // Copies take the default resource, as pmr containers do
+  HeaderMap(const HeaderMap& other) {
+    for (const auto& [name, value] : other)
+      Append(name, value);
+  }
+
+  HeaderMap(HeaderMap&& other) noexcept : allocator_(other.allocator_) { Take(other); }
+
+  HeaderMap& operator=(const HeaderMap& other) {
+    if (this != &other) {
+      clear();
+      for (const auto& [name, value] : other)
+        Append(name, value);
+    }
+    return *this;
+  }
+
+  HeaderMap& operator=(HeaderMap&& other) noexcept {
+    if (this != &other) {
+      clear();
+      Take(other);
+    }
+    return *this;
+  }
+
+  ~HeaderMap() {
+    clear();
+    Deallocate();
+  }
+
+  NETWORK_NODISCARD iterator find(std::string_view name) {
+    return std::find_if(begin(), end(), [name](const value_type& field) {
+      return EqualsIgnoreCase(field.first, name);
+    });
+  }
+
+  NETWORK_NODISCARD const_iterator find(std::string_view name) const {
+    return const_cast<HeaderMap*>(this)->find(name);
+  }
+
+  NETWORK_NODISCARD bool contains(std::string_view name) const { return find(name) != end(); }
+
+  NETWORK_NODISCARD size_type count(std::string_view name) const {
+    return std::count_if(begin(), end(), [name](const value_type& field) {
+      return EqualsIgnoreCase(field.first, name);
+    });
+  }
+
+  // The first value of `name`. Throws std::out_of_range if there is none.
+  NETWORK_NODISCARD const mapped_type& at(std::string_view name) const {
+    const auto it = find(name);
+    if (it == end())
+      throw std::out_of_range("HeaderMap::at");
+    return it->second;
+  }
+
+  // Calls f(value) for every field named `name`, in order.
+  template<typename F>
+  void for_each(std::string_view name, F&& f) const {
+    for (const auto& field : *this) {
+      if (EqualsIgnoreCase(field.first, name))
+        f(std::string_view(field.second));
+    }
+  }
+
+  // Appends a field, keeping any earlier one with the same name.
+  iterator insert(std::string_view name, std::string_view value) {
+    return Append(name, value);
+  }
+
+  // Replaces the value of the first field named `name` and removes the
+  // others, or appends a new field.
+  iterator insert_or_assign(std::string_view name, std::string_view value) {
+    const auto it = find(name);
+    if (it == end())
+      return insert(name, value);
+    it->second.assign(value.data(), value.size());
+    Truncate(std::remove_if(it + 1, end(), [name](const value_type& field) {
+      return EqualsIgnoreCase(field.first, name);
+    }));
+    return it;
+  }
+
+  // Removes every field named `name`. Returns the number removed.
+  size_type erase(std::string_view name) {
+    const auto size = size_;
+    Truncate(std::remove_if(begin(), end(), [name](const value_type& field) {
+      return EqualsIgnoreCase(field.first, name);
+    }));
+    return size - size_;
+  }
+
+  // Keeps the array, inline or not, for the next fields.
+  void clear() { Truncate(begin()); }
+
+  NETWORK_NODISCARD iterator begin() { return data_; }
+  NETWORK_NODISCARD iterator end() { return data_ + size_; }
+  NETWORK_NODISCARD const_iterator begin() const { return data_; }
+  NETWORK_NODISCARD const_iterator end() const { return data_ + size_; }
+
+  NETWORK_NODISCARD size_type size() const { return size_; }
+  NETWORK_NODISCARD bool empty() const { return size_ == 0; }
+  NETWORK_NODISCARD size_type capacity() const { return capacity_; }
+  // Whether the fields are still held in the object itself
+  NETWORK_NODISCARD bool is_inline() const { return data_ == InlineData(); }
+
+  NETWORK_NODISCARD allocator_type get_allocator() const { return allocator_; }
+
+ private:
+  NETWORK_NODISCARD value_type* InlineData() { return reinterpret_cast<value_type*>(inline_); }
+  NETWORK_NODISCARD const value_type* InlineData() const { return reinterpret_cast<const value_type*>(inline_); }
+
+  template<typename Name, typename Value>
+  iterator Append(Name&& name, Value&& value) {
+    if (size_ == capacity_)
+      Grow();
+    auto* field = data_ + size_;
+    new (field) value_type(std::piecewise_construct,
+                           std::forward_as_tuple(std::forward<Name>(name), allocator_),
+                           std::forward_as_tuple(std::forward<Value>(value), allocator_));
+    ++size_;
+    return field;
+  }
+
+  // Moves the fields to an array twice as large, taken from the resource
+  void Grow() {
+    const auto capacity = capacity_ * 2;
+    auto* data = allocator_.allocate(capacity);
+    for (size_type i = 0; i < size_; ++i) {
+      new (data + i) value_type(std::move(data_[i]));
+      data_[i].~value_type();
+    }
+    Deallocate();
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  // Destroys the fields from `first` on
+  void Truncate(iterator first) {
+    for (auto it = first; it != end(); ++it)
+      it->~value_type();
+    size_ = first - data_;
+  }
+
+  void Deallocate() {
+    if (!is_inline())
+      allocator_.deallocate(data_, capacity_);
+    data_ = InlineData();
+    capacity_ = kInlineCapacity;
+  }
+
+  // Takes the fields of `other`, which is left empty: its array if it is on
+  // the same resource, one by one otherwise.
+  void Take(HeaderMap& other) {
+    if (!other.is_inline() && allocator_ == other.allocator_) {
+      Deallocate();
+      data_ = std::exchange(other.data_, other.InlineData());
+      size_ = std::exchange(other.size_, 0);
+      capacity_ = std::exchange(other.capacity_, kInlineCapacity);
+      return;
+    }
+    for (auto& [name, value] : other)
+      Append(std::move(name), std::move(value));
+    other.clear();
+  }
+
+  allocator_type allocator_;
+  value_type* data_ = InlineData();
+  size_type size_ = 0;
+  size_type capacity_ = kInlineCapacity;
+  alignas(value_type) unsigned char inline_[kInlineCapacity * sizeof(value_type)];
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_HEADER_MAP_H_
@@ -0,0 +1,198 @@
+//
+// Header storage benchmark: the unordered_map plus insertion-order vector that
+// BasicProtocol used to keep vs. the flat HeaderMap, for filling the fields
+// of a parsed message, looking a few of them up, and serializing them in order,
+// and the allocations each makes for a message without an arena.
+//
+// usage: header_map_benchmark [iterations]
+//
+
+#include "server/protocol/arena.h"
+#include "server/protocol/header_map.h"
+#include "server/protocol/http_protocol.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// The previous header storage, kept as a baseline.
+struct LegacyHeaders {
+  using map_type = std::pmr::unordered_map<std::pmr::string, std::pmr::string>;
+
+  explicit LegacyHeaders(std::pmr::memory_resource* resource) : map(resource), sequence(resource) {}
+
+  void insert(std::string_view name, std::string_view value) {
+    const auto it = map.find(std::pmr::string(name, map.get_allocator()));
+    if (it != map.end()) {
+      it->second = value;
+      std::swap(*std::find(sequence.begin(), sequence.end(), it), sequence.back());
+      return;
+    }
+    sequence.emplace_back(map.emplace(std::pmr::string(name, map.get_allocator()),
+                                      std::pmr::string(value, map.get_allocator())).first);
+  }
+
+  const std::pmr::string* find(std::string_view name) const {
+    const auto it = map.find(std::pmr::string(name, map.get_allocator()));
+    return it == map.end() ? nullptr : &it->second;
+  }
+
+  map_type map;
+  std::pmr::vector<map_type::iterator> sequence;
+};
+
+std::vector<std::pair<std::string, std::string>> MakeFields(int count) {
+  std::vector<std::pair<std::string, std::string>> fields = {
+    {"Host", "3.37.112.35:8085"},
+    {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 Chrome/118.0"},
+    {"Accept", "application/json, text/plain, */*"},
+    {"Accept-Language", "ko-KR,ko;q=0.9,en-US;q=0.8,en;q=0.7"},
+    {"Connection", "keep-alive"},
+    {"from_time", "1667768091000"},
+  };
+  for (int i = static_cast<int>(fields.size()); i < count; ++i)
+    fields.emplace_back("X-Custom-Header-" + std::to_string(i), std::string(24, 'v'));
+  fields.resize(count);
+  return fields;
+}
+
+template<typename F>
+double NanosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+// Counts the allocations made through it
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  size_t allocations = 0;
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    ++allocations;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+volatile size_t sink;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 200'000;
+  const std::string_view lookups[] = {"Host", "Connection", "from_time", "Content-Length"};
+
+  std::cout << "fields\tlegacy fill+find ns\tflat fill+find ns\tlegacy build ns\tflat build ns\n";
+  for (const int count : {4, 8, 16, 32}) {
+    const auto fields = MakeFields(count);
+
+    const auto legacy_fill_ns = NanosecondsPerCall(iterations, [&] {
+      network::Arena arena;
+      LegacyHeaders headers(arena.resource());
+      for (const auto& [name, value] : fields)
+        headers.insert(name, value);
+      size_t found = 0;
+      for (const auto name : lookups)
+        found += headers.find(name) != nullptr;
+      sink = found;
+    });
+
+    const auto flat_fill_ns = NanosecondsPerCall(iterations, [&] {
+      network::Arena arena;
+      network::HeaderMap headers(arena.resource());
+      for (const auto& [name, value] : fields)
+        headers.insert(name, value);
+      size_t found = 0;
+      for (const auto name : lookups)
+        found += headers.find(name) != headers.end();
+      sink = found;
+    });
+
+    LegacyHeaders legacy(std::pmr::get_default_resource());
+    network::HeaderMap flat;
+    for (const auto& [name, value] : fields) {
+      legacy.insert(name, value);
+      flat.insert(name, value);
+    }
+    std::string out;
+    out.reserve(64 * 1024);
+
+    const auto legacy_build_ns = NanosecondsPerCall(iterations, [&] {
+      out.clear();
+      for (const auto it : legacy.sequence)
+        out.append(it->first).append(": ").append(it->second).append("\r\n");
+      sink = out.size();
+    });
+
+    const auto flat_build_ns = NanosecondsPerCall(iterations, [&] {
+      out.clear();
+      for (const auto& [name, value] : flat)
+        out.append(name).append(": ").append(value).append("\r\n");
+      sink = out.size();
+    });
+
+    std::cout << count << "\t" << legacy_fill_ns << "\t\t\t" << flat_fill_ns << "\t\t\t"
+              << legacy_build_ns << "\t\t" << flat_build_ns << '\n';
+  }
+
+  // Names and values longer than the small string buffer allocate in both;
+  // the difference is the storage of the fields themselves
+  std::cout << "\nfields\tlegacy allocations\tflat allocations (default resource)\n";
+  for (const int count : {4, 8, 16, 32}) {
+    const auto fields = MakeFields(count);
+    CountingResource legacy_resource, flat_resource;
+    {
+      LegacyHeaders legacy(&legacy_resource);
+      network::HeaderMap flat(&flat_resource);
+      for (const auto& [name, value] : fields) {
+        legacy.insert(name, value);
+        flat.insert(name, value);
+      }
+    }
+    std::cout << count << "\t" << legacy_resource.allocations << "\t\t\t" << flat_resource.allocations << '\n';
+  }
+
+  // End to end through HTTPProtocol
+  std::string request = "GET /chat/history HTTP/1.1\r\n";
+  for (const auto& [name, value] : MakeFields(8))
+    request += name + ": " + value + "\r\n";
+  request += "\r\n";
+
+  const auto parse_ns = NanosecondsPerCall(iterations, [&] {
+    network::Arena arena;
+    network::HTTPProtocol protocol(arena.resource());
+    protocol.parse(request);
+    sink = protocol.header().find("from_time")->second.size();
+  });
+
+  const auto build_ns = NanosecondsPerCall(iterations, [&] {
+    network::Arena arena;
+    network::HTTPProtocol protocol(arena.resource());
+    protocol.response(200, "OK");
+    protocol.add_header("Server", "Apache");
+    protocol.add_header("Content-Length", 1234);
+    protocol.add_header("Connection", "keep-alive");
+    protocol.add_header("Keep-Alive", "timeout=30");
+    sink = protocol.build().GenerateNext()->size();
+  });
+
+  std::cout << "\nHTTPProtocol parse (8 fields) ns\t" << parse_ns
+            << "\nHTTPProtocol response build ns\t\t" << build_ns << '\n';
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+//
+// Tests for network::HeaderMap and its use in network::BasicProtocol.
+//
+
+#include "server/protocol/arena.h"
+#include "server/protocol/header_map.h"
+#include "server/protocol/http_protocol.h"
+
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int main() {
+  { // Lookup ignores case, iteration keeps insertion order
+    network::HeaderMap headers;
+    headers.insert("Host", "localhost");
+    headers.insert("content-length", "15");
+    headers.insert("Accept", "*/*");
+
+    if (headers.size() != 3) TEST_FAIL;
+    if (headers.find("HOST") == headers.end() || headers.find("HOST")->second != "localhost") TEST_FAIL;
+    if (headers.at("Content-Length") != "15") TEST_FAIL;
+    if (headers.find("Hos") != headers.end() || headers.contains("Hosts")) TEST_FAIL;
+
+    std::string order;
+    for (const auto& [name, value] : headers)
+      order += name + ';';
+    if (order != "Host;content-length;Accept;") TEST_FAIL;
+
+    bool thrown = false;
+    try {
+      (void)headers.at("Missing");
+    } catch (const std::out_of_range&) {
+      thrown = true;
+    }
+    if (!thrown) TEST_FAIL;
+  }
+
+  { // Repeated names keep every value until replaced
+    network::HeaderMap headers;
+    headers.insert("Set-Cookie", "a=1");
+    headers.insert("Server", "Apache");
+    headers.insert("set-cookie", "b=2");
+
+    if (headers.count("SET-COOKIE") != 2) TEST_FAIL;
+    if (headers.find("Set-Cookie")->second != "a=1") TEST_FAIL;
+    std::vector<std::string> values;
+    headers.for_each("Set-Cookie", [&values](std::string_view value) { values.emplace_back(value); });
+    if (values != std::vector<std::string>{"a=1", "b=2"}) TEST_FAIL;
+
+    const auto it = headers.insert_or_assign("SET-COOKIE", "c=3");
+    if (it != headers.begin() || it->second != "c=3") TEST_FAIL;
+    if (headers.count("Set-Cookie") != 1 || headers.size() != 2) TEST_FAIL;
+
+    headers.insert_or_assign("Date", "today");
+    if (headers.size() != 3 || (headers.end() - 1)->first != "Date") TEST_FAIL;
+
+    if (headers.erase("server") != 1 || headers.contains("Server")) TEST_FAIL;
+    headers.clear();
+    if (!headers.empty()) TEST_FAIL;
+  }
+
+  { // The first fields live in the object; more take the resource
+    network::HeaderMap headers(std::pmr::null_memory_resource());
+    for (int i = 0; i < network::HeaderMap::kInlineCapacity; ++i)
+      headers.insert("X-" + std::to_string(i), "short value");
+    if (!headers.is_inline() || headers.size() != network::HeaderMap::kInlineCapacity) TEST_FAIL;
+    bool thrown = false;
+    try {
+      headers.insert("X-Overflow", "v");
+    } catch (const std::bad_alloc&) {
+      thrown = true;
+    }
+    if (!thrown || headers.size() != network::HeaderMap::kInlineCapacity) TEST_FAIL;
+
+    network::Arena arena;
+    network::HeaderMap spilled(arena.resource());
+    for (int i = 0; i < 40; ++i)
+      spilled.insert("X-" + std::to_string(i), std::to_string(i));
+    if (spilled.is_inline() || spilled.size() != 40 || spilled.at("x-39") != "39") TEST_FAIL;
+    if (spilled.erase("X-0") != 1 || spilled.begin()->first != "X-1") TEST_FAIL;
+    spilled.clear();
+    if (!spilled.empty() || spilled.capacity() < 40) TEST_FAIL;
+  }
+
+  { // Copies and moves keep the fields and their order
+    network::Arena arena;
+    for (const int count : {3, 20}) {
+      network::HeaderMap headers(arena.resource());
+      for (int i = 0; i < count; ++i)
+        headers.insert("Field-" + std::to_string(i), "a value too long for the small string buffer");
+      const network::HeaderMap copy(headers);
+      if (copy.size() != headers.size() || copy.get_allocator().resource() != std::pmr::get_default_resource()) TEST_FAIL;
+
+      network::HeaderMap moved(std::move(headers));
+      if (!headers.empty() || moved.size() != static_cast<size_t>(count)) TEST_FAIL;
+      if (moved.get_allocator().resource() != arena.resource()) TEST_FAIL;
+      if (std::string_view((moved.end() - 1)->first) != "Field-" + std::to_string(count - 1)) TEST_FAIL;
+
+      network::HeaderMap assigned;
+      assigned.insert("Old", "field");
+      assigned = std::move(moved);
+      if (assigned.contains("Old") || assigned.size() != copy.size()) TEST_FAIL;
+      if (assigned.get_allocator().resource() != std::pmr::get_default_resource()) TEST_FAIL;
+      assigned = copy;
+      for (size_t i = 0; i < copy.size(); ++i) {
+        if (assigned.begin()[i] != copy.begin()[i]) TEST_FAIL;
+      }
+    }
+  }
+
+  { // Protocol objects keep repeated fields in order on parse and build
+    network::Arena arena(std::pmr::null_memory_resource());
+    network::HTTPProtocol protocol(arena.resource());
+    if (!protocol.parse("HTTP/1.1 200 OK\r\n"
+                        "Set-Cookie: a=1\r\n"
+                        "Content-Type: text/plain\r\n"
+                        "Set-Cookie: b=2\r\n"
+                        "\r\n"
+                        "body")) TEST_FAIL;
+    if (protocol.header().count("set-cookie") != 2) TEST_FAIL;
+    if (protocol.header().find("content-type")->second != "text/plain") TEST_FAIL;
+
+    network::HTTPProtocol response(arena.resource());
+    response.response(200, "OK");
+    response.add_header("Set-Cookie", "a=1");
+    response.add_header("Set-Cookie", "b=2");
+    response.set_content("body", "text/plain");
+    response.set_header("content-type", "text/html");
+    if (response.build().GenerateNext()->to_string() != "HTTP/1.1 200 OK\r\n"
+                                                        "Set-Cookie: a=1\r\n"
+                                                        "Set-Cookie: b=2\r\n"
+                                                        "Content-Type: text/html\r\n"
+                                                        "\r\n"
+                                                        "body") TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
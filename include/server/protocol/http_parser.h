@@ -0,0 +1,336 @@
+//
+// Resumable HTTP/1.1 request parser working in place on the receive buffer.
+//
+
+#ifndef SERVER_NETWORK_HTTP_PARSER_H_
+#define SERVER_NETWORK_HTTP_PARSER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "server/protocol/chunked_encoding.h"
+#include "server/protocol/delimiter_scanner.h"
+#include "server/protocol/header_map.h"
+#include "server/protocol/http_protocol.h"
+
+namespace network {
+
+// Feed the parser with everything received so far for the current request:
+//
+//   HTTPRequestParser parser;
+//   while (parser.parse(buffer) == HTTPRequestParser::kNeedMore)
+//     buffer += read_more();
+//
+// Only bytes that were not examined by an earlier call are scanned again, and
+// no byte is copied: the start line, headers and content are handed out as
+// views into the buffer given to the last parse() call. The buffer may be
+// reallocated between calls, but it must keep its contents and must outlive
+// any view taken from the parser. The one exception is a chunked content,
+// which is decoded into storage of the parser as it arrives.
+class HTTPRequestParser {
+ public:
+  enum Result {
+    kNeedMore,
+    kComplete,
+    kError,
+  };
+
+  using size_type = std::string_view::size_type;
+  static constexpr size_type npos = std::string_view::npos;
+  using header_value_type = std::pair<std::string_view, std::string_view>;
+
+  static constexpr size_type kMaxHeaderSize = 64 * 1024;
+  static constexpr size_type kMaxContentSize = 8 * 1024 * 1024;
+
+  Result parse(std::string_view buffer) {
+    base_ = buffer.data();
+
+    // Line ends and header colons are found in the same pass
+    DelimiterScanner scanner(buffer, '\n', ':');
+    scanner.seek(scan_pos_);
+
+    while (true) {
+      switch (state_) {
+        case kStartLineState:
+        case kHeaderState: {
+          const auto line = NextLine(buffer, scanner);
+          if (!line) {
+            if (buffer.size() > kMaxHeaderSize) {
+              Fail("Header section too large");
+              return kError;
+            }
+            return kNeedMore;
+          }
+          // Complete lines count too, however short each of them is
+          if (line_begin_ > kMaxHeaderSize) {
+            Fail("Header section too large");
+            return kError;
+          }
+
+          const auto ok = state_ == kStartLineState ? ParseStartLine(*line) : ParseHeaderLine(*line);
+          if (!ok)
+            return kError;
+          break;
+        }
+
+        case kContentState:
+          if (buffer.size() - content_.offset < content_.size)
+            return kNeedMore;
+          state_ = kCompleteState;
+          return kComplete;
+
+        case kChunkedState:
+          switch (chunked_.decode(buffer.substr(content_.offset))) {
+            case ChunkedDecoder::kNeedMore:
+              return kNeedMore;
+            case ChunkedDecoder::kError:
+              Fail(chunked_.error());
+              return kError;
+            case ChunkedDecoder::kComplete:
+              state_ = kCompleteState;
+              return kComplete;
+          }
+          break;
+
+        case kCompleteState:
+          return kComplete;
+
+        case kErrorState:
+          return kError;
+      }
+    }
+  }
+
+  // Prepares for the next request. Keeps allocated header storage.
+  void reset() {
+    state_ = kStartLineState;
+    scan_pos_ = 0;
+    line_begin_ = 0;
+    colon_pos_ = npos;
+    line_colon_ = npos;
+    method_ = target_ = version_ = content_ = {};
+    headers_.clear();
+    known_mask_ = 0;
+    error_ = nullptr;
+    is_chunked_ = false;
+    chunked_.reset();
+  }
+
+  NETWORK_NODISCARD std::string_view method()  const { return view(method_);  }
+  NETWORK_NODISCARD std::string_view target()  const { return view(target_);  }
+  NETWORK_NODISCARD std::string_view version() const { return view(version_); }
+  NETWORK_NODISCARD std::string_view content() const { return is_chunked_ ? chunked_.content() : view(content_); }
+
+  NETWORK_NODISCARD size_type header_count() const { return headers_.size(); }
+  NETWORK_NODISCARD header_value_type header(size_type index) const {
+    return {view(headers_[index].first), view(headers_[index].second)};
+  }
+
+  // First value of a well-known header, without looking at any name.
+  NETWORK_NODISCARD std::optional<std::string_view> find(KnownHeader header) const {
+    const auto index = static_cast<size_t>(header);
+    if (index >= kKnownHeaderCount || !(known_mask_ & (1u << index)))
+      return {};
+    return view(known_[index]);
+  }
+
+  // Case-insensitive lookup of the first header named `name`.
+  NETWORK_NODISCARD std::optional<std::string_view> find(std::string_view name) const {
+    if (const auto header = ClassifyHeader(name); header != KnownHeader::kUnknown)
+      return find(header);
+    for (const auto& [key, value] : headers_) {
+      if (EqualsIgnoreCase(view(key), name))
+        return view(value);
+    }
+    return {};
+  }
+
+  // Number of bytes of the buffer taken by the request. Valid once complete.
+  NETWORK_NODISCARD size_type size() const {
+    return content_.offset + (is_chunked_ ? chunked_.size() : content_.size);
+  }
+
+  // Whether the content was sent with Transfer-Encoding: chunked
+  NETWORK_NODISCARD bool chunked() const { return is_chunked_; }
+
+  // The coding to answer this request with, from its Accept-Encoding header
+  NETWORK_NODISCARD ContentEncoding accepted_encoding() const {
+    const auto value = find(KnownHeader::kAcceptEncoding);
+    return value ? NegotiateEncoding(*value) : ContentEncoding::kIdentity;
+  }
+
+  NETWORK_NODISCARD bool complete() const { return state_ == kCompleteState; }
+  NETWORK_NODISCARD const char* error() const { return error_; }
+
+ private:
+  static constexpr size_t kKnownHeaderCount = static_cast<size_t>(KnownHeader::kCount);
+  static_assert(kKnownHeaderCount <= 32, "known_mask_ has one bit per known header");
+
+  enum State {
+    kStartLineState,
+    kHeaderState,
+    kContentState,
+    kChunkedState,
+    kCompleteState,
+    kErrorState,
+  };
+
+  // Offsets stay valid when the receive buffer is reallocated.
+  struct Slice {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+  };
+
+  NETWORK_NODISCARD std::string_view view(Slice s) const { return {base_ + s.offset, s.size}; }
+
+  static Slice MakeSlice(size_type begin, size_type end) {
+    return {static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin)};
+  }
+
+  // Returns the next line without its line ending, either "\r\n" or "\n".
+  // The position of its first colon is left in line_colon_.
+  std::optional<Slice> NextLine(std::string_view buffer, DelimiterScanner& scanner) {
+    for (auto p = scanner.next(); p != npos; p = scanner.next()) {
+      if (buffer[p] == ':') {
+        if (colon_pos_ == npos)
+          colon_pos_ = p;
+        continue;
+      }
+
+      size_type end = p;
+      if (end > line_begin_ && buffer[end - 1] == '\r')
+        --end;
+
+      const auto line = MakeSlice(line_begin_, end);
+      line_begin_ = scan_pos_ = p + 1;
+      line_colon_ = colon_pos_ < end ? colon_pos_ : npos;
+      colon_pos_ = npos;
+      return line;
+    }
+    scan_pos_ = buffer.size();
+    return {};
+  }
+
+  bool ParseStartLine(Slice line) {
+    // Tolerate empty lines preceding the request line (RFC 7230 3.5)
+    if (line.size == 0) {
+      if (line_begin_ > 1024)
+        return Fail("Too many empty lines");
+      return true;
+    }
+
+    const auto s = view(line);
+    const auto sp1 = s.find(' ');
+    const auto sp2 = sp1 == std::string_view::npos ? sp1 : s.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp1 == 0 || sp2 == sp1 + 1 || sp2 + 1 == s.size())
+      return Fail("Invalid request line");
+    if (s.find(' ', sp2 + 1) != std::string_view::npos)
+      return Fail("Invalid request line");
+
+    method_ = MakeSlice(line.offset, line.offset + sp1);
+    target_ = MakeSlice(line.offset + sp1 + 1, line.offset + sp2);
+    version_ = MakeSlice(line.offset + sp2 + 1, line.offset + s.size());
+    if (view(version_).substr(0, 5) != "HTTP/")
+      return Fail("Invalid HTTP version");
+
+    state_ = kHeaderState;
+    return true;
+  }
+
+  bool ParseHeaderLine(Slice line) {
+    if (line.size == 0)
+      return FinishHeader();
+
+    const auto s = view(line);
+    const auto colon = line_colon_ == npos ? npos : line_colon_ - line.offset;
+    if (colon == npos || colon == 0)
+      return Fail("Invalid header line");
+
+    size_type value_begin = colon + 1;
+    size_type value_end = s.size();
+    while (value_begin < value_end && (s[value_begin] == ' ' || s[value_begin] == '\t'))
+      ++value_begin;
+    while (value_end > value_begin && (s[value_end - 1] == ' ' || s[value_end - 1] == '\t'))
+      --value_end;
+
+    const auto value = MakeSlice(line.offset + value_begin, line.offset + value_end);
+    headers_.emplace_back(MakeSlice(line.offset, line.offset + colon), value);
+
+    // The first occurrence of a known header wins, as with find(). Content
+    // lengths that disagree leave the message length unknown (RFC 9112
+    // section 6.3).
+    const auto index = static_cast<size_t>(ClassifyHeader(s.substr(0, colon)));
+    if (index == static_cast<size_t>(KnownHeader::kContentLength) && (known_mask_ & (1u << index)) &&
+        view(known_[index]) != view(value))
+      return Fail("Conflicting Content-Length");
+    if (index < kKnownHeaderCount && !(known_mask_ & (1u << index))) {
+      known_mask_ |= 1u << index;
+      known_[index] = value;
+    }
+    return true;
+  }
+
+  bool FinishHeader() {
+    // Content-Length is not trusted next to Transfer-Encoding (RFC 9112
+    // section 6.1), and chunked is the only coding we can undo
+    if (const auto encoding = find(KnownHeader::kTransferEncoding)) {
+      if (find(KnownHeader::kContentLength))
+        return Fail("Both Content-Length and Transfer-Encoding");
+      if (!EqualsIgnoreCase(*encoding, "chunked"))
+        return Fail("Unsupported Transfer-Encoding");
+      content_ = {static_cast<uint32_t>(line_begin_), 0};
+      is_chunked_ = true;
+      state_ = kChunkedState;
+      return true;
+    }
+
+    size_type content_length = 0;
+    if (const auto value = find(KnownHeader::kContentLength)) {
+      if (value->empty())
+        return Fail("Invalid Content-Length");
+      for (const char c : *value) {
+        if (c < '0' || c > '9')
+          return Fail("Invalid Content-Length");
+        content_length = content_length * 10 + (c - '0');
+        if (content_length > kMaxContentSize)
+          return Fail("Content too large");
+      }
+    }
+
+    content_ = {static_cast<uint32_t>(line_begin_), static_cast<uint32_t>(content_length)};
+    state_ = kContentState;
+    return true;
+  }
+
+  bool Fail(const char* reason) {
+    error_ = reason;
+    state_ = kErrorState;
+    return false;
+  }
+
+  State state_ = kStartLineState;
+  size_type scan_pos_ = 0;
+  size_type line_begin_ = 0;
+  size_type colon_pos_ = npos;
+  size_type line_colon_ = npos;
+  const char* base_ = nullptr;
+
+  Slice method_;
+  Slice target_;
+  Slice version_;
+  Slice content_;
+  std::vector<std::pair<Slice, Slice>> headers_;
+  Slice known_[kKnownHeaderCount];
+  uint32_t known_mask_ = 0;
+  const char* error_ = nullptr;
+  bool is_chunked_ = false;
+  ChunkedDecoder chunked_{kMaxContentSize};
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_HTTP_PARSER_H_
@@ -0,0 +1,207 @@
+//
+// Tests for network::HTTPRequestParser.
+//
+
+#include "server/protocol/http_parser.h"
+
+#include <cctype>
+#include <iostream>
+#include <string>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+int main() {
+  using Parser = network::HTTPRequestParser;
+
+  { // Whole request at once
+    const std::string request =
+      "POST /user HTTP/1.1\r\n"
+      "Host: localhost:8085\r\n"
+      "content-length: 15\r\n"
+      "X-Empty:\r\n"
+      "\r\n"
+      "Hello, network!";
+
+    Parser parser;
+    if (parser.parse(request) != Parser::kComplete) TEST_FAIL;
+    if (parser.method() != "POST") TEST_FAIL;
+    if (parser.target() != "/user") TEST_FAIL;
+    if (parser.version() != "HTTP/1.1") TEST_FAIL;
+    if (parser.header_count() != 3) TEST_FAIL;
+    if (parser.header(0).first != "Host") TEST_FAIL;
+    if (parser.header(0).second != "localhost:8085") TEST_FAIL;
+    if (parser.find("Content-Length") != "15") TEST_FAIL;
+    if (parser.find("x-empty") != "") TEST_FAIL;
+    if (parser.find("Missing").has_value()) TEST_FAIL;
+    if (parser.content() != "Hello, network!") TEST_FAIL;
+    if (parser.size() != request.size()) TEST_FAIL;
+
+    // Views point into the buffer
+    if (parser.method().data() != request.data()) TEST_FAIL;
+  }
+
+  { // One byte at a time, buffer reallocated between calls
+    const std::string request =
+      "GET / HTTP/1.1\r\n"
+      "from_time: 1667768091000\r\n"
+      "\r\n";
+
+    Parser parser;
+    std::string buffer;
+    for (std::string::size_type i = 0; i < request.size(); ++i) {
+      buffer.push_back(request[i]);
+      buffer.shrink_to_fit();
+      const auto result = parser.parse(buffer);
+      if (i + 1 < request.size() && result != Parser::kNeedMore) TEST_FAIL;
+      if (i + 1 == request.size() && result != Parser::kComplete) TEST_FAIL;
+    }
+    if (parser.method() != "GET") TEST_FAIL;
+    if (parser.find("FROM_TIME") != "1667768091000") TEST_FAIL;
+    if (!parser.content().empty()) TEST_FAIL;
+  }
+
+  { // Content split across reads
+    std::string buffer = "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\n01234";
+    Parser parser;
+    if (parser.parse(buffer) != Parser::kNeedMore) TEST_FAIL;
+    buffer += "56789";
+    if (parser.parse(buffer) != Parser::kComplete) TEST_FAIL;
+    if (parser.content() != "0123456789") TEST_FAIL;
+  }
+
+  { // Bytes of a following request are not consumed
+    const std::string buffer = "GET /a HTTP/1.1\n\nGET /b HTTP/1.1\n\n";
+    Parser parser;
+    if (parser.parse(buffer) != Parser::kComplete) TEST_FAIL;
+    if (parser.target() != "/a") TEST_FAIL;
+    if (buffer.substr(parser.size()) != "GET /b HTTP/1.1\n\n") TEST_FAIL;
+
+    parser.reset();
+    if (parser.parse(std::string_view(buffer).substr(17)) != Parser::kComplete) TEST_FAIL;
+    if (parser.target() != "/b") TEST_FAIL;
+  }
+
+  { // Malformed requests
+    const char* requests[] = {
+      "GET\r\n\r\n",
+      "GET /\r\n\r\n",
+      "GET / HTTP/1.1 extra\r\n\r\n",
+      "GET / FTP/1.0\r\n\r\n",
+      "GET / HTTP/1.1\r\nNoColon\r\n\r\n",
+      "POST / HTTP/1.1\r\nContent-Length: 12a\r\n\r\n",
+      "POST / HTTP/1.1\r\nContent-Length: 99999999999\r\n\r\n",
+      "POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n",
+      "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n",
+      "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+      "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd",
+    };
+    for (const auto request : requests) {
+      Parser parser;
+      if (parser.parse(request) != Parser::kError) TEST_FAIL;
+      if (parser.error() == nullptr) TEST_FAIL;
+      if (parser.parse(request) != Parser::kError) TEST_FAIL;
+    }
+
+    Parser parser;
+    if (parser.parse(std::string(Parser::kMaxHeaderSize + 1, 'a')) != Parser::kError) TEST_FAIL;
+
+    // Many short lines add up to the same limit
+    std::string many = "GET / HTTP/1.1\r\n";
+    while (many.size() <= Parser::kMaxHeaderSize)
+      many += "X-A: b\r\n";
+    many += "\r\n";
+    parser.reset();
+    if (parser.parse(many) != Parser::kError) TEST_FAIL;
+
+    // A repeated Content-Length that agrees is taken
+    parser.reset();
+    if (parser.parse("POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\nabc") != Parser::kComplete) TEST_FAIL;
+    if (parser.content() != "abc") TEST_FAIL;
+  }
+
+  { // Well-known headers are classified while scanning
+    for (size_t i = 0; i < static_cast<size_t>(network::KnownHeader::kCount); ++i) {
+      const auto header = static_cast<network::KnownHeader>(i);
+      std::string upper(network::KnownHeaderName(header));
+      for (auto& c : upper)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+      if (network::ClassifyHeader(network::KnownHeaderName(header)) != header) TEST_FAIL;
+      if (network::ClassifyHeader(upper) != header) TEST_FAIL;
+    }
+    for (const auto name : {"", "H", "Hos", "Hosts", "X-From-Time", "Content-Lengthy", "Sec-WebSocket-Accept"}) {
+      if (network::ClassifyHeader(name) != network::KnownHeader::kUnknown) TEST_FAIL;
+    }
+
+    const std::string request =
+      "GET /history HTTP/1.1\r\n"
+      "HOST: first\r\n"
+      "X-Custom: custom\r\n"
+      "from_time: 42\r\n"
+      "host: second\r\n"
+      "\r\n";
+    Parser parser;
+    if (parser.parse(request) != Parser::kComplete) TEST_FAIL;
+    if (parser.find(network::KnownHeader::kHost) != "first") TEST_FAIL;
+    if (parser.find("Host") != "first") TEST_FAIL;
+    if (parser.find(network::KnownHeader::kFromTime) != "42") TEST_FAIL;
+    if (parser.find(network::KnownHeader::kContentLength)) TEST_FAIL;
+    if (parser.find(network::KnownHeader::kUnknown)) TEST_FAIL;
+    if (parser.find("x-custom") != "custom") TEST_FAIL;
+    if (parser.header_count() != 4) TEST_FAIL;
+
+    parser.reset();
+    if (parser.parse("GET / HTTP/1.1\r\n\r\n") != Parser::kComplete) TEST_FAIL;
+    if (parser.find(network::KnownHeader::kHost)) TEST_FAIL;
+  }
+
+  { // Chunked content is decoded, at once or one byte at a time
+    const std::string request =
+      "POST /chat HTTP/1.1\r\n"
+      "Transfer-Encoding: Chunked\r\n"
+      "\r\n"
+      "8\r\n{\"name\":\r\n"
+      "11;ext\r\n\"a\", \"chat\": \"b\"}\r\n"
+      "0\r\n"
+      "\r\n";
+    const std::string next = "GET / HTTP/1.1\r\n\r\n";
+
+    Parser parser;
+    const auto whole = request + next;
+    if (parser.parse(whole) != Parser::kComplete) TEST_FAIL;
+    if (!parser.chunked()) TEST_FAIL;
+    if (parser.content() != "{\"name\":\"a\", \"chat\": \"b\"}") TEST_FAIL;
+    if (parser.size() != request.size()) TEST_FAIL;
+
+    parser.reset();
+    std::string buffer;
+    for (std::string::size_type i = 0; i < request.size(); ++i) {
+      buffer.push_back(request[i]);
+      buffer.shrink_to_fit();
+      const auto result = parser.parse(buffer);
+      if (i + 1 < request.size() && result != Parser::kNeedMore) TEST_FAIL;
+      if (i + 1 == request.size() && result != Parser::kComplete) TEST_FAIL;
+    }
+    if (parser.content() != "{\"name\":\"a\", \"chat\": \"b\"}") TEST_FAIL;
+
+    // The next request is not chunked
+    parser.reset();
+    if (parser.parse(std::string_view(whole).substr(request.size())) != Parser::kComplete) TEST_FAIL;
+    if (parser.chunked() || !parser.content().empty()) TEST_FAIL;
+
+    // The size limit holds across chunks
+    parser.reset();
+    std::string large = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    for (size_t size = 0; size <= Parser::kMaxContentSize; size += 0x100000)
+      large += "100000\r\n" + std::string(0x100000, 'x') + "\r\n";
+    if (parser.parse(large) != Parser::kError) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
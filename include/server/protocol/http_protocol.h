@@ -5,10 +5,110 @@
 #ifndef SERVER_NETWORK_HTTP_PROTOCOL_H_
 #define SERVER_NETWORK_HTTP_PROTOCOL_H_
 
+#include <charconv>
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+#include <string_view>
+#include <system_error>
+
+#include "server/protocol/chunked_encoding.h"
+#include "server/protocol/content_encoding.h"
 #include "server/protocol/protocol.h"
 
 namespace network {
 
+// Header fields the server looks at on every request. Parsers classify names
+// into these slots while scanning, so reading one is an array access.
+enum class KnownHeader : uint8_t {
+  kHost,
+  kContentLength,
+  kContentType,
+  kConnection,
+  kKeepAlive,
+  kTransferEncoding,
+  kAccept,
+  kAcceptEncoding,
+  kContentEncoding,
+  kUserAgent,
+  kUpgrade,
+  kExpect,
+  kPrefer,
+  kSecWebSocketKey,
+  kSecWebSocketVersion,
+  kFromTime,
+  kCount,
+  kUnknown = kCount,
+};
+
+constexpr std::string_view kKnownHeaderNames[] = {
+  "Host",
+  "Content-Length",
+  "Content-Type",
+  "Connection",
+  "Keep-Alive",
+  "Transfer-Encoding",
+  "Accept",
+  "Accept-Encoding",
+  "Content-Encoding",
+  "User-Agent",
+  "Upgrade",
+  "Expect",
+  "Prefer",
+  "Sec-WebSocket-Key",
+  "Sec-WebSocket-Version",
+  "from_time",
+};
+static_assert(std::size(kKnownHeaderNames) == static_cast<size_t>(KnownHeader::kCount));
+
+constexpr std::string_view KnownHeaderName(KnownHeader header) {
+  return kKnownHeaderNames[static_cast<size_t>(header)];
+}
+
+namespace detail {
+
+// Perfect hash of the known names on their length and first and last
+// characters; MakeKnownHeaderSlots() fails to compile if two of them collide.
+constexpr size_t kKnownHeaderSlotCount = 32;
+
+constexpr size_t KnownHeaderHash(std::string_view name) {
+  return (name.size() * 2 + ToLowerAscii(name.front()) * 19 + ToLowerAscii(name.back())) % kKnownHeaderSlotCount;
+}
+
+struct KnownHeaderSlots {
+  KnownHeader slots[kKnownHeaderSlotCount];
+};
+
+constexpr KnownHeaderSlots MakeKnownHeaderSlots() {
+  KnownHeaderSlots table{};
+  for (auto& slot : table.slots)
+    slot = KnownHeader::kUnknown;
+  for (size_t i = 0; i < std::size(kKnownHeaderNames); ++i) {
+    auto& slot = table.slots[KnownHeaderHash(kKnownHeaderNames[i])];
+    if (slot != KnownHeader::kUnknown)
+      throw "Known header names collide; change KnownHeaderHash";
+    slot = static_cast<KnownHeader>(i);
+  }
+  return table;
+}
+
+constexpr KnownHeaderSlots kKnownHeaderSlots = MakeKnownHeaderSlots();
+
+} // namespace detail
+
+// Case-insensitive; kUnknown for any other name.
+constexpr KnownHeader ClassifyHeader(std::string_view name) {
+  if (name.empty())
+    return KnownHeader::kUnknown;
+  const auto header = detail::kKnownHeaderSlots.slots[detail::KnownHeaderHash(name)];
+  if (header == KnownHeader::kUnknown || !EqualsIgnoreCase(KnownHeaderName(header), name))
+    return KnownHeader::kUnknown;
+  return header;
+}
+
+static_assert(ClassifyHeader("content-length") == KnownHeader::kContentLength);
+static_assert(ClassifyHeader("Content-Lengths") == KnownHeader::kUnknown);
+
 template<size_t PacketSize>
 class BasicHTTPProtocol :
   public BasicProtocol<PacketSize, BasicPacketGenerator<StringPacket>> {
@@ -19,19 +119,27 @@ class BasicHTTPProtocol :
   using generator = typename base::generator;
   using string_type = typename base::string_type;
 
-  BasicHTTPProtocol() : base(": ", "\r\n") {}
+  explicit BasicHTTPProtocol(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : base(": ", "\r\n", resource),
+      start_line_(resource),
+      status_text_(resource),
+      http_version_(kHTTP_1_1, resource),
+      http_method_(resource),
+      request_target_(resource)
+  {}
 
-  BasicHTTPProtocol& request(string_type http_method, string_type request_target) {
+  BasicHTTPProtocol& request(std::string_view http_method, std::string_view request_target) {
     if (!start_line_.empty()) {
       base::error("Start line already exists!. Existing start line will be overwritten");
     }
     http_method_ = http_method;
     request_target_ = request_target;
-    start_line_ = http_method + " " + request_target + " " + http_version_;
+    start_line_.clear();
+    start_line_.append(http_method).append(" ").append(request_target).append(" ").append(http_version_);
     return *this;
   }
 
-  BasicHTTPProtocol& response(int status_code, string_type status_text = "") {
+  BasicHTTPProtocol& response(int status_code, std::string_view status_text = {}) {
     if (!start_line_.empty()) {
       base::error("Start line already exists!. Existing start line will be overwritten");
     }
@@ -42,30 +150,121 @@ class BasicHTTPProtocol :
     status_code_ = status_code;
     status_text_ = status_text;
 
-    start_line_ = http_version_ + " " + std::to_string(status_code) + " " + status_text;
+    char code[16];
+    const auto code_end = std::to_chars(code, code + sizeof(code), status_code).ptr;
+    start_line_.clear();
+    start_line_.append(http_version_).append(" ").append(code, code_end).append(" ").append(status_text);
     return *this;
   }
 
-  void set_content(string_type data, string_type content_type = "") {
+  void set_content(std::string_view data, std::string_view content_type = {}) {
     if (!content_type.empty()) {
-      base::add_header("Content-Type", std::move(content_type));
+      base::set_header("Content-Type", content_type);
+    }
+    base::set_content(data);
+  }
+
+  // With chunked set, the message is built with "Transfer-Encoding: chunked"
+  // and its content as one chunk followed by the last chunk. Content-Length
+  // must not be set.
+  void set_chunked(bool chunked = true) {
+    chunked_ = chunked;
+    if (chunked)
+      base::set_header("Transfer-Encoding", "chunked");
+    else
+      base::erase_header("Transfer-Encoding");
+  }
+
+  // Whether the message is built chunked, or was received chunked
+  NETWORK_NODISCARD bool chunked() const { return chunked_; }
+
+  // The coding to answer this request with, from its Accept-Encoding header
+  NETWORK_NODISCARD ContentEncoding accepted_encoding() const {
+    const auto& header = base::header();
+    const auto it = header.find(KnownHeaderName(KnownHeader::kAcceptEncoding));
+    return it == header.end() ? ContentEncoding::kIdentity : NegotiateEncoding(it->second);
+  }
+
+  // Compresses a content of at least `min_size` bytes with `encoding`, and
+  // sets Content-Encoding and Vary. A Content-Length already set is updated.
+  // Returns false, leaving the message as it is, for identity or when
+  // compression is not built in.
+  bool encode_content(ContentEncoding encoding, size_t min_size = 0, int level = Compressor::kDefaultLevel) {
+    if (base::content().size() < min_size)
+      return false;
+    // Never empty once compressed: there is at least a header
+    const auto compressed = Compress(base::content(), encoding, level);
+    if (compressed.empty())
+      return false;
+    base::content().assign(compressed.data(), compressed.size());
+    base::set_header("Content-Encoding", ContentEncodingName(encoding));
+    base::set_header("Vary", "Accept-Encoding");
+    const auto& header = base::header();
+    if (header.find(KnownHeaderName(KnownHeader::kContentLength)) != header.end()) {
+      base::erase_header("Content-Length");
+      base::add_header("Content-Length", compressed.size());
     }
-    base::set_content(std::move(data));
+    return true;
+  }
+
+  NETWORK_NODISCARD size_t serialized_size() const {
+    auto size = start_line_.size() + base::key_separator().size() + base::serialized_size();
+    if (chunked_)
+      size += ChunkedSize(base::content().size()) - base::content().size() + kLastChunk.size();
+    return size;
+  }
+
+  size_t serialize_to(char* out, size_t capacity) const {
+    const auto size = serialized_size();
+    if (size <= capacity)
+      WriteTo(out);
+    return size;
+  }
+
+  void build_to(std::string& out) const {
+    const auto offset = out.size();
+    out.resize(offset + serialized_size());
+    WriteTo(out.data() + offset);
   }
 
-  generator build(std::stringstream ss = std::stringstream()) {
-    ss << start_line_ << base::key_separator();
-    return base::build(std::move(ss));
+  NETWORK_NODISCARD generator build() const {
+    typename generator::string_type out;
+    build_to(out);
+    return generator(packet_size, std::move(out));
   }
 
-  bool parse(const string_type& str) override {
+  bool parse(std::string_view str) override {
     // Parse request line
-    const auto p = str.find(base::key_separator(), 0);
+    const auto& separator = base::key_separator();
+    DelimiterScanner scanner(str, separator.front(), separator.front());
+    auto p = scanner.next();
+    while (p != std::string_view::npos && str.compare(p, separator.size(), separator) != 0)
+      p = scanner.next();
+    if (p == std::string_view::npos) {
+      base::error("Invalid HTTP format!");
+      return false;
+    }
     auto b = ParseStartLine(str.substr(0, p));
     if (!b) return false;
 
     // Parse header & content
-    return base::parse(str.substr(p + base::key_separator().size()));
+    chunked_ = false;
+    if (!base::parse(str.substr(p + base::key_separator().size())))
+      return false;
+
+    // A chunked content is decoded; anything behind its last chunk is dropped
+    const auto& header = base::header();
+    const auto encoding = header.find(KnownHeaderName(KnownHeader::kTransferEncoding));
+    if (encoding == header.end() || !HasToken(encoding->second, "chunked"))
+      return true;
+    ChunkedDecoder decoder;
+    if (decoder.decode(base::content()) != ChunkedDecoder::kComplete) {
+      base::error("Invalid chunked content! ", decoder.error() ? decoder.error() : "Incomplete");
+      return false;
+    }
+    base::content().assign(decoder.content().data(), decoder.content().size());
+    chunked_ = true;
+    return true;
   }
 
   NETWORK_NODISCARD int status_code() const { return status_code_; }
@@ -75,23 +274,43 @@ class BasicHTTPProtocol :
   NETWORK_NODISCARD const string_type& request_target() const { return request_target_; }
 
  private:
-  bool ParseStartLine(string_type start_line) {
-    const string_type delimiter = " ";
-    std::vector<string_type> tokens;
+  char* WriteTo(char* out) const {
+    out = base::Append(out, start_line_);
+    out = base::Append(out, base::key_separator());
+    if (!chunked_)
+      return base::WriteTo(out);
+
+    out = base::WriteHeaderTo(out);
+    if (const auto& content = base::content(); !content.empty()) {
+      out = WriteChunkHeader(out, content.size());
+      out = base::Append(out, content);
+      out = base::Append(out, "\r\n");
+    }
+    return base::Append(out, kLastChunk);
+  }
+
+  bool ParseStartLine(std::string_view start_line) {
+    constexpr std::string_view delimiter = " ";
+    // Only the first three tokens are kept; the rest belongs to the status text
+    std::string_view tokens[3];
+    size_t token_count = 0;
 
     ClearStartLine();
     start_line_ = start_line;
 
-    typename string_type::size_type p = 0;
+    DelimiterScanner scanner(start_line, delimiter.front(), delimiter.front());
+    std::string_view::size_type p = 0;
     while (true) {
-      const auto p2 = start_line.find(delimiter, p);
-      tokens.emplace_back(start_line.substr(p, p2 - p));
-      if (p2 == string_type::npos)
+      const auto p2 = scanner.next();
+      if (token_count < std::size(tokens))
+        tokens[token_count] = start_line.substr(p, p2 - p);
+      ++token_count;
+      if (p2 == std::string_view::npos)
         break;
       p = p2 + delimiter.size();
     }
 
-    if (tokens.size() < 3) {
+    if (token_count < 3) {
       base::error("Invalid start line '", start_line, "'!");
       return false;
     }
@@ -99,20 +318,17 @@ class BasicHTTPProtocol :
     // Response
     if (tokens[0].substr(0, 4) == "HTTP") {
       int status_code;
-      try {
-        status_code = std::stoi(tokens[1]);
-      } catch (...) {
+      const auto [ptr, ec] = std::from_chars(tokens[1].data(), tokens[1].data() + tokens[1].size(), status_code);
+      if (ec != std::errc() || ptr != tokens[1].data() + tokens[1].size()) {
         base::error("Invalid status code '", tokens[1], "'!");
         return false;
       }
 
-      http_version_ = std::move(tokens[0]);
+      http_version_ = tokens[0];
       status_code_ = status_code;
-      for (int i = 2; i < tokens.size(); ++i) {
-        status_text_ += std::move(tokens[i]);
-      }
+      status_text_ = start_line.substr(tokens[0].size() + tokens[1].size() + 2 * delimiter.size());
     } else { // Request
-      if (tokens.size() != 3) {
+      if (token_count != 3) {
         base::error("Invalid request start line '", start_line, "'!");
         return false;
       }
@@ -136,9 +352,10 @@ class BasicHTTPProtocol :
   string_type start_line_;
   int status_code_ = -1;
   string_type status_text_;
-  string_type http_version_ = kHTTP_1_1;
+  string_type http_version_;
   string_type http_method_;
   string_type request_target_;
+  bool chunked_ = false;
 };
 
 using HTTPProtocol = BasicHTTPProtocol<65535>;
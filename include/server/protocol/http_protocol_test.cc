@@ -2,6 +2,7 @@
 // Created by YongGyu Lee on 2022/10/14.
 //
 
+#include "server/protocol/arena.h"
 #include "server/protocol/http_protocol.h"
 
 #include <iostream>
@@ -85,5 +86,85 @@ int main() {
                             "<h1>FORBIDDEN</h1>") TEST_FAIL;
   }
 
+  { // A protocol object backed by an arena never touches the upstream resource
+    network::Arena arena(std::pmr::null_memory_resource());
+    for (int i = 0; i < 3; ++i) {
+      {
+        network::HTTPProtocol protocol(arena.resource());
+        protocol.response(200, "OK");
+        protocol.add_header("Server", "Apache");
+        protocol.add_header("Content-Length", 1234567890123ULL);
+        protocol.add_header("Keep-Alive", std::string("timeout=30, a value longer than the small string buffer"));
+        protocol.set_content("Some content that does not fit in a small string either");
+        if (protocol.header().find("Content-Length")->second != "1234567890123") TEST_FAIL;
+
+        auto packet = protocol.build().GenerateNext();
+        if (packet->to_string() != "HTTP/1.1 200 OK\r\n"
+                                   "Server: Apache\r\n"
+                                   "Content-Length: 1234567890123\r\n"
+                                   "Keep-Alive: timeout=30, a value longer than the small string buffer\r\n"
+                                   "\r\n"
+                                   "Some content that does not fit in a small string either") TEST_FAIL;
+      }
+      arena.reset();
+    }
+
+    network::HTTPProtocol parser(arena.resource());
+    if (!parser.parse("GET /history HTTP/1.1\r\nfrom_time: 3\r\n\r\n")) TEST_FAIL;
+    if (parser.http_method() != "GET" || parser.request_target() != "/history") TEST_FAIL;
+    if (parser.header().find("from_time")->second != "3") TEST_FAIL;
+  }
+
+  { // The serialized size is exact, and a caller buffer is only written if it fits
+    network::HTTPProtocol protocol;
+    protocol.response(200, "OK");
+    protocol.add_header("Content-Length", 5);
+    protocol.set_content("hello");
+    const std::string expected = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+    if (protocol.serialized_size() != expected.size()) TEST_FAIL;
+
+    char small[8] = "unused";
+    if (protocol.serialize_to(small, sizeof(small)) != expected.size()) TEST_FAIL;
+    if (std::string_view(small) != "unused") TEST_FAIL;
+
+    char buffer[128];
+    const auto size = protocol.serialize_to(buffer, sizeof(buffer));
+    if (std::string_view(buffer, size) != expected) TEST_FAIL;
+
+    std::string out = "prefix";
+    protocol.build_to(out);
+    if (out != "prefix" + expected) TEST_FAIL;
+  }
+
+  { // Chunked messages carry their content as chunks
+    network::HTTPProtocol protocol;
+    protocol.response(200, "OK");
+    protocol.set_chunked();
+    protocol.set_content("hello, world");
+    const std::string expected = "HTTP/1.1 200 OK\r\n"
+                                 "Transfer-Encoding: chunked\r\n"
+                                 "\r\n"
+                                 "c\r\nhello, world\r\n0\r\n\r\n";
+    if (protocol.serialized_size() != expected.size()) TEST_FAIL;
+    std::string out;
+    protocol.build_to(out);
+    if (out != expected) TEST_FAIL;
+
+    // An empty content is only the last chunk
+    protocol.set_content("");
+    out.clear();
+    protocol.build_to(out);
+    if (out.size() != protocol.serialized_size() || out.substr(out.size() - 7) != "\r\n0\r\n\r\n") TEST_FAIL;
+
+    protocol.set_chunked(false);
+    if (protocol.chunked() || protocol.header().count("Transfer-Encoding") != 0) TEST_FAIL;
+
+    network::HTTPProtocol parser;
+    if (!parser.parse(expected)) TEST_FAIL;
+    if (!parser.chunked() || parser.content() != "hello, world") TEST_FAIL;
+    if (parser.parse("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel")) TEST_FAIL;
+    if (!parser.parse("HTTP/1.1 200 OK\r\n\r\n5\r\nhel") || parser.chunked()) TEST_FAIL;
+  }
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,293 @@
+//
+// Single-pass decoder for the one JSON shape clients post, without a DOM.
+//
+
+#ifndef SERVER_NETWORK_JSON_DECODER_H_
+#define SERVER_NETWORK_JSON_DECODER_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "server/protocol/config.h"
+#include "server/protocol/delimiter_scanner.h"
+
+namespace network {
+
+namespace detail {
+
+inline int HexDigit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+inline void AppendUTF8(std::string& out, uint32_t cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+} // namespace detail
+
+// Decodes a chat post, {"name": "...", "chat": "..."}:
+//
+//   ChatJsonDecoder decoder;
+//   if (decoder.parse(body))
+//     post(decoder.name(), decoder.chat());
+//   else
+//     ... hand the body to a full JSON parser
+//
+// Strings are found with DelimiterScanner, 64 bytes per step, and a string
+// without escapes is returned as a view into the input. Only escaped strings
+// are decoded, into buffers that keep their capacity across calls. Escapes
+// (\uXXXX with surrogate pairs included) become UTF-8; other bytes are taken
+// as they are, like jsoncpp does.
+//
+// parse() returns false for anything it does not handle: a root that is not
+// an object, a name or chat that is not a string, nested values, escaped
+// keys, lone surrogates, malformed input, trailing bytes. Whether such a body
+// is valid is left to the full parser, so both always agree. Fields other
+// than name and chat are skipped; a missing one is empty, and a repeated one
+// keeps its last value.
+class ChatJsonDecoder {
+ public:
+  bool parse(std::string_view json) {
+    p_ = json.data();
+    end_ = p_ + json.size();
+    name_ = chat_ = {};
+
+    SkipSpace();
+    if (!Consume('{'))
+      return false;
+    SkipSpace();
+    if (Consume('}'))
+      return Finish();
+
+    while (true) {
+      std::string_view key;
+      if (!ReadKey(key))
+        return false;
+      SkipSpace();
+      if (!Consume(':'))
+        return false;
+      SkipSpace();
+
+      bool ok;
+      if (key == "name")
+        ok = ReadString(name_, name_buffer_);
+      else if (key == "chat")
+        ok = ReadString(chat_, chat_buffer_);
+      else
+        ok = SkipValue();
+      if (!ok)
+        return false;
+
+      SkipSpace();
+      if (Consume('}'))
+        return Finish();
+      if (!Consume(','))
+        return false;
+      SkipSpace();
+    }
+  }
+
+  // Valid until the next parse(), and as long as the input of the last one
+  NETWORK_NODISCARD std::string_view name() const { return name_; }
+  NETWORK_NODISCARD std::string_view chat() const { return chat_; }
+
+ private:
+  bool Consume(char c) {
+    if (p_ == end_ || *p_ != c)
+      return false;
+    ++p_;
+    return true;
+  }
+
+  void SkipSpace() {
+    while (p_ != end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t'))
+      ++p_;
+  }
+
+  bool Finish() {
+    SkipSpace();
+    return p_ == end_;
+  }
+
+  // Keys are short and never escaped in practice
+  bool ReadKey(std::string_view& key) {
+    if (!Consume('"'))
+      return false;
+    const auto begin = p_;
+    while (p_ != end_ && *p_ != '"' && *p_ != '\\')
+      ++p_;
+    if (p_ == end_ || *p_ != '"')
+      return false;
+    key = std::string_view(begin, p_ - begin);
+    ++p_;
+    return true;
+  }
+
+  // A view into the input when the string has no escape, otherwise decoded
+  // into `buffer`
+  bool ReadString(std::string_view& out, std::string& buffer) {
+    if (!Consume('"'))
+      return false;
+    const std::string_view rest(p_, end_ - p_);
+    DelimiterScanner scanner(rest, '"', '\\');
+    auto pos = scanner.next();
+    if (pos == DelimiterScanner::npos)
+      return false;
+    if (rest[pos] == '"') {
+      out = rest.substr(0, pos);
+      p_ += pos + 1;
+      return true;
+    }
+
+    buffer.assign(rest.data(), pos);
+    while (true) {
+      // rest[pos] is a backslash
+      const auto escape_end = DecodeEscape(rest, pos + 1, buffer);
+      if (escape_end == DelimiterScanner::npos)
+        return false;
+      scanner.seek(escape_end);
+      const auto next = scanner.next();
+      if (next == DelimiterScanner::npos)
+        return false;
+      buffer.append(rest.data() + escape_end, next - escape_end);
+      pos = next;
+      if (rest[pos] == '"')
+        break;
+    }
+    out = buffer;
+    p_ += pos + 1;
+    return true;
+  }
+
+  // Decodes the escape at rest[pos], just behind its backslash. Returns the
+  // position after it, or npos.
+  static size_t DecodeEscape(std::string_view rest, size_t pos, std::string& out) {
+    if (pos == rest.size())
+      return DelimiterScanner::npos;
+    switch (rest[pos]) {
+      case '"': out += '"'; return pos + 1;
+      case '\\': out += '\\'; return pos + 1;
+      case '/': out += '/'; return pos + 1;
+      case 'b': out += '\b'; return pos + 1;
+      case 'f': out += '\f'; return pos + 1;
+      case 'n': out += '\n'; return pos + 1;
+      case 'r': out += '\r'; return pos + 1;
+      case 't': out += '\t'; return pos + 1;
+      case 'u': break;
+      default: return DelimiterScanner::npos;
+    }
+
+    uint32_t cp;
+    if (!ReadHex4(rest, pos + 1, cp))
+      return DelimiterScanner::npos;
+    pos += 5;
+    if (cp >= 0xDC00 && cp <= 0xDFFF)
+      return DelimiterScanner::npos;
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+      uint32_t low;
+      if (rest.substr(pos, 2) != "\\u" || !ReadHex4(rest, pos + 2, low) || low < 0xDC00 || low > 0xDFFF)
+        return DelimiterScanner::npos;
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+      pos += 6;
+    }
+    detail::AppendUTF8(out, cp);
+    return pos;
+  }
+
+  static bool ReadHex4(std::string_view rest, size_t pos, uint32_t& value) {
+    if (rest.size() - pos < 4)
+      return false;
+    value = 0;
+    for (size_t i = pos; i < pos + 4; ++i) {
+      const auto digit = detail::HexDigit(rest[i]);
+      if (digit < 0)
+        return false;
+      value = value * 16 + digit;
+    }
+    return true;
+  }
+
+  // Strings, numbers, true, false and null. Objects and arrays are left to
+  // the full parser.
+  bool SkipValue() {
+    if (p_ == end_)
+      return false;
+    switch (*p_) {
+      case '"': {
+        std::string_view ignored;
+        return ReadString(ignored, skip_buffer_);
+      }
+      case 't': return SkipLiteral("true");
+      case 'f': return SkipLiteral("false");
+      case 'n': return SkipLiteral("null");
+      default: return SkipNumber();
+    }
+  }
+
+  bool SkipLiteral(std::string_view literal) {
+    if (static_cast<size_t>(end_ - p_) < literal.size() || std::string_view(p_, literal.size()) != literal)
+      return false;
+    p_ += literal.size();
+    return true;
+  }
+
+  // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+  bool SkipNumber() {
+    const auto digits = [this] {
+      const auto begin = p_;
+      while (p_ != end_ && *p_ >= '0' && *p_ <= '9')
+        ++p_;
+      return p_ - begin;
+    };
+    Consume('-');
+    if (p_ == end_)
+      return false;
+    if (*p_ == '0')
+      ++p_;
+    else if (digits() == 0)
+      return false;
+    if (Consume('.') && digits() == 0)
+      return false;
+    if (p_ != end_ && (*p_ == 'e' || *p_ == 'E')) {
+      ++p_;
+      if (!Consume('+'))
+        Consume('-');
+      if (digits() == 0)
+        return false;
+    }
+    return true;
+  }
+
+  const char* p_ = nullptr;
+  const char* end_ = nullptr;
+  std::string_view name_;
+  std::string_view chat_;
+  std::string name_buffer_;
+  std::string chat_buffer_;
+  std::string skip_buffer_;
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_JSON_DECODER_H_
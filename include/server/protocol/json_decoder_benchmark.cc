@@ -0,0 +1,85 @@
+//
+// Decoding chat posts with Korean text: Json::Reader into a DOM, as the
+// server used to, Json::CharReader into a DOM, and ChatJsonDecoder.
+//
+// usage: json_decoder_benchmark [iterations]
+//
+
+#include "server/protocol/json_decoder.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+namespace {
+
+template<typename F>
+double NanosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile size_t sink;
+
+std::string Repeat(std::string_view text, size_t bytes) {
+  std::string out;
+  while (out.size() < bytes)
+    out += text;
+  return out;
+}
+
+void Run(const char* label, const std::string& json, int iterations) {
+  const auto reader_ns = NanosecondsPerCall(iterations, [&] {
+    Json::Value root;
+    Json::Reader reader;
+    reader.parse(json.data(), json.data() + json.size(), root);
+    sink = root["name"].asString().size() + root["chat"].asString().size();
+  });
+
+  Json::CharReaderBuilder builder;
+  const std::unique_ptr<Json::CharReader> char_reader(builder.newCharReader());
+  const auto char_reader_ns = NanosecondsPerCall(iterations, [&] {
+    Json::Value root;
+    char_reader->parse(json.data(), json.data() + json.size(), &root, nullptr);
+    sink = root["name"].asString().size() + root["chat"].asString().size();
+  });
+
+  network::ChatJsonDecoder decoder;
+  if (!decoder.parse(json))
+    std::cerr << label << ": not decoded by the fast path\n";
+  const auto fast_ns = NanosecondsPerCall(iterations, [&] {
+    decoder.parse(json);
+    sink = decoder.name().size() + decoder.chat().size();
+  });
+
+  const auto mbps = [&json](double ns) { return json.size() * 1000 / ns; };
+  std::cout << label << " (" << json.size() << " B)\n"
+            << "  Json::Reader      " << reader_ns << " ns\t" << mbps(reader_ns) << " MB/s\n"
+            << "  Json::CharReader  " << char_reader_ns << " ns\t" << mbps(char_reader_ns) << " MB/s\n"
+            << "  ChatJsonDecoder   " << fast_ns << " ns\t" << mbps(fast_ns) << " MB/s\t"
+            << reader_ns / fast_ns << "x Reader\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+  const std::string short_chat = "안녕하세요";
+  const std::string sentence = "오늘 저녁에 같이 밥 먹을래요? 7시에 강남역에서 만나요. ";
+  Run("short", R"({"name": "이민호", "chat": ")" + short_chat + R"("})", iterations);
+  Run("sentence", R"({"name": "이민호", "chat": ")" + sentence + R"("})", iterations);
+  Run("long", R"({"name": "이민호", "chat": ")" + Repeat(sentence, 4000) + R"("})", iterations / 20);
+  Run("escaped", R"({"name": "이민호", "chat": "첫 줄\n둘째 줄 \"인용\" 😀"})", iterations);
+  Run("extra fields", R"({"time": 1667200000000, "name": "이민호", "chat": ")" + sentence + R"(", "read": false})",
+      iterations);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+//
+// Tests for network::ChatJsonDecoder, checked against jsoncpp.
+//
+
+#include "server/protocol/json_decoder.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+// The server's fallback
+bool JsoncppChat(std::string_view json, std::string& name, std::string& chat) {
+  Json::Value root;
+  const std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+  if (!reader->parse(json.data(), json.data() + json.size(), &root, nullptr) || !root.isObject())
+    return false;
+  if (!root["name"].isConvertibleTo(Json::stringValue) || !root["chat"].isConvertibleTo(Json::stringValue))
+    return false;
+  name = root["name"].asString();
+  chat = root["chat"].asString();
+  return true;
+}
+
+int main() {
+  network::ChatJsonDecoder decoder;
+
+  { // Plain strings are views into the input
+    const std::string json = R"({"name": "이민호", "chat": "안녕하세요"})";
+    if (!decoder.parse(json)) TEST_FAIL;
+    if (decoder.name() != "이민호" || decoder.chat() != "안녕하세요") TEST_FAIL;
+    if (decoder.name().data() < json.data() || decoder.name().data() >= json.data() + json.size()) TEST_FAIL;
+  }
+
+  { // Escapes, including surrogate pairs, decode to UTF-8
+    if (!decoder.parse(R"({"chat":"a\"b\\c\/d\b\f\n\r\t\u00e9\ud55c\ud83d\ude00","name":"A"})")) TEST_FAIL;
+    if (decoder.chat() != "a\"b\\c/d\b\f\n\r\t\xC3\xA9\xED\x95\x9C\xF0\x9F\x98\x80") TEST_FAIL;
+    if (decoder.name() != "A") TEST_FAIL;
+
+    // Escapes on both sides of a 64-byte scanner block
+    std::string chat(200, 'x');
+    std::string expected;
+    std::string json = "{\"name\":\"n\",\"chat\":\"";
+    for (size_t i = 0; i < chat.size(); ++i) {
+      if (i % 7 == 0) {
+        json += "\\n";
+        expected += '\n';
+      } else {
+        json += 'x';
+        expected += 'x';
+      }
+    }
+    json += "\"}";
+    if (!decoder.parse(json) || decoder.chat() != expected) TEST_FAIL;
+  }
+
+  { // Other fields are skipped; missing ones are empty; the last of a repeated one wins
+    if (!decoder.parse(R"( { "time" : -1.5e+3, "ok": true, "x": null, "y": "\"}", "name": "a", "name": "b" } )"))
+      TEST_FAIL;
+    if (decoder.name() != "b" || !decoder.chat().empty()) TEST_FAIL;
+    if (!decoder.parse("{}") || !decoder.name().empty()) TEST_FAIL;
+  }
+
+  { // Agrees with jsoncpp whenever it decodes, and declines anything unusual
+    const std::vector<std::string> corpus = {
+      R"({"name":"a","chat":"b"})",
+      R"({"name":"이범석","chat":"안녕못해요"})",
+      R"({"name":"a","chat":"😀 \u0000 end"})",
+      "{\"name\":\"raw\tcontrol\",\"chat\":\"\x01\"}",
+      R"({"name":"a"})",
+      R"({"name":"a","chat":"b", "extra": {"nested": 1}})",
+      R"({"name":"a","chat":["b"]})",
+      R"({"name":1,"chat":true})",
+      R"({"name":"a","chat":"\ud83d"})",
+      R"({"name":"a","chat":"\ude00"})",
+      R"({"name":"a","chat":"\x"})",
+      R"({"name":"a","chat":"b"} trailing)",
+      R"({"name":"a" "chat":"b"})",
+      R"(/* comment */ {"name":"a"})",
+      R"({"name":"a","n":01})",
+      R"({"name":"a",})",
+      R"(["name"])",
+      R"({"name":"unterminated)",
+      R"({"name":"a\)",
+      "",
+      "{",
+    };
+    for (const auto& json : corpus) {
+      std::string name, chat;
+      const bool expected = JsoncppChat(json, name, chat);
+      if (decoder.parse(json)) {
+        if (!expected || decoder.name() != name || decoder.chat() != chat) TEST_FAIL;
+      }
+    }
+    // The fast path takes the common shapes
+    for (size_t i = 0; i < 5; ++i) {
+      if (!decoder.parse(corpus[i])) TEST_FAIL;
+    }
+    for (size_t i = 5; i < corpus.size(); ++i) {
+      if (decoder.parse(corpus[i])) TEST_FAIL;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,258 @@
+//
+// Escaping of JSON string contents, vectorized with SSE2/AVX2.
+//
+
+#ifndef SERVER_NETWORK_JSON_ESCAPE_H_
+#define SERVER_NETWORK_JSON_ESCAPE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "server/protocol/config.h"
+#include "server/protocol/cpu_features.h"
+
+#if defined(NETWORK_X86)
+#include <immintrin.h>
+#endif
+
+namespace network {
+namespace detail {
+
+// Bytes that must be escaped inside a JSON string: '"', '\\' and the control
+// characters below 0x20
+constexpr bool NeedsJsonEscape(unsigned char c) {
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Each kernel returns the length of the longest prefix of p[0..size) without
+// a byte that needs escaping, and sets `non_ascii` if that prefix has a byte
+// of 0x80 or above.
+using json_scan_kernel = size_t (*)(const char* p, size_t size, bool& non_ascii);
+
+inline size_t ScanJsonPlainScalar(const char* p, size_t size, bool& non_ascii) {
+  unsigned char high = 0;
+  size_t i = 0;
+  for (; i < size; ++i) {
+    const auto c = static_cast<unsigned char>(p[i]);
+    if (NeedsJsonEscape(c))
+      break;
+    high |= c;
+  }
+  non_ascii = non_ascii || (high & 0x80);
+  return i;
+}
+
+#if defined(NETWORK_X86) && defined(__SSE2__)
+inline size_t ScanJsonPlainSSE2(const char* p, size_t size, bool& non_ascii) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control_max = _mm_set1_epi8(0x1F);
+  __m128i high = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    // v <= 0x1F unsigned
+    const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, control_max), control_max);
+    const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)), control);
+    const auto mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+    if (mask != 0) {
+      const auto run = static_cast<size_t>(__builtin_ctz(mask));
+      non_ascii = non_ascii || _mm_movemask_epi8(high) != 0;
+      return i + ScanJsonPlainScalar(p + i, run, non_ascii);
+    }
+    high = _mm_or_si128(high, v);
+  }
+  non_ascii = non_ascii || _mm_movemask_epi8(high) != 0;
+  return i + ScanJsonPlainScalar(p + i, size - i, non_ascii);
+}
+#endif
+
+#if defined(NETWORK_X86)
+__attribute__((target("avx2")))
+inline size_t ScanJsonPlainAVX2(const char* p, size_t size, bool& non_ascii) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control_max = _mm256_set1_epi8(0x1F);
+  __m256i high = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    const __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(v, control_max), control_max);
+    const __m256i special =
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)), control);
+    const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+    if (mask != 0) {
+      const auto run = static_cast<size_t>(__builtin_ctz(mask));
+      non_ascii = non_ascii || _mm256_movemask_epi8(high) != 0;
+      return i + ScanJsonPlainScalar(p + i, run, non_ascii);
+    }
+    high = _mm256_or_si256(high, v);
+  }
+  non_ascii = non_ascii || _mm256_movemask_epi8(high) != 0;
+  return i + ScanJsonPlainScalar(p + i, size - i, non_ascii);
+}
+#endif
+
+// Length of the longest prefix of p[0..size) that is valid UTF-8: no
+// overlong forms, no surrogates, nothing above U+10FFFF. Runs of ASCII are
+// skipped eight bytes at a time.
+inline size_t ValidUTF8Prefix(const char* p, size_t size) {
+  const auto* s = reinterpret_cast<const unsigned char*>(p);
+  size_t i = 0;
+  while (i < size) {
+    const auto c = s[i];
+    if (c < 0x80) {
+      ++i;
+      while (size - i >= 8) {
+        uint64_t word;
+        std::memcpy(&word, s + i, sizeof(word));
+        if ((word & 0x8080808080808080) != 0)
+          break;
+        i += 8;
+      }
+      continue;
+    }
+
+    size_t length;
+    unsigned char low = 0x80, high = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      length = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      length = 3;
+      if (c == 0xE0)
+        low = 0xA0;
+      else if (c == 0xED)
+        high = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      length = 4;
+      if (c == 0xF0)
+        low = 0x90;
+      else if (c == 0xF4)
+        high = 0x8F;
+    } else {
+      return i;
+    }
+    if (size - i < length || s[i + 1] < low || s[i + 1] > high)
+      return i;
+    for (size_t k = 2; k < length; ++k) {
+      if ((s[i + k] & 0xC0) != 0x80)
+        return i;
+    }
+    i += length;
+  }
+  return size;
+}
+
+} // namespace detail
+
+// Writes the contents of a JSON string, without the quotes around it:
+//
+//   out += '"';
+//   JsonEscaper().append(out, chat);
+//   out += '"';
+//
+// Runs of bytes that need no escaping are found 16 or 32 bytes at a time and
+// copied as they are; runs with multibyte characters are checked to be valid
+// UTF-8 on the way. A byte that does not belong to a valid UTF-8 sequence is
+// replaced with U+FFFD, so the output is always valid JSON in valid UTF-8.
+// The vector kernel is chosen at runtime from what the CPU supports.
+class JsonEscaper : public KernelDispatch {
+ public:
+  explicit JsonEscaper(Kernel kernel = best_kernel()) : scan_(SelectKernel(kernel)) {}
+
+  // Bytes written by write() for `str`
+  NETWORK_NODISCARD size_t escaped_size(std::string_view str) const {
+    size_t size = 0;
+    Escape(str, [&size](const char*, size_t n) { size += n; });
+    return size;
+  }
+
+  // Writes escaped_size(str) bytes at `out` and returns the end of them
+  char* write(char* out, std::string_view str) const {
+    Escape(str, [&out](const char* p, size_t n) {
+      std::memcpy(out, p, n);
+      out += n;
+    });
+    return out;
+  }
+
+  void append(std::string& out, std::string_view str) const {
+    // Enough for text that needs no escaping; grows otherwise
+    out.reserve(out.size() + str.size());
+    Escape(str, [&out](const char* p, size_t n) { out.append(p, n); });
+  }
+
+ private:
+  static detail::json_scan_kernel SelectKernel(Kernel kernel) {
+    return Select(kernel, detail::ScanJsonPlainScalar, NETWORK_SSE2_KERNEL(detail::ScanJsonPlainSSE2),
+                  NETWORK_AVX2_KERNEL(detail::ScanJsonPlainAVX2));
+  }
+
+  // Hands the output to `emit` as (pointer, size) pieces
+  template<typename Emit>
+  void Escape(std::string_view str, Emit&& emit) const {
+    static constexpr char kReplacement[] = "\xEF\xBF\xBD";
+    const char* p = str.data();
+    size_t size = str.size();
+
+    while (size != 0) {
+      bool non_ascii = false;
+      const auto run = scan_(p, size, non_ascii);
+      if (non_ascii) {
+        // Every invalid byte is replaced, and validation resumes after it
+        auto rest = std::string_view(p, run);
+        while (true) {
+          const auto valid = detail::ValidUTF8Prefix(rest.data(), rest.size());
+          emit(rest.data(), valid);
+          if (valid == rest.size())
+            break;
+          emit(kReplacement, 3);
+          rest.remove_prefix(valid + 1);
+        }
+      } else {
+        emit(p, run);
+      }
+      p += run;
+      size -= run;
+      if (size == 0)
+        break;
+
+      char escape[6] = {'\\', 0, 0, 0, 0, 0};
+      size_t escape_size = 2;
+      switch (*p) {
+        case '"': escape[1] = '"'; break;
+        case '\\': escape[1] = '\\'; break;
+        case '\b': escape[1] = 'b'; break;
+        case '\f': escape[1] = 'f'; break;
+        case '\n': escape[1] = 'n'; break;
+        case '\r': escape[1] = 'r'; break;
+        case '\t': escape[1] = 't'; break;
+        default: {
+          static constexpr char kHex[] = "0123456789abcdef";
+          const auto c = static_cast<unsigned char>(*p);
+          std::memcpy(escape + 1, "u00", 3);
+          escape[4] = kHex[c >> 4];
+          escape[5] = kHex[c & 0xF];
+          escape_size = 6;
+        }
+      }
+      emit(escape, escape_size);
+      ++p;
+      --size;
+    }
+  }
+
+  detail::json_scan_kernel scan_;
+};
+
+// Shorthand for the best kernel
+inline void AppendJsonEscaped(std::string& out, std::string_view str) {
+  static const JsonEscaper escaper;
+  escaper.append(out, str);
+}
+
+} // namespace network
+
+#endif // SERVER_NETWORK_JSON_ESCAPE_H_
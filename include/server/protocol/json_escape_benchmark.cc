@@ -0,0 +1,104 @@
+//
+// Escaping chat text for JSON responses: a byte-at-a-time escaper, as a
+// baseline, and JsonEscaper with each kernel, on ASCII and Korean text.
+//
+// usage: json_escape_benchmark [iterations]
+//
+
+#include "server/protocol/json_escape.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+namespace {
+
+template<typename F>
+double NanosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile size_t sink;
+
+std::string Repeat(std::string_view text, size_t bytes) {
+  std::string out;
+  while (out.size() < bytes)
+    out += text;
+  return out;
+}
+
+// Escapes but does not check UTF-8
+void NaiveEscape(std::string& out, std::string_view str) {
+  for (const char c : str) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          static constexpr char kHex[] = "0123456789abcdef";
+          out += "\\u00";
+          out += kHex[c >> 4];
+          out += kHex[c & 0xF];
+        } else {
+          out += c;
+        }
+    }
+  }
+}
+
+void Run(const char* label, const std::string& text, int iterations) {
+  std::string out;
+  out.reserve(text.size() * 2);
+  const auto gbps = [&text](double ns) { return text.size() / ns; };
+
+  const auto naive_ns = NanosecondsPerCall(iterations, [&] {
+    out.clear();
+    NaiveEscape(out, text);
+    sink = out.size();
+  });
+  std::cout << label << " (" << text.size() << " B)\n"
+            << "  byte at a time  " << naive_ns << " ns\t" << gbps(naive_ns) << " GB/s\n";
+
+  using network::JsonEscaper;
+  for (const auto& [kernel, name] : {std::pair{JsonEscaper::kScalar, "scalar"},
+                                     std::pair{JsonEscaper::kSSE2, "SSE2"},
+                                     std::pair{JsonEscaper::kAVX2, "AVX2"}}) {
+    if (!JsonEscaper::supported(kernel))
+      continue;
+    const JsonEscaper escaper(kernel);
+    const auto ns = NanosecondsPerCall(iterations, [&] {
+      out.clear();
+      escaper.append(out, text);
+      sink = out.size();
+    });
+    std::cout << "  " << name << std::string(16 - std::string_view(name).size(), ' ') << ns << " ns\t" << gbps(ns)
+              << " GB/s\t" << naive_ns / ns << "x\n";
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+  const std::string ascii = "Are we still on for dinner at 7? Meet me at the station exit 11. ";
+  const std::string korean = "오늘 저녁에 같이 밥 먹을래요? 7시에 강남역에서 만나요. ";
+  Run("ascii short", "see you soon", iterations);
+  Run("ascii sentence", ascii, iterations);
+  Run("ascii 64 KB", Repeat(ascii, 65536), iterations / 500);
+  Run("korean short", "안녕하세요", iterations);
+  Run("korean sentence", korean, iterations);
+  Run("korean 64 KB", Repeat(korean, 65536), iterations / 500);
+  Run("escaped sentence", "첫 줄\n둘째 줄 \"인용\"\tand \\path\\ 😀", iterations);
+
+  return EXIT_SUCCESS;
+}
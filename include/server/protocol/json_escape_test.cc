@@ -0,0 +1,165 @@
+//
+// Tests for network::JsonEscaper, checked against jsoncpp.
+//
+
+#include "server/protocol/json_escape.h"
+#include "server/protocol/json_decoder.h"
+#include "server/protocol/protocol.h"
+
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+bool ParseJson(std::string_view json, Json::Value& root) {
+  const std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+  return reader->parse(json.data(), json.data() + json.size(), &root, nullptr);
+}
+
+// One byte at a time, for comparison
+std::string ReferenceEscape(std::string_view str) {
+  std::string out;
+  const auto* s = reinterpret_cast<const unsigned char*>(str.data());
+  for (size_t i = 0; i < str.size();) {
+    const auto c = s[i];
+    if (c == '"') {
+      out += "\\\"";
+    } else if (c == '\\') {
+      out += "\\\\";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\t') {
+      out += "\\t";
+    } else if (c == '\b') {
+      out += "\\b";
+    } else if (c == '\f') {
+      out += "\\f";
+    } else if (c < 0x20) {
+      char hex[7];
+      std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+      out += hex;
+    } else if (c < 0x80) {
+      out += static_cast<char>(c);
+    } else {
+      const auto valid = network::detail::ValidUTF8Prefix(str.data() + i, std::min<size_t>(4, str.size() - i));
+      if (valid == 0) {
+        out += "\xEF\xBF\xBD";
+        ++i;
+        continue;
+      }
+      // The first character only: its length follows from the lead byte
+      const size_t length = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+      out.append(str.data() + i, length);
+      i += length;
+      continue;
+    }
+    ++i;
+  }
+  return out;
+}
+
+int main() {
+  using network::JsonEscaper;
+  const auto kernels = {JsonEscaper::kScalar, JsonEscaper::kSSE2, JsonEscaper::kAVX2};
+
+  { // Escapes
+    std::string out;
+    network::AppendJsonEscaped(out, "a\"b\\c/d\b\f\n\r\t\x01\x1f\x7f");
+    if (out != "a\\\"b\\\\c/d\\b\\f\\n\\r\\t\\u0001\\u001f\x7f") TEST_FAIL;
+    out.clear();
+    network::AppendJsonEscaped(out, std::string_view("\0", 1));
+    if (out != "\\u0000") TEST_FAIL;
+  }
+
+  { // UTF-8 is checked; what is not valid becomes U+FFFD
+    const auto escape = [](std::string_view s) {
+      std::string out;
+      network::AppendJsonEscaped(out, s);
+      return out;
+    };
+    if (escape("안녕 😀 é") != "안녕 😀 é") TEST_FAIL;
+    // Lone continuation, truncated sequence, invalid lead bytes
+    if (escape("a\x80" "b") != "a\xEF\xBF\xBD" "b") TEST_FAIL;
+    if (escape("\xED\x95") != "\xEF\xBF\xBD\xEF\xBF\xBD") TEST_FAIL;
+    if (escape("\xC0\xAF") != "\xEF\xBF\xBD\xEF\xBF\xBD") TEST_FAIL;
+    if (escape("\xFF") != "\xEF\xBF\xBD") TEST_FAIL;
+    // Overlong forms, surrogates, above U+10FFFF
+    if (escape("\xE0\x80\xAF") != "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD") TEST_FAIL;
+    if (escape("\xF0\x80\x80\xAF") != "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD") TEST_FAIL;
+    if (escape("\xED\xA0\x80") != "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD") TEST_FAIL;
+    if (escape("\xF4\x90\x80\x80") != "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD") TEST_FAIL;
+    // A sequence cut by a byte that needs escaping
+    if (escape("\xED\x95\n") != "\xEF\xBF\xBD\xEF\xBF\xBD\\n") TEST_FAIL;
+    // Highest code points that are allowed
+    if (escape("\xF4\x8F\xBF\xBF\xED\x9F\xBF") != "\xF4\x8F\xBF\xBF\xED\x9F\xBF") TEST_FAIL;
+  }
+
+  { // Every kernel agrees with the reference, at any length and alignment
+    std::mt19937 rng(7);
+    const std::vector<std::string> pieces = {"a", "xyz", " ", "\"", "\\", "\n", "\x01", "한", "😀", "é", "\x80", "\xED\xA0"};
+    for (size_t trial = 0; trial < 3000; ++trial) {
+      std::string str;
+      const auto count = rng() % 80;
+      // Mostly plain text, so that whole vectors are skipped too
+      for (size_t i = 0; i < count; ++i)
+        str += rng() % 4 == 0 ? pieces[rng() % pieces.size()] : pieces[rng() % 3];
+      const auto expected = ReferenceEscape(str);
+      for (const auto kernel : kernels) {
+        if (!JsonEscaper::supported(kernel))
+          continue;
+        const JsonEscaper escaper(kernel);
+        std::string out = "prefix";
+        escaper.append(out, str);
+        if (out != "prefix" + expected) TEST_FAIL;
+        if (escaper.escaped_size(str) != expected.size()) TEST_FAIL;
+        std::string buffer(expected.size() + 1, '#');
+        if (escaper.write(buffer.data(), str) != buffer.data() + expected.size()) TEST_FAIL;
+        if (buffer.compare(0, expected.size(), expected) != 0 || buffer.back() != '#') TEST_FAIL;
+      }
+    }
+  }
+
+  { // Round trip: jsoncpp and ChatJsonDecoder read back what was written
+    const std::vector<std::string> chats = {
+      "plain", "", "안녕하세요 \"인용\"\n둘째 줄\t탭", "back\\slash /", std::string("nul\0byte", 8),
+      "\x1b[31mred\x1b[0m", "😀 " + std::string(100, 'x') + " \r\n",
+    };
+    network::ChatJsonDecoder decoder;
+    for (const auto& chat : chats) {
+      std::string json = "{\"name\":\"";
+      network::AppendJsonEscaped(json, "이\"름");
+      json += "\",\"chat\":\"";
+      network::AppendJsonEscaped(json, chat);
+      json += "\"}";
+
+      Json::Value root;
+      if (!ParseJson(json, root)) TEST_FAIL;
+      if (root["name"].asString() != "이\"름" || root["chat"].asString() != chat) TEST_FAIL;
+      if (!decoder.parse(json) || decoder.name() != "이\"름" || decoder.chat() != chat) TEST_FAIL;
+    }
+  }
+
+  { // Packets write escaped strings in place
+    network::StringPacket packet(16);
+    packet << "[\"";
+    packet.write_json_escaped("a\nb");
+    packet << "\"]";
+    if (packet.string_view() != "[\"a\\nb\"]") TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
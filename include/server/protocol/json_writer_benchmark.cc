@@ -0,0 +1,113 @@
+//
+// Writing a history response of N messages: StreamWriterBuilder and
+// FastWriter from a Json::Value, Json::BufferWriter from the same Value, and
+// BufferWriter driven message by message with no Value, handing the output
+// off every 64 KB. Peak bytes are the largest output buffer each one needed.
+//
+// usage: json_writer_benchmark [iterations]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json/json.h"
+
+namespace {
+
+template<typename F>
+double NanosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile size_t sink;
+
+constexpr size_t kHandOff = 64 * 1024;
+
+void Run(size_t count, int iterations) {
+  std::vector<std::pair<std::string, std::string>> messages;
+  Json::Value root(Json::arrayValue);
+  for (size_t i = 0; i < count; ++i) {
+    messages.emplace_back("이민호" + std::to_string(i % 10), "오늘 저녁에 같이 밥 먹을래요? 7시에 강남역에서 만나요.");
+    Json::Value message;
+    message["name"] = messages.back().first;
+    message["chatKey"] = messages.back().second;
+    root.append(message);
+  }
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  builder["emitUTF8"] = true;
+  size_t document_size = 0;
+  const auto builder_ns = NanosecondsPerCall(iterations, [&] {
+    const auto out = Json::writeString(builder, root);
+    sink = document_size = out.size();
+  });
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+  Json::FastWriter fast_writer;
+  fast_writer.omitEndingLineFeed();
+  const auto fast_ns = NanosecondsPerCall(iterations, [&] { sink = fast_writer.write(root).size(); });
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+  std::string out;
+  const auto value_ns = NanosecondsPerCall(iterations, [&] {
+    out.clear();
+    Json::BufferWriter(out, true).write(root);
+    sink = out.size();
+  });
+
+  // Each hand-off stands for a send; the buffer keeps its capacity
+  size_t peak = 0;
+  const auto stream_ns = NanosecondsPerCall(iterations, [&] {
+    out.clear();
+    size_t sent = 0;
+    Json::BufferWriter writer(out, true);
+    writer.beginArray();
+    for (const auto& [name, chat] : messages) {
+      writer.beginObject().key("name").string(name).key("chatKey").string(chat).endObject();
+      if (out.size() >= kHandOff) {
+        peak = std::max(peak, out.size());
+        sent += out.size();
+        out.clear();
+      }
+    }
+    writer.endArray();
+    peak = std::max(peak, out.size());
+    sink = sent + out.size();
+  });
+
+  const auto line = [&](const char* label, double ns, size_t peak_bytes) {
+    std::cout << "  " << label << ns / 1000 << " us\t" << document_size * 1000 / ns << " MB/s\tpeak "
+              << peak_bytes / 1024 << " KB\t" << builder_ns / ns << "x\n";
+  };
+  std::cout << count << " messages (" << document_size / 1024 << " KB)\n";
+  line("StreamWriterBuilder       ", builder_ns, document_size);
+  line("FastWriter                ", fast_ns, document_size);
+  line("BufferWriter from Value   ", value_ns, document_size);
+  line("BufferWriter, 64 KB steps ", stream_ns, peak);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+
+  Run(10, iterations * 10);
+  Run(1000, iterations);
+  Run(100000, std::max(1, iterations / 200));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+//
+// Tests for Json::BufferWriter, checked against StreamWriterBuilder.
+//
+
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+std::string Compact(const Json::Value& root, bool emit_utf8) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  builder["commentStyle"] = "None";
+  builder["emitUTF8"] = emit_utf8;
+  return Json::writeString(builder, root);
+}
+
+std::string Buffered(const Json::Value& root, bool emit_utf8) {
+  std::string out;
+  Json::BufferWriter(out, emit_utf8).write(root);
+  return out;
+}
+
+bool Parse(const std::string& json, Json::Value& root) {
+  const std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+  return reader->parse(json.data(), json.data() + json.size(), &root, nullptr);
+}
+
+int main() {
+  const char chat[] = "quote \" backslash \\ newline \n tab \t nul \0 end 😀";
+  Json::Value document;
+  document["name"] = "이민호";
+  document["chat"] = std::string(chat, sizeof(chat) - 1);
+  document["empty"] = "";
+  document["int"] = -42;
+  document["min"] = std::numeric_limits<Json::Int64>::min();
+  document["max"] = std::numeric_limits<Json::UInt64>::max();
+  document["real"] = 0.1;
+  document["whole"] = 3.0;
+  document["huge"] = 1e300;
+  document["nan"] = std::numeric_limits<double>::quiet_NaN();
+  document["inf"] = -std::numeric_limits<double>::infinity();
+  document["yes"] = true;
+  document["none"] = Json::Value();
+  document["list"].append(1);
+  document["list"].append("two");
+  document["list"].append(Json::Value(Json::arrayValue));
+  document["list"].append(Json::Value(Json::objectValue));
+  document["nested"]["deeper"]["deepest"] = "x";
+
+  { // Same output as StreamWriterBuilder, with and without emitUTF8
+    for (const bool emit_utf8 : {false, true}) {
+      const auto expected = Compact(document, emit_utf8);
+      if (Buffered(document, emit_utf8) != expected) TEST_FAIL;
+    }
+    if (Buffered(Json::Value(), false) != "null") TEST_FAIL;
+    if (Buffered(Json::Value(Json::arrayValue), false) != "[]") TEST_FAIL;
+    if (Buffered(Json::Value(Json::objectValue), false) != "{}") TEST_FAIL;
+
+    // And it reads back, leaving out what jsoncpp cannot read: infinities and
+    // embedded nul characters
+    Json::Value readable = document;
+    readable.removeMember("inf");
+    readable["chat"] = "quote \" backslash \\ newline \n tab \t end 😀";
+    for (const bool emit_utf8 : {false, true}) {
+      Json::Value parsed;
+      if (!Parse(Buffered(readable, emit_utf8), parsed)) TEST_FAIL;
+      if (parsed["chat"] != readable["chat"] || parsed["name"] != readable["name"]) TEST_FAIL;
+      if (parsed["min"] != readable["min"] || parsed["max"] != readable["max"]) TEST_FAIL;
+    }
+  }
+
+  { // Escaping
+    if (Buffered("a\"b\\c/d\b\f\n\r\t\x01", false) != "\"a\\\"b\\\\c/d\\b\\f\\n\\r\\t\\u0001\"") TEST_FAIL;
+    if (Buffered("한😀", false) != "\"\\ud55c\\ud83d\\ude00\"") TEST_FAIL;
+    if (Buffered("한😀", true) != "\"한😀\"") TEST_FAIL;
+    if (Json::valueToQuotedString("plain") != "\"plain\"") TEST_FAIL;
+    if (Json::valueToQuotedString("a\nb") != "\"a\\nb\"") TEST_FAIL;
+  }
+
+  { // Written piece by piece, the same as from a Value
+    std::string out;
+    Json::BufferWriter writer(out, true);
+    writer.beginObject();
+    writer.key("messages").beginArray();
+    Json::Value expected;
+    expected["messages"] = Json::Value(Json::arrayValue);
+    for (int i = 0; i < 3; ++i) {
+      writer.beginObject().key("name").string("이민호").key("id").integer(i).key("read").boolean(i == 1);
+      writer.key("time").real(i + 0.5).key("reply").null().endObject();
+      Json::Value message;
+      message["name"] = "이민호";
+      message["id"] = i;
+      message["read"] = i == 1;
+      message["time"] = i + 0.5;
+      message["reply"] = Json::Value();
+      expected["messages"].append(message);
+    }
+    writer.endArray();
+    if (writer.depth() != 1) TEST_FAIL;
+    writer.key("count").integer(size_t{3});
+    writer.key(std::string("last")).write(expected["messages"][2]);
+    writer.endObject();
+    if (writer.depth() != 0) TEST_FAIL;
+    expected["count"] = 3;
+    expected["last"] = expected["messages"][2];
+    // Keys are written in call order, which here is not sorted
+    Json::Value parsed;
+    if (!Parse(out, parsed) || parsed != expected) TEST_FAIL;
+  }
+
+  { // The caller takes the output as it goes, and nothing is lost
+    const std::string fragment = R"({"name":"n","chatKey":"c"})";
+    std::string out, taken;
+    Json::BufferWriter writer(out);
+    writer.beginArray();
+    for (int i = 0; i < 1000; ++i) {
+      writer.raw(fragment.data(), fragment.data() + fragment.size());
+      if (out.size() >= 256) {
+        taken += out;
+        out.clear();
+      }
+    }
+    writer.endArray();
+    taken += out;
+    Json::Value parsed;
+    if (!Parse(taken, parsed) || parsed.size() != 1000 || parsed[999]["chatKey"] != "c") TEST_FAIL;
+  }
+
+  { // Misuse is refused
+    std::string out;
+    Json::BufferWriter writer(out);
+    bool thrown = false;
+    try {
+      writer.beginObject().string("no key");
+    } catch (const Json::LogicError&) {
+      thrown = true;
+    }
+    if (!thrown) TEST_FAIL;
+    thrown = false;
+    try {
+      writer.endArray();
+    } catch (const Json::LogicError&) {
+      thrown = true;
+    }
+    if (!thrown) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
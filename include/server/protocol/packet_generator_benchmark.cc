@@ -0,0 +1,131 @@
+//
+// Response serialization benchmark: the stringstream build and copying
+// GenerateNext the server used before, vs. slicing the built message with
+// NextView, vs. build_to into a reused buffer. Reports heap bytes allocated
+// (through a replaced operator new) and bytes copied per response.
+//
+// usage: packet_generator_benchmark [iterations]
+//
+
+#include "server/protocol/http_protocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+
+namespace {
+
+std::atomic<uint64_t> allocated_bytes{0};
+
+// Bytes written by each serialization path, tallied at every copy it makes
+uint64_t copied_bytes = 0;
+
+void FillResponse(network::HTTPProtocol& protocol, const std::string& body) {
+  protocol.response(200, "OK");
+  protocol.add_header("Server", "Apache");
+  protocol.add_header("Content-Length", body.size());
+  protocol.add_header("Connection", "keep-alive");
+  protocol.add_header("Keep-Alive", "timeout=30");
+  protocol.set_content(body);
+}
+
+// What build() and GenerateNext() used to do, kept as a baseline
+std::string LegacySerialize(const network::HTTPProtocol& protocol) {
+  std::stringstream ss;
+  ss << protocol.http_version() << ' ' << protocol.status_code() << ' ' << protocol.status_text() << "\r\n";
+  for (const auto& [key, value] : protocol.header())
+    ss << key << ": " << value << "\r\n";
+  ss << "\r\n" << protocol.content();
+  const auto data = ss.str();
+  copied_bytes += 2 * data.size();
+
+  std::string response;
+  const auto packet_size = std::min<size_t>(network::HTTPProtocol::packet_size, data.size());
+  for (size_t offset = 0; offset < data.size(); offset += packet_size) {
+    const auto piece = data.substr(offset, packet_size);
+    network::StringPacket packet(packet_size);
+    packet << piece;
+    response += packet.string_view();
+    copied_bytes += 3 * piece.size();
+  }
+  return response;
+}
+
+std::string ViewSerialize(const network::HTTPProtocol& protocol) {
+  auto generator = protocol.build();
+  copied_bytes += generator.view().size();
+  std::string response;
+  while (const auto slice = generator.NextView()) {
+    response += *slice;
+    copied_bytes += slice->size();
+  }
+  return response;
+}
+
+struct Result {
+  double ns;
+  double allocated;
+  double copied;
+};
+
+template<typename F>
+Result Measure(int iterations, F&& f) {
+  const auto allocated_before = allocated_bytes.load();
+  copied_bytes = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return {elapsed.count() / iterations,
+          static_cast<double>(allocated_bytes.load() - allocated_before) / iterations,
+          static_cast<double>(copied_bytes) / iterations};
+}
+
+volatile size_t sink;
+
+} // namespace
+
+void* operator new(size_t size) {
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 20'000;
+
+  std::cout << "body bytes\tpath\t\tns\t\theap bytes\tcopied bytes\n";
+  for (const size_t body_size : {size_t{0}, size_t{1024}, size_t{256 * 1024}}) {
+    const std::string body(body_size, 'b');
+    network::HTTPProtocol protocol;
+    FillResponse(protocol, body);
+
+    if (LegacySerialize(protocol) != ViewSerialize(protocol))
+      return EXIT_FAILURE;
+
+    const auto print = [body_size](const char* name, Result r) {
+      std::cout << body_size << "\t\t" << name << '\t' << r.ns << "\t\t" << r.allocated << "\t\t" << r.copied << '\n';
+    };
+
+    print("stringstream", Measure(iterations, [&] { sink = LegacySerialize(protocol).size(); }));
+    print("NextView\t", Measure(iterations, [&] { sink = ViewSerialize(protocol).size(); }));
+
+    std::string out;
+    print("build_to reused", Measure(iterations, [&] {
+      out.clear();
+      protocol.build_to(out);
+      copied_bytes += out.size();
+      sink = out.size();
+    }));
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -7,27 +7,24 @@
 
 #include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
-#include <sstream>
+#include <memory_resource>
 #include <string>
 #include <string_view>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <optional>
 
-#if __cplusplus >= 201703L
-#define NETWORK_NODISCARD [[nodiscard]]
-#else
-#define NETWORK_NODISCARD
-#endif
-
-#define NETWORK_ASSERT(expr, msg) \
-  assert(((void)msg, (expr)))
+#include "server/protocol/byte_order.h"
+#include "server/protocol/config.h"
+#include "server/protocol/delimiter_scanner.h"
+#include "server/protocol/header_map.h"
+#include "server/protocol/json_escape.h"
 
 namespace network {
 
@@ -45,10 +42,18 @@ class BasicPacket {
   NETWORK_NODISCARD size_type size() const { return buffer_.size(); }
   NETWORK_NODISCARD size_type used_size() const { return write_idx; }
 
-  NETWORK_NODISCARD std::string_view string_view() const { return data(); }
-  NETWORK_NODISCARD string_type to_string() const { return data(); }
+  // The bytes written so far
+  NETWORK_NODISCARD std::string_view string_view() const { return {data(), write_idx}; }
+  NETWORK_NODISCARD string_type to_string() const { return string_type(string_view()); }
+
+  // Hands the written bytes over without copying them. The packet is left empty.
+  NETWORK_NODISCARD string_type release() {
+    buffer_.resize(write_idx);
+    write_idx = 0;
+    return std::move(buffer_);
+  }
 
-  BasicPacket& operator << (const string_type& str) {
+  BasicPacket& operator << (std::string_view str) {
     CheckOverflow(str.size());
     std::memcpy(data(write_idx), str.data(), str.size());
     write_idx += str.size();
@@ -85,33 +90,105 @@ class StringPacket : public BasicPacket {
   BasicPacket& operator << (const T& value) {
     return (*this) << std::to_string(value);
   }
+
+  // Writes `str` escaped for the inside of a JSON string (see JsonEscaper)
+  StringPacket& write_json_escaped(std::string_view str) {
+    static const JsonEscaper escaper;
+    const auto size = escaper.escaped_size(str);
+    CheckOverflow(size);
+    escaper.write(data(write_idx), str);
+    write_idx += size;
+    return *this;
+  }
 };
 
 template<> NETWORK_NODISCARD int StringPacket::get<int>(size_t index) const { return std::atoi(base::data(index)); }
 template<> NETWORK_NODISCARD long StringPacket::get<long>(size_t index) const { return std::atol(base::data(index)); }
 template<> NETWORK_NODISCARD long long StringPacket::get<long long>(size_t index) const { return std::atoll(base::data(index)); }
 
+// Integers and floating point values are stored little-endian, at any offset.
 class BinaryPacket : public BasicPacket {
  public:
   using base = BasicPacket;
   using string_type = base::string_type;
   using size_type = base::size_type;
-  using base::operator<<;
 
   explicit BinaryPacket(size_t buffer_size) : BasicPacket(buffer_size) {}
 
   template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
   NETWORK_NODISCARD T get(size_t index) const {
-    return *base::data<const T*>(index);
+    NETWORK_ASSERT(index + sizeof(T) <= size(), "Reading past the end of packet");
+    return LoadLittleEndian<T>(base::data(index));
   }
 
+  // Copies `count` values starting at `index` into `values`
   template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
-  BasicPacket& operator << (const T& value) {
+  void get(size_t index, T* values, size_t count) const {
+    NETWORK_ASSERT(index + count * sizeof(T) <= size(), "Reading past the end of packet");
+    LoadLittleEndian(base::data(index), values, count);
+  }
+
+  // Reads a varint at `index`. Returns its size in bytes, or 0 if it is malformed.
+  size_t get_varint(size_t index, uint64_t& value) const {
+    const auto begin = base::data(index);
+    const auto end = DecodeVarint(begin, base::data(size()), value);
+    return end ? end - begin : 0;
+  }
+
+  // Overwrites a value written earlier, a count only known at the end for instance
+  template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+  void put(size_t index, const T& value) {
+    NETWORK_ASSERT(index + sizeof(T) <= write_idx, "Writing past the written bytes of packet");
+    StoreLittleEndian(base::data<char*>(index), value);
+  }
+
+  template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+  BinaryPacket& operator << (const T& value) {
     CheckOverflow(sizeof(T));
-    (*base::data<T*>()) = value;
+    StoreLittleEndian(base::data<char*>(write_idx), value);
     write_idx += sizeof(T);
     return *this;
   }
+
+  BinaryPacket& operator << (std::string_view str) {
+    base::operator<<(str);
+    return *this;
+  }
+
+  // Appends `count` fixed-width values with a single bounds check
+  template<typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+  BinaryPacket& write(const T* values, size_t count) {
+    CheckOverflow(count * sizeof(T));
+    StoreLittleEndian(base::data<char*>(write_idx), values, count);
+    write_idx += count * sizeof(T);
+    return *this;
+  }
+
+  BinaryPacket& write_varint(uint64_t value) {
+    CheckOverflow(VarintSize(value));
+    write_idx = EncodeVarint(base::data<char*>(write_idx), value) - base::data();
+    return *this;
+  }
+
+  BinaryPacket& write_signed_varint(int64_t value) { return write_varint(ZigZagEncode(value)); }
+
+  // Appends `count` varints. Checks the space once when it is known to be
+  // enough for the worst case, and per value near the end of the buffer.
+  BinaryPacket& write_varints(const uint64_t* values, size_t count) {
+    size_t i = 0;
+    while (i < count) {
+      const auto fast_count = std::min(count - i, (size() - write_idx) / kMaxVarintSize);
+      if (fast_count == 0)
+        break;
+      auto* p = base::data<char*>(write_idx);
+      for (const auto end = i + fast_count; i < end; ++i)
+        p = EncodeVarintUnchecked(p, values[i]);
+      write_idx = p - base::data();
+    }
+    for (; i < count; ++i)
+      write_varint(values[i]);
+    return *this;
+  }
 };
 
 template<typename Packet>
@@ -132,20 +209,42 @@ class BasicPacketGenerator {
       max_packet_size_(max_packet_size)
   {}
 
-  virtual std::optional<packet> GenerateNext() {
+  // The next packet-sized slice of the data, pointing into the generator. The
+  // slice stays valid as long as the generator does.
+  std::optional<std::string_view> NextView() {
     if (write_offset_ >= data().size()) {
       return {};
     }
 
-    const uint32_t packet_size = std::min(max_packet_size_, static_cast<uint32_t>(data().size()));
-    packet p(packet_size);
+    const auto size = std::min<size_t>(max_packet_size_, data().size() - write_offset_);
+    const std::string_view slice(data().data() + write_offset_, size);
+    write_offset_ += size;
+    ++generated_packet_index_;
+    return slice;
+  }
 
-    p << data().substr(write_offset_, packet_size);
-    write_offset_ += packet_size;
+  // Owning variant of NextView(), for callers that need the packet to outlive
+  // the generator. The slice is copied once.
+  virtual std::optional<packet> GenerateNext() {
+    const auto slice = NextView();
+    if (!slice) {
+      return {};
+    }
 
+    packet p(slice->size());
+    p << *slice;
     return p;
   }
 
+  // Everything the generator slices, in one piece
+  NETWORK_NODISCARD std::string_view view() const { return data(); }
+
+  // Hands the data over without copying it. The generator is left empty.
+  NETWORK_NODISCARD string_type release() {
+    write_offset_ = 0;
+    return std::move(data_);
+  }
+
   NETWORK_NODISCARD auto total_packet_num() const { return total_packet_num_; }
   NETWORK_NODISCARD auto generated_packet_num() const { return generated_packet_index_; }
 
@@ -161,6 +260,9 @@ class BasicPacketGenerator {
   string_type data_;
 };
 
+// Headers and content of a message. All of its storage comes from the memory
+// resource given at construction, so a per-request Arena can back a protocol
+// object and be reset in one shot once the object is gone.
 template<size_t PacketSize, typename PacketGenerator>
 class BasicProtocol {
  public:
@@ -168,67 +270,78 @@ class BasicProtocol {
     packet_size = PacketSize
   };
 
-  using string_type = std::string;
+  using string_type = std::pmr::string;
   using key_type = string_type;
   using value_type = string_type;
   using generator = PacketGenerator;
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
 
-  using header_type = std::unordered_map<key_type, value_type>;
-  using header_sequence_type = std::vector<header_type::iterator>;
+  using header_type = HeaderMap;
 
-  BasicProtocol(string_type key_value_separator, string_type key_separator)
-    : key_value_separator_(std::move(key_value_separator)),
-      key_separator_(std::move(key_separator))
+  BasicProtocol(std::string_view key_value_separator, std::string_view key_separator,
+                std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : header_(resource),
+      content_(resource),
+      key_value_separator_(key_value_separator, resource),
+      key_separator_(key_separator, resource)
   {}
 
-  void add_header(string_type key, string_type value) {
-    if (const auto it = header().find(key); it != header().end()) {
-      error("Key ", it->first, " already exists! Existing key will be overwritten");
+  // Appends a field. A name that is already present gets another value, which
+  // is how repeated fields such as Set-Cookie are sent and received.
+  void add_header(std::string_view key, std::string_view value) {
+    header_.insert(key, value);
+  }
 
-      header_.emplace(std::move(key), std::move(value));
-      auto prev_it = std::find(header_sequence_.begin(), header_sequence_.end(), it);
-      std::swap(*prev_it, header_sequence_.back());
-    } else {
-      auto p = header_.emplace(std::move(key), std::move(value));
-      header_sequence_.emplace_back(p.first);
-    }
+  // Replaces every value of `key` with `value`.
+  void set_header(std::string_view key, std::string_view value) {
+    header_.insert_or_assign(key, value);
+  }
+
+  // Removes every value of `key`.
+  void erase_header(std::string_view key) {
+    header_.erase(key);
   }
 
   template<typename Key, typename Value>
   std::enable_if_t<
     std::conjunction_v<
-      std::is_constructible<string_type, Key>,
-      std::is_constructible<string_type, Value>
-    >
-  >
-  add_header(Key&& key, Value&& value) {
-    add_header(string_type(std::forward<Key>(key)), string_type(std::forward<Value>(value)));
+      std::is_constructible<std::string_view, Key>,
+      std::is_integral<Value>,
+      std::negation<std::is_same<Value, bool>>>>
+  add_header(Key&& key, Value value) {
+    char buf[24];
+    const auto end = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+    add_header(std::forward<Key>(key), std::string_view(buf, end - buf));
   }
 
   template<typename Key, typename Value>
   std::enable_if_t<
     std::conjunction_v<
-      std::is_constructible<string_type, Key>,
-      std::is_arithmetic<Value>>>
+      std::is_constructible<std::string_view, Key>,
+      std::is_same<Value, bool>>>
   add_header(Key&& key, Value value) {
-    add_header(string_type(std::forward<Key>(key)), std::to_string(value));
+    add_header(std::forward<Key>(key), value ? std::string_view("true") : std::string_view("false"));
   }
 
-  void set_content(string_type data) {
+  template<typename Key, typename Value>
+  std::enable_if_t<
+    std::conjunction_v<
+      std::is_constructible<std::string_view, Key>,
+      std::is_floating_point<Value>>>
+  add_header(Key&& key, Value value) {
+    add_header(std::forward<Key>(key), std::to_string(value));
+  }
+
+  void set_content(std::string_view data) {
     if (!content_.empty()) {
       error("Content already exists! Existing content will be overwritten.");
     }
 
-    content_ = std::move(data);
-  }
-
-  template<typename T, std::enable_if_t<std::is_constructible_v<T&&, string_type>, int> = 0>
-  void set_content(T&& data) {
-    set_content(std::string(std::forward<T>(data)));
+    content_.assign(data.data(), data.size());
   }
 
   void set_content(const char* data, size_t data_size) {
-    set_content(std::string(data, data + data_size));
+    set_content(std::string_view(data, data_size));
   }
 
   NETWORK_NODISCARD const header_type& header() const { return header_; }
@@ -236,19 +349,42 @@ class BasicProtocol {
   NETWORK_NODISCARD string_type& content() { return content_; }
   NETWORK_NODISCARD const string_type& content() const { return content_; }
 
-  NETWORK_NODISCARD generator build(std::stringstream ss = std::stringstream()) const {
-    for (const auto it : header_sequence_) {
-      const auto& [key, value] = *it;
-      ss << key << key_value_separator_ << value << key_separator_;
+  NETWORK_NODISCARD allocator_type get_allocator() const { return content_.get_allocator(); }
+
+  // Exact number of bytes the serialized message takes.
+  NETWORK_NODISCARD size_t serialized_size() const {
+    size_t size = key_separator_.size() + content_.size();
+    for (const auto& [key, value] : header_) {
+      size += key.size() + key_value_separator_.size() + value.size() + key_separator_.size();
     }
+    return size;
+  }
+
+  // Writes the message to a caller-supplied buffer if it fits, like snprintf.
+  // Returns serialized_size() either way.
+  size_t serialize_to(char* out, size_t capacity) const {
+    const auto size = serialized_size();
+    if (size <= capacity)
+      WriteTo(out);
+    return size;
+  }
 
-    ss << key_separator_;
-    ss << content_;
+  // Appends the message to `out`, growing it once to the exact size. Reusing
+  // `out` across messages keeps its capacity, so steady-state serialization
+  // does not allocate.
+  void build_to(std::string& out) const {
+    const auto offset = out.size();
+    out.resize(offset + serialized_size());
+    WriteTo(out.data() + offset);
+  }
 
-    return generator(packet_size, ss.str());
+  NETWORK_NODISCARD generator build() const {
+    typename generator::string_type out;
+    build_to(out);
+    return generator(packet_size, std::move(out));
   }
 
-  virtual bool parse(const string_type& str) {
+  virtual bool parse(std::string_view str) {
     if (!header_.empty())
       error("Header already exists! Existing values will be overwritten");
     if (!content_.empty())
@@ -259,31 +395,49 @@ class BasicProtocol {
     }
     clear();
 
-    string_type::size_type pos_begin = 0;
-    string_type::size_type pos_end = 0;
-    while (pos_begin < str.size()) {
-      pos_end = str.find(key_separator_, pos_begin);
+    // A single scan finds both separators; candidates are confirmed by
+    // comparing the whole separator.
+    constexpr auto npos = std::string_view::npos;
+    DelimiterScanner scanner(str, key_separator_.front(), key_value_separator_.front());
+    std::string_view::size_type line_begin = 0;
+    std::string_view::size_type sep_pos = npos;
+    std::string_view::size_type content_begin = str.size();
+
+    while (line_begin < str.size()) {
+      auto p = scanner.next();
+      if (p != npos && p < line_begin)
+        continue;
+
+      const bool line_end = p == npos || str.compare(p, key_separator_.size(), key_separator_) == 0;
+      if (!line_end) {
+        if (sep_pos == npos && str.compare(p, key_value_separator_.size(), key_value_separator_) == 0)
+          sep_pos = p;
+        continue;
+      }
+      if (p == npos)
+        p = str.size();
 
       // Content
-      if (pos_begin == pos_end)
+      if (p == line_begin) {
+        content_begin = std::min(p + key_separator_.size(), str.size());
         break;
+      }
 
       // Header
-      const auto sep_pos = str.find(key_value_separator_, pos_begin);
-      if (sep_pos == string_type::npos)
+      if (sep_pos == npos || sep_pos + key_value_separator_.size() > p)
         return false;
-      std::string key(str.begin() + pos_begin, str.begin() + sep_pos);
-      std::string value(str.begin() + sep_pos + key_value_separator_.size(), str.begin() + pos_end);
-      add_header(std::move(key), std::move(value));
-      pos_begin = pos_end + key_separator_.size();
+      add_header(str.substr(line_begin, sep_pos - line_begin),
+                 str.substr(sep_pos + key_value_separator_.size(),
+                            p - sep_pos - key_value_separator_.size()));
+      line_begin = p + key_separator_.size();
+      sep_pos = npos;
     }
-    set_content(str.substr(std::min(pos_end + key_separator_.size(), str.size())));
+    set_content(str.substr(content_begin));
     return true;
   }
 
   void clear() {
     header_.clear();
-    header_sequence_.clear();
     content_.clear();
   }
 
@@ -295,6 +449,27 @@ class BasicProtocol {
   NETWORK_NODISCARD const string_type& key_value_separator() const { return key_value_separator_; }
 
  protected:
+  // Writes serialized_size() bytes to `out` and returns the end of them.
+  char* WriteTo(char* out) const {
+    return Append(WriteHeaderTo(out), content_);
+  }
+
+  // Everything but the content
+  char* WriteHeaderTo(char* out) const {
+    for (const auto& [key, value] : header_) {
+      out = Append(out, key);
+      out = Append(out, key_value_separator_);
+      out = Append(out, value);
+      out = Append(out, key_separator_);
+    }
+    return Append(out, key_separator_);
+  }
+
+  static char* Append(char* out, std::string_view str) {
+    std::memcpy(out, str.data(), str.size());
+    return out + str.size();
+  }
+
   template<typename ...Args>
   static void error(const Args&... args) {
     ((std::cerr << "BasicProtocol: ") << ... << args) << '\n';
@@ -307,7 +482,6 @@ class BasicProtocol {
 
  private:
   header_type header_;
-  header_sequence_type header_sequence_;
   string_type content_;
   string_type key_value_separator_;
   string_type key_separator_;
@@ -110,6 +110,20 @@ int main() {
     }
   }
 
+  { // Numbers and booleans
+    Protocol protocol(":", ";");
+
+    protocol.add_header("size", 1024);
+    protocol.add_header("offset", -3L);
+    protocol.add_header("keep", true);
+    protocol.add_header("gzip", false);
+
+    if (protocol.header().find("size")->second != "1024") TEST_FAIL;
+    if (protocol.header().find("offset")->second != "-3") TEST_FAIL;
+    if (protocol.header().find("keep")->second != "true") TEST_FAIL;
+    if (protocol.header().find("gzip")->second != "false") TEST_FAIL;
+  }
+
   { // Parse test 1
     Protocol protocol("=>", "\r\n");
 
@@ -152,5 +166,42 @@ int main() {
     if (const auto p = builder.GenerateNext(); p.has_value()) TEST_FAIL;
   }
 
+  { // Views slice the serialized message in place, the last one is short
+    network::BasicProtocol<10, network::BasicPacketGenerator<network::StringPacket>> protocol(":", ";");
+    protocol.add_header("key", "value");
+    protocol.set_content("0123456789abc");
+
+    auto generator = protocol.build();
+    const auto whole = generator.view();
+    if (whole != "key:value;;0123456789abc") TEST_FAIL;
+    if (generator.total_packet_num() != 3) TEST_FAIL;
+
+    std::string joined;
+    while (const auto slice = generator.NextView()) {
+      if (slice->data() < whole.data() || slice->data() + slice->size() > whole.data() + whole.size()) TEST_FAIL;
+      if (slice->size() > 10) TEST_FAIL;
+      joined += *slice;
+    }
+    if (joined != whole || generator.generated_packet_num() != 3) TEST_FAIL;
+
+    // Owning packets hold exactly their slice
+    auto owning = protocol.build();
+    if (const auto p = owning.GenerateNext(); p->size() != 10 || p->string_view() != "key:value;") TEST_FAIL;
+    if (const auto p = owning.GenerateNext(); p->string_view() != ";012345678") TEST_FAIL;
+    if (const auto p = owning.GenerateNext(); p->size() != 4 || p->to_string() != "9abc") TEST_FAIL;
+    if (owning.GenerateNext()) TEST_FAIL;
+
+    const auto released = protocol.build().release();
+    if (released != "key:value;;0123456789abc") TEST_FAIL;
+
+    // A reused output buffer keeps its capacity
+    std::string out;
+    protocol.build_to(out);
+    const auto capacity = out.capacity();
+    out.clear();
+    protocol.build_to(out);
+    if (out != released || out.capacity() != capacity) TEST_FAIL;
+  }
+
   return EXIT_SUCCESS;
 }
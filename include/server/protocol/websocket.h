@@ -0,0 +1,542 @@
+//
+// RFC 6455 WebSocket: the opening handshake on top of HTTP/1.1, and frames.
+//
+// A frame is a 2-byte header, an extended length, a masking key and the
+// payload:
+//
+//   u8  FIN | RSV1-3 | opcode
+//   u8  MASK | 7-bit length: 126 means a u16 length follows, 127 a u64
+//   u16/u64 extended length, big-endian
+//   u8  masking key[4], present in every client frame and in no server frame
+//
+// Client payloads are XORed with the masking key repeated, which the server
+// undoes on every inbound byte; the kernels below do it 16 or 32 bytes at a
+// time. Server frames are never masked, so one encoded frame can be shared by
+// every subscriber of a broadcast.
+//
+
+#ifndef SERVER_NETWORK_WEBSOCKET_H_
+#define SERVER_NETWORK_WEBSOCKET_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "server/protocol/byte_order.h"
+#include "server/protocol/config.h"
+#include "server/protocol/cpu_features.h"
+#include "server/protocol/header_map.h"
+#include "server/protocol/http_parser.h"
+#include "server/protocol/http_protocol.h"
+#include "server/protocol/json_escape.h"
+
+#if defined(NETWORK_X86)
+#include <immintrin.h>
+#endif
+
+namespace network {
+
+enum class WebSocketOpcode : uint8_t {
+  kContinuation = 0x0,
+  kText = 0x1,
+  kBinary = 0x2,
+  kClose = 0x8,
+  kPing = 0x9,
+  kPong = 0xA,
+};
+
+// Status codes carried by close frames
+enum class WebSocketStatus : uint16_t {
+  kNormal = 1000,
+  kGoingAway = 1001,
+  kProtocolError = 1002,
+  kUnsupportedData = 1003,
+  kInvalidPayload = 1007,
+  kPolicyViolation = 1008,
+  kMessageTooBig = 1009,
+};
+
+namespace detail {
+
+// SHA-1 (FIPS 180-4). Only the handshake uses it, to derive
+// Sec-WebSocket-Accept; it is not meant for anything security related.
+class Sha1 {
+ public:
+  enum {
+    kDigestSize = 20,
+    kBlockSize = 64,
+  };
+
+  using digest_type = std::array<uint8_t, kDigestSize>;
+
+  void update(std::string_view data) {
+    length_ += data.size();
+    while (!data.empty()) {
+      const auto n = std::min<size_t>(kBlockSize - buffered_, data.size());
+      std::memcpy(block_ + buffered_, data.data(), n);
+      buffered_ += n;
+      data.remove_prefix(n);
+      if (buffered_ == kBlockSize) {
+        Compress(block_);
+        buffered_ = 0;
+      }
+    }
+  }
+
+  // Pads the message and returns its digest. The object is spent afterwards.
+  digest_type digest() {
+    const uint64_t bits = length_ * 8;
+    block_[buffered_++] = 0x80;
+    if (buffered_ > kBlockSize - 8) {
+      std::memset(block_ + buffered_, 0, kBlockSize - buffered_);
+      Compress(block_);
+      buffered_ = 0;
+    }
+    std::memset(block_ + buffered_, 0, kBlockSize - 8 - buffered_);
+    StoreBigEndian(reinterpret_cast<char*>(block_) + kBlockSize - 8, bits);
+    Compress(block_);
+
+    digest_type digest;
+    for (int i = 0; i < 5; ++i)
+      StoreBigEndian(reinterpret_cast<char*>(digest.data()) + 4 * i, h_[i]);
+    return digest;
+  }
+
+ private:
+  static uint32_t Rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+  void Compress(const uint8_t* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i)
+      w[i] = LoadBigEndian<uint32_t>(reinterpret_cast<const char*>(block) + 4 * i);
+    for (int i = 16; i < 80; ++i)
+      w[i] = Rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      const uint32_t t = Rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = Rotl(b, 30);
+      b = a;
+      a = t;
+    }
+    h_[0] += a;
+    h_[1] += b;
+    h_[2] += c;
+    h_[3] += d;
+    h_[4] += e;
+  }
+
+  uint32_t h_[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  uint8_t block_[kBlockSize];
+  size_t buffered_ = 0;
+  uint64_t length_ = 0;
+};
+
+// Standard alphabet, padded
+inline std::string Base64Encode(const uint8_t* data, size_t size) {
+  static constexpr char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((size + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    const uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+    out += kAlphabet[v >> 18];
+    out += kAlphabet[(v >> 12) & 0x3F];
+    out += kAlphabet[(v >> 6) & 0x3F];
+    out += kAlphabet[v & 0x3F];
+  }
+  if (i + 1 == size) {
+    const uint32_t v = data[i] << 16;
+    out += kAlphabet[v >> 18];
+    out += kAlphabet[(v >> 12) & 0x3F];
+    out += "==";
+  } else if (i + 2 == size) {
+    const uint32_t v = (data[i] << 16) | (data[i + 1] << 8);
+    out += kAlphabet[v >> 18];
+    out += kAlphabet[(v >> 12) & 0x3F];
+    out += kAlphabet[(v >> 6) & 0x3F];
+    out += '=';
+  }
+  return out;
+}
+
+// Each kernel XORs p[0..size) with the masking key repeated from p[0]. `key`
+// holds the four key bytes in memory order.
+using mask_kernel = void (*)(char* p, size_t size, uint32_t key);
+
+inline void MaskBytes(char* p, size_t size, uint32_t key) {
+  char k[4];
+  std::memcpy(k, &key, sizeof(k));
+  for (size_t i = 0; i < size; ++i)
+    p[i] ^= k[i & 3];
+}
+
+// Eight bytes per step in a general purpose register
+inline void MaskScalar(char* p, size_t size, uint32_t key) {
+  const uint64_t key64 = (static_cast<uint64_t>(key) << 32) | key;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t v;
+    std::memcpy(&v, p + i, sizeof(v));
+    v ^= key64;
+    std::memcpy(p + i, &v, sizeof(v));
+  }
+  MaskBytes(p + i, size - i, key);
+}
+
+#if defined(NETWORK_X86) && defined(__SSE2__)
+inline void MaskSSE2(char* p, size_t size, uint32_t key) {
+  // Every lane starts at a multiple of four bytes, where the key starts over
+  const __m128i k = _mm_set1_epi32(static_cast<int>(key));
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    for (int j = 0; j < 4; ++j) {
+      auto* q = reinterpret_cast<__m128i*>(p + i + 16 * j);
+      _mm_storeu_si128(q, _mm_xor_si128(_mm_loadu_si128(q), k));
+    }
+  }
+  for (; i + 16 <= size; i += 16) {
+    auto* q = reinterpret_cast<__m128i*>(p + i);
+    _mm_storeu_si128(q, _mm_xor_si128(_mm_loadu_si128(q), k));
+  }
+  MaskScalar(p + i, size - i, key);
+}
+#endif
+
+#if defined(NETWORK_X86)
+__attribute__((target("avx2")))
+inline void MaskAVX2(char* p, size_t size, uint32_t key) {
+  const __m256i k = _mm256_set1_epi32(static_cast<int>(key));
+  size_t i = 0;
+  for (; i + 128 <= size; i += 128) {
+    for (int j = 0; j < 4; ++j) {
+      auto* q = reinterpret_cast<__m256i*>(p + i + 32 * j);
+      _mm256_storeu_si256(q, _mm256_xor_si256(_mm256_loadu_si256(q), k));
+    }
+  }
+  for (; i + 32 <= size; i += 32) {
+    auto* q = reinterpret_cast<__m256i*>(p + i);
+    _mm256_storeu_si256(q, _mm256_xor_si256(_mm256_loadu_si256(q), k));
+  }
+  MaskScalar(p + i, size - i, key);
+}
+#endif
+
+} // namespace detail
+
+// Applies a masking key to a payload, in place. Masking twice restores the
+// payload. The vector kernel is chosen at runtime from what the CPU supports.
+class WebSocketMask : public KernelDispatch {
+ public:
+  // `key` points to the four key bytes as they appear in the frame
+  explicit WebSocketMask(const char* key, Kernel kernel = best_kernel()) : apply_(SelectKernel(kernel)) {
+    std::memcpy(&key_, key, sizeof(key_));
+  }
+
+  // `data` is the start of the payload
+  void apply(char* data, size_t size) const { apply_(data, size, key_); }
+
+ private:
+  static detail::mask_kernel SelectKernel(Kernel kernel) {
+    return Select(kernel, detail::MaskScalar, NETWORK_SSE2_KERNEL(detail::MaskSSE2),
+                  NETWORK_AVX2_KERNEL(detail::MaskAVX2));
+  }
+
+  uint32_t key_;
+  detail::mask_kernel apply_;
+};
+
+// Opening handshake
+
+constexpr std::string_view kWebSocketGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Sec-WebSocket-Accept for a client's Sec-WebSocket-Key
+inline std::string WebSocketAccept(std::string_view key) {
+  detail::Sha1 sha1;
+  sha1.update(key);
+  sha1.update(kWebSocketGuid);
+  const auto digest = sha1.digest();
+  return detail::Base64Encode(digest.data(), digest.size());
+}
+
+// Whether the client asks to switch to WebSocket
+inline bool IsWebSocketUpgrade(const HTTPRequestParser& request) {
+  const auto upgrade = request.find(KnownHeader::kUpgrade);
+  return upgrade && HasToken(*upgrade, "websocket");
+}
+
+// Why an upgrade request cannot be accepted, or nullptr if it can
+inline const char* CheckWebSocketHandshake(const HTTPRequestParser& request) {
+  if (request.method() != "GET")
+    return "WebSocket handshake is not a GET";
+  if (request.version() != "HTTP/1.1")
+    return "WebSocket handshake requires HTTP/1.1";
+  const auto connection = request.find(KnownHeader::kConnection);
+  if (!connection || !HasToken(*connection, "upgrade"))
+    return "Connection header does not list upgrade";
+  // The base64 encoding of a 16-byte nonce
+  const auto key = request.find(KnownHeader::kSecWebSocketKey);
+  if (!key || key->size() != 24)
+    return "Missing or malformed Sec-WebSocket-Key";
+  const auto version = request.find(KnownHeader::kSecWebSocketVersion);
+  if (!version || *version != "13")
+    return "Unsupported Sec-WebSocket-Version";
+  return nullptr;
+}
+
+// The 101 response accepting the handshake of a client that sent `key`
+template<size_t PacketSize>
+void MakeWebSocketHandshake(BasicHTTPProtocol<PacketSize>& response, std::string_view key) {
+  response.response(101, "Switching Protocols");
+  response.add_header("Upgrade", "websocket");
+  response.add_header("Connection", "Upgrade");
+  response.add_header("Sec-WebSocket-Accept", WebSocketAccept(key));
+}
+
+// Frames
+
+enum {
+  kMaxWebSocketHeaderSize = 14,
+  kMaxWebSocketControlPayload = 125,
+};
+
+constexpr size_t WebSocketHeaderSize(size_t payload_size, bool masked = false) {
+  return 2 + (payload_size < 126 ? 0 : payload_size <= 0xFFFF ? 2 : 8) + (masked ? 4 : 0);
+}
+
+// Writes the header of a frame carrying `payload_size` bytes and returns its
+// end. A client frame passes its masking key.
+inline char* WriteWebSocketHeader(char* out, WebSocketOpcode opcode, size_t payload_size, bool fin = true,
+                                  const char* mask_key = nullptr) {
+  *out++ = static_cast<char>((fin ? 0x80 : 0) | static_cast<uint8_t>(opcode));
+  const uint8_t mask_bit = mask_key ? 0x80 : 0;
+  if (payload_size < 126) {
+    *out++ = static_cast<char>(mask_bit | payload_size);
+  } else if (payload_size <= 0xFFFF) {
+    *out++ = static_cast<char>(mask_bit | 126);
+    StoreBigEndian(out, static_cast<uint16_t>(payload_size));
+    out += sizeof(uint16_t);
+  } else {
+    *out++ = static_cast<char>(mask_bit | 127);
+    StoreBigEndian(out, static_cast<uint64_t>(payload_size));
+    out += sizeof(uint64_t);
+  }
+  if (mask_key) {
+    std::memcpy(out, mask_key, 4);
+    out += 4;
+  }
+  return out;
+}
+
+// A server frame. It is not masked, so it can be sent to any number of clients.
+inline std::string MakeWebSocketFrame(WebSocketOpcode opcode, std::string_view payload, bool fin = true) {
+  std::string frame(WebSocketHeaderSize(payload.size()) + payload.size(), '\0');
+  const auto p = WriteWebSocketHeader(frame.data(), opcode, payload.size(), fin);
+  std::memcpy(p, payload.data(), payload.size());
+  return frame;
+}
+
+// A client frame, masked with the four bytes at `key`
+inline std::string MakeMaskedWebSocketFrame(WebSocketOpcode opcode, std::string_view payload, const char* key,
+                                            bool fin = true) {
+  std::string frame(WebSocketHeaderSize(payload.size(), true) + payload.size(), '\0');
+  const auto p = WriteWebSocketHeader(frame.data(), opcode, payload.size(), fin, key);
+  std::memcpy(p, payload.data(), payload.size());
+  WebSocketMask(key).apply(p, payload.size());
+  return frame;
+}
+
+// A close frame with a status code and an optional reason
+inline std::string MakeWebSocketClose(WebSocketStatus status, std::string_view reason = {}) {
+  char payload[kMaxWebSocketControlPayload];
+  reason = reason.substr(0, sizeof(payload) - sizeof(uint16_t));
+  StoreBigEndian(payload, static_cast<uint16_t>(status));
+  std::memcpy(payload + sizeof(uint16_t), reason.data(), reason.size());
+  return MakeWebSocketFrame(WebSocketOpcode::kClose, std::string_view(payload, sizeof(uint16_t) + reason.size()));
+}
+
+// Incremental frame decoder working in place on the receive buffer. Feed it
+// everything received so far; once a whole frame is available its payload is
+// unmasked in place, so the frame must be consumed before the next call:
+//
+//   while ((result = decoder.parse(buf, size)) == kFragment || result == kComplete) {
+//     if (result == WebSocketDecoder::kComplete)
+//       handle(decoder.opcode(), decoder.message());
+//     buf += decoder.size(), size -= decoder.size();
+//   }
+//
+// A fragmented message is returned once, after its last frame, with the
+// opcode of its first frame. Control frames may arrive between fragments and
+// are returned as they come. An unfragmented message points into the buffer;
+// only fragments are copied.
+class WebSocketDecoder {
+ public:
+  enum Result {
+    kNeedMore,
+    // A frame was consumed, the message it belongs to is not complete yet
+    kFragment,
+    kComplete,
+    kError,
+  };
+
+  // Servers receive masked frames, clients unmasked ones
+  enum Role {
+    kServer,
+    kClient,
+  };
+
+  enum {
+    // Larger messages are refused rather than buffered
+    kDefaultMaxMessageSize = 1 << 20,
+  };
+
+  explicit WebSocketDecoder(Role role = kServer, size_t max_message_size = kDefaultMaxMessageSize)
+    : role_(role), max_message_size_(max_message_size) {}
+
+  Result parse(char* data, size_t size) {
+    if (assembled_) {
+      fragments_.clear();
+      assembled_ = false;
+    }
+    if (size < 2)
+      return kNeedMore;
+
+    const auto b0 = static_cast<uint8_t>(data[0]);
+    const auto b1 = static_cast<uint8_t>(data[1]);
+    const bool fin = b0 & 0x80;
+    const auto opcode = static_cast<WebSocketOpcode>(b0 & 0x0F);
+    const bool masked = b1 & 0x80;
+    uint64_t length = b1 & 0x7F;
+
+    // No extension is negotiated, so the reserved bits must be clear
+    if (b0 & 0x70)
+      return Fail(WebSocketStatus::kProtocolError, "Reserved bits set");
+    if (masked != (role_ == kServer))
+      return Fail(WebSocketStatus::kProtocolError, masked ? "Masked server frame" : "Unmasked client frame");
+
+    size_t header = 2;
+    if (length == 126) {
+      if (size < 4)
+        return kNeedMore;
+      length = LoadBigEndian<uint16_t>(data + 2);
+      header = 4;
+    } else if (length == 127) {
+      if (size < 10)
+        return kNeedMore;
+      length = LoadBigEndian<uint64_t>(data + 2);
+      header = 10;
+      if (length >> 63)
+        return Fail(WebSocketStatus::kProtocolError, "Frame length out of range");
+    }
+    const char* key = data + header;
+    if (masked)
+      header += 4;
+
+    if (IsControl(opcode)) {
+      if (opcode != WebSocketOpcode::kClose && opcode != WebSocketOpcode::kPing && opcode != WebSocketOpcode::kPong)
+        return Fail(WebSocketStatus::kProtocolError, "Unknown opcode");
+      if (!fin || length > kMaxWebSocketControlPayload)
+        return Fail(WebSocketStatus::kProtocolError, "Fragmented or oversized control frame");
+    } else if (opcode == WebSocketOpcode::kContinuation) {
+      if (!fragmented_)
+        return Fail(WebSocketStatus::kProtocolError, "Continuation outside of a fragmented message");
+    } else if (opcode == WebSocketOpcode::kText || opcode == WebSocketOpcode::kBinary) {
+      if (fragmented_)
+        return Fail(WebSocketStatus::kProtocolError, "New message before the last one ended");
+    } else {
+      return Fail(WebSocketStatus::kProtocolError, "Unknown opcode");
+    }
+    if (!IsControl(opcode) && length > max_message_size_ - fragments_.size())
+      return Fail(WebSocketStatus::kMessageTooBig, "Message too large");
+
+    if (size < header || size - header < length)
+      return kNeedMore;
+
+    char* payload = data + header;
+    if (masked)
+      WebSocketMask(key).apply(payload, length);
+    size_ = header + length;
+
+    if (IsControl(opcode) || (fin && !fragmented_)) {
+      opcode_ = opcode;
+      message_ = std::string_view(payload, length);
+      return Complete();
+    }
+
+    if (!fragmented_) {
+      fragmented_ = true;
+      message_opcode_ = opcode;
+    }
+    fragments_.append(payload, length);
+    if (!fin)
+      return kFragment;
+
+    fragmented_ = false;
+    assembled_ = true;
+    opcode_ = message_opcode_;
+    message_ = fragments_;
+    return Complete();
+  }
+
+  // Bytes of the last frame, header included
+  NETWORK_NODISCARD size_t size() const { return size_; }
+  NETWORK_NODISCARD WebSocketOpcode opcode() const { return opcode_; }
+  // Payload of the last complete message, unmasked
+  NETWORK_NODISCARD std::string_view message() const { return message_; }
+  NETWORK_NODISCARD std::string_view error() const { return error_; }
+  // Status to close the connection with after an error
+  NETWORK_NODISCARD WebSocketStatus status() const { return status_; }
+
+ private:
+  static constexpr bool IsControl(WebSocketOpcode opcode) { return static_cast<uint8_t>(opcode) & 0x08; }
+
+  // Text is checked as a whole message, since a character may span fragments
+  Result Complete() {
+    if (opcode_ == WebSocketOpcode::kText && detail::ValidUTF8Prefix(message_.data(), message_.size()) != message_.size())
+      return Fail(WebSocketStatus::kInvalidPayload, "Text message is not valid UTF-8");
+    return kComplete;
+  }
+
+  Result Fail(WebSocketStatus status, const char* message) {
+    status_ = status;
+    error_ = message;
+    return kError;
+  }
+
+  Role role_;
+  size_t max_message_size_;
+  size_t size_ = 0;
+  WebSocketOpcode opcode_ = WebSocketOpcode::kClose;
+  WebSocketOpcode message_opcode_ = WebSocketOpcode::kText;
+  std::string_view message_;
+  // Payloads of the frames of a fragmented message so far
+  std::string fragments_;
+  bool fragmented_ = false;
+  bool assembled_ = false;
+  WebSocketStatus status_ = WebSocketStatus::kNormal;
+  const char* error_ = "";
+};
+
+} // namespace network
+
+#endif // SERVER_NETWORK_WEBSOCKET_H_
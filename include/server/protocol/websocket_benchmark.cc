@@ -0,0 +1,105 @@
+//
+// Unmasking client payloads, which touches every inbound byte: one byte at a
+// time, then each WebSocketMask kernel; and decoding whole frames.
+//
+// usage: websocket_benchmark [iterations]
+//
+
+#include "server/protocol/websocket.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename F>
+double NanosecondsPerCall(int iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+volatile char sink;
+
+const char kKey[4] = {'\x12', '\x34', '\x56', '\x78'};
+
+// What unmasking looks like written the obvious way
+void NaiveUnmask(char* p, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    p[i] ^= kKey[i % 4];
+}
+
+void RunMask(size_t size, int iterations) {
+  using Mask = network::WebSocketMask;
+  std::string data(size, 'x');
+  // Payloads start right after a 2 to 14 byte header, never aligned
+  char* p = data.data() + (size > 1 ? 1 : 0);
+  const auto n = size > 1 ? size - 1 : size;
+
+  const auto gbps = [n](double ns) { return n / ns; };
+  std::cout << size << "\tbytewise " << gbps(NanosecondsPerCall(iterations, [&] {
+    NaiveUnmask(p, n);
+    sink = p[0];
+  }));
+  const std::pair<Mask::Kernel, const char*> kernels[] = {
+    {Mask::kScalar, "scalar"}, {Mask::kSSE2, "sse2"}, {Mask::kAVX2, "avx2"}};
+  for (const auto& [kernel, name] : kernels) {
+    if (!Mask::supported(kernel))
+      continue;
+    const Mask mask(kKey, kernel);
+    std::cout << '\t' << name << ' ' << gbps(NanosecondsPerCall(iterations, [&] {
+      mask.apply(p, n);
+      sink = p[0];
+    }));
+  }
+  std::cout << '\n';
+}
+
+// Decoding a stream of masked chat-sized text frames, unmasking and UTF-8
+// validation included
+void RunDecode(size_t payload_size, int iterations) {
+  std::mt19937 rng(42);
+  std::string payload(payload_size, '\0');
+  for (auto& c : payload)
+    c = static_cast<char>('a' + rng() % 26);
+  const auto frame = network::MakeMaskedWebSocketFrame(network::WebSocketOpcode::kText, payload, kKey);
+  const size_t count = (1 << 20) / frame.size() + 1;
+  std::string stream;
+  for (size_t i = 0; i < count; ++i)
+    stream += frame;
+
+  std::string work = stream;
+  const auto ns = NanosecondsPerCall(iterations, [&] {
+    // Frames are unmasked in place, so every pass starts from a fresh copy
+    std::memcpy(work.data(), stream.data(), stream.size());
+    network::WebSocketDecoder decoder;
+    size_t offset = 0;
+    while (decoder.parse(work.data() + offset, work.size() - offset) == network::WebSocketDecoder::kComplete)
+      offset += decoder.size();
+    sink = work[offset - 1];
+  });
+  std::cout << "decode " << payload_size << "-byte frames\t" << ns / count << " ns/frame\t"
+            << stream.size() / ns << " GB/s (copy included)\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+  std::cout << "unmask, GB/s\n";
+  for (const size_t size : {size_t{64}, size_t{512}, size_t{4096}, size_t{65536}, size_t{1} << 20})
+    RunMask(size, iterations * 100 / std::max<size_t>(1, size / 4096 + 1));
+
+  for (const size_t size : {size_t{60}, size_t{1000}, size_t{16000}})
+    RunDecode(size, iterations);
+
+  return EXIT_SUCCESS;
+}
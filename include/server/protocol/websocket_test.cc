@@ -0,0 +1,228 @@
+//
+// Tests for the WebSocket handshake, masking and frame codec.
+//
+
+#include "server/protocol/websocket.h"
+#include "server/protocol/http_parser.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define TEST_FAIL               \
+do {                            \
+  std::cerr                     \
+      << "Test failed at "      \
+      << __FILE__ << ", line "  \
+      << __LINE__ << '\n';      \
+  std::terminate();             \
+} while(false)
+
+std::string Sha1Base64(std::string_view data) {
+  network::detail::Sha1 sha1;
+  sha1.update(data);
+  const auto digest = sha1.digest();
+  return network::detail::Base64Encode(digest.data(), digest.size());
+}
+
+int main() {
+  using network::WebSocketDecoder;
+  using network::WebSocketOpcode;
+  const char key[4] = {'\x37', '\xfa', '\x21', '\x3d'};
+
+  { // SHA-1 and base64 test vectors
+    if (Sha1Base64("") != "2jmj7l5rSw0yVb/vlWAYkK/YBwk=") TEST_FAIL;
+    if (Sha1Base64("abc") != "qZk+NkcGgWq6PiVxeFDCbJzQ2J0=") TEST_FAIL;
+    // Padding spills into a second block
+    if (Sha1Base64("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") != "hJg+RBw70m66rkqh+VEp5eVGcPE=")
+      TEST_FAIL;
+    // Fed in pieces across block boundaries
+    const std::string million(1000000, 'a');
+    network::detail::Sha1 sha1;
+    for (size_t i = 0; i < million.size(); i += 999)
+      sha1.update(std::string_view(million).substr(i, 999));
+    const auto digest = sha1.digest();
+    if (network::detail::Base64Encode(digest.data(), digest.size()) != "NKqXPNTE2qT2Husr260nMWU0AW8=") TEST_FAIL;
+
+    const auto b64 = [](std::string_view s) {
+      return network::detail::Base64Encode(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+    };
+    if (b64("f") != "Zg==" || b64("fo") != "Zm8=" || b64("foo") != "Zm9v" || b64("foob") != "Zm9vYg==") TEST_FAIL;
+  }
+
+  { // The handshake of RFC 6455 section 1.3
+    if (network::WebSocketAccept("dGhlIHNhbXBsZSBub25jZQ==") != "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") TEST_FAIL;
+
+    const std::string request = "GET /chat HTTP/1.1\r\n"
+                                "Host: server.example.com\r\n"
+                                "Upgrade: websocket\r\n"
+                                "Connection: keep-alive, Upgrade\r\n"
+                                "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                "Sec-WebSocket-Version: 13\r\n"
+                                "\r\n";
+    network::HTTPRequestParser parser;
+    if (parser.parse(request) != network::HTTPRequestParser::kComplete) TEST_FAIL;
+    if (!network::IsWebSocketUpgrade(parser)) TEST_FAIL;
+    if (network::CheckWebSocketHandshake(parser) != nullptr) TEST_FAIL;
+
+    network::HTTPProtocol response;
+    network::MakeWebSocketHandshake(response, *parser.find(network::KnownHeader::kSecWebSocketKey));
+    std::string out;
+    response.build_to(out);
+    if (out.find("HTTP/1.1 101 Switching Protocols\r\n") != 0) TEST_FAIL;
+    if (out.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") == std::string::npos) TEST_FAIL;
+
+    const std::string old_version = "GET / HTTP/1.1\r\n"
+                                    "Upgrade: WebSocket\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                    "Sec-WebSocket-Version: 8\r\n"
+                                    "\r\n";
+    parser.reset();
+    if (parser.parse(old_version) != network::HTTPRequestParser::kComplete) TEST_FAIL;
+    if (!network::IsWebSocketUpgrade(parser)) TEST_FAIL;
+    if (network::CheckWebSocketHandshake(parser) == nullptr) TEST_FAIL;
+
+    if (!network::HasToken("a, b ,\tUpgrade", "upgrade") || network::HasToken("upgrades", "upgrade")) TEST_FAIL;
+  }
+
+  { // Every kernel agrees with a byte-at-a-time mask, at any length and alignment
+    using Mask = network::WebSocketMask;
+    std::mt19937 rng(42);
+    for (size_t size = 0; size < 300; ++size) {
+      std::string data(size + 7, '\0');
+      for (auto& c : data)
+        c = static_cast<char>(rng());
+      for (size_t offset = 0; offset < 4; ++offset) {
+        std::string expected = data;
+        network::detail::MaskBytes(expected.data() + offset, size, [&] {
+          uint32_t k;
+          std::memcpy(&k, key, sizeof(k));
+          return k;
+        }());
+        for (const auto kernel : {Mask::kScalar, Mask::kSSE2, Mask::kAVX2}) {
+          if (!Mask::supported(kernel))
+            continue;
+          std::string masked = data;
+          Mask(key, kernel).apply(masked.data() + offset, size);
+          if (masked != expected) TEST_FAIL;
+          Mask(key, kernel).apply(masked.data() + offset, size);
+          if (masked != data) TEST_FAIL;
+        }
+      }
+    }
+  }
+
+  { // Frames round trip at every length encoding
+    for (const size_t size : {size_t{0}, size_t{125}, size_t{126}, size_t{65535}, size_t{65536}, size_t{200000}}) {
+      std::string payload(size, '\0');
+      for (size_t i = 0; i < size; ++i)
+        payload[i] = static_cast<char>(i * 31);
+
+      auto frame = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kBinary, payload, key);
+      if (frame.size() != network::WebSocketHeaderSize(size, true) + size) TEST_FAIL;
+      WebSocketDecoder decoder;
+      // Nothing before the whole frame is there, and nothing is unmasked twice
+      for (const size_t partial : {size_t{0}, size_t{1}, frame.size() / 2, frame.size() - 1}) {
+        if (partial < frame.size() && decoder.parse(frame.data(), partial) != WebSocketDecoder::kNeedMore) TEST_FAIL;
+      }
+      if (decoder.parse(frame.data(), frame.size()) != WebSocketDecoder::kComplete) TEST_FAIL;
+      if (decoder.size() != frame.size() || decoder.opcode() != WebSocketOpcode::kBinary) TEST_FAIL;
+      if (decoder.message() != payload) TEST_FAIL;
+
+      // Server frames are not masked, and decoded by clients
+      auto server_frame = network::MakeWebSocketFrame(WebSocketOpcode::kBinary, payload);
+      if (server_frame.size() != network::WebSocketHeaderSize(size) + size) TEST_FAIL;
+      WebSocketDecoder client(WebSocketDecoder::kClient);
+      if (client.parse(server_frame.data(), server_frame.size()) != WebSocketDecoder::kComplete) TEST_FAIL;
+      if (client.message() != payload) TEST_FAIL;
+    }
+
+    // RFC 6455 section 5.7: a masked "Hello"
+    std::string hello("\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58", 11);
+    if (network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "Hello", key) != hello) TEST_FAIL;
+    WebSocketDecoder decoder;
+    if (decoder.parse(hello.data(), hello.size()) != WebSocketDecoder::kComplete) TEST_FAIL;
+    if (decoder.opcode() != WebSocketOpcode::kText || decoder.message() != "Hello") TEST_FAIL;
+  }
+
+  { // Fragments are assembled, with a ping in between
+    std::string stream = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "Hel", key, false) +
+                         network::MakeMaskedWebSocketFrame(WebSocketOpcode::kPing, "p", key) +
+                         network::MakeMaskedWebSocketFrame(WebSocketOpcode::kContinuation, "lo, ", key, false) +
+                         network::MakeMaskedWebSocketFrame(WebSocketOpcode::kContinuation, "world", key) +
+                         network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "next", key);
+    WebSocketDecoder decoder;
+    std::vector<std::pair<WebSocketOpcode, std::string>> messages;
+    size_t offset = 0;
+    while (true) {
+      const auto result = decoder.parse(stream.data() + offset, stream.size() - offset);
+      if (result == WebSocketDecoder::kNeedMore)
+        break;
+      if (result == WebSocketDecoder::kError) TEST_FAIL;
+      if (result == WebSocketDecoder::kComplete)
+        messages.emplace_back(decoder.opcode(), decoder.message());
+      offset += decoder.size();
+    }
+    if (offset != stream.size() || messages.size() != 3) TEST_FAIL;
+    if (messages[0] != std::make_pair(WebSocketOpcode::kPing, std::string("p"))) TEST_FAIL;
+    if (messages[1] != std::make_pair(WebSocketOpcode::kText, std::string("Hello, world"))) TEST_FAIL;
+    if (messages[2] != std::make_pair(WebSocketOpcode::kText, std::string("next"))) TEST_FAIL;
+  }
+
+  { // Protocol violations
+    const auto fails = [&](std::string frame, network::WebSocketStatus status, size_t max = 1 << 20) {
+      WebSocketDecoder decoder(WebSocketDecoder::kServer, max);
+      return decoder.parse(frame.data(), frame.size()) == WebSocketDecoder::kError && decoder.status() == status;
+    };
+    using network::WebSocketStatus;
+    // Unmasked client frame
+    if (!fails(network::MakeWebSocketFrame(WebSocketOpcode::kText, "hi"), WebSocketStatus::kProtocolError)) TEST_FAIL;
+    // Reserved bit
+    auto rsv = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "hi", key);
+    rsv[0] |= 0x40;
+    if (!fails(rsv, WebSocketStatus::kProtocolError)) TEST_FAIL;
+    // Fragmented or oversized control frames
+    if (!fails(network::MakeMaskedWebSocketFrame(WebSocketOpcode::kPing, "", key, false), WebSocketStatus::kProtocolError))
+      TEST_FAIL;
+    if (!fails(network::MakeMaskedWebSocketFrame(WebSocketOpcode::kPing, std::string(126, 'x'), key),
+               WebSocketStatus::kProtocolError))
+      TEST_FAIL;
+    // Continuation without a first frame, unknown opcode
+    if (!fails(network::MakeMaskedWebSocketFrame(WebSocketOpcode::kContinuation, "x", key),
+               WebSocketStatus::kProtocolError))
+      TEST_FAIL;
+    if (!fails(network::MakeMaskedWebSocketFrame(static_cast<WebSocketOpcode>(3), "x", key),
+               WebSocketStatus::kProtocolError))
+      TEST_FAIL;
+    // Text that is not UTF-8, also when split between fragments
+    if (!fails(network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "caf\xc3", key), WebSocketStatus::kInvalidPayload))
+      TEST_FAIL;
+    if (!fails(network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "\xed\xa0\x80", key), WebSocketStatus::kInvalidPayload))
+      TEST_FAIL;
+    WebSocketDecoder decoder;
+    auto first = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "caf\xc3", key, false);
+    auto last = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kContinuation, "\xa9", key);
+    if (decoder.parse(first.data(), first.size()) != WebSocketDecoder::kFragment) TEST_FAIL;
+    if (decoder.parse(last.data(), last.size()) != WebSocketDecoder::kComplete || decoder.message() != "caf\xc3\xa9") TEST_FAIL;
+    first = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kText, "caf\xc3", key, false);
+    last = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kContinuation, "e", key);
+    if (decoder.parse(first.data(), first.size()) != WebSocketDecoder::kFragment) TEST_FAIL;
+    if (decoder.parse(last.data(), last.size()) != WebSocketDecoder::kError) TEST_FAIL;
+    if (decoder.status() != WebSocketStatus::kInvalidPayload) TEST_FAIL;
+    // Binary messages are not checked
+    if (fails(network::MakeMaskedWebSocketFrame(WebSocketOpcode::kBinary, "\xff", key), WebSocketStatus::kInvalidPayload))
+      TEST_FAIL;
+    // Too large, refused from the header alone
+    const auto big = network::MakeMaskedWebSocketFrame(WebSocketOpcode::kBinary, std::string(1000, 'x'), key);
+    if (!fails(big.substr(0, 8), WebSocketStatus::kMessageTooBig, 999)) TEST_FAIL;
+  }
+
+  { // Close frames carry a status and a reason
+    const auto close = network::MakeWebSocketClose(network::WebSocketStatus::kGoingAway, "bye");
+    if (close != std::string("\x88\x05\x03\xe9" "bye", 7)) TEST_FAIL;
+  }
+
+  return EXIT_SUCCESS;
+}
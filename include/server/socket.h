@@ -38,25 +38,64 @@ struct stat_socket{
 struct stat_socket sock;
 
 void sock_init(int port_number);
+int sock_listen(int port_number);
+int sock_init_reuseport(int port_number);
 void sock_accept();
-void error_handling(char *msg);
+void error_handling(const char *msg);
 
 void sock_init(int port_number) {
   
   pthread_mutex_init(&sock.mutx, NULL);
-  sock.server_sock = socket(AF_INET, SOCK_STREAM, 0);
+  sock.server_sock = sock_listen(port_number);
 
-  memset(&sock.server_addr, 0, sizeof(&sock.server_addr));
+  memset(&sock.server_addr, 0, sizeof(sock.server_addr));
   sock.server_addr.sin_family = AF_INET;
 	sock.server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
 	sock.server_addr.sin_port = htons(port_number);
 
   printf("%s %d\n",inet_ntoa(sock.server_addr.sin_addr), port_number);
+}
+
+/* Plain listener on every interface, for a socket shared by all workers.
+ * Blocking; callers sharing it between loops make it non-blocking. */
+int sock_listen(int port_number) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port_number);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    error_handling("bind error");
+  if (listen(fd, SOMAXCONN) == -1)
+    error_handling("listen error");
 
-  if (bind(sock.server_sock, (struct sockaddr*)&(sock.server_addr), sizeof(sock.server_addr)) == -1)
+  return fd;
+}
+
+/* SO_REUSEPORT listener. Call once per shard: the kernel balances new
+ * connections between every socket bound to the same port. */
+int sock_init_reuseport(int port_number) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int on = 1;
+  struct sockaddr_in addr;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1)
+    error_handling("setsockopt error");
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port_number);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
     error_handling("bind error");
-  if (listen(sock.server_sock, sock.MAX_CLIENT) == -1)
+  if (listen(fd, SOMAXCONN) == -1)
     error_handling("listen error");
+
+  return fd;
 }
 
 void sock_accept(const char* ip_address, int port) {
@@ -71,7 +110,7 @@ void sock_accept(const char* ip_address, int port) {
   sock.client_socks[sock.client_cnt++] = sock.client_sock;
 }
 
-void error_handling(char *msg) {
+void error_handling(const char *msg) {
 	fputs(msg, stderr);
 	fputc('\n', stderr);
 	exit(1);
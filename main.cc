@@ -7,16 +7,33 @@
 #include <signal.h>
 #include <sys/types.h>
 
+#include <array>
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include <utility>
-#include <map>
+#include <memory>
+#include <charconv>
 #include <chrono>
-#include <mutex>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include "server/socket.h"
+#include "server/event_loop.h"
+#include "server/history/binary_history.h"
+#include "server/history/journal.h"
+#include "server/history/message_log.h"
+#include "server/history/response_cache.h"
+#include "server/protocol/arena.h"
+#include "server/protocol/binary_protocol.h"
+#include "server/protocol/http_parser.h"
 #include "server/protocol/http_protocol.h"
+#include "server/protocol/json_decoder.h"
+#include "server/protocol/json_escape.h"
+#include "server/protocol/websocket.h"
 
 #include "json/json.h"
 
@@ -24,19 +41,163 @@ using namespace std;
 
 extern struct stat_socket sock;
 
-void send_msg(const std::string& msg, int client);
-void *handle_client(void *arg);
-
+// Idle keep-alive connections are closed after this long
+constexpr std::chrono::seconds kKeepAliveTimeout{30};
+// Longest a history request may wait for new messages
+constexpr std::chrono::seconds kMaxLongPollWait{25};
+// Longest a post may wait for its journal commit before it is answered with
+// an error
+constexpr std::chrono::seconds kMaxCommitWait{5};
+// Unconsumed input a connection may hold: the largest request the HTTP parser
+// takes. WebSocket messages and binary frames are smaller.
+constexpr size_t kMaxInputSize = network::HTTPRequestParser::kMaxHeaderSize + network::HTTPRequestParser::kMaxContentSize;
+// Longer histories are streamed as chunks of about kHistoryBatchSize bytes
+// instead of being serialized whole
+constexpr uint64_t kStreamedHistoryMessages = 4 * network::MessageLog::kChunkSize;
+constexpr size_t kHistoryBatchSize = 64 * 1024;
+// Content length of a response sent with chunked transfer coding
+constexpr size_t kChunkedContent = SIZE_MAX;
+// Smaller history bodies are sent as they are to clients that take gzip or
+// deflate. Cached bodies and streams are compressed once per content version;
+// streams while they are sent, so at the fastest level.
+constexpr size_t kMinCompressedSize = 1024;
+constexpr int kStreamCompressionLevel = network::Compressor::kFastest;
+// Compressed streams kept for later clients of the same content version, per
+// loop. Streams being sent are not dropped.
+constexpr size_t kMaxCachedStreamBytes = 64 << 20;
+// WebSocket subscribers with more broadcast bytes than this waiting to be
+// written have stopped reading, and are closed with 1008
+constexpr size_t kMaxSubscriberBacklog = 1024 * 1024;
+
+// Connections upgraded to WebSocket, on all loops
+std::atomic<size_t> websocket_subscribers{0};
+
+// A connection upgraded to WebSocket. Every message posted from then on is
+// pushed to it as a text frame.
+struct WebSocketSession {
+  explicit WebSocketSession(network::Connection& conn) : conn(conn) { websocket_subscribers.fetch_add(1); }
+  ~WebSocketSession() { websocket_subscribers.fetch_sub(1); }
+
+  network::Connection& conn;
+  network::WebSocketDecoder decoder;
+};
+
+// Per-connection state. A connection parked on a long-poll remembers the
+// first message its client has not seen, and how to answer once it resumes;
+// one parked on a post, the journal ticket it waits for. After a WebSocket
+// handshake, the connection only speaks WebSocket.
+struct HTTPSession {
+  network::HTTPRequestParser parser;
+  uint64_t wait_begin = 0;
+  uint64_t commit_ticket = 0;
+  bool keep_alive = true;
+  // HTTP/1.0 clients do not take chunked responses
+  bool chunked = true;
+  network::ContentEncoding encoding = network::ContentEncoding::kIdentity;
+  std::shared_ptr<WebSocketSession> websocket;
+};
+
+struct BinarySession {
+  network::FrameDecoder decoder;
+  uint64_t wait_begin = 0;
+  uint64_t commit_ticket = 0;
+  uint32_t wait_sequence = 0;
+};
+
+// The JSON make_history makes of [begin, snapshot.end()), cut into batches of
+// about kHistoryBatchSize bytes, whole log chunks at a time.
+struct HistoryBatches {
+  HistoryBatches(const network::MessageLog::Snapshot& snapshot, uint64_t begin) : snapshot(snapshot), next(begin) {}
+
+  // Appends the next batch to `out`; returns true for the last one
+  bool append_next(std::string& out);
+
+  network::MessageLog::Snapshot snapshot;
+  uint64_t next;
+  bool opened = false;
+  bool first = true;
+};
+
+// A history stream compressed once for every client of the same snapshot,
+// first message and encoding: whichever client is ahead compresses the next
+// batch, the others send the chunks already made. Chunks are kept whole,
+// framing included.
+struct CompressedHistory {
+  CompressedHistory(const network::MessageLog::Snapshot& snapshot, uint64_t begin, network::ContentEncoding encoding)
+      : batches(std::in_place, snapshot, begin), compressor(encoding, kStreamCompressionLevel) {}
+
+  // Compresses the next batch into a new chunk
+  void make_chunk();
+
+  // Released with the snapshot once the last batch is made
+  std::optional<HistoryBatches> batches;
+  network::Compressor compressor;
+  std::vector<std::shared_ptr<const std::string>> chunks;
+  size_t bytes = 0;
+  bool done = false;
+};
+
+void send_msg(std::string_view msg, network::Connection& conn, std::shared_ptr<const std::string> body = nullptr);
+void handle_client(network::Connection& conn);
+void resume_client(network::Connection& conn, bool timed_out);
+void handle_binary_client(network::Connection& conn);
+void resume_binary_client(network::Connection& conn, bool timed_out);
+void handle_frame(const network::FrameDecoder& frame, network::Connection& conn);
+void handle_request(const network::HTTPRequestParser& request, bool keep_alive, network::Connection& conn);
+void upgrade_websocket(const network::HTTPRequestParser& request, network::Connection& conn);
+void handle_websocket(WebSocketSession& session);
+void handle_websocket_message(network::WebSocketOpcode opcode, std::string_view message, network::Connection& conn);
+bool parse_chat(std::string_view content, std::string_view& name, std::string_view& chat);
+uint64_t post_message(std::string_view name, std::string_view chat);
+void broadcast_message(std::string_view name, std::string_view chat);
+void broadcast_frame(const std::shared_ptr<const std::string>& frame);
+std::vector<std::weak_ptr<WebSocketSession>>& websocket_sessions();
+bool is_keep_alive(const network::HTTPRequestParser& request);
+std::chrono::seconds requested_wait(const network::HTTPRequestParser& request);
+void send_history(network::Connection& conn, const network::MessageLog::Snapshot& snapshot, uint64_t begin, bool keep_alive, bool chunked,
+                  network::ContentEncoding encoding);
+void stream_history(network::Connection& conn, const network::MessageLog::Snapshot& snapshot, uint64_t begin, bool keep_alive,
+                    network::ContentEncoding encoding);
+std::shared_ptr<CompressedHistory> find_compressed_history(const network::MessageLog::Snapshot& snapshot, uint64_t begin,
+                                                           network::ContentEncoding encoding);
+void send_binary_history(network::Connection& conn, uint32_t sequence, const network::MessageLog::Snapshot& snapshot, uint64_t begin);
+void send_post_reply(network::Connection& conn, network::Journal::Commit commit, bool keep_alive);
+void send_binary_post_reply(network::Connection& conn, uint32_t sequence, network::Journal::Commit commit);
+void notify_waiters();
+std::string_view make_response_header(int status_code, std::string_view status_text, size_t content_length, bool keep_alive,
+                                      network::ContentEncoding encoding = network::ContentEncoding::kIdentity);
+std::string_view make_response(int status_code, std::string_view status_text, std::string_view content, bool keep_alive);
+void append_response_header(std::string& out, int status_code, std::string_view status_text, size_t content_length, bool keep_alive,
+                            network::ContentEncoding encoding = network::ContentEncoding::kIdentity);
+void append_message(uint64_t time, std::string_view name, std::string_view chat);
+void append_message_json(std::string& out, std::string_view name, std::string_view chat);
+std::string make_history(const network::MessageLog::Snapshot& snapshot, uint64_t begin);
+uint64_t now_milliseconds();
+std::string& response_buffer();
+
+// Oldest chat messages are dropped once any of these limits is exceeded
+network::MessageLog message_history([] {
+  network::RetentionPolicy policy;
+  policy.max_messages = 1 << 20;
+  policy.max_bytes = 256 << 20;
+  return policy;
+}());
+
+// Every posted message is journaled, and replayed into message_history on
+// startup. Old segments are dropped once they exceed the in-memory retention.
+// Posts are acknowledged once their record is on disk.
+std::unique_ptr<network::Journal> journal;
+
+std::vector<std::unique_ptr<network::EventLoop>> loops;
+
+// Only async-signal-safe calls: the loops stop, and main closes the journal
 void signal_handler(int sig) {
-  std::cout << "Signal " << sig << '\n';
-  std::cout << "Closing socket\n";
-  close(sock.server_sock);
-  exit(0);
+  const char msg[] = "Signal received, shutting down\n";
+  write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+  for (auto& loop : loops)
+    loop->Stop();
 }
 
-std::map<unsigned long long, std::pair<std::string, std::string>> message_history;
-std::mutex history_m;
-
 int main(int argc, char *argv[]) {
 
   int port_number = 8085;
@@ -47,33 +208,120 @@ int main(int argc, char *argv[]) {
   if (argc > 2) webserver_port = atoi(argv[2]);
   if (argc > 3) ip_address = argv[3];
 
-  sock_init(port_number);
-
-  signal(SIGINT, signal_handler);
-  signal(SIGTERM, signal_handler);
+  unsigned worker_num = std::max(1u, std::thread::hardware_concurrency());
+  bool reuseport = false;
+  if (argc > 4) worker_num = std::max(1, atoi(argv[4]));
+  if (argc > 5) reuseport = atoi(argv[5]) != 0;
+  const char* journal_dir = argc > 6 ? argv[6] : "journal";
+  // Native clients speak length-prefixed binary frames on this port. 0 disables it.
+  const int binary_port = argc > 7 ? atoi(argv[7]) : 0;
+
+  // Either one listening socket shared by every worker, or one SO_REUSEPORT
+  // socket per worker so accepting scales with the number of cores.
+  std::vector<int> listen_socks;
+  if (reuseport) {
+    for (unsigned i = 0; i < worker_num; ++i)
+      listen_socks.emplace_back(sock_init_reuseport(port_number));
+    sock.server_sock = listen_socks.front();
+  } else {
+    sock_init(port_number);
+    if (!network::SetNonBlocking(sock.server_sock))
+      error_handling("fcntl error");
+    listen_socks.assign(worker_num, sock.server_sock);
+  }
 
-  message_history.emplace(10, std::make_pair("James", "Hi"));
-  message_history.emplace(20, std::make_pair("Nana", "Hi to you too"));
+  std::vector<int> binary_socks;
+  if (binary_port != 0) {
+    if (reuseport) {
+      for (unsigned i = 0; i < worker_num; ++i)
+        binary_socks.emplace_back(sock_init_reuseport(binary_port));
+    } else {
+      const int binary_sock = sock_listen(binary_port);
+      if (!network::SetNonBlocking(binary_sock))
+        error_handling("fcntl error");
+      binary_socks.assign(worker_num, binary_sock);
+    }
+  }
 
-  while (true) {
-    sock_accept(ip_address, webserver_port);
+  network::JournalOptions journal_options;
+  journal_options.max_segments = 8;
+  // Resumes the posts waiting for the batch. Nothing is appended before the
+  // loops are running.
+  journal_options.on_commit = [](uint64_t) { notify_waiters(); };
+  journal_options.on_failure = [](uint64_t) { notify_waiters(); };
+  journal = std::make_unique<network::Journal>(journal_dir, journal_options);
+  const auto start = std::chrono::steady_clock::now();
+  const auto recovered = journal->recover(append_message);
+  const std::chrono::duration<double, std::milli> recovery_time = std::chrono::steady_clock::now() - start;
+  std::cout << "Recovered " << recovered << " messages from " << journal_dir
+            << " in " << recovery_time.count() << " ms\n";
+  if (!journal->open())
+    error_handling("journal error");
+
+  if (recovered == 0) {
+    append_message(10, "James", "Hi");
+    append_message(20, "Nana", "Hi to you too");
+  }
 
-    pthread_create(&sock.t_id, NULL, handle_client, (void*)&sock.client_sock);
-    pthread_detach(sock.t_id);
-    printf("Connected client IP: %s \n", inet_ntoa(sock.client_addr.sin_addr));
+  std::cout << "Serving webserver " << ip_address << ":" << webserver_port
+            << " with " << worker_num << " worker threads"
+            << (reuseport ? " (SO_REUSEPORT)" : "") << '\n';
+  if (binary_port != 0)
+    std::cout << "Serving binary frames on port " << binary_port << '\n';
+
+  // Every worker runs its own event loop and owns the connections it accepts.
+  for (unsigned i = 0; i < worker_num; ++i) {
+    loops.emplace_back(std::make_unique<network::EventLoop>());
+    loops.back()->AddListener(listen_socks[i], handle_client, resume_client);
+    if (binary_port != 0)
+      loops.back()->AddListener(binary_socks[i], handle_binary_client, resume_binary_client);
+    loops.back()->set_idle_timeout(kKeepAliveTimeout);
+    loops.back()->set_max_input_size(kMaxInputSize);
   }
 
+  signal(SIGINT, signal_handler);
+  signal(SIGTERM, signal_handler);
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < worker_num; ++i) {
+    workers.emplace_back([&loop = loops[i], i, reuseport] {
+      if (reuseport)
+        network::PinCurrentThread(i);
+      loop->Run();
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
 
-  close(sock.server_sock);
+  std::cout << "Flushing journal\n";
+  journal->close();
+  std::cout << "Closing socket\n";
+  if (reuseport) {
+    for (const int fd : listen_socks)
+      close(fd);
+  } else {
+    close(sock.server_sock);
+  }
+  if (!binary_socks.empty()) {
+    if (reuseport) {
+      for (const int fd : binary_socks)
+        close(fd);
+    } else {
+      close(binary_socks.front());
+    }
+  }
 
   return 0;
 }
 
-void *handle_client(void *arg) {
-  std::cout << __func__ << '\n';
-  int client_sock = *((int*)arg);
-  int str_len = 0, i;
-  std::string buf(100'000, '\0');
+void handle_client(network::Connection& conn) {
+  auto& session = conn.context<HTTPSession>();
+  if (session.websocket) {
+    handle_websocket(*session.websocket);
+    return;
+  }
+  auto& parser = session.parser;
+  auto& buf = conn.input();
   // buf = "POST /user HTTP/1.1\r\n"
   // 			"\r\n"
   // 			"{\"name\": \"이민호\", \"chat\": \"안녕하세요\"}";
@@ -81,122 +329,687 @@ void *handle_client(void *arg) {
   // "From-Time: 3\r\n"
   // "\r\n";
 
-  if(read(client_sock, buf.data(), buf.size()) < 0) {
-    // if (false) {
-    perror("state code 500\n");
+  // Answer every complete request in order. A partial request stays in the
+  // buffer until the rest of it arrives, and requests behind a long-poll wait
+  // or a streamed response until it is over. Bytes behind a WebSocket
+  // handshake are frames.
+  size_t consumed = 0;
+  while (!conn.closing() && !conn.parked() && !conn.streaming() && !session.websocket) {
+    const auto result = parser.parse(buf.view().substr(consumed));
+    if (result == network::HTTPRequestParser::kNeedMore)
+      break;
+    if (result == network::HTTPRequestParser::kError) {
+      std::cerr << "Failed to parse HTTP request! " << parser.error() << '\n';
+      send_msg(make_response(400, "Bad Request", "", false), conn);
+      conn.close();
+      break;
+    }
+
+    const auto keep_alive = is_keep_alive(parser);
+    handle_request(parser, keep_alive, conn);
+    if (!keep_alive && !conn.parked())
+      conn.close();
+
+    consumed += parser.size();
+    parser.reset();
+  }
+  buf.consume(consumed);
+  if (session.websocket && !buf.empty())
+    handle_websocket(*session.websocket);
+}
+
+// Text messages are chat posts, {"name": ..., "chat": ...}. Control frames
+// are answered as they come.
+void handle_websocket(WebSocketSession& session) {
+  auto& conn = session.conn;
+  auto& decoder = session.decoder;
+  auto& buf = conn.input();
+
+  size_t consumed = 0;
+  while (!conn.closing()) {
+    const auto result = decoder.parse(buf.data() + consumed, buf.size() - consumed);
+    if (result == network::WebSocketDecoder::kNeedMore)
+      break;
+    if (result == network::WebSocketDecoder::kError) {
+      std::cerr << "Failed to parse WebSocket frame! " << decoder.error() << '\n';
+      conn.send(network::MakeWebSocketClose(decoder.status()));
+      conn.close();
+      break;
+    }
+
+    // The message may point into the buffer, which is consumed last
+    if (result == network::WebSocketDecoder::kComplete)
+      handle_websocket_message(decoder.opcode(), decoder.message(), conn);
+    consumed += decoder.size();
+  }
+  buf.consume(consumed);
+}
+
+void handle_websocket_message(network::WebSocketOpcode opcode, std::string_view message, network::Connection& conn) {
+  using network::WebSocketOpcode;
+  using network::WebSocketStatus;
+
+  switch (opcode) {
+    case WebSocketOpcode::kText: {
+      std::string_view name, chat;
+      if (!parse_chat(message, name, chat)) {
+        conn.send(network::MakeWebSocketClose(WebSocketStatus::kInvalidPayload, "Malformed chat message"));
+        conn.close();
+        return;
+      }
+      post_message(name, chat);
+      break;
+    }
+    case WebSocketOpcode::kPing:
+      conn.send(network::MakeWebSocketFrame(WebSocketOpcode::kPong, message));
+      break;
+    case WebSocketOpcode::kClose:
+      // Echo the status code, then close once it is written
+      conn.send(network::MakeWebSocketFrame(WebSocketOpcode::kClose, message.size() >= 2 ? message.substr(0, 2) : ""));
+      conn.close();
+      break;
+    case WebSocketOpcode::kPong:
+      break;
+    default:
+      conn.send(network::MakeWebSocketClose(WebSocketStatus::kUnsupportedData, "Only text messages are supported"));
+      conn.close();
+      break;
+  }
+}
+
+// Same operations as handle_client, without any text parsing or logging per
+// request. Frames are answered in order, tagged with the client's sequence.
+void handle_binary_client(network::Connection& conn) {
+  auto& decoder = conn.context<BinarySession>().decoder;
+  auto& buf = conn.input();
+
+  // Frames behind a parked request or a streamed reply wait for its end
+  size_t consumed = 0;
+  while (!conn.closing() && !conn.parked() && !conn.streaming()) {
+    const auto result = decoder.parse(buf.view().substr(consumed));
+    if (result == network::FrameDecoder::kNeedMore)
+      break;
+    if (result == network::FrameDecoder::kError) {
+      std::cerr << "Failed to parse frame! " << decoder.error() << '\n';
+      conn.send(network::MakeFrame(network::FrameType::kError, 0, decoder.error()).release());
+      conn.close();
+      break;
+    }
+
+    handle_frame(decoder, conn);
+    consumed += decoder.size();
+  }
+  buf.consume(consumed);
+}
+
+void handle_frame(const network::FrameDecoder& frame, network::Connection& conn) {
+  network::FrameReader payload(frame.payload());
+
+  if (frame.type() == network::FrameType::kPost) {
+    uint32_t name_size = 0;
+    std::string_view name;
+    if (!payload.read(name_size) || !payload.read(name_size, name)) {
+      conn.send(network::MakeFrame(network::FrameType::kError, frame.sequence(), "Malformed post").release());
+      return;
+    }
+    const auto ticket = post_message(name, payload.rest());
+    const auto commit = journal->status(ticket);
+    if (commit == network::Journal::Commit::kPending) {
+      auto& session = conn.context<BinarySession>();
+      session.commit_ticket = ticket;
+      session.wait_sequence = frame.sequence();
+      conn.park(std::chrono::steady_clock::now() + kMaxCommitWait);
+      return;
+    }
+    send_binary_post_reply(conn, frame.sequence(), commit);
+  } else if (frame.type() == network::FrameType::kHistory) {
+    uint64_t from_time = 0;
+    if (!payload.read(from_time)) {
+      conn.send(network::MakeFrame(network::FrameType::kError, frame.sequence(), "Malformed history request").release());
+      return;
+    }
+    // Optional
+    uint32_t wait_ms = 0;
+    payload.read(wait_ms);
+
+    const auto snapshot = message_history.snapshot();
+    const auto begin = snapshot.lower_bound(from_time);
+    if (begin == snapshot.end() && wait_ms != 0) {
+      auto& session = conn.context<BinarySession>();
+      session.wait_begin = begin;
+      session.wait_sequence = frame.sequence();
+      const auto wait = std::min<std::chrono::milliseconds>(std::chrono::milliseconds(wait_ms), kMaxLongPollWait);
+      conn.park(std::chrono::steady_clock::now() + wait);
+      return;
+    }
+    send_binary_history(conn, frame.sequence(), snapshot, begin);
   } else {
-    do {
-      printf("HTTP Request:\n%s\n", buf.data()); // TEST
-
-      network::HTTPProtocol parser;
-      const auto b = parser.parse(buf);
-      if (!b) {
-        std::cerr << "Failed to parse HTTP request!\n";
-        break;
+    conn.send(network::MakeFrame(network::FrameType::kError, frame.sequence(), "Unknown frame type").release());
+  }
+}
+
+// Answers a parked history request with everything posted since it parked,
+// or with an empty history once its wait is over; a parked post once it is
+// on disk
+void resume_client(network::Connection& conn, bool timed_out) {
+  auto& session = conn.context<HTTPSession>();
+  if (session.commit_ticket != 0) {
+    const auto commit = journal->status(session.commit_ticket);
+    if (!timed_out && commit == network::Journal::Commit::kPending) {
+      conn.park(conn.park_deadline());
+      return;
+    }
+    session.commit_ticket = 0;
+    send_post_reply(conn, commit, session.keep_alive);
+    if (!session.keep_alive)
+      conn.close();
+    return;
+  }
+
+  const auto snapshot = message_history.snapshot();
+  if (!timed_out && snapshot.end() <= session.wait_begin) {
+    conn.park(conn.park_deadline());
+    return;
+  }
+  send_history(conn, snapshot, session.wait_begin, session.keep_alive, session.chunked, session.encoding);
+  if (!session.keep_alive)
+    conn.close();
+}
+
+void resume_binary_client(network::Connection& conn, bool timed_out) {
+  auto& session = conn.context<BinarySession>();
+  if (session.commit_ticket != 0) {
+    const auto commit = journal->status(session.commit_ticket);
+    if (!timed_out && commit == network::Journal::Commit::kPending) {
+      conn.park(conn.park_deadline());
+      return;
+    }
+    session.commit_ticket = 0;
+    send_binary_post_reply(conn, session.wait_sequence, commit);
+    return;
+  }
+
+  const auto snapshot = message_history.snapshot();
+  if (!timed_out && snapshot.end() <= session.wait_begin) {
+    conn.park(conn.park_deadline());
+    return;
+  }
+  send_binary_history(conn, session.wait_sequence, snapshot, session.wait_begin);
+}
+
+// The payload is shared between polls of the same window, only the header
+// carries the sequence of each request. A history too large for one frame is
+// streamed a page per frame whenever the connection has written the previous
+// one, and not cached.
+void send_binary_history(network::Connection& conn, uint32_t sequence, const network::MessageLog::Snapshot& snapshot, uint64_t begin) {
+  thread_local network::ResponseCache history_cache;
+  auto body = history_cache.find(begin, snapshot.end());
+  if (!body) {
+    auto next = begin;
+    auto page = network::MakeHistoryPage(snapshot, next);
+    if (next < snapshot.end()) {
+      const network::FramePacket header(network::FrameType::kHistoryPart, sequence, page.size(), 0);
+      conn.send_all(header.string_view(), std::move(page));
+      conn.stream([snapshot, sequence, next](network::Connection& conn) mutable {
+        auto page = network::MakeHistoryPage(snapshot, next);
+        const auto done = next >= snapshot.end();
+        const network::FramePacket header(done ? network::FrameType::kHistoryReply : network::FrameType::kHistoryPart, sequence,
+                                          page.size(), 0);
+        conn.send_all(header.string_view(), std::move(page));
+        return !done;
+      });
+      return;
+    }
+    body = std::make_shared<const std::string>(std::move(page));
+    history_cache.insert(begin, snapshot.end(), body);
+  }
+
+  const network::FramePacket header(network::FrameType::kHistoryReply, sequence, body->size(), 0);
+  conn.send_all(header.string_view(), std::move(body));
+}
+
+// 200 once the post is on disk; 503 if the journal failed to write it, or
+// did not within kMaxCommitWait
+void send_post_reply(network::Connection& conn, network::Journal::Commit commit, bool keep_alive) {
+  if (commit == network::Journal::Commit::kDurable)
+    send_msg(make_response(200, "OK", "", keep_alive), conn);
+  else
+    send_msg(make_response(503, "Service Unavailable", "", keep_alive), conn);
+}
+
+void send_binary_post_reply(network::Connection& conn, uint32_t sequence, network::Journal::Commit commit) {
+  if (commit == network::Journal::Commit::kDurable)
+    conn.send(network::FramePacket(network::FrameType::kPostOk, sequence, 0).string_view());
+  else
+    conn.send(network::MakeFrame(network::FrameType::kError, sequence, "Post not committed").release());
+}
+
+bool is_keep_alive(const network::HTTPRequestParser& request) {
+  const auto connection = request.find(network::KnownHeader::kConnection);
+  if (request.version() == "HTTP/1.0")
+    return connection && network::EqualsIgnoreCase(*connection, "keep-alive");
+  return !(connection && network::EqualsIgnoreCase(*connection, "close"));
+}
+
+void handle_request(const network::HTTPRequestParser& request, bool keep_alive, network::Connection& conn) {
+  if (const auto method = request.method(); method == "POST") {
+    const auto content = request.content();
+    std::string_view name, chat;
+    if (!parse_chat(content, name, chat)) {
+      std::cerr << "Failed to parse!\n";
+      send_msg(make_response(400, "Bad Request", "", keep_alive), conn);
+      return;
+    }
+
+    const auto ticket = post_message(name, chat);
+    // Answered once the journal has it on disk, or failed to
+    const auto commit = journal->status(ticket);
+    if (commit == network::Journal::Commit::kPending) {
+      auto& session = conn.context<HTTPSession>();
+      session.commit_ticket = ticket;
+      session.keep_alive = keep_alive;
+      conn.park(std::chrono::steady_clock::now() + kMaxCommitWait);
+      return;
+    }
+    send_post_reply(conn, commit, keep_alive);
+  } else if (method == "GET") {
+    if (network::IsWebSocketUpgrade(request)) {
+      upgrade_websocket(request, conn);
+      return;
+    }
+
+    const auto from_time = request.find(network::KnownHeader::kFromTime);
+    if (!from_time) {
+      std::cerr << "Header " << "from_time" << " Not found!\n";
+      // "["
+      // "{\"name\":\"이범석\", \"chatKey\":\"안녕못해요\"},"
+      // "{\"name\":\"이민호\", \"chatKey\":\"나도안녕못해\"},"
+      // "{\"name\":\"이용규\", \"chatKey\":\"나도마찬가지\"}"
+      // "]";
+      send_msg(make_response(200, "OK", "", keep_alive), conn);
+      return;
+    }
+
+    unsigned long long t = 0;
+    if (const auto r = std::from_chars(from_time->data(), from_time->data() + from_time->size(), t);
+        r.ec != std::errc()) {
+      std::cerr << "Invalid from_time " << *from_time << '\n';
+      send_msg(make_response(400, "Bad Request", "", keep_alive), conn);
+      return;
+    }
+
+    const auto snapshot = message_history.snapshot();
+    const auto begin = snapshot.lower_bound(t);
+    // Nothing new: a client that asked to wait is answered by the next post
+    if (begin == snapshot.end()) {
+      if (const auto wait = requested_wait(request); wait.count() > 0) {
+        auto& session = conn.context<HTTPSession>();
+        session.wait_begin = begin;
+        session.keep_alive = keep_alive;
+        session.chunked = request.version() == "HTTP/1.1";
+        session.encoding = request.accepted_encoding();
+        conn.park(std::chrono::steady_clock::now() + wait);
+        return;
       }
+    }
+    send_history(conn, snapshot, begin, keep_alive, request.version() == "HTTP/1.1", request.accepted_encoding());
+  } else {
+    send_msg(make_response(405, "Method Not Allowed", "", keep_alive), conn);
+  }
+}
+
+// Switches the connection to WebSocket. From then on it gets every new
+// message pushed, and is no longer subject to the keep-alive timeout.
+void upgrade_websocket(const network::HTTPRequestParser& request, network::Connection& conn) {
+  if (const auto error = network::CheckWebSocketHandshake(request)) {
+    std::cerr << "Refused WebSocket handshake! " << error << '\n';
+    send_msg(make_response(400, "Bad Request", "", false), conn);
+    conn.close();
+    return;
+  }
+
+  network::Arena arena;
+  network::HTTPProtocol protocol(arena.resource());
+  network::MakeWebSocketHandshake(protocol, *request.find(network::KnownHeader::kSecWebSocketKey));
+  protocol.add_header("Server", "Apache");
+  auto& response = response_buffer();
+  protocol.build_to(response);
+  send_msg(response, conn);
+
+  auto& session = conn.context<HTTPSession>();
+  session.websocket = std::make_shared<WebSocketSession>(conn);
+  conn.keep_open();
+  websocket_sessions().emplace_back(session.websocket);
+}
+
+// Posts are JSON objects with a name and a chat. The views point into
+// `content` or into thread-local storage, valid until the next call.
+bool parse_chat(std::string_view content, std::string_view& name, std::string_view& chat) {
+  thread_local network::ChatJsonDecoder decoder;
+  if (decoder.parse(content)) {
+    name = decoder.name();
+    chat = decoder.chat();
+    return true;
+  }
+
+  // Anything unusual, such as nested values or comments, goes through jsoncpp
+  thread_local std::string name_storage, chat_storage;
+  Json::Value root;
+  Json::Reader reader;
+  if (!reader.parse(content.data(), content.data() + content.size(), root) || !root.isObject())
+    return false;
+  // asString() throws for arrays and objects
+  if (!root["name"].isConvertibleTo(Json::stringValue) || !root["chat"].isConvertibleTo(Json::stringValue))
+    return false;
+  name = name_storage = root["name"].asString();
+  chat = chat_storage = root["chat"].asString();
+  return true;
+}
+
+// "Prefer: wait=N" (RFC 7240) asks to hold a history request for up to N
+// seconds until there is something new to answer with
+std::chrono::seconds requested_wait(const network::HTTPRequestParser& request) {
+  const auto prefer = request.find(network::KnownHeader::kPrefer);
+  if (!prefer)
+    return {};
+  const auto p = prefer->find("wait=");
+  if (p == std::string_view::npos)
+    return {};
+  unsigned long seconds = 0;
+  std::from_chars(prefer->data() + p + 5, prefer->data() + prefer->size(), seconds);
+  return std::min<std::chrono::seconds>(std::chrono::seconds(seconds), kMaxLongPollWait);
+}
+
+// Polls for the same window share one serialized body until the next post;
+// so do all the long-polls a post wakes up on this thread. The compressed
+// forms of a body are cached next to it, one per encoding. Long histories are
+// streamed to clients that take chunked responses.
+void send_history(network::Connection& conn, const network::MessageLog::Snapshot& snapshot, uint64_t begin, bool keep_alive, bool chunked,
+                  network::ContentEncoding encoding) {
+  if (chunked && snapshot.end() - std::max(begin, snapshot.begin()) > kStreamedHistoryMessages) {
+    stream_history(conn, snapshot, begin, keep_alive, encoding);
+    return;
+  }
+
+  thread_local network::ResponseCache history_cache;
+  const auto variant = static_cast<unsigned>(encoding);
+  auto body = encoding != network::ContentEncoding::kIdentity ? history_cache.find(begin, snapshot.end(), variant) : nullptr;
+  if (!body) {
+    body = history_cache.find(begin, snapshot.end());
+    if (!body) {
+      body = std::make_shared<const std::string>(make_history(snapshot, begin));
+      history_cache.insert(begin, snapshot.end(), body);
+    }
+    std::string compressed;
+    if (encoding != network::ContentEncoding::kIdentity && body->size() >= kMinCompressedSize)
+      compressed = network::Compress(*body, encoding);
+    if (!compressed.empty()) {
+      body = std::make_shared<const std::string>(std::move(compressed));
+      history_cache.insert(begin, snapshot.end(), body, variant);
+    } else {
+      encoding = network::ContentEncoding::kIdentity;
+    }
+  }
+
+  const auto header = make_response_header(200, "OK", body->size(), keep_alive, encoding);
+  send_msg(header, conn, std::move(body));
+}
 
-      std::cout << "Request type: " << parser.http_method() << '\n';
-
-      if (const auto& method = parser.http_method(); method == "POST") {
-        std::cout << "Content: " << parser.content() << '\n';
-        Json::Value root;
-        Json::Reader reader;
-        const auto success = reader.parse(parser.content(), root);
-        if (!success) {
-          std::cerr << "Failed to parse!\n";
-          break;
-        }
-
-        const auto now = std::chrono::system_clock::now();
-        const auto t = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-
-        const auto name = root["name"].asString();
-        const auto chat = root["chat"].asString();
-
-        std::cout << "name: " << name << '\n';
-        std::cout << "chat: " << chat << '\n';
-
-        {
-          std::lock_guard lck(history_m);
-          message_history.emplace(t, std::make_pair(name, chat));
-        }
-
-        string response =
-          "HTTP/1.1 200 OK\r\n"
-          "\r\n";
-        send_msg(response, client_sock);
-      } else if (method == "GET") {
-        const auto& header = parser.header();
-        const auto it = header.find("from_time");
-        if (it == header.end()) {
-          std::cerr << "Header " << "from_time" << " Not found!\n";
-
-          std::string res =
-            "HTTP/1.1 200 OK\r\n"
-            "Server: Apache\r\n"
-            "Date: Sun, 6 Nov 2022 20:54:51 GMT\r\n"
-            "\r\n";
-          // "["
-          // "{\"name\":\"이범석\", \"chatKey\":\"안녕못해요\"},"
-          // "{\"name\":\"이민호\", \"chatKey\":\"나도안녕못해\"},"
-          // "{\"name\":\"이용규\", \"chatKey\":\"나도마찬가지\"}"
-          // "]";
-          send_msg(res, client_sock);
-        } else {
-          std::cout << "from_time: " << it->second << '\n';
-          const auto t = std::stoll(it->second);
-
-          std::unique_lock lck(history_m);
-          auto lb = message_history.lower_bound(t);
-
-          std::string res =
-            "HTTP/1.1 200 OK\r\n"
-            "Server: Apache\r\n"
-            "Date: Sun, 6 Nov 2022 20:54:51 GMT\r\n"
-            "\r\n"
-            "[";
-
-          if (lb != message_history.end()) {
-            res += "{\"name\":\"" + lb->second.first + "\",\"chatKey\":\"" + lb->second.second + "\"}";
-          }
-          ++lb;
-
-          while (lb != message_history.end()) {
-            res += ",{\"name\":\"" + lb->second.first + "\",\"chatKey\":\"" + lb->second.second + "\"}";
-            ++lb;
-          }
-          lck.unlock();
-
-          res += "]";
-
-          send_msg(res, client_sock);
-        }
+// The same JSON as make_history, sent one batch per chunk whenever the
+// connection has written the previous one. The snapshot takes no lock, so
+// posts go on meanwhile, and the response never holds more than a batch and a
+// log chunk. Messages evicted before their batch is read are left out. With
+// an encoding, each batch is compressed and flushed into its own chunk, and
+// the chunks are shared with the other clients of the same content version.
+void stream_history(network::Connection& conn, const network::MessageLog::Snapshot& snapshot, uint64_t begin, bool keep_alive,
+                    network::ContentEncoding encoding) {
+  send_msg(make_response_header(200, "OK", kChunkedContent, keep_alive, encoding), conn);
+
+  if (encoding != network::ContentEncoding::kIdentity) {
+    conn.stream([history = find_compressed_history(snapshot, begin, encoding), sent = size_t{0}](network::Connection& conn) mutable {
+      if (sent == history->chunks.size())
+        history->make_chunk();
+      conn.send(history->chunks[sent++]);
+      return sent < history->chunks.size() || !history->done;
+    });
+    return;
+  }
+
+  conn.stream([batches = HistoryBatches(snapshot, begin)](network::Connection& conn) mutable {
+    std::string batch;
+    batch.reserve(kHistoryBatchSize + kHistoryBatchSize / 4);
+    const auto done = batches.append_next(batch);
+
+    char header[network::kMaxChunkHeaderSize];
+    const auto header_end = network::WriteChunkHeader(header, batch.size());
+    conn.send_all(std::string_view(header, header_end - header), std::move(batch), std::string_view("\r\n"),
+                  done ? network::kLastChunk : std::string_view());
+    return !done;
+  });
+}
+
+bool HistoryBatches::append_next(std::string& out) {
+  const auto start = out.size();
+  if (!opened) {
+    out += '[';
+    opened = true;
+  }
+  while (next < snapshot.end() && out.size() - start < kHistoryBatchSize) {
+    const auto chunk_end = std::min(snapshot.end(), (next / network::MessageLog::kChunkSize + 1) * network::MessageLog::kChunkSize);
+    snapshot.for_each_payload(next, chunk_end, [&](std::string_view slice) {
+      if (first && !slice.empty()) {
+        slice.remove_prefix(1);
+        first = false;
       }
+      out += slice;
+    });
+    next = chunk_end;
+  }
+  const auto done = next >= snapshot.end();
+  if (done)
+    out += ']';
+  return done;
+}
 
-    } while (false);
+void CompressedHistory::make_chunk() {
+  NETWORK_ASSERT(!done, "Stream already complete");
+  std::string batch;
+  batch.reserve(kHistoryBatchSize + kHistoryBatchSize / 4);
+  done = batches->append_next(batch);
+  if (done)
+    batches.reset();
+
+  std::string compressed;
+  compressor.append(compressed, batch, done);
+  auto chunk = std::make_shared<std::string>();
+  chunk->reserve(network::ChunkedSize(compressed.size()) + network::kLastChunk.size());
+  network::AppendChunk(*chunk, compressed);
+  if (done)
+    *chunk += network::kLastChunk;
+  bytes += chunk->size();
+  chunks.push_back(std::move(chunk));
+}
+
+// Streams of this loop for the newest snapshot end it has seen, by first
+// message and encoding, dropped with that end like the bodies of a
+// ResponseCache. Over kMaxCachedStreamBytes, the cache starts over; streams
+// being sent keep theirs.
+std::shared_ptr<CompressedHistory> find_compressed_history(const network::MessageLog::Snapshot& snapshot, uint64_t begin,
+                                                           network::ContentEncoding encoding) {
+  thread_local uint64_t cached_end = 0;
+  thread_local std::unordered_map<uint64_t, std::array<std::shared_ptr<CompressedHistory>, 3>> cache;
+  if (snapshot.end() < cached_end)
+    return std::make_shared<CompressedHistory>(snapshot, begin, encoding);
+  if (snapshot.end() > cached_end) {
+    cache.clear();
+    cached_end = snapshot.end();
   }
 
-  pthread_mutex_lock(&sock.mutx);
-  for(i = 0; i < sock.client_cnt; i++) {
-    if (client_sock == sock.client_socks[i]) {
-      while(i++ < sock.client_cnt - 1)
-        sock.client_socks[i] = sock.client_socks[i+1];
-      break;
+  const auto variant = static_cast<size_t>(encoding);
+  if (const auto it = cache.find(begin); it != cache.end() && it->second[variant])
+    return it->second[variant];
+
+  size_t bytes = 0;
+  for (const auto& [first, streams] : cache)
+    for (const auto& stream : streams)
+      bytes += stream ? stream->bytes : 0;
+  if (bytes >= kMaxCachedStreamBytes)
+    cache.clear();
+  auto& stream = cache[begin][variant];
+  stream = std::make_shared<CompressedHistory>(snapshot, begin, encoding);
+  return stream;
+}
+
+// Parked long-polls are resumed by their own loops
+void notify_waiters() {
+  for (auto& loop : loops)
+    loop->Wake();
+}
+
+// Journals the message, then publishes it. Returns its journal ticket: the
+// post may be acknowledged once journal->status() says it is durable. Other
+// clients may see the message before that, and keep it if the journal fails.
+uint64_t post_message(std::string_view name, std::string_view chat) {
+  const auto t = now_milliseconds();
+  const auto ticket = journal->append(t, name, chat);
+  append_message(t, name, chat);
+  notify_waiters();
+  broadcast_message(name, chat);
+  return ticket;
+}
+
+// WebSocket connections of the calling thread's loop. A session goes away
+// with its connection.
+std::vector<std::weak_ptr<WebSocketSession>>& websocket_sessions() {
+  thread_local std::vector<std::weak_ptr<WebSocketSession>> sessions;
+  return sessions;
+}
+
+// The message is encoded into one frame, shared by every subscriber; each
+// loop sends it to its own connections
+void broadcast_message(std::string_view name, std::string_view chat) {
+  if (websocket_subscribers.load(std::memory_order_relaxed) == 0)
+    return;
+  std::string json;
+  json.reserve(name.size() + chat.size() + 23);
+  append_message_json(json, name, chat);
+  const auto frame = std::make_shared<const std::string>(
+    network::MakeWebSocketFrame(network::WebSocketOpcode::kText, json));
+  for (auto& loop : loops)
+    loop->Post([frame] { broadcast_frame(frame); });
+}
+
+void broadcast_frame(const std::shared_ptr<const std::string>& frame) {
+  auto& sessions = websocket_sessions();
+  for (size_t i = 0; i < sessions.size();) {
+    const auto session = sessions[i].lock();
+    if (!session) {
+      sessions[i] = std::move(sessions.back());
+      sessions.pop_back();
+      continue;
+    }
+    auto& conn = session->conn;
+    if (conn.closing()) {
+      // Nothing more for a subscriber that is going away
+    } else if (conn.queued() > kMaxSubscriberBacklog) {
+      std::cerr << "Closing WebSocket subscriber " << conn.fd() << ": " << conn.queued() << " bytes behind\n";
+      conn.send(network::MakeWebSocketClose(network::WebSocketStatus::kPolicyViolation, "Too far behind"));
+      conn.close();
+    } else {
+      conn.send(frame);
     }
+    ++i;
   }
+}
+
+void append_message(uint64_t time, std::string_view name, std::string_view chat) {
+  // The JSON fragment of the message is built once here, with the separator
+  // that precedes it in a history response
+  std::string fragment;
+  fragment.reserve(name.size() + chat.size() + 24);
+  fragment += ',';
+  append_message_json(fragment, name, chat);
+  message_history.append(time, name, chat, fragment);
+}
 
-  sock.client_cnt--;
-  pthread_mutex_unlock(&sock.mutx);
-  close(client_sock);
+// One message as it appears in history responses and WebSocket pushes. Both
+// strings are escaped, so any text posted keeps the response valid JSON.
+void append_message_json(std::string& out, std::string_view name, std::string_view chat) {
+  out += "{\"name\":\"";
+  network::AppendJsonEscaped(out, name);
+  out += "\",\"chatKey\":\"";
+  network::AppendJsonEscaped(out, chat);
+  out += "\"}";
+}
 
-  return NULL;
+std::string make_history(const network::MessageLog::Snapshot& snapshot, uint64_t begin) {
+  std::string res = "[";
+  bool first = true;
+  snapshot.for_each_payload(begin, snapshot.end(), [&](std::string_view slice) {
+    if (first && !slice.empty()) {
+      slice.remove_prefix(1);
+      first = false;
+    }
+    res += slice;
+  });
+  res += "]";
+  return res;
 }
 
-void send_msg(const std::string& msg, int client_sock) {
-  std::cout << "Sending Response to " << client_sock << ": \n";
-  std::cout << msg << "\n\n";
+uint64_t now_milliseconds() {
+  const auto now = std::chrono::system_clock::now();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+}
+
+// Responses are serialized into one buffer per thread, reused by every
+// response; a returned view is valid until the next response is made.
+std::string& response_buffer() {
+  thread_local std::string buffer;
+  buffer.clear();
+  return buffer;
+}
+
+std::string_view make_response(int status_code, std::string_view status_text, std::string_view content, bool keep_alive) {
+  auto& response = response_buffer();
+  append_response_header(response, status_code, status_text, content.size(), keep_alive);
+  response += content;
+  return response;
+}
+
+std::string_view make_response_header(int status_code, std::string_view status_text, size_t content_length, bool keep_alive,
+                                      network::ContentEncoding encoding) {
+  auto& response = response_buffer();
+  append_response_header(response, status_code, status_text, content_length, keep_alive, encoding);
+  return response;
+}
+
+void append_response_header(std::string& out, int status_code, std::string_view status_text, size_t content_length, bool keep_alive,
+                            network::ContentEncoding encoding) {
+  static const auto keep_alive_value = "timeout=" + std::to_string(kKeepAliveTimeout.count());
+
+  // Everything the protocol object allocates is dropped with the arena
+  network::Arena arena;
+  network::HTTPProtocol protocol(arena.resource());
+  protocol.response(status_code, status_text);
+  protocol.add_header("Server", "Apache");
+  if (content_length == kChunkedContent)
+    protocol.add_header("Transfer-Encoding", "chunked");
+  else
+    protocol.add_header("Content-Length", content_length);
+  if (encoding != network::ContentEncoding::kIdentity) {
+    protocol.add_header("Content-Encoding", network::ContentEncodingName(encoding));
+    protocol.add_header("Vary", "Accept-Encoding");
+  }
+  if (keep_alive) {
+    protocol.add_header("Connection", "keep-alive");
+    protocol.add_header("Keep-Alive", keep_alive_value);
+  } else {
+    protocol.add_header("Connection", "close");
+  }
+  protocol.build_to(out);
+}
 
-  pthread_mutex_lock(&sock.mutx);
-  write(client_sock, msg.c_str(), msg.size());
-  pthread_mutex_unlock(&sock.mutx);
+// The header and the shared body go out together in one writev
+void send_msg(std::string_view msg, network::Connection& conn, std::shared_ptr<const std::string> body) {
+  conn.send_all(msg, std::move(body));
 }
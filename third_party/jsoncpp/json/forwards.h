@@ -19,6 +19,7 @@ class Writer;
 class FastWriter;
 class StyledWriter;
 class StyledStreamWriter;
+class BufferWriter;
 
 // reader.h
 class Reader;
@@ -5,6 +5,7 @@
 
 #if !defined(JSON_IS_AMALGAMATION)
 #include "json_tool.h"
+#include <json/assertions.h>
 #include <json/writer.h>
 #endif // if !defined(JSON_IS_AMALGAMATION)
 #include <algorithm>
@@ -175,14 +176,6 @@ String valueToString(double value, unsigned int precision,
 
 String valueToString(bool value) { return value ? "true" : "false"; }
 
-static bool doesAnyCharRequireEscaping(char const* s, size_t n) {
-  assert(s || !n);
-
-  return std::any_of(s, s + n, [](unsigned char c) {
-    return c == '\\' || c == '"' || c < 0x20 || c > 0x7F;
-  });
-}
-
 static unsigned int utf8ToCodepoint(const char*& s, const char* e) {
   const unsigned int REPLACEMENT_CHARACTER = 0xFFFD;
 
@@ -251,41 +244,40 @@ static const char hex2[] = "000102030405060708090a0b0c0d0e0f"
                            "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
                            "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
 
-static String toHex16Bit(unsigned int x) {
-  const unsigned int hi = (x >> 8) & 0xff;
-  const unsigned int lo = x & 0xff;
-  String result(4, ' ');
-  result[0] = hex2[2 * hi];
-  result[1] = hex2[2 * hi + 1];
-  result[2] = hex2[2 * lo];
-  result[3] = hex2[2 * lo + 1];
-  return result;
-}
-
 static void appendRaw(String& result, unsigned ch) {
   result += static_cast<char>(ch);
 }
 
 static void appendHex(String& result, unsigned ch) {
-  result.append("\\u").append(toHex16Bit(ch));
+  const unsigned int hi = (ch >> 8) & 0xff;
+  const unsigned int lo = ch & 0xff;
+  const char hex[6] = {'\\',         'u',
+                       hex2[2 * hi], hex2[2 * hi + 1],
+                       hex2[2 * lo], hex2[2 * lo + 1]};
+  result.append(hex, sizeof(hex));
 }
 
-static String valueToQuotedStringN(const char* value, unsigned length,
-                                   bool emitUTF8 = false) {
-  if (value == nullptr)
-    return "";
+static bool charRequiresEscaping(unsigned char c, bool emitUTF8) {
+  return c == '\\' || c == '"' || c < 0x20 || (!emitUTF8 && c > 0x7F);
+}
 
-  if (!doesAnyCharRequireEscaping(value, length))
-    return String("\"") + value + "\"";
-  // We have to walk value and escape any special characters.
-  // Appending to String is not efficient, but this should be rare.
-  // (Note: forward slashes are *not* rare, but I am not escaping them.)
-  String::size_type maxsize = length * 2 + 3; // allescaped+quotes+NULL
-  String result;
-  result.reserve(maxsize); // to avoid lots of mallocs
-  result += "\"";
+// Appends the quoted string to `result`. Runs of characters that need no
+// escaping are appended as a whole.
+static void appendQuotedStringN(String& result, const char* value,
+                                unsigned length, bool emitUTF8) {
+  assert(value || !length);
+  result += '"';
   char const* end = value + length;
-  for (const char* c = value; c != end; ++c) {
+  char const* c = value;
+  while (c != end) {
+    char const* run = c;
+    while (c != end &&
+           !charRequiresEscaping(static_cast<unsigned char>(*c), emitUTF8))
+      ++c;
+    result.append(run, c);
+    if (c == end)
+      break;
+
     switch (*c) {
     case '\"':
       result += "\\\"";
@@ -342,8 +334,19 @@ static String valueToQuotedStringN(const char* value, unsigned length,
       }
     } break;
     }
+    ++c;
   }
-  result += "\"";
+  result += '"';
+}
+
+static String valueToQuotedStringN(const char* value, unsigned length,
+                                   bool emitUTF8 = false) {
+  if (value == nullptr)
+    return "";
+
+  String result;
+  result.reserve(length + 2);
+  appendQuotedStringN(result, value, length, emitUTF8);
   return result;
 }
 
@@ -1150,6 +1153,212 @@ bool BuiltStyledStreamWriter::hasCommentForValue(const Value& value) {
          value.hasComment(commentAfter);
 }
 
+// Class BufferWriter
+// //////////////////////////////////////////////////////////////////
+
+BufferWriter::BufferWriter(String& out, bool emitUTF8)
+    : out_(out), emitUTF8_(emitUTF8) {}
+
+// A comma before every value of an array, and before every key of an object
+// but the first; nothing between a key and its value.
+void BufferWriter::separate() {
+  if (afterKey_) {
+    afterKey_ = false;
+    return;
+  }
+  JSON_ASSERT_MESSAGE(closers_.empty() || closers_.back() == ']',
+                      "BufferWriter: value without a key in an object");
+  if (!first_)
+    out_ += ',';
+  first_ = false;
+}
+
+BufferWriter& BufferWriter::write(const Value& root) {
+  writeValue(root);
+  return *this;
+}
+
+void BufferWriter::writeValue(const Value& value) {
+  switch (value.type()) {
+  case nullValue:
+    null();
+    break;
+  case intValue:
+    writeInt(value.asLargestInt());
+    break;
+  case uintValue:
+    writeUInt(value.asLargestUInt());
+    break;
+  case realValue:
+    real(value.asDouble());
+    break;
+  case stringValue: {
+    char const* str;
+    char const* end;
+    if (value.getString(&str, &end))
+      string(str, end);
+    else
+      string("", "");
+    break;
+  }
+  case booleanValue:
+    boolean(value.asBool());
+    break;
+  case arrayValue: {
+    beginArray();
+    ArrayIndex size = value.size();
+    for (ArrayIndex index = 0; index < size; ++index)
+      writeValue(value[index]);
+    endArray();
+  } break;
+  case objectValue: {
+    beginObject();
+    // Members in the same order as getMemberNames(), without copying names
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      char const* end;
+      char const* name = it.memberName(&end);
+      key(name, end);
+      writeValue(*it);
+    }
+    endObject();
+  } break;
+  }
+}
+
+BufferWriter& BufferWriter::beginArray() {
+  separate();
+  out_ += '[';
+  closers_ += ']';
+  first_ = true;
+  return *this;
+}
+
+BufferWriter& BufferWriter::endArray() {
+  JSON_ASSERT_MESSAGE(!closers_.empty() && closers_.back() == ']',
+                      "BufferWriter: endArray() without beginArray()");
+  out_ += ']';
+  closers_.pop_back();
+  first_ = false;
+  return *this;
+}
+
+BufferWriter& BufferWriter::beginObject() {
+  separate();
+  out_ += '{';
+  closers_ += '}';
+  first_ = true;
+  return *this;
+}
+
+BufferWriter& BufferWriter::endObject() {
+  JSON_ASSERT_MESSAGE(!closers_.empty() && closers_.back() == '}' && !afterKey_,
+                      "BufferWriter: endObject() without beginObject()");
+  out_ += '}';
+  closers_.pop_back();
+  first_ = false;
+  return *this;
+}
+
+BufferWriter& BufferWriter::key(const char* begin, const char* end) {
+  JSON_ASSERT_MESSAGE(!closers_.empty() && closers_.back() == '}' && !afterKey_,
+                      "BufferWriter: key() outside of an object");
+  if (!first_)
+    out_ += ',';
+  first_ = false;
+  appendQuotedStringN(out_, begin, static_cast<unsigned>(end - begin),
+                      emitUTF8_);
+  out_ += ':';
+  afterKey_ = true;
+  return *this;
+}
+
+BufferWriter& BufferWriter::key(const char* name) {
+  return key(name, name + strlen(name));
+}
+
+BufferWriter& BufferWriter::key(const String& name) {
+  return key(name.data(), name.data() + name.size());
+}
+
+BufferWriter& BufferWriter::string(const char* begin, const char* end) {
+  separate();
+  appendQuotedStringN(out_, begin, static_cast<unsigned>(end - begin),
+                      emitUTF8_);
+  return *this;
+}
+
+BufferWriter& BufferWriter::string(const char* value) {
+  return string(value, value + strlen(value));
+}
+
+BufferWriter& BufferWriter::string(const String& value) {
+  return string(value.data(), value.data() + value.size());
+}
+
+BufferWriter& BufferWriter::writeInt(LargestInt value) {
+  separate();
+  UIntToStringBuffer buffer;
+  char* const last = buffer + sizeof(buffer) - 1; // uintToString's '\0'
+  char* current = buffer + sizeof(buffer);
+  if (value == Value::minLargestInt) {
+    uintToString(LargestUInt(Value::maxLargestInt) + 1, current);
+    *--current = '-';
+  } else if (value < 0) {
+    uintToString(LargestUInt(-value), current);
+    *--current = '-';
+  } else {
+    uintToString(LargestUInt(value), current);
+  }
+  out_.append(current, last);
+  return *this;
+}
+
+BufferWriter& BufferWriter::writeUInt(LargestUInt value) {
+  separate();
+  UIntToStringBuffer buffer;
+  char* const last = buffer + sizeof(buffer) - 1;
+  char* current = buffer + sizeof(buffer);
+  uintToString(value, current);
+  out_.append(current, last);
+  return *this;
+}
+
+// Same as valueToString(value, false, 17, significantDigits), in a buffer
+// on the stack
+BufferWriter& BufferWriter::real(double value) {
+  separate();
+  if (!isfinite(value)) {
+    out_ += isnan(value) ? "null" : (value < 0) ? "-1e+9999" : "1e+9999";
+    return *this;
+  }
+  char buffer[36];
+  int len = jsoncpp_snprintf(buffer, sizeof(buffer), "%.*g", 17, value);
+  assert(len >= 0 && static_cast<size_t>(len) < sizeof(buffer));
+  char* end = fixNumericLocale(buffer, buffer + len);
+  out_.append(buffer, end);
+  if (std::find(buffer, end, '.') == end && std::find(buffer, end, 'e') == end)
+    out_ += ".0";
+  return *this;
+}
+
+BufferWriter& BufferWriter::boolean(bool value) {
+  separate();
+  out_ += value ? "true" : "false";
+  return *this;
+}
+
+BufferWriter& BufferWriter::null() {
+  separate();
+  out_ += "null";
+  return *this;
+}
+
+BufferWriter& BufferWriter::raw(const char* begin, const char* end) {
+  separate();
+  out_.append(begin, end);
+  return *this;
+}
+
 ///////////////
 // StreamWriter
 
@@ -11,6 +11,7 @@
 #endif // if !defined(JSON_IS_AMALGAMATION)
 #include <ostream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 // Disable warning C4251: <data member>: <type> needs to have dll-interface to
@@ -340,6 +341,80 @@ private:
 #pragma warning(pop)
 #endif
 
+/** \brief Writes compact JSON straight into a caller-owned String.
+ *
+ * Output is appended to \c out as it is written: no String per value, no
+ * std::ostream. A document can be written from a Value, or piece by piece so
+ * that a large array never exists as a Value, nor in memory as a whole:
+ * \code
+ *  String out;
+ *  Json::BufferWriter writer(out);
+ *  writer.beginArray();
+ *  for (const auto& message : history) {
+ *    writer.beginObject();
+ *    writer.key("name").string(message.name);
+ *    writer.key("chat").string(message.chat);
+ *    writer.endObject();
+ *    if (out.size() >= 64 * 1024) {
+ *      connection.send(std::move(out));
+ *      out.clear();
+ *    }
+ *  }
+ *  writer.endArray();
+ * \endcode
+ * The caller may take or clear \c out between any two calls; writing goes on
+ * where it left off. The output is the same as StreamWriterBuilder's with
+ * "indentation" set to "", "commentStyle" to "None" and the given "emitUTF8".
+ */
+class JSON_API BufferWriter {
+public:
+  explicit BufferWriter(String& out, bool emitUTF8 = false);
+
+  /// Writes \c root as the next value.
+  BufferWriter& write(const Value& root);
+
+  BufferWriter& beginArray();
+  BufferWriter& endArray();
+  BufferWriter& beginObject();
+  BufferWriter& endObject();
+
+  /// Writes the name of the next member of the current object.
+  BufferWriter& key(const char* begin, const char* end);
+  BufferWriter& key(const char* name);
+  BufferWriter& key(const String& name);
+
+  BufferWriter& string(const char* begin, const char* end);
+  BufferWriter& string(const char* value);
+  BufferWriter& string(const String& value);
+  template <typename T> BufferWriter& integer(T value) {
+    static_assert(std::is_integral<T>::value, "integer() takes integers");
+    return std::is_signed<T>::value
+               ? writeInt(static_cast<LargestInt>(value))
+               : writeUInt(static_cast<LargestUInt>(value));
+  }
+  BufferWriter& real(double value);
+  BufferWriter& boolean(bool value);
+  BufferWriter& null();
+  /// Writes [begin, end), which must be one complete JSON value already
+  /// encoded, such as a cached fragment.
+  BufferWriter& raw(const char* begin, const char* end);
+
+  /// Number of arrays and objects begun and not yet ended.
+  size_t depth() const { return closers_.size(); }
+
+private:
+  BufferWriter& writeInt(LargestInt value);
+  BufferWriter& writeUInt(LargestUInt value);
+  void writeValue(const Value& value);
+  void separate();
+
+  String& out_;
+  String closers_;
+  bool first_{true};
+  bool afterKey_{false};
+  bool emitUTF8_;
+};
+
 #if defined(JSON_HAS_INT64)
 String JSON_API valueToString(Int value);
 String JSON_API valueToString(UInt value);